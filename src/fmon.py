@@ -31,6 +31,8 @@ from rich import box
 import inquirer
 from inquirer.themes import GreenPassion
 
+from monitor_stats import open_history, sparkline, format_age, load_monitor_stats
+
 
 console = Console()
 
@@ -57,17 +59,44 @@ class MonitorIPC:
                 "data": data or {}
             }
             
-            sock.send(json.dumps(message).encode())
-            response = sock.recv(4096).decode()
+            sock.sendall(json.dumps(message).encode())
+            
+            # 응답은 한 줄 JSON이며 모니터가 보낸 뒤 연결을 닫는다
+            chunks = []
+            while True:
+                chunk = sock.recv(65536)
+                if not chunk:
+                    break
+                chunks.append(chunk)
             sock.close()
             
-            return json.loads(response)
+            return json.loads(b"".join(chunks).decode())
         except Exception as e:
             return {"success": False, "error": str(e)}
     
     def is_monitor_running(self) -> bool:
         """모니터가 실행 중인지 확인"""
         return os.path.exists(self.socket_path)
+    
+    def subscribe(self, from_seq: int = 0):
+        """from_seq부터 이벤트 로그 라인을 (seq, line) 형태로 순서대로 반환
+        
+        과거 이벤트는 디스크의 로그 세그먼트에서 재생되고 이후에는 실시간으로 이어진다.
+        from_seq=0 이면 실시간 이벤트만 받는다.
+        """
+        sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        sock.connect(self.socket_path)
+        sock.sendall(json.dumps({"command": "subscribe", "data": {"from_seq": from_seq}}).encode())
+        
+        with sock, sock.makefile('r', encoding='utf-8', errors='replace') as stream:
+            header = json.loads(stream.readline() or '{}')
+            if not header.get("success"):
+                raise RuntimeError(header.get("error", "subscribe failed"))
+            for line in stream:
+                # "[YYYY-MM-DD HH:MM:SS] #<seq>[@<read time>+<latency>] <event>"
+                seq_field = line[22:].split(' ', 1)[0]
+                if seq_field.startswith('#'):
+                    yield int(seq_field[1:].split('@', 1)[0]), line.rstrip('\n')
 
 class ConfigManager:
     """설정 파일 관리 클래스"""
@@ -237,6 +266,15 @@ class LogAnalyzer:
                         stats["event_types"]["opened"] = stats["event_types"].get("opened", 0) + 1
                     elif "Closed:" in line:
                         stats["event_types"]["closed"] = stats["event_types"].get("closed", 0) + 1
+                    elif "Accessed:" in line:
+                        stats["event_types"]["accessed"] = stats["event_types"].get("accessed", 0) + 1
+                    elif " [1/" in line:
+                        # 샘플링된 줄("Opened [1/100]: ...")은 비율만큼 가중
+                        label, _, rest = line.partition(" [1/")
+                        rate = rest.split("]", 1)[0]
+                        name = {"Opened": "opened", "Closed": "closed", "Accessed": "accessed"}.get(label.rsplit(" ", 1)[-1])
+                        if name and rate.isdigit():
+                            stats["event_types"][name] = stats["event_types"].get(name, 0) + int(rate)
                     
                     # 일별 통계
                     if line.startswith('['):
@@ -251,24 +289,63 @@ class LogAnalyzer:
             
         return stats
     
-    def search_logs(self, query: str, limit: int = 50) -> list:
-        """로그에서 검색"""
-        results = []
+    def search_logs(self, query: str, limit: int = 50, since: str = None,
+                    until: str = None, types: str = None) -> list:
+        """로그에서 검색 (회전된 .gz 세그먼트 포함)"""
+        return list(self.iter_search(query, limit, since, until, types))
+    
+    def iter_search(self, query: str, limit: int = 50, since: str = None,
+                    until: str = None, types: str = None):
+        """monitor --query 결과를 한 줄씩 스트리밍"""
+        script_dir = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+        monitor_executable = os.path.join(script_dir, 'build', 'monitor')
         
+        if not os.path.exists(monitor_executable):
+            # 빌드 전에는 활성 로그만 파이썬으로 검색
+            yield from self._search_active_log(query, limit)
+            return
+        
+        cmd = [monitor_executable, f'--query={query}', f'--limit={limit}']
+        if since:
+            cmd.append(f'--since={since}')
+        if until:
+            cmd.append(f'--until={until}')
+        if types:
+            cmd.append(f'--type={types}')
+        
+        try:
+            process = subprocess.Popen(
+                cmd,
+                cwd=os.path.dirname(os.path.abspath(self.log_path)),
+                stdout=subprocess.PIPE,
+                stderr=subprocess.DEVNULL,
+                text=True,
+                errors='replace'
+            )
+            try:
+                for line in process.stdout:
+                    yield line.rstrip('\n')
+            finally:
+                process.stdout.close()
+                process.wait()
+        except OSError as e:
+            console.print(f"Log search failed: {e}")
+    
+    def _search_active_log(self, query: str, limit: int):
         if not os.path.exists(self.log_path):
-            return results
-            
+            return
+        
+        count = 0
         try:
             with open(self.log_path, 'r', encoding='utf-8') as f:
                 for line in f:
                     if query.lower() in line.lower():
-                        results.append(line.strip())
-                        if len(results) >= limit:
+                        yield line.strip()
+                        count += 1
+                        if count >= limit:
                             break
         except Exception as e:
             console.print(f"Log search failed: {e}")
-            
-        return results
 
 def format_file_size(size_bytes: int) -> str:
     """파일 크기를 사람이 읽기 쉬운 형태로 변환"""
@@ -310,7 +387,7 @@ def cli(ctx, interactive):
 @click.argument('path', default='.')
 @click.option('--background', '-b', is_flag=True, help='Run in background')
 @click.option('--config', '-c', default=CONFIG_FILE, help='Configuration file path')
-@click.option('--mode', '-m', type=click.Choice(['basic', 'advanced', 'enhanced']), default='basic', help='Monitor mode')
+@click.option('--mode', '-m', type=click.Choice(['basic', 'advanced', 'enhanced', 'metrics']), default='basic', help='Monitor mode')
 @click.option('--parent', '-p', is_flag=True, help='Monitor parent directory')
 @click.option('--project-root', '-r', is_flag=True, help='Auto-detect and monitor project root')
 @click.option('--levels', '-l', type=int, default=1, help='Number of parent levels to go up (with --parent)')
@@ -375,12 +452,14 @@ def start(path: str, background: bool, config: str, mode: str, parent: bool, pro
     mode_names = {
         'basic': 'Basic Monitor',
         'advanced': 'Advanced Monitor',
-        'enhanced': 'Enhanced Monitor'
+        'enhanced': 'Enhanced Monitor',
+        'metrics': 'Metrics Monitor'
     }
     mode_features = {
         'basic': 'Simple file monitoring',
         'advanced': 'Checksums, Log Rotation, Performance Stats',
-        'enhanced': 'Dynamic Watch Management, Auto-scaling, Enhanced Stats'
+        'enhanced': 'Dynamic Watch Management, Auto-scaling, Enhanced Stats',
+        'metrics': 'Event Counts per Directory, Extension and Type (no per-event log)'
     }
     
     # 시작 정보 표시
@@ -480,6 +559,88 @@ def stop():
     console.print("Stopping monitor...")
     stop_monitor()
 
+@cli.command()
+@click.argument('root', default='')
+@click.option('--since', type=int, default=0, help='Clock (event sequence number) from a previous query')
+@click.option('--glob', '-g', 'pattern', default=None, help='Glob on the file name, or on the path if it has a /')
+@click.option('--type', '-t', 'file_type', type=click.Choice(['f', 'd']), default=None, help='f = files, d = directories')
+@click.option('--json', 'as_json', is_flag=True, help='Print the raw JSON response')
+def query(root: str, since: int, pattern: Optional[str], file_type: Optional[str], as_json: bool):
+    """List files under ROOT changed since a clock (for build tools)"""
+    
+    ipc = MonitorIPC()
+    if not ipc.is_monitor_running():
+        console.print("WARNING: Monitor is not running")
+        return
+    
+    result = ipc.send_command("query", {"since": since, "root": root, "glob": pattern, "type": file_type})
+    if as_json:
+        print(json.dumps(result))
+        return
+    if not result.get("success"):
+        console.print(f"ERROR: Query failed: {result.get('error')}")
+        return
+    
+    if result.get("is_fresh_instance"):
+        console.print("WARNING: Changes since that clock are no longer known (restart or pruned deletes); do a full scan")
+    for entry in result.get("files", []):
+        marker = " " if entry.get("exists") else "-"
+        console.print(f"{marker} {entry['name']}", markup=False, highlight=False)
+    console.print(f"clock: {result.get('clock')}")
+
+@cli.command()
+@click.argument('root', default='')
+@click.option('--limit', '-n', type=int, default=1000, help='Maximum entries per list')
+@click.option('--json', 'as_json', is_flag=True, help='Print the raw JSON response')
+def paths(root: str, limit: int, as_json: bool):
+    """List watched directories and tracked files under ROOT"""
+    
+    ipc = MonitorIPC()
+    if not ipc.is_monitor_running():
+        console.print("WARNING: Monitor is not running")
+        return
+    
+    result = ipc.send_command("paths", {"root": root, "limit": limit})
+    if as_json:
+        print(json.dumps(result))
+        return
+    if not result.get("success"):
+        console.print(f"ERROR: Paths failed: {result.get('error')}")
+        return
+    
+    for path in result.get("watched", []):
+        console.print(f"W {path}", markup=False, highlight=False)
+    for path in result.get("tracked", []):
+        console.print(f"T {path}", markup=False, highlight=False)
+    if result.get("truncated"):
+        console.print(f"WARNING: Truncated at {limit} entries")
+
+@cli.command()
+@click.argument('root', default='')
+@click.option('--json', 'as_json', is_flag=True, help='Print the raw JSON response')
+def du(root: str, as_json: bool):
+    """Show bytes and files under ROOT (needs disk_usage=true)"""
+    
+    ipc = MonitorIPC()
+    if not ipc.is_monitor_running():
+        console.print("WARNING: Monitor is not running")
+        return
+    
+    result = ipc.send_command("du", {"root": root})
+    if as_json:
+        print(json.dumps(result))
+        return
+    if not result.get("success"):
+        console.print(f"ERROR: du failed: {result.get('error')}")
+        return
+    
+    console.print(f"{format_file_size(result['bytes'])}\t{result['files']:,} files\t{root or '/'}",
+                  markup=False, highlight=False)
+    filesystem = result.get("filesystem")
+    if filesystem:
+        console.print(f"filesystem: {filesystem['used_percent']}% used, "
+                      f"{format_file_size(filesystem['available_bytes'])} available")
+
 @cli.command()
 def status():
     """Check monitor status (supports all monitor types)"""
@@ -489,16 +650,13 @@ def status():
     table.add_column("Item", style="cyan", no_wrap=True, width=20)
     table.add_column("Value", style="white", width=50)
     
-    # Monitor 상태 확인
-    stats_file = "monitor_stats.json"
+    # Monitor 상태 확인 (공유 메모리 통계 페이지, 없으면 monitor_stats.json)
     log_file_path = "monitor.log"
     monitor_running = False
+    stats = load_monitor_stats()
     
-    if os.path.exists(stats_file):
+    if stats is not None:
         try:
-            with open(stats_file, 'r') as f:
-                stats = json.load(f)
-            
             # Monitor는 통계 파일로 실행 상태 확인
             if stats.get('uptime_seconds', 0) > 0:
                 monitor_running = True
@@ -514,6 +672,13 @@ def status():
                 minutes = (uptime % 3600) // 60
                 seconds = uptime % 60
                 table.add_row("Uptime", f"{hours:02d}:{minutes:02d}:{seconds:02d}")
+                if 'disk_usage_percent' in stats:
+                    table.add_row("Disk Usage", f"{stats['disk_usage_percent']}%")
+                if 'tracked_bytes' in stats:
+                    table.add_row("Tracked Size", f"{format_file_size(stats['tracked_bytes'])} in {stats.get('tracked_files', 0):,} files")
+                if 'last_seq' in stats:
+                    table.add_row("Last Sequence", f"{stats['last_seq']:,}")
+                    table.add_row("Subscribers", f"{stats.get('subscribers', 0):,}")
                 
                 # Enhanced mode specific stats
                 if mode == 'enhanced':
@@ -636,6 +801,35 @@ def show(lines: int):
     except Exception as e:
         console.print(f"ERROR: Failed to read log: {e}")
 
+@logs.command()
+@click.option('--from-seq', type=int, default=None, help='Start at this event sequence number')
+@click.option('--cursor', type=click.Path(), default=None,
+              help='File holding the last processed sequence number; resumes from it')
+def follow(from_seq: Optional[int], cursor: Optional[str]):
+    """Stream events by sequence number, resuming where the last run stopped"""
+    
+    if from_seq is None:
+        from_seq = 0
+        if cursor and os.path.exists(cursor):
+            with open(cursor) as f:
+                from_seq = int(f.read().strip() or 0) + 1
+    
+    ipc = MonitorIPC()
+    if not ipc.is_monitor_running():
+        console.print("WARNING: Monitor is not running")
+        return
+    
+    try:
+        for seq, line in ipc.subscribe(from_seq):
+            console.print(line, markup=False, highlight=False)
+            if cursor:
+                with open(cursor, 'w') as f:
+                    f.write(f"{seq}\n")
+    except KeyboardInterrupt:
+        pass
+    except Exception as e:
+        console.print(f"ERROR: Event stream failed: {e}")
+
 @logs.command()
 def tail():
     """Real-time log viewing"""
@@ -717,7 +911,8 @@ def stats():
             "moved": "Moved",
             "attribute": "Attribute Changed",
             "opened": "Opened",
-            "closed": "Closed"
+            "closed": "Closed",
+            "accessed": "Accessed"
         }
         
         type_name = type_names.get(event_type, event_type)
@@ -734,21 +929,27 @@ def stats():
 @logs.command()
 @click.argument('query')
 @click.option('--limit', '-l', default=50, help='Maximum number of results')
-def search(query: str, limit: int):
+@click.option('--since', help='Only events at or after this time (2026-01-31, 24h, 7d)')
+@click.option('--until', help='Only events at or before this time')
+@click.option('--type', 'types', help='Event types, comma separated (created,modified,...)')
+def search(query: str, limit: int, since: str, until: str, types: str):
     """Search in logs"""
     
     analyzer = LogAnalyzer()
-    results = analyzer.search_logs(query, limit)
+    count = 0
+    
+    for line in analyzer.iter_search(query, limit, since, until, types):
+        if count == 0:
+            console.print(f"Search results for '{query}':")
+            console.print("=" * 50)
+        count += 1
+        console.print(f"{count:3d}: {line}")
     
-    if not results:
+    if count == 0:
         console.print(f"WARNING: No search results for '{query}'")
         return
     
-    console.print(f"Search results for '{query}': {len(results)} found")
-    console.print("=" * 50)
-    
-    for i, line in enumerate(results, 1):
-        console.print(f"{i:3d}: {line}")
+    console.print(f"{count} found")
 
 @logs.command()
 def clean():
@@ -923,112 +1124,102 @@ def build(clean: bool):
 def perf():
     """View performance statistics (supports all monitor types)"""
     
-    # Enhanced Monitor 통계 파일 확인
-    enhanced_stats_file = "enhanced_stats.json"
-    advanced_stats_file = "performance_stats.json"
-    
-    enhanced_available = os.path.exists(enhanced_stats_file)
-    advanced_available = os.path.exists(advanced_stats_file)
-    
-    if not enhanced_available and not advanced_available:
+    stats = load_monitor_stats()
+    if stats is None:
         console.print("WARNING: No performance statistics available")
         console.print("Start monitor first:")
-        console.print("  fmon start --enhanced    # Enhanced statistics")
-        console.print("  fmon start --advanced    # Advanced statistics")
+        console.print("  fmon start . --background")
         return
     
-    # Enhanced Monitor 통계 표시
-    if enhanced_available:
-        try:
-            with open(enhanced_stats_file, 'r') as f:
-                enhanced_stats = json.load(f)
-            
-            console.print("\n=== ENHANCED MONITOR STATISTICS ===")
-            
-            # Enhanced statistics table
-            enhanced_table = Table(title="Enhanced Monitor Performance", box=box.SIMPLE, width=80)
-            enhanced_table.add_column("Metric", style="cyan", width=20)
-            enhanced_table.add_column("Value", style="white", width=15)
-            enhanced_table.add_column("Details", style="dim", width=30)
-            
-            # Core metrics
-            enhanced_table.add_row("Total Events", f"{enhanced_stats.get('total_events', 0):,}", "events processed")
-            enhanced_table.add_row("Active Watches", f"{enhanced_stats.get('active_watches', 0):,}", "directories monitored")
-            enhanced_table.add_row("Watch Capacity", f"{enhanced_stats.get('watch_capacity', 0):,}", "max directories")
-            enhanced_table.add_row("Memory Usage", f"{enhanced_stats.get('memory_usage_kb', 0):,}", "KB")
-            enhanced_table.add_row("Watch Limit Hits", f"{enhanced_stats.get('watch_limit_hits', 0):,}", "expansion triggers")
-            enhanced_table.add_row("Memory Reallocations", f"{enhanced_stats.get('memory_reallocations', 0):,}", "dynamic expansions")
-            
-            if enhanced_stats.get('most_active_path') and enhanced_stats.get('most_active_path') != 'none':
-                enhanced_table.add_row("Most Active Path", enhanced_stats['most_active_path'][:50] + "...", 
-                                     f"{enhanced_stats.get('max_events_per_path', 0)} events")
-            
-            if 'uptime_seconds' in enhanced_stats:
-                uptime = enhanced_stats['uptime_seconds']
-                hours = uptime // 3600
-                minutes = (uptime % 3600) // 60
-                seconds = uptime % 60
-                enhanced_table.add_row("Uptime", f"{hours:02d}:{minutes:02d}:{seconds:02d}", "h:m:s")
-            
-            console.print(enhanced_table)
-            
-        except json.JSONDecodeError:
-            console.print("ERROR: Invalid enhanced statistics file")
-        except Exception as e:
-            console.print(f"ERROR: Failed to read enhanced statistics: {e}")
-    
-    # Advanced Monitor 통계 표시 (기존 코드)
-    if advanced_available:
-        try:
-            with open(advanced_stats_file, 'r') as f:
-                stats = json.load(f)
-            
-            console.print("\n=== ADVANCED MONITOR STATISTICS ===")
-            
-            # Performance table
-            perf_table = Table(title="Advanced Monitor Performance", box=box.SIMPLE, width=80)
-            perf_table.add_column("Metric", style="cyan", width=25)
-            perf_table.add_column("Value", style="white", width=20)
-            perf_table.add_column("Unit", style="dim", width=15)
-            perf_table.add_column("Unit", style="dim")
-            
-            # CPU and Memory stats
-            if 'cpu_usage' in stats:
-                perf_table.add_row("CPU Usage", f"{stats['cpu_usage']:.1f}", "%")
-            if 'memory_usage' in stats:
-                perf_table.add_row("Memory Usage", f"{stats['memory_usage']:.1f}", "MB")
-            if 'memory_peak' in stats:
-                perf_table.add_row("Peak Memory", f"{stats['memory_peak']:.1f}", "MB")
-            
-            # File operation stats
-            if 'files_processed' in stats:
-                perf_table.add_row("Files Processed", f"{stats['files_processed']:,}", "files")
-            if 'events_per_second' in stats:
-                perf_table.add_row("Events/Second", f"{stats['events_per_second']:.2f}", "ops/s")
-            if 'checksums_computed' in stats:
-                perf_table.add_row("Checksums Computed", f"{stats['checksums_computed']:,}", "files")
-            
-            # Timing stats
-            if 'avg_processing_time' in stats:
-                perf_table.add_row("Avg Processing Time", f"{stats['avg_processing_time']:.3f}", "ms")
-            if 'uptime' in stats:
-                hours = stats['uptime'] // 3600
-                minutes = (stats['uptime'] % 3600) // 60
-                seconds = stats['uptime'] % 60
-                perf_table.add_row("Uptime", f"{hours:02d}:{minutes:02d}:{seconds:02d}", "h:m:s")
-            
-            console.print(perf_table)
-            
-            # Update time
-            if 'last_updated' in stats:
-                update_time = datetime.fromtimestamp(stats['last_updated']).strftime("%Y-%m-%d %H:%M:%S")
-                console.print(f"\nLast updated: {update_time}")
-            
-        except json.JSONDecodeError:
-            console.print("ERROR: Invalid performance statistics file")
-        except Exception as e:
-            console.print(f"ERROR: Failed to read performance statistics: {e}")
+    mode = stats.get('mode', 'unknown')
+    console.print(f"\n=== {mode.upper()} MONITOR STATISTICS ===")
+    
+    perf_table = Table(title="Monitor Performance", box=box.SIMPLE, width=80)
+    perf_table.add_column("Metric", style="cyan", width=22)
+    perf_table.add_column("Value", style="white", width=18)
+    perf_table.add_column("Details", style="dim", width=30)
+    
+    perf_table.add_row("Total Events", f"{stats.get('total_events', 0):,}", "events processed")
+    perf_table.add_row("Events/Second", f"{stats.get('events_per_second', 0):,.2f}", "average since start")
+    perf_table.add_row("CPU Usage", f"{stats.get('cpu_usage_percent', 0):.1f}", "% average since start")
+    perf_table.add_row("Memory Usage", f"{stats.get('memory_usage_kb', 0):,}", "KB")
+    perf_table.add_row("Active Watches", f"{stats.get('active_watches', 0):,}", "directories monitored")
+    
+    if mode == 'enhanced':
+        perf_table.add_row("Watch Capacity", f"{stats.get('watch_capacity', 0):,}", "max directories")
+        perf_table.add_row("Watch Limit Hits", f"{stats.get('watch_limit_hits', 0):,}", "expansion triggers")
+        perf_table.add_row("Memory Reallocations", f"{stats.get('memory_reallocations', 0):,}", "dynamic expansions")
+        if stats.get('most_active_path') and stats.get('most_active_path') != 'none':
+            perf_table.add_row("Most Active Path", stats['most_active_path'][-18:],
+                               f"{stats.get('max_events_per_path', 0)} events")
+    
+    # 메트릭 모드: 마지막 집계 구간
+    metrics = stats.get('metrics')
+    if mode == 'metrics' and metrics:
+        interval = f"last {metrics.get('interval_sec', 0)}s"
+        perf_table.add_row("Interval Events", f"{metrics.get('events', 0):,}", interval)
+        for entry in metrics.get('directories', [])[:3]:
+            perf_table.add_row("Busy Directory", entry['path'][-18:], f"{entry['events']:,} events")
+        for entry in metrics.get('extensions', [])[:3]:
+            perf_table.add_row("Busy Extension", entry['ext'] or '(none)', f"{entry['events']:,} events")
+    
+    # 최근 구간 지연 시간 (monitor_stats.ring)
+    stats_history = open_history()
+    if stats_history is not None:
+        with stats_history:
+            latest = stats_history.latest()
+        if latest:
+            perf_table.add_row("Batch Latency p50", f"{latest['latency_p50_ns'] / 1000:,.1f}", "us, last interval")
+            perf_table.add_row("Batch Latency p99", f"{latest['latency_p99_ns'] / 1000:,.1f}", "us, last interval")
+    
+    uptime = stats.get('uptime_seconds', 0)
+    hours = uptime // 3600
+    minutes = (uptime % 3600) // 60
+    seconds = uptime % 60
+    perf_table.add_row("Uptime", f"{hours:02d}:{minutes:02d}:{seconds:02d}", "h:m:s")
+    
+    console.print(perf_table)
+
 
+@cli.command()
+@click.option('--minutes', '-m', default=60, help='How far back to look')
+def history(minutes: int):
+    """Show stats trends from the time-series history"""
+    
+    stats_history = open_history()
+    if stats_history is None:
+        console.print("WARNING: No stats history (monitor_stats.ring) available")
+        return
+    
+    with stats_history:
+        samples = stats_history.samples(minutes * 60)
+    if not samples:
+        console.print("WARNING: No samples recorded yet")
+        return
+    
+    latest = samples[-1]
+    table = Table(title=f"Last {minutes} minutes ({len(samples)} samples, newest {format_age(latest['timestamp'])})",
+                  box=box.SIMPLE)
+    table.add_column("Metric", style="cyan", no_wrap=True)
+    table.add_column("Trend", no_wrap=True)
+    table.add_column("Now", justify="right")
+    table.add_column("Max", justify="right")
+    
+    rows = [
+        ("Events/s", 'events_per_sec', lambda v: f"{v:,.1f}"),
+        ("Log bytes/s", 'bytes_per_sec', lambda v: format_file_size(int(v))),
+        ("Batch p50", 'latency_p50_ns', lambda v: f"{v / 1000:,.1f} us"),
+        ("Batch p99", 'latency_p99_ns', lambda v: f"{v / 1000:,.1f} us"),
+        ("CPU", 'cpu_percent', lambda v: f"{v:.1f}%"),
+        ("RSS", 'rss_kb', lambda v: f"{int(v):,} KB"),
+        ("Watches", 'active_watches', lambda v: f"{int(v):,}"),
+    ]
+    for label, key, fmt in rows:
+        values = [sample[key] for sample in samples]
+        table.add_row(label, sparkline(values, 40), fmt(values[-1]), fmt(max(values)))
+    
+    console.print(table)
+    console.print(f"Total events: {latest['total_events']:,}")
 
 @cli.command()  
 def dashboard():
@@ -1105,6 +1296,16 @@ def dashboard():
         if stats['file_size'] > 0:
             stats_content += f"Log Size: {format_file_size(stats['file_size'])}"
         
+        # 최근 1시간 추이 (monitor_stats.ring)
+        stats_history = open_history()
+        if stats_history is not None:
+            with stats_history:
+                samples = stats_history.samples(3600)
+            if samples:
+                rates = [sample['events_per_sec'] for sample in samples]
+                stats_content += f"\n\nEvents/s (1h): {sparkline(rates, 30)}"
+                stats_content += f"\nNow: {rates[-1]:,.1f}/s  p99: {samples[-1]['latency_p99_ns'] / 1000:,.1f} us"
+        
         layout["stats"].update(Panel(stats_content, title="Statistics", border_style="yellow"))
         
         # 최근 로그
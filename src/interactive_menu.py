@@ -21,6 +21,8 @@ from rich.layout import Layout
 from rich.panel import Panel
 from rich import box
 
+from monitor_stats import open_history, sparkline, format_age, read_stats_page
+
 try:
     import psutil
     PSUTIL_AVAILABLE = True
@@ -296,13 +298,11 @@ class InteractiveFileMonitor:
             except:
                 console.print("\n[dim]System resources unavailable[/dim]")
         
-        # Enhanced stats (compact)
-        if os.path.exists("enhanced_stats.json"):
+        # Monitor stats (compact), from the shared-memory stats page
+        stats = read_stats_page()
+        if stats is not None:
             try:
-                with open("enhanced_stats.json", 'r') as f:
-                    stats = json.load(f)
-                
-                console.print(f"\n[bold yellow]Enhanced Monitor:[/bold yellow]")
+                console.print(f"\n[bold yellow]{stats['mode'].capitalize()} Monitor:[/bold yellow]")
                 console.print(f"  Events: {stats.get('total_events', 0):,}")
                 console.print(f"  Watches: {stats.get('active_watches', 0):,}")
                 console.print(f"  Memory: {stats.get('memory_usage_kb', 0):,}KB")
@@ -344,8 +344,36 @@ class InteractiveFileMonitor:
         if enhanced_panel:
             panels.append(enhanced_panel)
         
+        # Trend panel from the stats history ring
+        trend_panel = self.get_trend_panel()
+        if trend_panel:
+            panels.append(trend_panel)
+        
         return Columns(panels, equal=True, expand=True)
     
+    def get_trend_panel(self):
+        """Get last-hour trends from monitor_stats.ring"""
+        stats_history = open_history()
+        if stats_history is None:
+            return None
+        
+        with stats_history:
+            samples = stats_history.samples(3600)
+        if not samples:
+            return None
+        
+        latest = samples[-1]
+        rates = [sample['events_per_sec'] for sample in samples]
+        p99 = [sample['latency_p99_ns'] / 1000 for sample in samples]
+        rss = [sample['rss_kb'] for sample in samples]
+        content = f"""Events/s {sparkline(rates, 24)} {latest['events_per_sec']:,.1f}
+p99 (us) {sparkline(p99, 24)} {p99[-1]:,.1f}
+RSS (KB) {sparkline(rss, 24)} {latest['rss_kb']:,}
+
+Updated: {format_age(latest['timestamp'])}"""
+        
+        return Panel(content, title="Last Hour", border_style="cyan")
+    
     def get_system_resources_panel(self):
         """Get system resources panel"""
         if not PSUTIL_AVAILABLE:
@@ -379,15 +407,12 @@ Updated: {time.strftime('%H:%M:%S')}"""
         return Panel(content, title="System Resources", border_style="blue")
     
     def get_enhanced_stats_panel(self):
-        """Get enhanced monitor statistics panel"""
-        stats_file = "enhanced_stats.json"
-        if not os.path.exists(stats_file):
+        """Get monitor statistics panel (shared-memory stats page)"""
+        stats = read_stats_page()
+        if stats is None:
             return None
             
         try:
-            with open(stats_file, 'r') as f:
-                stats = json.load(f)
-            
             uptime = stats.get('uptime_seconds', 0)
             hours = uptime // 3600
             minutes = (uptime % 3600) // 60
@@ -399,12 +424,13 @@ Memory Usage: {stats.get('memory_usage_kb', 0):,} KB
 Watch Capacity: {stats.get('watch_capacity', 0):,}
 Watch Limit Hits: {stats.get('watch_limit_hits', 0)}
 Memory Reallocations: {stats.get('memory_reallocations', 0)}
+Last Sequence: {stats.get('last_seq', 0):,}
 
 Uptime: {hours:02d}:{minutes:02d}:{seconds:02d}"""
             
-            return Panel(content, title="Enhanced Monitor Stats", border_style="yellow")
+            return Panel(content, title=f"{stats['mode'].capitalize()} Monitor Stats", border_style="yellow")
         except:
-            return Panel("Error reading enhanced stats", title="Enhanced Monitor Stats", border_style="red")
+            return Panel("Error reading monitor stats", title="Monitor Stats", border_style="red")
 
     def logs_menu(self):
         """Logs menu"""
@@ -709,13 +735,11 @@ Timestamp: {time.strftime('%H:%M:%S')}"""
         else:
             content += "Monitor Process: Not running\n\n"
         
-        # Enhanced monitor stats
-        if os.path.exists("enhanced_stats.json"):
+        # Monitor stats from the shared-memory stats page
+        stats = read_stats_page()
+        if stats is not None:
             try:
-                with open("enhanced_stats.json", 'r') as f:
-                    stats = json.load(f)
-                
-                content += "Enhanced Monitor:\n"
+                content += f"{stats['mode'].capitalize()} Monitor:\n"
                 content += f"  Events: {stats.get('total_events', 0):,}\n"
                 content += f"  Watches: {stats.get('active_watches', 0):,}\n"
                 content += f"  Memory: {stats.get('memory_usage_kb', 0):,}KB\n"
@@ -727,9 +751,9 @@ Timestamp: {time.strftime('%H:%M:%S')}"""
                 content += f"  Events/sec: {events_per_sec:.2f}\n"
                 
             except:
-                content += "Enhanced Monitor: Error reading stats\n"
+                content += "Monitor Stats: Error reading stats\n"
         else:
-            content += "Enhanced Monitor: Not running\n"
+            content += "Monitor Stats: Not running\n"
         
         # Log file info
         if os.path.exists(self.log_file):
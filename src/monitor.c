@@ -4,28 +4,44 @@
  *   - basic: Simple file monitoring
  *   - advanced: File monitoring with checksums and compression
  *   - enhanced: File monitoring with dynamic scaling
+ *   - aggregate: Merges replicated event streams from many monitors
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
+#include <ctype.h>
 #include <unistd.h>
 #include <signal.h>
 #include <time.h>
 #include <errno.h>
 #include <locale.h>
+#include <fcntl.h>
 #include <sys/inotify.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <poll.h>
 #include <sys/resource.h>
 #include <sys/statvfs.h>
 #include <dirent.h>
 #include <libgen.h>
+#include <fnmatch.h>
 #include <pthread.h>
 #include <json-c/json.h>
 #include <openssl/sha.h>
 #include <zlib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 // Constants
 #define EVENT_SIZE          (sizeof(struct inotify_event))
@@ -34,6 +50,8 @@
 #define CONFIG_FILE         "monitor.conf"
 #define LOG_FILE            "monitor.log"
 #define STATS_FILE          "monitor_stats.json"
+#define STATS_HISTORY_FILE  "monitor_stats.ring"
+#define STATS_PAGE_FILE     "/dev/shm/file_monitor.stats"
 #define IPC_SOCKET_PATH     "/tmp/file_monitor.sock"
 #define INITIAL_WATCH_CAPACITY 1024
 #define WATCH_GROWTH_FACTOR    2
@@ -41,37 +59,148 @@
 #define MAX_LOG_FILES       10
 #define HASH_SIZE           65
 #define STATS_UPDATE_INTERVAL 5
+#define LOG_BUFFER_SIZE     (64 * 1024)
+#define TIMESTAMP_SIZE      20
+#define BENCH_WARMUP_EVENTS 10000
+#define BENCH_EVENT_NAMES   64
+#define COLLECTOR_SPOOL_FILE    "monitor_collector.spool"
+#define COLLECTOR_FRAME_MAGIC   0x424d4346  /* "FCMB" little-endian */
+#define COLLECTOR_FRAME_VERSION 1
+#define COLLECTOR_FLAG_DEFLATE  0x0001
+#define COLLECTOR_MAX_BATCH_KB  256
+#define COLLECTOR_MAX_DGRAM_KB  64
+#define COLLECTOR_STAGE_FRAMES  8
+#define COLLECTOR_BACKOFF_MIN_MS 100
+#define COLLECTOR_BACKOFF_MAX_MS 30000
+#define COLLECTOR_SPOOL_MAX_MB  256
+#define REPLICA_SPOOL_FILE      "monitor_replica.spool"
+#define REPLICA_BATCH_MAGIC     0x42524d46  /* "FMRB" */
+#define REPLICA_HELLO_MAGIC     0x48524d46  /* "FMRH" */
+#define REPLICA_ACK_MAGIC       0x41524d46  /* "FMRA" */
+#define REPLICA_STATE_MAGIC     0x53524d46  /* "FMRS" */
+#define REPLICA_VERSION         1
+#define REPLICA_FLAG_DEFLATE    0x0001
+#define REPLICA_MAX_BATCH_KB    1024
+#define REPLICA_STAGE_BATCHES   8
+#define REPLICA_SPOOL_MAX_MB    512
+#define SEQ_STATE_FILE          "monitor.seq"
+#define JOURNAL_FILE            "monitor.journal"
+#define SEQ_RESERVE_BLOCK       65536
+#define IPC_MAX_SUBSCRIBERS     16
+#define IPC_SUBSCRIBER_RING     (256 * 1024)
+#define IPC_REQUEST_MAX         4096
+#define AGGREGATE_LOG_FILE      "aggregate.log"
+#define AGGREGATE_MAX_LISTENERS 8
+#define AGGREGATE_MAX_SOURCES   256
+#define AGGREGATE_PENDING_BATCHES 4096
+#define AGGREGATE_DEDUP_SLOTS   65536
+#define AGGREGATE_MERGE_INTERVAL_MS 100
 
 // Monitor modes
 typedef enum {
     MODE_BASIC,
     MODE_ADVANCED,
-    MODE_ENHANCED
+    MODE_ENHANCED,
+    MODE_METRICS,
+    MODE_AGGREGATE
 } monitor_mode_t;
 
-// Dynamic watch management structure (for enhanced mode)
+// Per-subtree policy (see SUBTREE POLICIES)
+#define POLICY_MAX            32
+#define POLICY_MAX_EXTENSIONS 16
+#define POLICY_MASK_ALL       (IN_CREATE | IN_DELETE | IN_MODIFY | IN_MOVE | IN_ATTRIB | IN_OPEN | IN_CLOSE | IN_ACCESS)
+#define POLICY_HASH_DEFAULT   0   // as the mode does (advanced hashes)
+#define POLICY_HASH_ON        1
+#define POLICY_HASH_OFF       2
+#define POLICY_SINK_LOG       0x1 // log, file tree and journal
+#define POLICY_SINK_REPLICA   0x2
+#define POLICY_SINK_ALL       (POLICY_SINK_LOG | POLICY_SINK_REPLICA)
+
+// Event filter expression (see EVENT FILTER)
+#define FILTER_MAX_SOURCE     1024
+#define FILTER_MAX_NODES      256
+#define FILTER_MAX_STRINGS    128
+#define FILTER_POOL_SIZE      2048
+
+typedef struct {
+    char prefix[MAX_PATH_LEN];
+    size_t prefix_len;
+    uint32_t mask;          // inotify events to report
+    int hash;               // POLICY_HASH_*
+    int ignore;             // no watches at all below the prefix
+    int extension_count;    // -1 = global extension list, 0 = everything
+    char extension_data[128];
+    const char *extensions[POLICY_MAX_EXTENSIONS];
+    unsigned long rate;     // events per second, 0 = unlimited
+    double tokens;
+    int64_t refill_ns;
+    uint32_t sinks;         // POLICY_SINK_*
+    unsigned long events;
+    unsigned long dropped;  // over the rate limit
+} monitor_policy_t;
+
+// Path index (see PATH INDEX)
+#define PATH_INDEX_NONE       UINT32_MAX
+#define PATH_BLOCK_MAX        32      // keys in a leaf block before it bursts
+
+typedef struct {
+    uint32_t parent;
+    uint32_t child;         // first child node
+    uint32_t sibling;
+    uint32_t block;         // leaf block of longer keys, PATH_INDEX_NONE = none
+    uint32_t value;         // value of the key ending here, PATH_INDEX_NONE = none
+    uint32_t label_off;     // edge label from the parent, in labels
+    uint32_t label_len;
+} path_node_t;
+
+typedef struct {
+    char *data;             // front-coded entries in key order
+    uint32_t len;
+    uint32_t capacity;
+    uint32_t count;
+    uint32_t node;
+} path_block_t;
+
+typedef struct {
+    path_node_t *nodes;
+    uint32_t node_count;
+    uint32_t node_capacity;
+    path_block_t *blocks;
+    uint32_t block_count;
+    uint32_t block_capacity;
+    char *labels;
+    uint32_t labels_len;
+    uint32_t labels_capacity;
+    uint32_t *owners;       // value -> PATH_OWNER_NODE | node, or block
+    uint32_t owner_capacity;
+    char *scratch;          // a block is rebuilt here, then copied back
+    uint32_t scratch_capacity;
+    uint32_t count;         // keys stored
+    uint64_t key_bytes;     // their total length
+} path_index_t;
+
+typedef int (*path_index_visit_t)(const char *path, size_t len, uint32_t value, void *arg);
+
+// Dynamic watch management structure (for enhanced mode). The path is
+// kept in watch_index under the entry's index.
 typedef struct {
     int wd;
-    char path[MAX_PATH_LEN];
     time_t added_time;
     unsigned long event_count;
+    unsigned long reported_count;   // event_count at the last metrics rollup
+    uint32_t self_outputs;  // monitor output files living in this directory
+    monitor_policy_t *policy;
 } watch_entry_t;
 
 typedef struct {
     watch_entry_t *entries;
     size_t capacity;
     size_t count;
+    size_t *wd_index;       // wd -> entry index + 1 (0 = not ours)
+    size_t wd_index_capacity;
     pthread_mutex_t mutex;
 } watch_manager_t;
 
-// File hash info (for advanced mode)
-typedef struct {
-    char filepath[MAX_PATH_LEN];
-    char hash[HASH_SIZE];
-    time_t last_modified;
-    off_t file_size;
-} file_hash_info_t;
-
 // Statistics structure
 typedef struct {
     unsigned long total_events;
@@ -87,34 +216,340 @@ typedef struct {
     long disk_usage_percent;
     char most_active_path[MAX_PATH_LEN];
     unsigned long max_events_per_path;
+    unsigned long collector_frames_sent;
+    unsigned long collector_bytes_sent;
+    unsigned long collector_reconnects;
+    unsigned long collector_frames_spooled;
+    unsigned long collector_bytes_dropped;
+    unsigned long collector_frames_oversized;
+    unsigned long replica_batches_sent;
+    unsigned long replica_batches_acked;
+    unsigned long replica_reconnects;
+    unsigned long replica_records_dropped;
+    unsigned long aggregate_batches_received;
+    unsigned long aggregate_records_written;
+    unsigned long aggregate_duplicates;
+    unsigned long aggregate_late_records;
+    unsigned long aggregate_records_dropped;
+    unsigned long hashes_computed;
+    unsigned long hashes_reused;
+    unsigned long self_events_suppressed;
+    unsigned long crawl_jobs;
+    unsigned long crawl_duplicates;
+    unsigned long crawl_overflows;
+    unsigned long crawl_catchup_events;
+    unsigned long filter_rejected;
+    unsigned long filter_stat_calls;
+    unsigned long enrich_statx_calls;
+    unsigned long enrich_cache_hits;
+    unsigned long event_latency_samples;
+    uint64_t event_latency_total_ns;
+    uint64_t event_latency_max_ns;
 } monitor_stats_t;
 
+// When an event was read: both clocks, taken once per inotify read()
+// batch (or per directory listing for crawl catch-up events) and carried
+// with the event to the log and the replication stream
+typedef struct {
+    uint64_t monotonic_ns;
+    uint64_t realtime_ns;
+} event_time_t;
+
+// Event types as handlers report them (see EVENT SAMPLING)
+enum {
+    EVENT_TYPE_CREATE, EVENT_TYPE_DELETE, EVENT_TYPE_MODIFY, EVENT_TYPE_MOVED_FROM, EVENT_TYPE_MOVED_TO,
+    EVENT_TYPE_ATTRIB, EVENT_TYPE_OPEN, EVENT_TYPE_CLOSE, EVENT_TYPE_ACCESS, EVENT_TYPE_OTHER,
+    EVENT_TYPE_COUNT
+};
+
+// Metrics mode counter tables (see METRICS MODE)
+#define METRICS_EXT_SLOTS     1024    // power of two
+#define METRICS_EXT_PROBES    8
+#define METRICS_EXT_MAX_LEN   15
+#define METRICS_TOP_MAX       64
+#define METRICS_TYPE_MASK     (IN_ALL_EVENTS | IN_Q_OVERFLOW)
+
+typedef struct {
+    uint64_t count;         // 0 = free slot
+    uint32_t hash;
+    uint8_t len;
+    char ext[METRICS_EXT_MAX_LEN];
+} metrics_ext_t;
+
+// Per-thread and per-stage CPU accounting (see THREAD ACCOUNTING)
+#define CPU_THREAD_MAX 64
+#define CPU_STAGE_SAMPLE 16     // split one event batch in this many into stages
+
+enum { CPU_STAGE_READ, CPU_STAGE_DISPATCH, CPU_STAGE_HASH, CPU_STAGE_WRITE, CPU_STAGE_COUNT };
+
+typedef struct {
+    pid_t tid;
+    char role[16];
+    uint64_t cpu_ns;
+    uint64_t last_cpu_ns;
+    double cpu_percent;     // over the last sample interval
+    int seen;
+} cpu_thread_t;
+
+// Collector frame header; followed by payload_len bytes of log lines
+// (deflate-compressed when COLLECTOR_FLAG_DEFLATE is set)
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;
+    uint32_t raw_len;
+    uint32_t payload_len;
+} collector_frame_header_t;
+
+// Replicated event record; followed by path_len bytes of path
+typedef struct {
+    uint64_t timestamp_ns;
+    uint32_t mask;
+    uint16_t path_len;
+    uint16_t reserved;
+} replica_record_t;
+
+// Replication batch header; followed by payload_len bytes of records
+// (deflate-compressed when REPLICA_FLAG_DEFLATE is set). crc is the zlib
+// crc32 of the payload as sent.
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;
+    uint64_t batch_seq;
+    uint32_t record_count;
+    uint32_t raw_len;
+    uint32_t payload_len;
+    uint32_t crc;
+} replica_batch_header_t;
+
+// Sent once per connection by the monitor. The aggregator answers with a
+// replica_ack_t carrying the last batch it already holds for this source.
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    char source[64];
+} replica_hello_t;
+
+// Cumulative acknowledgement: every batch up to batch_seq is stored
+typedef struct {
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t batch_seq;
+} replica_ack_t;
+
 // Global variables
 static monitor_mode_t mode = MODE_BASIC;
 static int inotify_fd = -1;
-static FILE *log_file = NULL;
+static int log_fd = -1;
 static int recursive_mode = 1;
 static volatile int running = 1;
 static pthread_t stats_thread;
 static int ipc_socket = -1;
+static char ipc_socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)] = IPC_SOCKET_PATH;
+static pthread_t ipc_thread;
+
+// Event sequence numbers: assigned under log_mutex so log order and
+// sequence order always agree
+static uint64_t event_seq = 0;
+static uint64_t event_seq_reserved = 0;
+static int seq_fd = -1;
+
+// Change journal (journal=true): see the CHANGE JOURNAL section
+static int journal_requested = 0;
+static int journal_enabled = 0;
+static char journal_path[MAX_PATH_LEN] = JOURNAL_FILE;
+
+// Log compaction of old rotated segments (compact_age_hours > 0)
+static long compact_age_hours = 0;
+static int compact_drop_open = 1;
+static int compact_drop_close = 1;
+static pthread_t compact_thread;
+static pthread_mutex_t segment_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Stats time-series ring (stats_history=true): see the STATS HISTORY section
+static int stats_history_enabled = 1;
+static char stats_history_path[MAX_PATH_LEN] = STATS_HISTORY_FILE;
+static int stats_history_interval = 10;
+static int stats_history_days = 7;
+
+// Shared-memory stats page (stats_page=true): see the STATS PAGE section
+static int stats_page_enabled = 1;
+static char stats_page_path[MAX_PATH_LEN] = STATS_PAGE_FILE;
+
+// Subtree policies (policy=<prefix> ...): see the SUBTREE POLICIES section
+static monitor_policy_t policies[POLICY_MAX];
+static int policy_count = 0;
+
+// Event filter (filter=<expression>): see the EVENT FILTER section
+static char filter_source[FILTER_MAX_SOURCE];
+static int filter_source_overflow = 0;
+static const char *filter_cli = NULL;   // --filter=, replaces the config
+static uint32_t filter_len = 0;         // compiled instructions, 0 = no filter
+
+// Live IPC subscribers. The logger copies each event line into every
+// active ring under log_mutex; a subscriber that falls a full ring behind
+// is marked overrun and disconnected after draining, and resumes from the
+// on-disk segments when it reconnects.
+typedef struct {
+    int active;
+    int overrun;
+    char *ring;
+    uint64_t head;
+    uint64_t tail;
+} ipc_subscriber_t;
+
+static ipc_subscriber_t ipc_subscribers[IPC_MAX_SUBSCRIBERS];
+static int ipc_subscriber_count = 0;
+static pthread_cond_t ipc_cond = PTHREAD_COND_INITIALIZER;
+
+// Path of the event being handled, assembled by build_event_path()
+static char event_path[MAX_PATH_LEN];
+
+// Policy of the watch the event being handled came from
+static monitor_policy_t *event_policy = NULL;
 
 // Basic mode variables
 static int watch_descriptors[1024];
-static char watch_paths[1024][MAX_PATH_LEN];
+static uint32_t watch_self_outputs[1024];
+static monitor_policy_t *watch_policies[1024];
 static int watch_count = 0;
 
+// Watched directory paths by basic slot or enhanced entry index
+static path_index_t watch_index;
+
+// Guards the watch registries (both modes). Held by the event thread for
+// a whole batch and by the crawl worker while it registers a watch, so
+// handlers never see an entry move underneath them.
+static pthread_mutex_t watch_lock = PTHREAD_MUTEX_INITIALIZER;
+
 // Enhanced mode variables
 static watch_manager_t watch_manager = {0};
 
 // Advanced mode variables
-static file_hash_info_t *file_hashes = NULL;
-static int hash_count = 0;
-static int hash_capacity = 0;
 static int enable_checksum = 1;
 static int enable_compression = 1;
 static pthread_mutex_t hash_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+// Log buffering: lines are staged in a fixed buffer and written with a
+// single write() per inotify read batch instead of fprintf+fflush per line
+static char log_buffer[LOG_BUFFER_SIZE];
+static size_t log_buffer_len = 0;
+static off_t log_size = 0;
+static int log_batching = 0;
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// event_times=true: "#<seq>@<realtime s.ns>+<read-to-log ns>" in event lines
+static int event_times_enabled = 0;
+static event_time_t event_time;     // read time of the batch being processed
+
+// access_events=true subscribes to IN_ACCESS, which is off by default
+static int access_events = 0;
+
+// Event sampling: exact per-type counts of what policies let through,
+// how many were logged, and the 1-in-N rate of each type (event thread)
+static char sample_spec[FILTER_MAX_SOURCE] = "";
+static uint32_t sample_rates[EVENT_TYPE_COUNT] = { 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 };
+static uint32_t sample_phase[EVENT_TYPE_COUNT];
+static uint64_t event_type_seen[EVENT_TYPE_COUNT];
+static uint64_t event_type_logged[EVENT_TYPE_COUNT];
+static int sampling_enabled = 0;
+static int sample_interval = 10;
+
+// Directory usage (disk_usage=true) and growth_alert=<subtree> <size>
+// thresholds, checked every growth_interval seconds (see DIRECTORY USAGE)
+#define GROWTH_ALERT_MAX 32
+
+typedef struct {
+    char path[MAX_PATH_LEN];
+    uint64_t threshold;
+    uint64_t last_bytes;
+    int primed;
+} growth_alert_t;
+
+static int disk_usage = 0;
+static volatile int usage_seeded = 0;      // initial crawl done
+static growth_alert_t growth_alerts[GROWTH_ALERT_MAX];
+static int growth_alert_count = 0;
+static int growth_interval = 60;
+static char monitor_root[MAX_PATH_LEN];     // watched directory, for statvfs()
+
+// Since-clock queries (file_tree=true) and how long a deleted path stays
+// in the tree before it is pruned (see FILE TREE)
+static int file_tree_enabled = 0;
+static long file_tree_tombstone_sec = 3600;
+
+// Event enrichment (enrich=true): metadata cache size and how long a
+// measurement is reused for events that change nothing (see EVENT ENRICHMENT)
+#define ENRICH_SUFFIX_MAX 160
+
+static int enrich_enabled = 0;
+static uint32_t enrich_cache_entries = 16384;
+static uint64_t enrich_window_ns = 0;
+
+// Metrics mode: counts for the current interval, guarded by watch_lock,
+// and the last rollup for save_stats
+static int metrics_interval = 10;
+static int metrics_top = 10;
+static uint64_t metrics_type_counts[32];    // by inotify mask bit
+static metrics_ext_t metrics_exts[METRICS_EXT_SLOTS];
+static uint64_t metrics_ext_other = 0;
+static json_object *metrics_last = NULL;
+static pthread_mutex_t metrics_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Thread CPU samples, and the event thread's CPU time per stage
+static const char *const cpu_stage_names[CPU_STAGE_COUNT] = { "read", "dispatch", "hash", "write" };
+static cpu_thread_t cpu_threads[CPU_THREAD_MAX];
+static int cpu_thread_count = 0;
+static uint64_t cpu_sampled_ns = 0;
+static pthread_mutex_t cpu_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Written by the event thread only, for the sampled batches
+static uint64_t cpu_stage_ns[CPU_STAGE_COUNT];
+static uint64_t cpu_stage_events = 0;
+static uint64_t cpu_batch_end_ns = 0;   // end of the last sampled batch
+static unsigned cpu_batch_count = 0;
+static __thread int cpu_event_thread = 0;   // in a sampled batch
+
+// Benchmark mode (--bench=N): synthetic events, log discarded, no rotation
+static int bench_mode = 0;
+
+// Collector sink: log lines are shipped in frames to a local collector
+static char collector_socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)] = "";
+static int collector_socket_type = SOCK_DGRAM;
+static size_t collector_batch_bytes = 32 * 1024;
+static int collector_flush_ms = 200;
+static int collector_compress = 0;
+static char collector_spool_path[MAX_PATH_LEN] = COLLECTOR_SPOOL_FILE;
+static int collector_enabled = 0;
+static int collector_stopping = 0;
+static char *collector_stage = NULL;
+static char *collector_outbox = NULL;
+static size_t collector_stage_len = 0;
+static size_t collector_stage_capacity = 0;
+static pthread_t collector_thread;
+static pthread_mutex_t collector_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t collector_cond = PTHREAD_COND_INITIALIZER;
+
+// Replication sink: binary event batches streamed to an aggregator
+static char replica_target[MAX_PATH_LEN] = "";
+static char replica_source[64] = "";
+static size_t replica_batch_bytes = 64 * 1024;
+static int replica_flush_ms = 500;
+static int replica_compress = 1;
+static char replica_spool_path[MAX_PATH_LEN] = REPLICA_SPOOL_FILE;
+static int replica_enabled = 0;
+static int replica_stopping = 0;
+static char *replica_stage = NULL;
+static char *replica_outbox = NULL;
+static size_t replica_stage_len = 0;
+static size_t replica_stage_capacity = 0;
+static pthread_t replica_thread;
+static pthread_mutex_t replica_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t replica_cond = PTHREAD_COND_INITIALIZER;
+
 // File extensions filter
 static char **file_extensions = NULL;
 static int extension_count = 0;
@@ -122,55 +557,220 @@ static int extension_count = 0;
 // Statistics
 static monitor_stats_t stats = {0};
 
+#ifdef ALLOC_CHECK
+// Allocation accounting for `make test-alloc`: every heap call made while
+// the current thread has tracking enabled is counted, then forwarded to
+// glibc. Only the benchmark enables tracking.
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static __thread int alloc_tracking = 0;
+static unsigned long alloc_calls = 0;
+static unsigned long free_calls = 0;
+
+void *malloc(size_t size) {
+    if (alloc_tracking) alloc_calls++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    if (alloc_tracking) alloc_calls++;
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    if (alloc_tracking) alloc_calls++;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    if (alloc_tracking && ptr) free_calls++;
+    __libc_free(ptr);
+}
+
+#define ALLOC_TRACKING_BEGIN() (alloc_calls = free_calls = 0, alloc_tracking = 1)
+#define ALLOC_TRACKING_END()   (alloc_tracking = 0)
+#else
+#define ALLOC_TRACKING_BEGIN() ((void)0)
+#define ALLOC_TRACKING_END()   ((void)0)
+#endif
+
 // Function declarations
 void signal_handler(int sig);
 void cleanup_and_exit(int code);
 void log_event(const char *message);
-char *get_timestamp();
+void event_time_now(event_time_t *time);
+uint64_t log_path_event(const event_time_t *time, const char *label, const char *path, size_t path_len);
+void emit_event(uint32_t mask, const char *label, const char *path, size_t path_len);
+void emit_event_to(uint32_t sinks, const event_time_t *time, uint32_t mask, const char *label,
+                   const char *path, size_t path_len);
+const char *event_label(uint32_t mask);
+const char *mode_name();
+int uses_watch_manager();
+void log_flush();
+const char *get_timestamp();
 int load_config();
 int should_monitor_file(const char *filename);
+int policy_add(char *spec);
+int policy_compile();
+monitor_policy_t *policy_lookup(const char *dir_path);
+int policy_accepts(const monitor_policy_t *policy, const char *filename);
+void policy_emit(monitor_policy_t *policy, uint32_t mask, const char *label,
+                 const char *path, size_t path_len);
+int policy_wants(const monitor_policy_t *policy, uint32_t mask, const char *path, size_t path_len);
+void policy_emit_wanted(monitor_policy_t *policy, uint32_t mask, const char *label,
+                        const char *path, size_t path_len);
+void policy_emit_sampled(monitor_policy_t *policy, const event_time_t *time, uint32_t mask,
+                         const char *label, const char *path, size_t path_len);
+void policy_cleanup();
+void filter_add(const char *expression);
+int filter_compile();
+int filter_match(uint32_t mask, const char *path, size_t path_len);
+size_t build_event_path(const char *dir, size_t dir_len, const char *name, uint32_t name_max);
 void print_usage(const char *program_name);
 
+// Path index functions
+int path_index_put(path_index_t *ix, const char *key, size_t len, uint32_t value);
+uint32_t path_index_get(const path_index_t *ix, const char *key, size_t len);
+uint32_t path_index_remove(path_index_t *ix, const char *key, size_t len);
+size_t path_index_key(const path_index_t *ix, uint32_t value, char *out);
+uint32_t path_index_longest(const path_index_t *ix, const char *key, size_t len);
+void path_index_each(const path_index_t *ix, const char *prefix, size_t prefix_len,
+                     path_index_visit_t visit, void *arg);
+size_t path_index_memory(const path_index_t *ix);
+void path_index_free(path_index_t *ix);
+const char *watch_path(uint32_t slot, size_t *len);
+
 // Basic mode functions
-int add_watch_basic(const char *path);
+int add_watch_basic(const char *path, monitor_policy_t *policy, int *added);
 int add_watch_recursive_basic(const char *path);
-void handle_event_basic(struct inotify_event *event, const char *watch_path);
+void handle_event_basic(struct inotify_event *event, const char *watch_path, size_t watch_path_len);
 
 // Enhanced mode functions
 int init_watch_manager();
 void cleanup_watch_manager();
-int add_watch_dynamic(const char *path);
+int add_watch_dynamic(const char *path, monitor_policy_t *policy, int *added);
 watch_entry_t *find_watch_by_wd(int wd);
+
+// Event sampling functions
+int sample_compile();
+void sample_report();
+
+// Metrics mode functions
+void handle_event_metrics(struct inotify_event *event);
+void metrics_count_catch_up(int wd, const char *name);
+void metrics_rollup();
 int add_watch_recursive_enhanced(const char *path);
 void handle_event_enhanced(struct inotify_event *event);
 
+// Crawl worker functions
+int crawl_directory(const char *path, int catch_up, int rescan);
+void crawl_submit(const char *path, size_t path_len);
+void crawl_submit_measure(const char *path, size_t path_len, uint64_t moved_ns);
+uint64_t crawl_seed_horizon();
+int crawl_start(const char *root);
+void crawl_shutdown();
+
+// Event dispatch
+void self_outputs_init();
+uint32_t self_output_mask(const char *dir_path);
+int self_event(uint32_t outputs, const struct inotify_event *event);
+void process_events(char *buffer, int length);
+int run_benchmark(unsigned long iterations);
+
 // Advanced mode functions
-char* calculate_file_hash(const char *filepath);
+int calculate_fd_hash(int fd, char hex_string[HASH_SIZE]);
 int check_file_changed(const char *filepath);
-void update_file_hash(const char *filepath);
+int file_identity_check(const char *filepath, size_t len);
+void file_identity_event(uint32_t mask, const char *filepath, size_t len);
+void file_identity_cleanup();
 void rotate_log_file();
 void compress_old_log(const char *filename);
-void handle_event_advanced(struct inotify_event *event, const char *watch_path);
+int segment_compress_file(const char *src_path, const char *gz_path);
+void handle_event_advanced(struct inotify_event *event, const char *watch_path, size_t watch_path_len);
+
+// Collector sink functions
+int collector_init();
+void collector_submit(const char *data, size_t len);
+void collector_shutdown();
+void* collector_thread_func(void* arg);
+
+// Replication sink functions
+int replica_init();
+void replica_submit(const event_time_t *time, uint32_t mask, const char *path, size_t path_len);
+void replica_shutdown();
+void* replica_thread_func(void* arg);
+int open_stream_connection(const char *target, int timeout_ms);
+int recv_exact(int fd, void *buf, size_t len, int timeout_ms);
+
+// Aggregator mode functions
+int run_aggregator();
+
+// Event sequence and IPC server functions
+int seq_init();
+void seq_shutdown();
+int tree_init(uint64_t start_clock);
+void tree_record(uint32_t mask, const char *path, size_t path_len, uint64_t clock, const event_time_t *time);
+json_object *tree_query(uint64_t since, const char *root, const char *glob, const char *type);
+void tree_maintain();
+int enrich_cached(uint32_t node);
+int parse_size(const char *text, uint64_t *bytes);
+int growth_alert_add(const char *spec);
+void usage_seed(int dir_fd, const char *name, const char *path, size_t len, uint64_t watched_ns);
+void usage_scan(const char *path, uint64_t moved_ns);
+void usage_event(uint32_t mask, const char *path, size_t len);
+json_object *usage_query(const char *root);
+void usage_check_growth();
+int enrich_init();
+size_t enrich_event(uint32_t mask, const char *path, size_t path_len, const event_time_t *time, char *out);
+size_t event_text_path_len(const char *text, size_t len);
+int journal_init();
+void journal_record(uint32_t mask, const char *path, size_t path_len, uint64_t seq);
+void journal_flush();
+json_object *journal_query(uint64_t since, uint64_t limit);
+void journal_shutdown();
+
+// Log compaction functions
+int compact_pass(long max_age_hours);
+void* compact_thread_func(void* arg);
+
+// Log query functions
+int run_query();
+uint64_t parse_line_seq(const char *line, size_t len);
+int ipc_init();
+void ipc_publish_locked(const char *line, size_t len);
+void* ipc_thread_func(void* arg);
+
+// Thread accounting functions
+void thread_set_role(const char *role);
+uint64_t thread_cpu_ns();
+void cpu_sample();
 
 // Statistics functions
 void update_stats();
 void save_stats();
 void* stats_thread_func(void* arg);
+int stats_history_init();
+void stats_history_sample();
+int stats_page_init();
+void stats_page_publish(int running_now);
+unsigned long read_rss_kb();
 
 // Signal handler
 void signal_handler(int sig) {
     if (sig == SIGINT || sig == SIGTERM) {
+        // The main loop sees the interrupted read() and runs the cleanup,
+        // so buffered log lines are never torn mid-append
         printf("\n[STOP] Received signal: %d. Shutting down safely...\n", sig);
         running = 0;
-        save_stats();
-        cleanup_and_exit(0);
     } else if (sig == SIGUSR1) {
         update_stats();
         printf("\n=== MONITOR STATS ===\n");
-        printf("Mode: %s\n", mode == MODE_BASIC ? "basic" : 
-                             mode == MODE_ADVANCED ? "advanced" : "enhanced");
+        printf("Mode: %s\n", mode_name());
         printf("Total Events: %lu\n", stats.total_events);
-        if (mode == MODE_ENHANCED) {
+        if (uses_watch_manager()) {
             printf("Active Watches: %zu/%zu\n", watch_manager.count, watch_manager.capacity);
             printf("Memory Reallocations: %lu\n", stats.memory_reallocations);
         } else {
@@ -185,9 +785,16 @@ void signal_handler(int sig) {
 // Cleanup and exit
 void cleanup_and_exit(int code) {
     running = 0;
+    crawl_shutdown();
+    
+    // The interval in progress is reported too
+    if (mode == MODE_METRICS && !bench_mode && inotify_fd != -1) {
+        metrics_rollup();
+    }
     
+    pthread_mutex_lock(&watch_lock);
     if (inotify_fd != -1) {
-        if (mode == MODE_ENHANCED) {
+        if (uses_watch_manager()) {
             // Enhanced mode cleanup
             pthread_mutex_lock(&watch_manager.mutex);
             for (size_t i = 0; i < watch_manager.count; i++) {
@@ -206,15 +813,11 @@ void cleanup_and_exit(int code) {
         close(inotify_fd);
         inotify_fd = -1;
     }
-    
-    if (log_file) {
-        fclose(log_file);
-        log_file = NULL;
-    }
+    pthread_mutex_unlock(&watch_lock);
     
     if (ipc_socket != -1) {
         close(ipc_socket);
-        unlink(IPC_SOCKET_PATH);
+        unlink(ipc_socket_path);
         ipc_socket = -1;
     }
     
@@ -226,44 +829,304 @@ void cleanup_and_exit(int code) {
         free(file_extensions);
     }
     
-    // Cleanup file hashes (advanced mode)
-    if (file_hashes) {
-        free(file_hashes);
+    if (!bench_mode) {
+        save_stats();
+        stats_page_publish(0);
+    }
+    pthread_mutex_lock(&watch_lock);
+    path_index_free(&watch_index);
+    pthread_mutex_unlock(&watch_lock);
+    
+    // Cleanup file identities (advanced mode)
+    file_identity_cleanup();
+    policy_cleanup();
+    pthread_mutex_lock(&metrics_mutex);
+    if (metrics_last) {
+        json_object_put(metrics_last);
+        metrics_last = NULL;
     }
+    pthread_mutex_unlock(&metrics_mutex);
     
-    save_stats();
     log_event("[STOP] Monitor terminated gracefully");
     
+    if (log_fd != -1) {
+        log_flush();
+        close(log_fd);
+        log_fd = -1;
+    }
+    journal_shutdown();
+    seq_shutdown();
+    collector_shutdown();
+    replica_shutdown();
+    
     exit(code);
 }
 
 // Logging functions
-void log_event(const char *message) {
-    if (!log_file) return;
-    
-    char *timestamp = get_timestamp();
-    fprintf(log_file, "[%s] %s\n", timestamp, message);
-    fflush(log_file);
-    free(timestamp);
+// Write staged log lines to disk. Caller must hold log_mutex.
+static void log_flush_locked() {
+    size_t written = 0;
+    while (written < log_buffer_len) {
+        ssize_t n = write(log_fd, log_buffer + written, log_buffer_len - written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        written += n;
+    }
+    log_size += written;
+    stats.bytes_logged += written;
+    if (collector_enabled) {
+        collector_submit(log_buffer, log_buffer_len);
+    }
+    if (ipc_subscriber_count > 0) {
+        pthread_cond_broadcast(&ipc_cond);
+    }
+    log_buffer_len = 0;
+}
+
+void log_flush() {
+    pthread_mutex_lock(&log_mutex);
+    if (log_fd != -1 && log_buffer_len > 0) {
+        log_flush_locked();
+    }
+    int needs_rotation = (mode == MODE_ADVANCED && !bench_mode &&
+                          log_size > (off_t)MAX_LOG_SIZE_MB * 1024 * 1024);
+    pthread_mutex_unlock(&log_mutex);
     
     // Check log size and rotate if needed (advanced mode)
-    if (mode == MODE_ADVANCED) {
-        fseek(log_file, 0, SEEK_END);
-        long size = ftell(log_file);
-        if (size > MAX_LOG_SIZE_MB * 1024 * 1024) {
-            rotate_log_file();
+    if (needs_rotation) {
+        rotate_log_file();
+    }
+}
+
+// Hand out the next event sequence number. The state file always holds a
+// value no smaller than any number handed out: it is advanced a block at
+// a time while running and set to the exact last number on clean
+// shutdown, so only a crash leaves a gap. Caller holds log_mutex.
+static void seq_store(uint64_t value) {
+    char text[32];
+    int len = snprintf(text, sizeof(text), "%llu\n", (unsigned long long)value);
+    if (pwrite(seq_fd, text, len, 0) == len) {
+        if (ftruncate(seq_fd, len) == 0) {
+            fdatasync(seq_fd);
+        }
+    }
+}
+
+static uint64_t next_event_seq() {
+    uint64_t seq = ++event_seq;
+    if (seq > event_seq_reserved) {
+        event_seq_reserved = seq + SEQ_RESERVE_BLOCK - 1;
+        if (seq_fd != -1) {
+            seq_store(event_seq_reserved);
+        }
+    }
+    return seq;
+}
+
+static char *put_decimal(char *out, uint64_t value) {
+    char digits[20];
+    int digit_count = 0;
+    do {
+        digits[digit_count++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    while (digit_count) {
+        *out++ = digits[--digit_count];
+    }
+    return out;
+}
+
+// Stage "[timestamp] [#seq ]<label><text>\n" in the log buffer. All parts
+// have known lengths, so the line is assembled with memcpy only. File
+// events are sequenced; returns the assigned number (0 for plain lines).
+// With event_times the sequence number is followed by the event's read
+// time and how long it took from read() to here.
+static uint64_t log_append(int sequenced, const event_time_t *time, const char *label, size_t label_len,
+                           const char *text, size_t text_len) {
+    pthread_mutex_lock(&log_mutex);
+    if (log_fd == -1) {
+        pthread_mutex_unlock(&log_mutex);
+        return 0;
+    }
+    
+    // "[" timestamp "] " ["#" seq ["@" s "." ns "+" ns] " "] label text "\n"
+    size_t prefix_len = TIMESTAMP_SIZE + 3 + (sequenced ? 22 : 0) + (time ? 53 : 0);
+    size_t line_len = prefix_len + label_len + text_len;
+    if (log_buffer_len + line_len > LOG_BUFFER_SIZE) {
+        log_flush_locked();
+        if (line_len > LOG_BUFFER_SIZE) {
+            text_len = LOG_BUFFER_SIZE - prefix_len - label_len;
+        }
+    }
+    
+    char *line = log_buffer + log_buffer_len;
+    char *out = line;
+    *out++ = '[';
+    memcpy(out, get_timestamp(), TIMESTAMP_SIZE - 1);
+    out += TIMESTAMP_SIZE - 1;
+    *out++ = ']';
+    *out++ = ' ';
+    
+    uint64_t seq = 0;
+    if (sequenced) {
+        seq = next_event_seq();
+        *out++ = '#';
+        out = put_decimal(out, seq);
+        if (time) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            uint64_t now_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+            uint64_t latency = now_ns > time->monotonic_ns ? now_ns - time->monotonic_ns : 0;
+            
+            *out++ = '@';
+            out = put_decimal(out, time->realtime_ns / 1000000000ULL);
+            *out++ = '.';
+            uint32_t ns = time->realtime_ns % 1000000000ULL;
+            for (uint32_t div = 100000000; div; div /= 10) {
+                *out++ = '0' + ns / div % 10;
+            }
+            *out++ = '+';
+            out = put_decimal(out, latency);
+            
+            stats.event_latency_samples++;
+            stats.event_latency_total_ns += latency;
+            if (latency > stats.event_latency_max_ns) stats.event_latency_max_ns = latency;
+        }
+        *out++ = ' ';
+    }
+    memcpy(out, label, label_len);
+    out += label_len;
+    memcpy(out, text, text_len);
+    out += text_len;
+    *out++ = '\n';
+    log_buffer_len = out - log_buffer;
+    
+    if (sequenced && ipc_subscriber_count > 0) {
+        ipc_publish_locked(line, out - line);
+    }
+    
+    int batching = log_batching;
+    pthread_mutex_unlock(&log_mutex);
+    
+    // Outside an event batch every line is written immediately
+    if (!batching) {
+        log_flush();
+    }
+    return seq;
+}
+
+void log_event(const char *message) {
+    log_append(0, NULL, "", 0, message, strlen(message));
+}
+
+void event_time_now(event_time_t *time) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    time->monotonic_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+    clock_gettime(CLOCK_REALTIME, &now);
+    time->realtime_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// Log a file event line such as "#42 Created: <path>"
+uint64_t log_path_event(const event_time_t *time, const char *label, const char *path, size_t path_len) {
+    return log_append(1, event_times_enabled ? time : NULL, label, strlen(label), path, path_len);
+}
+
+// Hand one file event of the current read batch to every output: the log
+// and, when configured, the file tree, the journal and the replication
+// stream
+void emit_event(uint32_t mask, const char *label, const char *path, size_t path_len) {
+    emit_event_to(POLICY_SINK_ALL, &event_time, mask, label, path, path_len);
+}
+
+// emit_event() limited to the given POLICY_SINK_* outputs, for an event
+// read at time
+void emit_event_to(uint32_t sinks, const event_time_t *time, uint32_t mask, const char *label,
+                   const char *path, size_t path_len) {
+    if (sinks & POLICY_SINK_LOG) {
+        uint64_t seq;
+        if (enrich_enabled) {
+            char text[MAX_PATH_LEN + ENRICH_SUFFIX_MAX];
+            size_t text_len = enrich_event(mask, path, path_len, time, text);
+            seq = log_path_event(time, label, text, text_len);
+        } else {
+            seq = log_path_event(time, label, path, path_len);
         }
+        if (seq) {
+            if (file_tree_enabled) {
+                tree_record(mask, path, path_len, seq, time);
+            }
+            if (journal_enabled) {
+                journal_record(mask, path, path_len, seq);
+            }
+        }
+    }
+    if ((sinks & POLICY_SINK_REPLICA) && replica_enabled) {
+        replica_submit(time, mask, path, path_len);
     }
 }
 
-char *get_timestamp() {
+// Log label for a single replicated event bit
+const char *event_label(uint32_t mask) {
+    if (mask & IN_CREATE) return "Created: ";
+    if (mask & IN_DELETE) return "Deleted: ";
+    if (mask & IN_MODIFY) return "Modified: ";
+    if (mask & IN_MOVED_FROM) return "Moved from: ";
+    if (mask & IN_MOVED_TO) return "Moved to: ";
+    if (mask & IN_OPEN) return "Opened: ";
+    if (mask & IN_CLOSE) return "Closed: ";
+    if (mask & IN_ACCESS) return "Accessed: ";
+    return "Event: ";
+}
+
+const char *mode_name() {
+    switch (mode) {
+        case MODE_ADVANCED:  return "advanced";
+        case MODE_ENHANCED:  return "enhanced";
+        case MODE_METRICS:   return "metrics";
+        case MODE_AGGREGATE: return "aggregate";
+        default:             return "basic";
+    }
+}
+
+// Enhanced and metrics modes keep their watches in watch_manager
+int uses_watch_manager() {
+    return mode == MODE_ENHANCED || mode == MODE_METRICS;
+}
+
+// Returns the current local time as "YYYY-MM-DD HH:MM:SS". The string is
+// cached and only reformatted when the second changes; caller must hold
+// log_mutex.
+const char *get_timestamp() {
+    static char timestamp[TIMESTAMP_SIZE];
+    static time_t cached_second = (time_t)-1;
+    
     time_t now = time(NULL);
-    struct tm *tm_info = localtime(&now);
-    char *timestamp = malloc(20);
-    strftime(timestamp, 20, "%Y-%m-%d %H:%M:%S", tm_info);
+    if (now != cached_second) {
+        struct tm tm_info;
+        localtime_r(&now, &tm_info);
+        strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &tm_info);
+        cached_second = now;
+    }
     return timestamp;
 }
 
+// Copy a string config value into its fixed-size buffer. Values that do
+// not fit are rejected rather than silently truncated.
+static int config_string(char *dst, size_t size, const char *key, const char *value) {
+    size_t len = strlen(value);
+    if (len >= size) {
+        char msg[256];
+        snprintf(msg, sizeof(msg), "[ERROR] %s value too long (%zu bytes, max %zu)", key, len, size - 1);
+        log_event(msg);
+        return -1;
+    }
+    memcpy(dst, value, len + 1);
+    return 0;
+}
+
 // Configuration loading
 int load_config() {
     FILE *config_file = fopen(CONFIG_FILE, "r");
@@ -272,7 +1135,8 @@ int load_config() {
         return 0;
     }
     
-    char line[256];
+    char line[FILTER_MAX_SOURCE];
+    int config_errors = 0;
     int extensions_capacity = 10;
     file_extensions = malloc(sizeof(char*) * extensions_capacity);
     extension_count = 0;
@@ -289,20 +1153,173 @@ int load_config() {
             }
             file_extensions[extension_count] = strdup(line + 10);
             extension_count++;
+        } else if (strncmp(line, "collector_socket=", 17) == 0) {
+            if (config_string(collector_socket_path, sizeof(collector_socket_path), "collector_socket", line + 17) != 0) {
+                config_errors++;
+            }
+        } else if (strncmp(line, "collector_type=", 15) == 0) {
+            collector_socket_type = (strcmp(line + 15, "stream") == 0) ? SOCK_STREAM : SOCK_DGRAM;
+        } else if (strncmp(line, "collector_batch_kb=", 19) == 0) {
+            long kb = atol(line + 19);
+            if (kb < 1) kb = 1;
+            if (kb > COLLECTOR_MAX_BATCH_KB) kb = COLLECTOR_MAX_BATCH_KB;
+            collector_batch_bytes = kb * 1024;
+        } else if (strncmp(line, "collector_flush_ms=", 19) == 0) {
+            collector_flush_ms = atoi(line + 19);
+            if (collector_flush_ms < 1) collector_flush_ms = 1;
+        } else if (strncmp(line, "collector_compress=", 19) == 0) {
+            collector_compress = (strcmp(line + 19, "true") == 0 || strcmp(line + 19, "yes") == 0);
+        } else if (strncmp(line, "collector_spool=", 16) == 0) {
+            if (config_string(collector_spool_path, sizeof(collector_spool_path), "collector_spool", line + 16) != 0) {
+                config_errors++;
+            }
+        } else if (strncmp(line, "replicate_to=", 13) == 0) {
+            if (config_string(replica_target, sizeof(replica_target), "replicate_to", line + 13) != 0) {
+                config_errors++;
+            }
+        } else if (strncmp(line, "replicate_source=", 17) == 0) {
+            if (config_string(replica_source, sizeof(replica_source), "replicate_source", line + 17) != 0) {
+                config_errors++;
+            }
+        } else if (strncmp(line, "replicate_batch_kb=", 19) == 0) {
+            long kb = atol(line + 19);
+            if (kb < 1) kb = 1;
+            if (kb > REPLICA_MAX_BATCH_KB) kb = REPLICA_MAX_BATCH_KB;
+            replica_batch_bytes = kb * 1024;
+        } else if (strncmp(line, "replicate_flush_ms=", 19) == 0) {
+            replica_flush_ms = atoi(line + 19);
+            if (replica_flush_ms < 1) replica_flush_ms = 1;
+        } else if (strncmp(line, "replicate_compress=", 19) == 0) {
+            replica_compress = (strcmp(line + 19, "true") == 0 || strcmp(line + 19, "yes") == 0);
+        } else if (strncmp(line, "replicate_spool=", 16) == 0) {
+            if (config_string(replica_spool_path, sizeof(replica_spool_path), "replicate_spool", line + 16) != 0) {
+                config_errors++;
+            }
+        } else if (strncmp(line, "event_times=", 12) == 0) {
+            event_times_enabled = (strcmp(line + 12, "true") == 0 || strcmp(line + 12, "yes") == 0);
+        } else if (strncmp(line, "journal=", 8) == 0) {
+            journal_requested = (strcmp(line + 8, "true") == 0 || strcmp(line + 8, "yes") == 0);
+        } else if (strncmp(line, "stats_page=", 11) == 0) {
+            stats_page_enabled = (strcmp(line + 11, "true") == 0 || strcmp(line + 11, "yes") == 0);
+        } else if (strncmp(line, "stats_page_path=", 16) == 0) {
+            if (config_string(stats_page_path, sizeof(stats_page_path), "stats_page_path", line + 16) != 0) {
+                config_errors++;
+            }
+        } else if (strncmp(line, "stats_history=", 14) == 0) {
+            stats_history_enabled = (strcmp(line + 14, "true") == 0 || strcmp(line + 14, "yes") == 0);
+        } else if (strncmp(line, "stats_history_path=", 19) == 0) {
+            if (config_string(stats_history_path, sizeof(stats_history_path), "stats_history_path", line + 19) != 0) {
+                config_errors++;
+            }
+        } else if (strncmp(line, "file_tree=", 10) == 0) {
+            file_tree_enabled = (strcmp(line + 10, "true") == 0 || strcmp(line + 10, "yes") == 0);
+        } else if (strncmp(line, "file_tree_tombstone_sec=", 24) == 0) {
+            file_tree_tombstone_sec = atol(line + 24);
+            if (file_tree_tombstone_sec < 0) file_tree_tombstone_sec = 0;
+            if (file_tree_tombstone_sec > INT32_MAX) file_tree_tombstone_sec = INT32_MAX;
+        } else if (strncmp(line, "enrich=", 7) == 0) {
+            enrich_enabled = (strcmp(line + 7, "true") == 0 || strcmp(line + 7, "yes") == 0);
+        } else if (strncmp(line, "enrich_cache=", 13) == 0) {
+            long entries = atol(line + 13);
+            enrich_cache_entries = entries < 1 ? 1 : entries > (1L << 24) ? (1L << 24) : entries;
+        } else if (strncmp(line, "enrich_window_ms=", 17) == 0) {
+            long window_ms = atol(line + 17);
+            enrich_window_ns = window_ms > 0 ? (uint64_t)window_ms * 1000000ULL : 0;
+        } else if (strncmp(line, "disk_usage=", 11) == 0) {
+            disk_usage = (strcmp(line + 11, "true") == 0 || strcmp(line + 11, "yes") == 0);
+        } else if (strncmp(line, "growth_alert=", 13) == 0) {
+            if (growth_alert_add(line + 13) != 0) {
+                char msg[MAX_PATH_LEN + 64];
+                snprintf(msg, sizeof(msg), "[WARN] Ignoring growth_alert=%s (expected <subtree> <size>)", line + 13);
+                log_event(msg);
+            }
+        } else if (strncmp(line, "growth_interval=", 16) == 0) {
+            growth_interval = atoi(line + 16);
+            if (growth_interval < 1) growth_interval = 1;
+        } else if (strncmp(line, "access_events=", 14) == 0) {
+            access_events = (strcmp(line + 14, "true") == 0 || strcmp(line + 14, "yes") == 0);
+        } else if (strncmp(line, "sample=", 7) == 0) {
+            size_t used = strlen(sample_spec);
+            snprintf(sample_spec + used, sizeof(sample_spec) - used, "%s%s", used ? "," : "", line + 7);
+        } else if (strncmp(line, "sample_interval=", 16) == 0) {
+            sample_interval = atoi(line + 16);
+            if (sample_interval < 1) sample_interval = 1;
+        } else if (strncmp(line, "metrics_interval=", 17) == 0) {
+            metrics_interval = atoi(line + 17);
+            if (metrics_interval < 1) metrics_interval = 1;
+        } else if (strncmp(line, "metrics_top=", 12) == 0) {
+            metrics_top = atoi(line + 12);
+            if (metrics_top < 0) metrics_top = 0;
+            if (metrics_top > METRICS_TOP_MAX) metrics_top = METRICS_TOP_MAX;
+        } else if (strncmp(line, "stats_history_interval=", 23) == 0) {
+            stats_history_interval = atoi(line + 23);
+        } else if (strncmp(line, "stats_history_days=", 19) == 0) {
+            stats_history_days = atoi(line + 19);
+        } else if (strncmp(line, "journal_path=", 13) == 0) {
+            if (config_string(journal_path, sizeof(journal_path), "journal_path", line + 13) != 0) {
+                config_errors++;
+            }
+        } else if (strncmp(line, "compact_age_hours=", 18) == 0) {
+            compact_age_hours = atol(line + 18);
+            if (compact_age_hours < 0) compact_age_hours = 0;
+        } else if (strncmp(line, "compact_drop=", 13) == 0) {
+            compact_drop_open = strstr(line + 13, "open") != NULL;
+            compact_drop_close = strstr(line + 13, "close") != NULL;
+        } else if (strncmp(line, "policy=", 7) == 0) {
+            if (policy_add(line + 7) != 0) {
+                config_errors++;
+            }
+        } else if (strncmp(line, "filter=", 7) == 0) {
+            filter_add(line + 7);
+        } else if (strncmp(line, "ipc_socket=", 11) == 0) {
+            if (config_string(ipc_socket_path, sizeof(ipc_socket_path), "ipc_socket", line + 11) != 0) {
+                config_errors++;
+            }
         }
     }
     
     fclose(config_file);
     
+    if (config_errors) {
+        return -1;
+    }
+    
+    if (policy_compile() != 0) {
+        log_event("[ERROR] Failed to compile subtree policies");
+        return -1;
+    }
+    
     char config_msg[256];
     snprintf(config_msg, sizeof(config_msg), 
-            "[CONFIG] Loaded: recursive=%s, extensions=%d", 
-            recursive_mode ? "yes" : "no", extension_count);
+            "[CONFIG] Loaded: recursive=%s, extensions=%d, policies=%d", 
+            recursive_mode ? "yes" : "no", extension_count, policy_count);
     log_event(config_msg);
     
     return 0;
 }
 
+// Assemble "<dir>/<name>" into the reusable event_path buffer. The
+// directory length is stored with each watch and the name is bounded by
+// the inotify record length, so neither string is rescanned twice.
+// Returns the assembled length.
+size_t build_event_path(const char *dir, size_t dir_len, const char *name, uint32_t name_max) {
+    size_t name_len = strnlen(name, name_max);
+    
+    if (dir_len > MAX_PATH_LEN - 2) {
+        dir_len = MAX_PATH_LEN - 2;
+    }
+    if (dir_len + 1 + name_len > MAX_PATH_LEN - 1) {
+        name_len = MAX_PATH_LEN - 1 - dir_len - 1;
+    }
+    
+    memcpy(event_path, dir, dir_len);
+    event_path[dir_len] = '/';
+    memcpy(event_path + dir_len + 1, name, name_len);
+    event_path[dir_len + 1 + name_len] = '\0';
+    
+    return dir_len + 1 + name_len;
+}
+
 int should_monitor_file(const char *filename) {
     if (extension_count == 0) return 1;
     
@@ -320,551 +1337,8217 @@ int should_monitor_file(const char *filename) {
     return 0;
 }
 
-// ===== BASIC MODE FUNCTIONS =====
+// ===== PATH INDEX =====
 
-int add_watch_basic(const char *path) {
-    if (watch_count >= 1024) {
-        log_event("[ERROR] Maximum watch limit reached (basic mode)");
-        return -1;
-    }
-    
-    int wd = inotify_add_watch(inotify_fd, path,
-                              IN_CREATE | IN_DELETE | IN_MODIFY | 
-                              IN_MOVE | IN_ATTRIB | IN_OPEN | IN_CLOSE);
-    
-    if (wd == -1) {
-        char error_msg[512];
-        snprintf(error_msg, sizeof(error_msg),
-                "[ERROR] Failed to add watch for %s: %s", path, strerror(errno));
-        log_event(error_msg);
-        return -1;
+// Maps paths to 32-bit values (watch slots, identity paths, policies) while
+// storing the parts that paths share only once. Inner nodes form a
+// compressed radix trie whose edges carry multi-byte labels. The keys that
+// continue below a node live in its leaf block, sorted and front-coded:
+//   varint shared, varint rest_len, rest bytes, 4-byte value
+// where shared is the number of leading bytes repeated from the previous
+// key. A block that grows past PATH_BLOCK_MAX bursts: its largest group of
+// keys with the same first byte moves below a new child node labelled with
+// the group's common prefix. No key in a block starts with the first byte
+// of a child's label, so every lookup follows a single path. owners[] maps
+// a value back to the node or block holding its key, for value -> path.
+// Each value names at most one key. Nodes are not merged back on removal.
+
+#define PATH_OWNER_NODE 0x80000000u
+
+static uint32_t path_varint_put(char *out, uint32_t value) {
+    uint32_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = (char)(value | 0x80);
+        value >>= 7;
     }
-    
-    watch_descriptors[watch_count] = wd;
-    strncpy(watch_paths[watch_count], path, MAX_PATH_LEN - 1);
-    watch_paths[watch_count][MAX_PATH_LEN - 1] = '\0';
-    watch_count++;
-    
-    char success_msg[512];
-    snprintf(success_msg, sizeof(success_msg), "[WATCH] Added: %s (wd: %d)", path, wd);
-    log_event(success_msg);
-    
-    return wd;
+    out[n++] = (char)value;
+    return n;
 }
 
-int add_watch_recursive_basic(const char *path) {
-    struct stat path_stat;
-    if (stat(path, &path_stat) != 0) {
-        char error_msg[512];
-        snprintf(error_msg, sizeof(error_msg), "[ERROR] Cannot stat path: %s", path);
-        log_event(error_msg);
-        return -1;
-    }
-    
-    if (!S_ISDIR(path_stat.st_mode)) {
-        log_event("[ERROR] Path is not a directory");
-        return -1;
+static uint32_t path_varint_get(const char **in) {
+    const unsigned char *p = (const unsigned char *)*in;
+    uint32_t value = 0;
+    int shift = 0;
+    while (*p & 0x80) {
+        value |= (uint32_t)(*p++ & 0x7f) << shift;
+        shift += 7;
     }
-    
-    if (add_watch_basic(path) == -1) {
-        return -1;
+    value |= (uint32_t)*p++ << shift;
+    *in = (const char *)p;
+    return value;
+}
+
+// Walks a block, decoding each key in place over the previous one
+typedef struct {
+    const char *p;
+    const char *end;
+    char *key;
+    size_t len;
+    uint32_t value;
+} path_cursor_t;
+
+static void path_cursor_init(path_cursor_t *cursor, const path_block_t *block, char *key) {
+    cursor->p = block->data;
+    cursor->end = block->len ? block->data + block->len : block->data;
+    cursor->key = key;
+    cursor->len = 0;
+    cursor->value = PATH_INDEX_NONE;
+}
+
+static int path_cursor_next(path_cursor_t *cursor) {
+    if (cursor->p >= cursor->end) return 0;
+    uint32_t shared = path_varint_get(&cursor->p);
+    uint32_t rest = path_varint_get(&cursor->p);
+    memcpy(cursor->key + shared, cursor->p, rest);
+    cursor->p += rest;
+    cursor->len = shared + rest;
+    memcpy(&cursor->value, cursor->p, sizeof(uint32_t));
+    cursor->p += sizeof(uint32_t);
+    return 1;
+}
+
+static int path_compare(const char *a, size_t a_len, const char *b, size_t b_len) {
+    int cmp = memcmp(a, b, a_len < b_len ? a_len : b_len);
+    if (cmp) return cmp;
+    return a_len < b_len ? -1 : a_len > b_len;
+}
+
+static int path_reserve(char **buf, uint32_t *capacity, size_t needed) {
+    if (needed <= *capacity) return 0;
+    size_t grown_capacity = *capacity ? *capacity : 256;
+    while (grown_capacity < needed) grown_capacity *= 2;
+    char *grown = realloc(*buf, grown_capacity);
+    if (!grown) return -1;
+    *buf = grown;
+    *capacity = grown_capacity;
+    return 0;
+}
+
+// Copy a block rebuilt in scratch back into block b, keeping its buffer
+// within about an eighth of the encoded size
+static int path_block_store(path_index_t *ix, uint32_t b, uint32_t len, uint32_t count) {
+    path_block_t *block = &ix->blocks[b];
+    if (len > block->capacity || len + 64 < block->capacity / 2) {
+        uint32_t capacity = len + len / 8 + 32;
+        char *data = realloc(block->data, capacity);
+        if (data) {
+            block->data = data;
+            block->capacity = capacity;
+        } else if (len > block->capacity) {
+            return -1;
+        }
+    }
+    memcpy(block->data, ix->scratch, len);
+    block->len = len;
+    block->count = count;
+    return 0;
+}
+
+// Append one entry; prev holds the previous key and is updated to key.
+// The caller has reserved room for it.
+static void path_emit(char *buf, uint32_t *len, char *prev, size_t *prev_len,
+                      const char *key, size_t key_len, uint32_t value) {
+    size_t shared = 0;
+    while (shared < *prev_len && shared < key_len && prev[shared] == key[shared]) shared++;
+    char *out = buf + *len;
+    out += path_varint_put(out, shared);
+    out += path_varint_put(out, key_len - shared);
+    memcpy(out, key + shared, key_len - shared);
+    out += key_len - shared;
+    memcpy(out, &value, sizeof(uint32_t));
+    out += sizeof(uint32_t);
+    *len = out - buf;
+    memcpy(prev + shared, key + shared, key_len - shared);
+    *prev_len = key_len;
+}
+
+static uint32_t path_node_new(path_index_t *ix, uint32_t parent) {
+    if (ix->node_count == ix->node_capacity) {
+        uint32_t capacity = ix->node_capacity ? ix->node_capacity * 2 : 64;
+        path_node_t *grown = realloc(ix->nodes, capacity * sizeof(path_node_t));
+        if (!grown) return PATH_INDEX_NONE;
+        ix->nodes = grown;
+        ix->node_capacity = capacity;
+    }
+    path_node_t *node = &ix->nodes[ix->node_count];
+    memset(node, 0, sizeof(*node));
+    node->parent = parent;
+    node->child = node->sibling = node->block = node->value = PATH_INDEX_NONE;
+    return ix->node_count++;
+}
+
+static uint32_t path_block_new(path_index_t *ix, uint32_t node) {
+    if (ix->block_count == ix->block_capacity) {
+        uint32_t capacity = ix->block_capacity ? ix->block_capacity * 2 : 64;
+        path_block_t *grown = realloc(ix->blocks, capacity * sizeof(path_block_t));
+        if (!grown) return PATH_INDEX_NONE;
+        ix->blocks = grown;
+        ix->block_capacity = capacity;
+    }
+    path_block_t *block = &ix->blocks[ix->block_count];
+    memset(block, 0, sizeof(*block));
+    block->node = node;
+    ix->nodes[node].block = ix->block_count;
+    return ix->block_count++;
+}
+
+static int path_set_owner(path_index_t *ix, uint32_t value, uint32_t owner) {
+    if (value >= ix->owner_capacity) {
+        uint32_t capacity = ix->owner_capacity ? ix->owner_capacity : 64;
+        while (capacity <= value) capacity *= 2;
+        uint32_t *grown = realloc(ix->owners, capacity * sizeof(uint32_t));
+        if (!grown) return -1;
+        memset(grown + ix->owner_capacity, 0xff, (capacity - ix->owner_capacity) * sizeof(uint32_t));
+        ix->owners = grown;
+        ix->owner_capacity = capacity;
+    }
+    ix->owners[value] = owner;
+    return 0;
+}
+
+// Child of node whose label starts with byte, or PATH_INDEX_NONE
+static uint32_t path_child(const path_index_t *ix, uint32_t node, char byte) {
+    uint32_t child = ix->nodes[node].child;
+    while (child != PATH_INDEX_NONE && ix->labels[ix->nodes[child].label_off] != byte) {
+        child = ix->nodes[child].sibling;
+    }
+    return child;
+}
+
+// Cut child's edge after k bytes; the first part becomes a new node
+static uint32_t path_split(path_index_t *ix, uint32_t child, uint32_t k) {
+    uint32_t mid = path_node_new(ix, ix->nodes[child].parent);
+    if (mid == PATH_INDEX_NONE) return PATH_INDEX_NONE;
+    path_node_t *old = &ix->nodes[child];
+    path_node_t *node = &ix->nodes[mid];
+    node->label_off = old->label_off;
+    node->label_len = k;
+    node->child = child;
+    node->sibling = old->sibling;
+    
+    uint32_t *link = &ix->nodes[old->parent].child;
+    while (*link != child) link = &ix->nodes[*link].sibling;
+    *link = mid;
+    old->parent = mid;
+    old->label_off += k;
+    old->label_len -= k;
+    old->sibling = PATH_INDEX_NONE;
+    return mid;
+}
+
+// Rebuild block b in scratch with key inserted or replaced (value set) or
+// removed (value PATH_INDEX_NONE). *old receives the value key had before.
+static int path_block_rewrite(path_index_t *ix, uint32_t b, const char *key, size_t key_len,
+                              uint32_t value, uint32_t *old) {
+    path_block_t *block = &ix->blocks[b];
+    *old = PATH_INDEX_NONE;
+    // Dropping or adding one key changes the shared part of the next key
+    if (path_reserve(&ix->scratch, &ix->scratch_capacity,
+                     (size_t)block->len + key_len + MAX_PATH_LEN + 32) != 0) {
+        return -1;
+    }
+    
+    char cur[MAX_PATH_LEN], prev[MAX_PATH_LEN];
+    size_t prev_len = 0;
+    uint32_t len = 0, count = 0;
+    int placed = 0;
+    path_cursor_t cursor;
+    path_cursor_init(&cursor, block, cur);
+    while (path_cursor_next(&cursor)) {
+        if (!placed) {
+            int cmp = path_compare(key, key_len, cur, cursor.len);
+            if (cmp <= 0) {
+                placed = 1;
+                if (value != PATH_INDEX_NONE) {
+                    path_emit(ix->scratch, &len, prev, &prev_len, key, key_len, value);
+                    count++;
+                }
+                if (cmp == 0) {
+                    *old = cursor.value;
+                    continue;
+                }
+            }
+        }
+        path_emit(ix->scratch, &len, prev, &prev_len, cur, cursor.len, cursor.value);
+        count++;
+    }
+    if (!placed && value != PATH_INDEX_NONE) {
+        path_emit(ix->scratch, &len, prev, &prev_len, key, key_len, value);
+        count++;
+    }
+    return path_block_store(ix, b, len, count);
+}
+
+// Move the largest same-first-byte group of node's block below a new
+// child. Returns the child if its own block is now over the limit.
+static uint32_t path_burst(path_index_t *ix, uint32_t node) {
+    uint32_t b = ix->nodes[node].block;
+    char key[MAX_PATH_LEN], first[MAX_PATH_LEN];
+    uint32_t counts[256] = {0};
+    size_t key_total = 0;
+    
+    path_cursor_t cursor;
+    path_cursor_init(&cursor, &ix->blocks[b], key);
+    while (path_cursor_next(&cursor)) {
+        counts[(unsigned char)key[0]]++;
+        key_total += cursor.len;
+    }
+    int byte = 0;
+    for (int i = 1; i < 256; i++) {
+        if (counts[i] > counts[byte]) byte = i;
+    }
+    if (counts[byte] < 2) return PATH_INDEX_NONE;
+    
+    // The group is contiguous and sorted, so its common prefix is the
+    // shortest one any member shares with the first
+    size_t first_len = 0, common = 0;
+    path_cursor_init(&cursor, &ix->blocks[b], key);
+    while (path_cursor_next(&cursor)) {
+        if ((unsigned char)key[0] != byte) continue;
+        if (!first_len) {
+            memcpy(first, key, cursor.len);
+            first_len = common = cursor.len;
+        } else {
+            size_t shared = 0;
+            while (shared < common && shared < cursor.len && first[shared] == key[shared]) shared++;
+            common = shared;
+        }
+    }
+    
+    size_t reserve = key_total + 16 * (size_t)ix->blocks[b].count;
+    if (path_reserve(&ix->labels, &ix->labels_capacity, (size_t)ix->labels_len + common) != 0 ||
+        path_reserve(&ix->scratch, &ix->scratch_capacity, reserve) != 0) {
+        return PATH_INDEX_NONE;
+    }
+    uint32_t child = path_node_new(ix, node);
+    if (child == PATH_INDEX_NONE) return PATH_INDEX_NONE;
+    uint32_t child_block = path_block_new(ix, child);
+    if (child_block == PATH_INDEX_NONE ||
+        path_reserve(&ix->blocks[child_block].data, &ix->blocks[child_block].capacity, reserve) != 0) {
+        return PATH_INDEX_NONE;     // an empty child node costs nothing but space
+    }
+    memcpy(ix->labels + ix->labels_len, first, common);
+    ix->nodes[child].label_off = ix->labels_len;
+    ix->nodes[child].label_len = common;
+    ix->labels_len += common;
+    ix->nodes[child].sibling = ix->nodes[node].child;
+    ix->nodes[node].child = child;
+    
+    path_block_t *block = &ix->blocks[b];
+    path_block_t *moved = &ix->blocks[child_block];
+    char prev[MAX_PATH_LEN], moved_prev[MAX_PATH_LEN];
+    size_t prev_len = 0, moved_prev_len = 0;
+    uint32_t len = 0, count = 0;
+    path_cursor_init(&cursor, block, key);
+    while (path_cursor_next(&cursor)) {
+        if ((unsigned char)key[0] != byte) {
+            path_emit(ix->scratch, &len, prev, &prev_len, key, cursor.len, cursor.value);
+            count++;
+        } else if (cursor.len == common) {
+            ix->nodes[child].value = cursor.value;
+            ix->owners[cursor.value] = PATH_OWNER_NODE | child;
+        } else {
+            path_emit(moved->data, &moved->len, moved_prev, &moved_prev_len,
+                      key + common, cursor.len - common, cursor.value);
+            moved->count++;
+            ix->owners[cursor.value] = child_block;
+        }
+    }
+    
+    // Shrinking cannot fail in a way that matters: the old buffer stays
+    char *fitted = realloc(moved->data, moved->len + moved->len / 8 + 32);
+    if (fitted) {
+        moved->data = fitted;
+        moved->capacity = moved->len + moved->len / 8 + 32;
+    }
+    path_block_store(ix, b, len, count);     // no larger than before
+    return moved->count > PATH_BLOCK_MAX ? child : PATH_INDEX_NONE;
+}
+
+// Map key to value, replacing the value it had. Returns 0, or -1 when out
+// of memory or the key is too long.
+int path_index_put(path_index_t *ix, const char *key, size_t len, uint32_t value) {
+    if (len >= MAX_PATH_LEN || value >= PATH_OWNER_NODE) return -1;
+    if (!ix->nodes && path_node_new(ix, PATH_INDEX_NONE) == PATH_INDEX_NONE) return -1;
+    if (path_set_owner(ix, value, PATH_INDEX_NONE) != 0) return -1;
+    
+    uint32_t node = 0;
+    size_t pos = 0;
+    uint32_t old;
+    while (pos < len) {
+        uint32_t child = path_child(ix, node, key[pos]);
+        if (child == PATH_INDEX_NONE) break;
+        const char *label = ix->labels + ix->nodes[child].label_off;
+        uint32_t k = 0;
+        while (k < ix->nodes[child].label_len && pos + k < len && label[k] == key[pos + k]) k++;
+        if (k < ix->nodes[child].label_len) {
+            child = path_split(ix, child, k);
+            if (child == PATH_INDEX_NONE) return -1;
+        }
+        node = child;
+        pos += k;
+    }
+    
+    if (pos == len) {
+        old = ix->nodes[node].value;
+        ix->nodes[node].value = value;
+        ix->owners[value] = PATH_OWNER_NODE | node;
+    } else {
+        uint32_t b = ix->nodes[node].block;
+        if (b == PATH_INDEX_NONE) {
+            b = path_block_new(ix, node);
+            if (b == PATH_INDEX_NONE) return -1;
+        }
+        if (path_block_rewrite(ix, b, key + pos, len - pos, value, &old) != 0) return -1;
+        ix->owners[value] = b;
+        while (node != PATH_INDEX_NONE && ix->blocks[ix->nodes[node].block].count > PATH_BLOCK_MAX) {
+            node = path_burst(ix, node);
+        }
+    }
+    
+    if (old == PATH_INDEX_NONE) {
+        ix->count++;
+        ix->key_bytes += len;
+    } else if (old != value) {
+        ix->owners[old] = PATH_INDEX_NONE;
+    }
+    return 0;
+}
+
+// Node whose path is key, or the node whose block would hold key (with
+// *pos at the first byte not covered by labels)
+static uint32_t path_descend(const path_index_t *ix, const char *key, size_t len, size_t *pos) {
+    uint32_t node = 0;
+    *pos = 0;
+    while (*pos < len) {
+        uint32_t child = path_child(ix, node, key[*pos]);
+        if (child == PATH_INDEX_NONE) break;
+        const path_node_t *next = &ix->nodes[child];
+        if (next->label_len > len - *pos ||
+            memcmp(ix->labels + next->label_off, key + *pos, next->label_len) != 0) {
+            return PATH_INDEX_NONE;
+        }
+        *pos += next->label_len;
+        node = child;
+    }
+    return node;
+}
+
+// Value of key in a block, searched without decoding: match is the prefix
+// the last (smaller) entry shares with key, and an entry repeating more
+// of the previous one than that is still smaller, one repeating less is
+// already past key
+static uint32_t path_block_find(const path_block_t *block, const char *key, size_t len) {
+    const char *p = block->data;
+    const char *end = block->len ? block->data + block->len : block->data;
+    size_t match = 0;
+    while (p < end) {
+        uint32_t shared = path_varint_get(&p);
+        uint32_t rest = path_varint_get(&p);
+        const char *bytes = p;
+        p += rest + sizeof(uint32_t);
+        if (shared > match) continue;
+        if (shared < match) break;
+        
+        size_t i = 0;
+        while (i < rest && match + i < len && bytes[i] == key[match + i]) i++;
+        if (i == rest && match + i == len) {
+            uint32_t value;
+            memcpy(&value, bytes + rest, sizeof(uint32_t));
+            return value;
+        }
+        if (match + i == len) break;
+        if (i < rest && (unsigned char)bytes[i] > (unsigned char)key[match + i]) break;
+        match += i;
+    }
+    return PATH_INDEX_NONE;
+}
+
+uint32_t path_index_get(const path_index_t *ix, const char *key, size_t len) {
+    if (!ix->nodes || len >= MAX_PATH_LEN) return PATH_INDEX_NONE;
+    size_t pos;
+    uint32_t node = path_descend(ix, key, len, &pos);
+    if (node == PATH_INDEX_NONE) return PATH_INDEX_NONE;
+    if (pos == len) return ix->nodes[node].value;
+    
+    uint32_t b = ix->nodes[node].block;
+    if (b == PATH_INDEX_NONE) return PATH_INDEX_NONE;
+    return path_block_find(&ix->blocks[b], key + pos, len - pos);
+}
+
+// Remove key; returns the value it had, or PATH_INDEX_NONE
+uint32_t path_index_remove(path_index_t *ix, const char *key, size_t len) {
+    if (!ix->nodes || len >= MAX_PATH_LEN) return PATH_INDEX_NONE;
+    size_t pos;
+    uint32_t node = path_descend(ix, key, len, &pos);
+    if (node == PATH_INDEX_NONE) return PATH_INDEX_NONE;
+    
+    uint32_t old = PATH_INDEX_NONE;
+    if (pos == len) {
+        old = ix->nodes[node].value;
+        ix->nodes[node].value = PATH_INDEX_NONE;
+    } else if (ix->nodes[node].block != PATH_INDEX_NONE &&
+               path_block_rewrite(ix, ix->nodes[node].block, key + pos, len - pos,
+                                  PATH_INDEX_NONE, &old) != 0) {
+        return PATH_INDEX_NONE;
+    }
+    if (old != PATH_INDEX_NONE) {
+        ix->owners[old] = PATH_INDEX_NONE;
+        ix->count--;
+        ix->key_bytes -= len;
+    }
+    return old;
+}
+
+// Write the key of value into out (MAX_PATH_LEN bytes). Returns its
+// length, 0 when value has no key.
+size_t path_index_key(const path_index_t *ix, uint32_t value, char *out) {
+    if (value >= ix->owner_capacity || ix->owners[value] == PATH_INDEX_NONE) return 0;
+    uint32_t owner = ix->owners[value];
+    uint32_t node = owner & PATH_OWNER_NODE ? owner & ~PATH_OWNER_NODE : ix->blocks[owner].node;
+    
+    size_t depth = 0;
+    for (uint32_t n = node; n != 0; n = ix->nodes[n].parent) depth += ix->nodes[n].label_len;
+    size_t pos = depth;
+    for (uint32_t n = node; n != 0; n = ix->nodes[n].parent) {
+        pos -= ix->nodes[n].label_len;
+        memcpy(out + pos, ix->labels + ix->nodes[n].label_off, ix->nodes[n].label_len);
+    }
+    
+    size_t len = depth;
+    if (!(owner & PATH_OWNER_NODE)) {
+        path_cursor_t cursor;
+        path_cursor_init(&cursor, &ix->blocks[owner], out + depth);
+        while (path_cursor_next(&cursor) && cursor.value != value) { }
+        if (cursor.value != value) return 0;
+        len += cursor.len;
+    }
+    out[len] = '\0';
+    return len;
+}
+
+static int path_boundary(const char *key, size_t len, size_t pos) {
+    return pos == len || key[pos] == '/' || (pos > 0 && key[pos - 1] == '/');
+}
+
+// Value of the longest stored key that is a prefix of key ending on a
+// path component boundary, or PATH_INDEX_NONE
+uint32_t path_index_longest(const path_index_t *ix, const char *key, size_t len) {
+    if (!ix->nodes) return PATH_INDEX_NONE;
+    uint32_t best = PATH_INDEX_NONE;
+    uint32_t node = 0;
+    size_t pos = 0;
+    char cur[MAX_PATH_LEN];
+    for (;;) {
+        if (ix->nodes[node].value != PATH_INDEX_NONE && path_boundary(key, len, pos)) {
+            best = ix->nodes[node].value;
+        }
+        if (pos == len) break;
+        
+        uint32_t child = path_child(ix, node, key[pos]);
+        if (child == PATH_INDEX_NONE) {
+            // Only the block can hold a longer match; sorted, so the last one wins
+            uint32_t b = ix->nodes[node].block;
+            if (b == PATH_INDEX_NONE) break;
+            path_cursor_t cursor;
+            path_cursor_init(&cursor, &ix->blocks[b], cur);
+            while (path_cursor_next(&cursor)) {
+                if (cursor.len <= len - pos && memcmp(cur, key + pos, cursor.len) == 0 &&
+                    path_boundary(key, len, pos + cursor.len)) {
+                    best = cursor.value;
+                }
+            }
+            break;
+        }
+        const path_node_t *next = &ix->nodes[child];
+        if (next->label_len > len - pos ||
+            memcmp(ix->labels + next->label_off, key + pos, next->label_len) != 0) {
+            break;
+        }
+        pos += next->label_len;
+        node = child;
+    }
+    return best;
+}
+
+typedef struct {
+    path_index_visit_t visit;
+    void *arg;
+    size_t prefix_len;
+    char path[MAX_PATH_LEN];
+} path_walk_t;
+
+static int path_walk_emit(path_walk_t *walk, size_t len, uint32_t value) {
+    if (len < walk->prefix_len ||
+        (walk->prefix_len && !path_boundary(walk->path, len, walk->prefix_len))) {
+        return 0;
+    }
+    walk->path[len] = '\0';
+    return walk->visit(walk->path, len, value, walk->arg);
+}
+
+// Visit every key below node, whose own path is walk->path[0, depth)
+static int path_walk(const path_index_t *ix, path_walk_t *walk, uint32_t node, size_t depth) {
+    const path_node_t *n = &ix->nodes[node];
+    if (n->value != PATH_INDEX_NONE && path_walk_emit(walk, depth, n->value)) return 1;
+    if (n->block != PATH_INDEX_NONE) {
+        path_cursor_t cursor;
+        path_cursor_init(&cursor, &ix->blocks[n->block], walk->path + depth);
+        while (path_cursor_next(&cursor)) {
+            if (path_walk_emit(walk, depth + cursor.len, cursor.value)) return 1;
+        }
+    }
+    for (uint32_t child = n->child; child != PATH_INDEX_NONE; child = ix->nodes[child].sibling) {
+        memcpy(walk->path + depth, ix->labels + ix->nodes[child].label_off, ix->nodes[child].label_len);
+        if (path_walk(ix, walk, child, depth + ix->nodes[child].label_len)) return 1;
+    }
+    return 0;
+}
+
+// Visit every key equal to prefix or below it (at a component boundary)
+// until visit returns non-zero. Keys come out grouped by subtree, not sorted.
+void path_index_each(const path_index_t *ix, const char *prefix, size_t prefix_len,
+                     path_index_visit_t visit, void *arg) {
+    if (!ix->nodes || prefix_len >= MAX_PATH_LEN) return;
+    path_walk_t walk;
+    walk.visit = visit;
+    walk.arg = arg;
+    walk.prefix_len = prefix_len;
+    memcpy(walk.path, prefix, prefix_len);
+    
+    uint32_t node = 0;
+    size_t pos = 0;
+    while (pos < prefix_len) {
+        uint32_t child = path_child(ix, node, prefix[pos]);
+        if (child == PATH_INDEX_NONE) {
+            // Matching keys can only be in this node's block
+            uint32_t b = ix->nodes[node].block;
+            if (b == PATH_INDEX_NONE) return;
+            path_cursor_t cursor;
+            path_cursor_init(&cursor, &ix->blocks[b], walk.path + pos);
+            while (path_cursor_next(&cursor)) {
+                if (memcmp(walk.path, prefix, prefix_len < pos + cursor.len ? prefix_len : pos + cursor.len) == 0 &&
+                    path_walk_emit(&walk, pos + cursor.len, cursor.value)) {
+                    return;
+                }
+            }
+            return;
+        }
+        const path_node_t *next = &ix->nodes[child];
+        const char *label = ix->labels + next->label_off;
+        size_t k = 0;
+        while (k < next->label_len && pos + k < prefix_len && label[k] == prefix[pos + k]) k++;
+        if (k < next->label_len && pos + k < prefix_len) return;
+        memcpy(walk.path + pos, label, next->label_len);
+        pos += next->label_len;
+        node = child;
+    }
+    path_walk(ix, &walk, node, pos);
+}
+
+// Bytes held by the index
+size_t path_index_memory(const path_index_t *ix) {
+    size_t bytes = (size_t)ix->node_capacity * sizeof(path_node_t) +
+                   (size_t)ix->block_capacity * sizeof(path_block_t) +
+                   ix->labels_capacity + (size_t)ix->owner_capacity * sizeof(uint32_t) +
+                   ix->scratch_capacity;
+    for (uint32_t b = 0; b < ix->block_count; b++) bytes += ix->blocks[b].capacity;
+    return bytes;
+}
+
+void path_index_free(path_index_t *ix) {
+    for (uint32_t b = 0; b < ix->block_count; b++) free(ix->blocks[b].data);
+    free(ix->nodes);
+    free(ix->blocks);
+    free(ix->labels);
+    free(ix->owners);
+    free(ix->scratch);
+    memset(ix, 0, sizeof(*ix));
+}
+
+// Path of a watch slot (entry index in enhanced mode), decoded from
+// watch_index. Consecutive events mostly come from one directory, so the
+// last path stays decoded. Caller holds watch_lock.
+const char *watch_path(uint32_t slot, size_t *len) {
+    static char path[MAX_PATH_LEN];
+    static uint32_t cached_slot = PATH_INDEX_NONE;
+    static size_t cached_len = 0;
+    if (slot != cached_slot) {
+        cached_len = path_index_key(&watch_index, slot, path);
+        cached_slot = cached_len ? slot : PATH_INDEX_NONE;
+    }
+    *len = cached_len;
+    return cached_len ? path : NULL;
+}
+
+// ===== SUBTREE POLICIES =====
+
+// Per-prefix overrides of what is reported and how, e.g.
+//   policy=/srv/config hash=on
+//   policy=/srv/cache mask=create,delete
+//   policy=/srv/tmp ignore
+// Prefixes go into a path index and the longest prefix ending on a path
+// component wins. A directory is resolved once, when its watch is added,
+// and events only follow the pointer stored with the watch. Paths are
+// matched lexically after making them absolute; symlinks are not resolved.
+
+static monitor_policy_t default_policy = {
+    .mask = POLICY_MASK_ALL, .extension_count = -1, .sinks = POLICY_SINK_ALL
+};
+static path_index_t policy_index;          // normalised prefix -> policies[] index
+static char policy_cwd[MAX_PATH_LEN];
+static size_t policy_cwd_len = 0;
+
+// Lexically normalise path into an absolute "/a/b" form (no trailing slash,
+// no "." or ".." components). Returns the length, 0 if it does not fit.
+static size_t policy_normalize(const char *path, char *out, size_t out_size) {
+    size_t len = 0;
+    if (path[0] != '/') {
+        if (policy_cwd_len >= out_size) return 0;
+        memcpy(out, policy_cwd, policy_cwd_len);
+        len = policy_cwd_len;
+        if (len == 1) len = 0;      // cwd is "/"
+    }
+    
+    const char *p = path;
+    while (*p) {
+        while (*p == '/') p++;
+        const char *end = p;
+        while (*end && *end != '/') end++;
+        size_t comp_len = end - p;
+        
+        if (comp_len == 0 || (comp_len == 1 && p[0] == '.')) {
+            // skip
+        } else if (comp_len == 2 && p[0] == '.' && p[1] == '.') {
+            while (len > 0 && out[len - 1] != '/') len--;
+            if (len > 0) len--;
+        } else {
+            if (len + 1 + comp_len >= out_size) return 0;
+            out[len++] = '/';
+            memcpy(out + len, p, comp_len);
+            len += comp_len;
+        }
+        p = end;
+    }
+    
+    if (len == 0) out[len++] = '/';
+    out[len] = '\0';
+    return len;
+}
+
+// Parse one "policy=<prefix> key=value ..." line. A line that cannot be
+// applied exactly as written is rejected, like an invalid filter=, rather
+// than leaving a subtree with a mask or extension list nobody asked for.
+int policy_add(char *spec) {
+    char msg[MAX_PATH_LEN + 128];
+    if (policy_count == POLICY_MAX) {
+        snprintf(msg, sizeof(msg), "[ERROR] More than %d subtree policies: %s", POLICY_MAX, spec);
+        log_event(msg);
+        return -1;
+    }
+    if (!policy_cwd_len && getcwd(policy_cwd, sizeof(policy_cwd))) {
+        policy_cwd_len = strlen(policy_cwd);
+    }
+    
+    char *save = NULL;
+    char *token = strtok_r(spec, " \t", &save);
+    if (!token) {
+        log_event("[ERROR] policy= needs a path prefix");
+        return -1;
+    }
+    
+    monitor_policy_t *policy = &policies[policy_count];
+    memset(policy, 0, sizeof(*policy));
+    policy->prefix_len = policy_normalize(token, policy->prefix, sizeof(policy->prefix));
+    if (policy->prefix_len == 0) {
+        snprintf(msg, sizeof(msg), "[ERROR] Policy prefix too long: %s", token);
+        log_event(msg);
+        return -1;
+    }
+    policy->mask = POLICY_MASK_ALL;
+    policy->extension_count = -1;
+    policy->sinks = POLICY_SINK_ALL;
+    
+    while ((token = strtok_r(NULL, " \t", &save)) != NULL) {
+        char *value = strchr(token, '=');
+        if (value) *value++ = '\0';
+        
+        if (strcmp(token, "ignore") == 0) {
+            policy->ignore = !value || strcmp(value, "true") == 0 || strcmp(value, "yes") == 0;
+        } else if (value && strcmp(token, "hash") == 0) {
+            policy->hash = (strcmp(value, "on") == 0 || strcmp(value, "true") == 0) ?
+                           POLICY_HASH_ON : POLICY_HASH_OFF;
+        } else if (value && strcmp(token, "rate") == 0) {
+            policy->rate = strtoul(value, NULL, 10);
+            policy->tokens = policy->rate;
+        } else if (value && strcmp(token, "mask") == 0) {
+            static const struct { const char *name; uint32_t bits; } names[] = {
+                {"create", IN_CREATE}, {"delete", IN_DELETE}, {"modify", IN_MODIFY},
+                {"move", IN_MOVE}, {"attrib", IN_ATTRIB}, {"open", IN_OPEN},
+                {"close", IN_CLOSE}, {"access", IN_ACCESS}, {"all", POLICY_MASK_ALL}
+            };
+            policy->mask = 0;
+            char *item_save = NULL;
+            for (char *item = strtok_r(value, ",", &item_save); item; item = strtok_r(NULL, ",", &item_save)) {
+                size_t i = 0;
+                while (i < sizeof(names) / sizeof(names[0]) && strcmp(item, names[i].name) != 0) i++;
+                if (i == sizeof(names) / sizeof(names[0])) {
+                    snprintf(msg, sizeof(msg), "[ERROR] Unknown policy mask '%s' for %s", item, policy->prefix);
+                    log_event(msg);
+                    return -1;
+                }
+                policy->mask |= names[i].bits;
+            }
+        } else if (value && strcmp(token, "ext") == 0) {
+            policy->extension_count = 0;
+            if (strcmp(value, "*") != 0) {
+                if (strlen(value) >= sizeof(policy->extension_data)) {
+                    snprintf(msg, sizeof(msg), "[ERROR] Policy extension list for %s exceeds %zu bytes",
+                             policy->prefix, sizeof(policy->extension_data) - 1);
+                    log_event(msg);
+                    return -1;
+                }
+                strcpy(policy->extension_data, value);
+                char *item_save = NULL;
+                for (char *item = strtok_r(policy->extension_data, ",", &item_save); item;
+                     item = strtok_r(NULL, ",", &item_save)) {
+                    if (policy->extension_count == POLICY_MAX_EXTENSIONS) {
+                        snprintf(msg, sizeof(msg), "[ERROR] More than %d policy extensions for %s",
+                                 POLICY_MAX_EXTENSIONS, policy->prefix);
+                        log_event(msg);
+                        return -1;
+                    }
+                    policy->extensions[policy->extension_count++] = item;
+                }
+            }
+        } else if (value && strcmp(token, "sink") == 0) {
+            policy->sinks = 0;
+            if (strstr(value, "log")) policy->sinks |= POLICY_SINK_LOG;
+            if (strstr(value, "replica")) policy->sinks |= POLICY_SINK_REPLICA;
+            if (strcmp(value, "all") == 0) policy->sinks = POLICY_SINK_ALL;
+        } else {
+            snprintf(msg, sizeof(msg), "[WARN] Unknown policy option: %s", token);
+            log_event(msg);
+        }
+    }
+    
+    policy_count++;
+    return 0;
+}
+
+// Index the prefixes once every policy is known
+int policy_compile() {
+    path_index_free(&policy_index);
+    for (int i = 0; i < policy_count; i++) {
+        if (path_index_put(&policy_index, policies[i].prefix, policies[i].prefix_len, i) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Policy for a directory: the longest configured prefix that ends on a
+// component boundary of its absolute path
+monitor_policy_t *policy_lookup(const char *dir_path) {
+    if (policy_index.count == 0) return &default_policy;
+    
+    char path[MAX_PATH_LEN];
+    size_t len = policy_normalize(dir_path, path, sizeof(path));
+    if (len == 0) return &default_policy;
+    
+    uint32_t best = path_index_longest(&policy_index, path, len);
+    return best != PATH_INDEX_NONE ? &policies[best] : &default_policy;
+}
+
+// Extension filter of a policy, falling back to the global list
+int policy_accepts(const monitor_policy_t *policy, const char *filename) {
+    if (policy->extension_count < 0) return should_monitor_file(filename);
+    if (policy->extension_count == 0) return 1;
+    
+    const char *ext = strrchr(filename, '.');
+    if (!ext) return 0;
+    ext++;
+    for (int i = 0; i < policy->extension_count; i++) {
+        if (strcmp(ext, policy->extensions[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+// Token bucket refilled at policy->rate per second, holding at most one
+// second's worth. Only the event thread draws from it.
+static int policy_take_token(monitor_policy_t *policy) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    int64_t now_ns = (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+    
+    policy->tokens += (double)(now_ns - policy->refill_ns) * policy->rate / 1e9;
+    if (policy->tokens > policy->rate) policy->tokens = policy->rate;
+    policy->refill_ns = now_ns;
+    if (policy->tokens < 1.0) return 0;
+    policy->tokens -= 1.0;
+    return 1;
+}
+
+static int event_type_index(uint32_t mask) {
+    if (mask & IN_CREATE) return EVENT_TYPE_CREATE;
+    if (mask & IN_DELETE) return EVENT_TYPE_DELETE;
+    if (mask & IN_MODIFY) return EVENT_TYPE_MODIFY;
+    if (mask & IN_MOVED_FROM) return EVENT_TYPE_MOVED_FROM;
+    if (mask & IN_MOVED_TO) return EVENT_TYPE_MOVED_TO;
+    if (mask & IN_ATTRIB) return EVENT_TYPE_ATTRIB;
+    if (mask & IN_OPEN) return EVENT_TYPE_OPEN;
+    if (mask & IN_CLOSE) return EVENT_TYPE_CLOSE;
+    if (mask & IN_ACCESS) return EVENT_TYPE_ACCESS;
+    return EVENT_TYPE_OTHER;
+}
+
+// Whether the watch's mask and the filter let an event through. Handlers
+// that do extra work per event (hashing) ask first and then emit with
+// policy_emit_wanted().
+int policy_wants(const monitor_policy_t *policy, uint32_t mask, const char *path, size_t path_len) {
+    if (!(mask & policy->mask)) return 0;
+    return !filter_len || filter_match(mask, path, path_len);
+}
+
+// emit_event() for a handler: applies the watch's mask, rate limit, event
+// sampling and sinks
+void policy_emit(monitor_policy_t *policy, uint32_t mask, const char *label,
+                 const char *path, size_t path_len) {
+    if (!policy_wants(policy, mask, path, path_len)) return;
+    policy_emit_wanted(policy, mask, label, path, path_len);
+}
+
+// policy_emit() for an event that already passed policy_wants()
+void policy_emit_wanted(monitor_policy_t *policy, uint32_t mask, const char *label,
+                        const char *path, size_t path_len) {
+    if (policy->rate && !policy_take_token(policy)) {
+        policy->dropped++;
+        return;
+    }
+    policy_emit_sampled(policy, &event_time, mask, label, path, path_len);
+}
+
+// Count an event per type, apply its type's sampling and emit it to the
+// policy's sinks as read at time. Caller holds watch_lock.
+void policy_emit_sampled(monitor_policy_t *policy, const event_time_t *time, uint32_t mask,
+                         const char *label, const char *path, size_t path_len) {
+    int type = event_type_index(mask);
+    event_type_seen[type]++;
+    uint32_t rate = sample_rates[type];
+    char sampled_label[96];
+    if (rate > 1) {
+        if (++sample_phase[type] < rate) return;
+        sample_phase[type] = 0;
+        
+        // "Opened: " becomes "Opened [1/100]: "
+        size_t label_len = strlen(label);
+        if (label_len >= 2 && label_len < sizeof(sampled_label) - 16) {
+            memcpy(sampled_label, label, label_len - 2);
+            snprintf(sampled_label + label_len - 2, sizeof(sampled_label) - label_len + 2, " [1/%u]: ", rate);
+            label = sampled_label;
+        }
+    }
+    event_type_logged[type]++;
+    policy->events++;
+    emit_event_to(policy->sinks, time, mask, label, path, path_len);
+}
+
+void policy_cleanup() {
+    path_index_free(&policy_index);
+}
+
+// ===== EVENT FILTER =====
+
+// filter=<expression> reports only the events it matches, e.g.
+//   filter=size > 10MB and ext in {log, dat} and event is modify and path not under tmp/
+// The expression is parsed once into a small tree, the operands of every
+// and/or are reordered cheapest first, and the tree is flattened into
+// bytecode whose jumps short-circuit the rest of a chain. Event, name and
+// path checks only look at the event record; size and age need a stat()
+// of the path, made at most once per event and only when every cheaper
+// check has let the event through. Deleted files have no size or age.
+
+enum {
+    FILTER_OP_EVENT,        // mask & value
+    FILTER_OP_DIR,          // mask & IN_ISDIR
+    FILTER_OP_EXT,          // extension is one of strings [arg, arg + value)
+    FILTER_OP_NAME,         // name is one of strings [arg, arg + value)
+    FILTER_OP_UNDER,        // path at or below strings[arg]
+    FILTER_OP_NAME_GLOB,    // fnmatch(strings[arg], name)
+    FILTER_OP_PATH_GLOB,    // fnmatch(strings[arg], path)
+    FILTER_OP_SIZE,         // st_size <cmp> value
+    FILTER_OP_AGE,          // seconds since st_mtime <cmp> value
+    FILTER_OP_NOT,
+    FILTER_OP_JUMP_FALSE,
+    FILTER_OP_JUMP_TRUE,
+    FILTER_OP_END
+};
+
+enum { FILTER_CMP_EQ, FILTER_CMP_NE, FILTER_CMP_LT, FILTER_CMP_LE, FILTER_CMP_GT, FILTER_CMP_GE };
+
+enum { FILTER_NODE_LEAF, FILTER_NODE_NOT, FILTER_NODE_AND, FILTER_NODE_OR };
+
+typedef struct {
+    uint8_t op;
+    uint8_t cmp;
+    uint16_t arg;
+    uint32_t jump;
+    int64_t value;
+} filter_insn_t;
+
+typedef struct {
+    int kind;
+    filter_insn_t insn;     // FILTER_NODE_LEAF only
+    int child;              // first operand, -1 = none
+    int next;               // next operand of the parent, -1 = last
+    uint32_t cost;
+} filter_node_t;
+
+typedef struct {
+    const char *src;
+    const char *pos;
+    const char *tok_start;
+    char tok[256];
+    int tok_quoted;
+    const char *error;
+} filter_parser_t;
+
+static filter_insn_t filter_code[FILTER_MAX_NODES * 2 + 1];
+static filter_node_t filter_nodes[FILTER_MAX_NODES];
+static int filter_node_count = 0;
+static struct { uint16_t off, len; } filter_strings[FILTER_MAX_STRINGS];
+static int filter_string_count = 0;
+static char filter_pool[FILTER_POOL_SIZE];
+static size_t filter_pool_len = 0;
+
+// Relative cost of each leaf; size and age pay for a stat()
+static uint32_t filter_op_cost(int op) {
+    switch (op) {
+        case FILTER_OP_EVENT:
+        case FILTER_OP_DIR:         return 1;
+        case FILTER_OP_EXT:
+        case FILTER_OP_NAME:        return 2;
+        case FILTER_OP_UNDER:       return 4;
+        case FILTER_OP_NAME_GLOB:
+        case FILTER_OP_PATH_GLOB:   return 8;
+        default:                    return 64;
+    }
+}
+
+static const struct {
+    const char *name;
+    uint32_t mask;
+} filter_event_names[] = {
+    { "create", IN_CREATE }, { "delete", IN_DELETE }, { "modify", IN_MODIFY },
+    { "move", IN_MOVE }, { "moved_from", IN_MOVED_FROM }, { "moved_to", IN_MOVED_TO },
+    { "attrib", IN_ATTRIB }, { "open", IN_OPEN }, { "close", IN_CLOSE },
+    { "close_write", IN_CLOSE_WRITE }, { "close_nowrite", IN_CLOSE_NOWRITE },
+    { "access", IN_ACCESS }
+};
+
+// Read the next token into p->tok: a word, a "quoted string" or one of
+// ( ) { } , == != = < <= > >=. An empty tok means end of input.
+static void filter_next(filter_parser_t *p) {
+    while (*p->pos == ' ' || *p->pos == '\t') p->pos++;
+    p->tok_start = p->pos;
+    p->tok_quoted = 0;
+    size_t len = 0;
+    
+    if (*p->pos == '"') {
+        p->pos++;
+        while (*p->pos && *p->pos != '"' && len < sizeof(p->tok) - 1) {
+            p->tok[len++] = *p->pos++;
+        }
+        if (*p->pos != '"') {
+            p->error = "unterminated string";
+        } else {
+            p->pos++;
+        }
+        p->tok_quoted = 1;
+    } else if (strchr("(){},", *p->pos) && *p->pos) {
+        p->tok[len++] = *p->pos++;
+    } else if (strchr("=!<>", *p->pos) && *p->pos) {
+        p->tok[len++] = *p->pos++;
+        if (*p->pos == '=') p->tok[len++] = *p->pos++;
+    } else {
+        while (*p->pos && !strchr(" \t(){},=!<>\"", *p->pos) && len < sizeof(p->tok) - 1) {
+            p->tok[len++] = *p->pos++;
+        }
+    }
+    p->tok[len] = '\0';
+}
+
+static int filter_is(filter_parser_t *p, const char *word) {
+    return !p->tok_quoted && strcasecmp(p->tok, word) == 0;
+}
+
+static int filter_node(filter_parser_t *p, int kind) {
+    if (filter_node_count >= FILTER_MAX_NODES) {
+        p->error = "expression too long";
+        return -1;
+    }
+    filter_node_t *node = &filter_nodes[filter_node_count];
+    memset(node, 0, sizeof(*node));
+    node->kind = kind;
+    node->child = -1;
+    node->next = -1;
+    return filter_node_count++;
+}
+
+static int filter_leaf(filter_parser_t *p, int op, int cmp, uint16_t arg, int64_t value) {
+    int n = filter_node(p, FILTER_NODE_LEAF);
+    if (n < 0) return -1;
+    filter_nodes[n].insn.op = op;
+    filter_nodes[n].insn.cmp = cmp;
+    filter_nodes[n].insn.arg = arg;
+    filter_nodes[n].insn.value = value;
+    filter_nodes[n].cost = filter_op_cost(op);
+    return n;
+}
+
+static int filter_negate(filter_parser_t *p, int n) {
+    if (n < 0) return -1;
+    int not_node = filter_node(p, FILTER_NODE_NOT);
+    if (not_node < 0) return -1;
+    filter_nodes[not_node].child = n;
+    filter_nodes[not_node].cost = filter_nodes[n].cost;
+    return not_node;
+}
+
+// Copy a NUL-terminated string into the pool; returns its index
+static int filter_string(filter_parser_t *p, const char *text, size_t len) {
+    if (filter_string_count >= FILTER_MAX_STRINGS || filter_pool_len + len + 1 > FILTER_POOL_SIZE) {
+        p->error = "too many strings";
+        return -1;
+    }
+    memcpy(filter_pool + filter_pool_len, text, len);
+    filter_pool[filter_pool_len + len] = '\0';
+    filter_strings[filter_string_count].off = filter_pool_len;
+    filter_strings[filter_string_count].len = len;
+    filter_pool_len += len + 1;
+    return filter_string_count++;
+}
+
+// The current token as a value of field (an extension loses its leading dot)
+static int filter_value_string(filter_parser_t *p, int op) {
+    const char *text = p->tok;
+    if (!text[0]) {
+        p->error = "missing value";
+        return -1;
+    }
+    if (op == FILTER_OP_EXT && text[0] == '.') text++;
+    return filter_string(p, text, strlen(text));
+}
+
+static uint32_t filter_event_mask(filter_parser_t *p) {
+    for (size_t i = 0; i < sizeof(filter_event_names) / sizeof(filter_event_names[0]); i++) {
+        if (filter_is(p, filter_event_names[i].name)) return filter_event_names[i].mask;
+    }
+    p->error = "unknown event";
+    return 0;
+}
+
+static int filter_cmp(filter_parser_t *p) {
+    if (p->tok_quoted) return -1;
+    if (strcmp(p->tok, "==") == 0 || strcmp(p->tok, "=") == 0) return FILTER_CMP_EQ;
+    if (strcmp(p->tok, "!=") == 0) return FILTER_CMP_NE;
+    if (strcmp(p->tok, "<") == 0) return FILTER_CMP_LT;
+    if (strcmp(p->tok, "<=") == 0) return FILTER_CMP_LE;
+    if (strcmp(p->tok, ">") == 0) return FILTER_CMP_GT;
+    if (strcmp(p->tok, ">=") == 0) return FILTER_CMP_GE;
+    return -1;
+}
+
+// "10MB", "10 MB", "512k" (1024-based) or "30m", "2h", "7d" for age.
+// Consumes the number and an optional separate unit word.
+static int64_t filter_number(filter_parser_t *p, int is_age) {
+    char *end;
+    errno = 0;
+    double value = strtod(p->tok, &end);
+    if (end == p->tok || errno || value < 0) {
+        p->error = "expected a number";
+        return 0;
+    }
+    char unit[16];
+    snprintf(unit, sizeof(unit), "%.15s", end);
+    filter_next(p);
+    if (!unit[0] && !p->tok_quoted && isalpha((unsigned char)p->tok[0]) &&
+        !filter_is(p, "and") && !filter_is(p, "or")) {
+        snprintf(unit, sizeof(unit), "%.15s", p->tok);
+        filter_next(p);
+    }
+    
+    double scale = 1;
+    if (is_age) {
+        if (!unit[0] || strcasecmp(unit, "s") == 0) scale = 1;
+        else if (strcasecmp(unit, "m") == 0) scale = 60;
+        else if (strcasecmp(unit, "h") == 0) scale = 3600;
+        else if (strcasecmp(unit, "d") == 0) scale = 86400;
+        else p->error = "unknown time unit";
+    } else {
+        if (!unit[0] || strcasecmp(unit, "b") == 0) scale = 1;
+        else if (strcasecmp(unit, "k") == 0 || strcasecmp(unit, "kb") == 0) scale = 1024.0;
+        else if (strcasecmp(unit, "m") == 0 || strcasecmp(unit, "mb") == 0) scale = 1024.0 * 1024;
+        else if (strcasecmp(unit, "g") == 0 || strcasecmp(unit, "gb") == 0) scale = 1024.0 * 1024 * 1024;
+        else p->error = "unknown size unit";
+    }
+    return (int64_t)(value * scale);
+}
+
+// is | is not | == | = | !=, leaving the value as the current token
+static int filter_is_equality(filter_parser_t *p, int *negate) {
+    *negate = 0;
+    if (filter_is(p, "is")) {
+        filter_next(p);
+        if (filter_is(p, "not")) {
+            *negate = 1;
+            filter_next(p);
+        }
+        return 0;
+    }
+    int cmp = filter_cmp(p);
+    if (cmp != FILTER_CMP_EQ && cmp != FILTER_CMP_NE) {
+        p->error = "expected is, ==, != or in";
+        return -1;
+    }
+    *negate = cmp == FILTER_CMP_NE;
+    filter_next(p);
+    return 0;
+}
+
+// ext/name: is|==|= VALUE, != VALUE, in {V, ...}; name also: matches GLOB
+static int filter_parse_strings(filter_parser_t *p, int op) {
+    int negate = 0;
+    if (op == FILTER_OP_NAME && filter_is(p, "matches")) {
+        filter_next(p);
+        int s = filter_value_string(p, op);
+        filter_next(p);
+        return s < 0 ? -1 : filter_leaf(p, FILTER_OP_NAME_GLOB, 0, s, 0);
+    }
+    if (filter_is(p, "in")) {
+        filter_next(p);
+        if (strcmp(p->tok, "{") != 0) {
+            p->error = "expected {";
+            return -1;
+        }
+        int first = filter_string_count;
+        for (;;) {
+            filter_next(p);
+            if (filter_value_string(p, op) < 0) return -1;
+            filter_next(p);
+            if (strcmp(p->tok, "}") == 0) break;
+            if (strcmp(p->tok, ",") != 0) {
+                p->error = "expected , or }";
+                return -1;
+            }
+        }
+        filter_next(p);
+        return filter_leaf(p, op, 0, first, filter_string_count - first);
+    }
+    
+    if (filter_is_equality(p, &negate) != 0) return -1;
+    int s = filter_value_string(p, op);
+    if (s < 0) return -1;
+    filter_next(p);
+    int n = filter_leaf(p, op, 0, s, 1);
+    return negate ? filter_negate(p, n) : n;
+}
+
+static int filter_parse_cond(filter_parser_t *p) {
+    if (filter_is(p, "dir")) {
+        filter_next(p);
+        return filter_leaf(p, FILTER_OP_DIR, 0, 0, 0);
+    }
+    
+    if (filter_is(p, "event")) {
+        filter_next(p);
+        int negate = 0;
+        uint32_t mask = 0;
+        if (filter_is(p, "in")) {
+            filter_next(p);
+            if (strcmp(p->tok, "{") != 0) {
+                p->error = "expected {";
+                return -1;
+            }
+            for (;;) {
+                filter_next(p);
+                mask |= filter_event_mask(p);
+                if (p->error) return -1;
+                filter_next(p);
+                if (strcmp(p->tok, "}") == 0) break;
+                if (strcmp(p->tok, ",") != 0) {
+                    p->error = "expected , or }";
+                    return -1;
+                }
+            }
+        } else {
+            if (filter_is_equality(p, &negate) != 0) return -1;
+            mask = filter_event_mask(p);
+            if (p->error) return -1;
+        }
+        filter_next(p);
+        int n = filter_leaf(p, FILTER_OP_EVENT, 0, 0, mask);
+        return negate ? filter_negate(p, n) : n;
+    }
+    
+    if (filter_is(p, "ext") || filter_is(p, "name")) {
+        int op = filter_is(p, "ext") ? FILTER_OP_EXT : FILTER_OP_NAME;
+        filter_next(p);
+        return filter_parse_strings(p, op);
+    }
+    
+    if (filter_is(p, "path")) {
+        filter_next(p);
+        int negate = 0;
+        if (filter_is(p, "not")) {
+            negate = 1;
+            filter_next(p);
+        }
+        int op;
+        if (filter_is(p, "under")) {
+            op = FILTER_OP_UNDER;
+        } else if (filter_is(p, "matches")) {
+            op = FILTER_OP_PATH_GLOB;
+        } else {
+            p->error = "expected under or matches";
+            return -1;
+        }
+        filter_next(p);
+        size_t len = strlen(p->tok);
+        if (op == FILTER_OP_UNDER) {
+            while (len > 1 && p->tok[len - 1] == '/') len--;
+        }
+        if (len == 0) {
+            p->error = "missing value";
+            return -1;
+        }
+        int s = filter_string(p, p->tok, len);
+        if (s < 0) return -1;
+        filter_next(p);
+        int n = filter_leaf(p, op, 0, s, 0);
+        return negate ? filter_negate(p, n) : n;
+    }
+    
+    if (filter_is(p, "size") || filter_is(p, "age")) {
+        int op = filter_is(p, "size") ? FILTER_OP_SIZE : FILTER_OP_AGE;
+        filter_next(p);
+        int cmp = filter_cmp(p);
+        if (cmp < 0) {
+            p->error = "expected a comparison";
+            return -1;
+        }
+        filter_next(p);
+        int64_t value = filter_number(p, op == FILTER_OP_AGE);
+        if (p->error) return -1;
+        return filter_leaf(p, op, cmp, 0, value);
+    }
+    
+    p->error = p->tok[0] ? "unknown field" : "unexpected end";
+    return -1;
+}
+
+static int filter_parse_or(filter_parser_t *p);
+
+static int filter_parse_not(filter_parser_t *p) {
+    if (filter_is(p, "not")) {
+        filter_next(p);
+        return filter_negate(p, filter_parse_not(p));
+    }
+    if (strcmp(p->tok, "(") == 0 && !p->tok_quoted) {
+        filter_next(p);
+        int n = filter_parse_or(p);
+        if (n < 0) return -1;
+        if (strcmp(p->tok, ")") != 0) {
+            p->error = "expected )";
+            return -1;
+        }
+        filter_next(p);
+        return n;
+    }
+    return filter_parse_cond(p);
+}
+
+// operand (WORD operand)*, collected under one node of kind
+static int filter_parse_chain(filter_parser_t *p, int kind, const char *word,
+                              int (*operand)(filter_parser_t *)) {
+    int first = operand(p);
+    if (first < 0 || !filter_is(p, word)) return first;
+    
+    int chain = filter_node(p, kind);
+    if (chain < 0) return -1;
+    filter_nodes[chain].child = first;
+    filter_nodes[chain].cost = filter_nodes[first].cost;
+    int last = first;
+    while (filter_is(p, word)) {
+        filter_next(p);
+        int n = operand(p);
+        if (n < 0) return -1;
+        filter_nodes[last].next = n;
+        filter_nodes[chain].cost += filter_nodes[n].cost;
+        last = n;
+    }
+    return chain;
+}
+
+static int filter_parse_and(filter_parser_t *p) {
+    return filter_parse_chain(p, FILTER_NODE_AND, "and", filter_parse_not);
+}
+
+static int filter_parse_or(filter_parser_t *p) {
+    return filter_parse_chain(p, FILTER_NODE_OR, "or", filter_parse_and);
+}
+
+static int filter_append(filter_insn_t insn) {
+    if (filter_len >= sizeof(filter_code) / sizeof(filter_code[0])) return -1;
+    filter_code[filter_len] = insn;
+    return filter_len++;
+}
+
+// Flatten the tree. The operands of and/or have no side effects, so they
+// are emitted cheapest first (a stable sort keeps the written order among
+// equals); each but the last is followed by a jump to the end of the chain
+// that is taken as soon as the outcome is known.
+static int filter_emit(int n) {
+    filter_node_t *node = &filter_nodes[n];
+    if (node->kind == FILTER_NODE_LEAF) {
+        return filter_append(node->insn) < 0 ? -1 : 0;
+    }
+    if (node->kind == FILTER_NODE_NOT) {
+        if (filter_emit(node->child) != 0) return -1;
+        filter_insn_t insn = { .op = FILTER_OP_NOT };
+        return filter_append(insn) < 0 ? -1 : 0;
+    }
+    
+    int sorted = -1;
+    while (node->child >= 0) {
+        int c = node->child;
+        node->child = filter_nodes[c].next;
+        int *link = &sorted;
+        while (*link >= 0 && filter_nodes[*link].cost <= filter_nodes[c].cost) {
+            link = &filter_nodes[*link].next;
+        }
+        filter_nodes[c].next = *link;
+        *link = c;
+    }
+    node->child = sorted;
+    
+    // Pending jumps are chained through their jump field until patched
+    uint32_t pending = UINT32_MAX;
+    for (int c = node->child; c >= 0; c = filter_nodes[c].next) {
+        if (filter_emit(c) != 0) return -1;
+        if (filter_nodes[c].next < 0) break;
+        filter_insn_t insn = {
+            .op = node->kind == FILTER_NODE_AND ? FILTER_OP_JUMP_FALSE : FILTER_OP_JUMP_TRUE,
+            .jump = pending
+        };
+        int at = filter_append(insn);
+        if (at < 0) return -1;
+        pending = at;
+    }
+    while (pending != UINT32_MAX) {
+        uint32_t next = filter_code[pending].jump;
+        filter_code[pending].jump = filter_len;
+        pending = next;
+    }
+    return 0;
+}
+
+// filter=<expression>; several lines are combined with "or". Lines that
+// no longer fit are rejected and make filter_compile() fail, rather than
+// leaving a truncated expression behind.
+void filter_add(const char *expression) {
+    size_t used = strlen(filter_source);
+    int n = snprintf(filter_source + used, sizeof(filter_source) - used,
+                     "%s(%s)", used ? " or " : "", expression);
+    if (n < 0 || (size_t)n >= sizeof(filter_source) - used) {
+        filter_source[used] = '\0';
+        filter_source_overflow = 1;
+        char msg[FILTER_MAX_SOURCE + 96];
+        snprintf(msg, sizeof(msg), "[ERROR] Filter expressions exceed %d bytes: %s",
+                 FILTER_MAX_SOURCE - 1, expression);
+        log_event(msg);
+    }
+}
+
+// Compile the --filter option, or else the filter= lines of the config
+int filter_compile() {
+    const char *source = filter_cli ? filter_cli : filter_source;
+    filter_len = 0;
+    filter_node_count = 0;
+    filter_string_count = 0;
+    filter_pool_len = 0;
+    if (!filter_cli && filter_source_overflow) {
+        fprintf(stderr, "Invalid filter: filter= lines exceed %d bytes\n", FILTER_MAX_SOURCE - 1);
+        return -1;
+    }
+    if (!source[0]) return 0;
+    
+    filter_parser_t p = { .src = source, .pos = source };
+    filter_next(&p);
+    int root = filter_parse_or(&p);
+    if (!p.error && root < 0) p.error = "syntax error";
+    if (!p.error && p.tok[0]) p.error = "unexpected token";
+    if (!p.error && filter_emit(root) != 0) p.error = "expression too long";
+    if (!p.error) {
+        filter_insn_t end = { .op = FILTER_OP_END };
+        if (filter_append(end) < 0) p.error = "expression too long";
+    }
+    if (p.error) {
+        char msg[MAX_PATH_LEN + 128];
+        snprintf(msg, sizeof(msg), "[CONFIG] Invalid filter (%s at column %d): %s",
+                 p.error, (int)(p.tok_start - source) + 1, source);
+        log_event(msg);
+        fprintf(stderr, "%s\n", msg + 9);
+        filter_len = 0;
+        return -1;
+    }
+    
+    char msg[MAX_PATH_LEN + 64];
+    snprintf(msg, sizeof(msg), "[CONFIG] Filter compiled to %u instructions: %s",
+             filter_len, source);
+    log_event(msg);
+    return 0;
+}
+
+static inline int filter_compare(int64_t a, int cmp, int64_t b) {
+    switch (cmp) {
+        case FILTER_CMP_EQ: return a == b;
+        case FILTER_CMP_NE: return a != b;
+        case FILTER_CMP_LT: return a < b;
+        case FILTER_CMP_LE: return a <= b;
+        case FILTER_CMP_GT: return a > b;
+        default:            return a >= b;
+    }
+}
+
+static inline int filter_string_in(uint16_t first, int64_t count, const char *text, size_t len) {
+    for (int64_t i = 0; i < count; i++) {
+        if (filter_strings[first + i].len == len &&
+            memcmp(filter_pool + filter_strings[first + i].off, text, len) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// A prefix starting with '/' must begin the path; any other prefix may
+// start at any component. Either must end on a component boundary.
+static inline int filter_under(const char *prefix, size_t prefix_len, const char *path, size_t path_len) {
+    for (size_t at = 0; at + prefix_len <= path_len; ) {
+        if (memcmp(path + at, prefix, prefix_len) == 0 &&
+            (at + prefix_len == path_len || path[at + prefix_len] == '/' || prefix[prefix_len - 1] == '/')) {
+            return 1;
+        }
+        if (prefix[0] == '/') return 0;
+        const char *slash = memchr(path + at, '/', path_len - at);
+        if (!slash) return 0;
+        at = slash - path + 1;
+    }
+    return 0;
+}
+
+// Run the compiled filter against one event. path is NUL-terminated.
+int filter_match(uint32_t mask, const char *path, size_t path_len) {
+    const char *name = memrchr(path, '/', path_len);
+    name = name ? name + 1 : path;
+    size_t name_len = path + path_len - name;
+    const char *ext = NULL;
+    size_t ext_len = 0;
+    int ext_known = 0;
+    struct stat st;
+    int stat_state = 0;     // 0 = not yet, 1 = valid, -1 = failed
+    int acc = 0;
+    
+    uint32_t pc = 0;
+    for (;;) {
+        const filter_insn_t *insn = &filter_code[pc++];
+        switch (insn->op) {
+            case FILTER_OP_EVENT:
+                acc = (mask & (uint32_t)insn->value) != 0;
+                break;
+            case FILTER_OP_DIR:
+                acc = (mask & IN_ISDIR) != 0;
+                break;
+            case FILTER_OP_EXT:
+                if (!ext_known) {
+                    ext = memrchr(name, '.', name_len);
+                    if (ext) {
+                        ext++;
+                        ext_len = name + name_len - ext;
+                    }
+                    ext_known = 1;
+                }
+                acc = ext && filter_string_in(insn->arg, insn->value, ext, ext_len);
+                break;
+            case FILTER_OP_NAME:
+                acc = filter_string_in(insn->arg, insn->value, name, name_len);
+                break;
+            case FILTER_OP_UNDER:
+                acc = filter_under(filter_pool + filter_strings[insn->arg].off,
+                                   filter_strings[insn->arg].len, path, path_len);
+                break;
+            case FILTER_OP_NAME_GLOB:
+                acc = fnmatch(filter_pool + filter_strings[insn->arg].off, name, 0) == 0;
+                break;
+            case FILTER_OP_PATH_GLOB:
+                acc = fnmatch(filter_pool + filter_strings[insn->arg].off, path, 0) == 0;
+                break;
+            case FILTER_OP_SIZE:
+            case FILTER_OP_AGE:
+                if (stat_state == 0) {
+                    stat_state = stat(path, &st) == 0 ? 1 : -1;
+                    stats.filter_stat_calls++;
+                }
+                if (stat_state < 0) {
+                    acc = 0;
+                } else if (insn->op == FILTER_OP_SIZE) {
+                    acc = filter_compare(st.st_size, insn->cmp, insn->value);
+                } else {
+                    acc = filter_compare(time(NULL) - st.st_mtime, insn->cmp, insn->value);
+                }
+                break;
+            case FILTER_OP_NOT:
+                acc = !acc;
+                break;
+            case FILTER_OP_JUMP_FALSE:
+                if (!acc) pc = insn->jump;
+                break;
+            case FILTER_OP_JUMP_TRUE:
+                if (acc) pc = insn->jump;
+                break;
+            default:
+                if (!acc) stats.filter_rejected++;
+                return acc;
+        }
+    }
+}
+
+// ===== BASIC MODE FUNCTIONS =====
+
+// Register a watch for path. *added is 0 when the directory was already
+// watched (inotify hands back the existing wd), so crawls can stop there.
+int add_watch_basic(const char *path, monitor_policy_t *policy, int *added) {
+    *added = 0;
+    uint32_t self_outputs = self_output_mask(path);
+    
+    pthread_mutex_lock(&watch_lock);
+    if (!running) {
+        pthread_mutex_unlock(&watch_lock);
+        return -1;
+    }
+    if (watch_count >= 1024) {
+        pthread_mutex_unlock(&watch_lock);
+        log_event("[ERROR] Maximum watch limit reached (basic mode)");
+        return -1;
+    }
+    
+    int wd = inotify_add_watch(inotify_fd, path,
+                              IN_CREATE | IN_DELETE | IN_MODIFY | 
+                              IN_MOVE | IN_ATTRIB | IN_OPEN | IN_CLOSE |
+                              (access_events ? IN_ACCESS : 0));
+    
+    if (wd == -1) {
+        pthread_mutex_unlock(&watch_lock);
+        char error_msg[512];
+        snprintf(error_msg, sizeof(error_msg),
+                "[ERROR] Failed to add watch for %s: %s", path, strerror(errno));
+        log_event(error_msg);
+        return -1;
+    }
+    
+    for (int i = 0; i < watch_count; i++) {
+        if (watch_descriptors[i] == wd) {
+            pthread_mutex_unlock(&watch_lock);
+            return wd;
+        }
+    }
+    
+    if (path_index_put(&watch_index, path, strlen(path), watch_count) != 0) {
+        inotify_rm_watch(inotify_fd, wd);
+        pthread_mutex_unlock(&watch_lock);
+        log_event("[ERROR] Failed to record watch path");
+        return -1;
+    }
+    watch_descriptors[watch_count] = wd;
+    watch_self_outputs[watch_count] = self_outputs;
+    watch_policies[watch_count] = policy;
+    watch_count++;
+    pthread_mutex_unlock(&watch_lock);
+    *added = 1;
+    
+    char success_msg[512];
+    snprintf(success_msg, sizeof(success_msg), "[WATCH] Added: %s (wd: %d)", path, wd);
+    log_event(success_msg);
+    
+    return wd;
+}
+
+int add_watch_recursive_basic(const char *path) {
+    struct stat path_stat;
+    if (stat(path, &path_stat) != 0) {
+        char error_msg[512];
+        snprintf(error_msg, sizeof(error_msg), "[ERROR] Cannot stat path: %s", path);
+        log_event(error_msg);
+        return -1;
+    }
+    
+    if (!S_ISDIR(path_stat.st_mode)) {
+        log_event("[ERROR] Path is not a directory");
+        return -1;
+    }
+    
+    return crawl_directory(path, 0, 0);
+}
+
+void handle_event_basic(struct inotify_event *event, const char *watch_path, size_t watch_path_len) {
+    stats.total_events++;
+    
+    if (event->len > 0) {
+        if (!policy_accepts(event_policy, event->name)) {
+            return;
+        }
+        
+        size_t path_len = build_event_path(watch_path, watch_path_len, event->name, event->len);
+        const char *full_path = event_path;
+        
+        if (disk_usage) {
+            usage_event(event->mask, full_path, path_len);
+        }
+        if (event->mask & IN_CREATE) {
+            policy_emit(event_policy, IN_CREATE | (event->mask & IN_ISDIR), "Created: ", full_path, path_len);
+            
+            if (event->mask & IN_ISDIR && recursive_mode) {
+                crawl_submit(full_path, path_len);
+            }
+        }
+        if (event->mask & IN_DELETE) {
+            policy_emit(event_policy, IN_DELETE | (event->mask & IN_ISDIR), "Deleted: ", full_path, path_len);
+        }
+        if ((event->mask & IN_MODIFY) && (event_policy->mask & IN_MODIFY)) {
+            if (event_policy->hash != POLICY_HASH_ON) {
+                policy_emit(event_policy, IN_MODIFY | (event->mask & IN_ISDIR), "Modified: ", full_path, path_len);
+            } else if (policy_wants(event_policy, IN_MODIFY | (event->mask & IN_ISDIR), full_path, path_len) &&
+                       check_file_changed(full_path)) {
+                policy_emit_wanted(event_policy, IN_MODIFY | (event->mask & IN_ISDIR), "Modified (checksum changed): ", full_path, path_len);
+            }
+        }
+        if (event->mask & IN_MOVED_FROM) {
+            policy_emit(event_policy, IN_MOVED_FROM | (event->mask & IN_ISDIR), "Moved from: ", full_path, path_len);
+        }
+        if (event->mask & IN_MOVED_TO) {
+            policy_emit(event_policy, IN_MOVED_TO | (event->mask & IN_ISDIR), "Moved to: ", full_path, path_len);
+        }
+        if (event->mask & IN_OPEN) {
+            policy_emit(event_policy, IN_OPEN | (event->mask & IN_ISDIR), "Opened: ", full_path, path_len);
+        }
+        if (event->mask & IN_CLOSE) {
+            policy_emit(event_policy, IN_CLOSE | (event->mask & IN_ISDIR), "Closed: ", full_path, path_len);
+        }
+        if (event->mask & IN_ACCESS) {
+            policy_emit(event_policy, IN_ACCESS | (event->mask & IN_ISDIR), "Accessed: ", full_path, path_len);
+        }
+    }
+}
+
+// ===== ENHANCED MODE FUNCTIONS =====
+
+int init_watch_manager() {
+    watch_manager.capacity = INITIAL_WATCH_CAPACITY;
+    watch_manager.count = 0;
+    watch_manager.entries = malloc(sizeof(watch_entry_t) * watch_manager.capacity);
+    
+    if (!watch_manager.entries) {
+        log_event("[ERROR] Failed to allocate watch manager memory");
+        return -1;
+    }
+    
+    if (pthread_mutex_init(&watch_manager.mutex, NULL) != 0) {
+        log_event("[ERROR] Failed to initialize watch manager mutex");
+        free(watch_manager.entries);
+        return -1;
+    }
+    
+    log_event("[INFO] Watch manager initialized");
+    return 0;
+}
+
+void cleanup_watch_manager() {
+    if (watch_manager.entries) {
+        pthread_mutex_lock(&watch_manager.mutex);
+        free(watch_manager.entries);
+        free(watch_manager.wd_index);
+        watch_manager.entries = NULL;
+        watch_manager.wd_index = NULL;
+        watch_manager.count = 0;
+        watch_manager.capacity = 0;
+        watch_manager.wd_index_capacity = 0;
+        pthread_mutex_unlock(&watch_manager.mutex);
+        pthread_mutex_destroy(&watch_manager.mutex);
+    }
+}
+
+int add_watch_dynamic(const char *path, monitor_policy_t *policy, int *added) {
+    *added = 0;
+    uint32_t self_outputs = self_output_mask(path);
+    
+    pthread_mutex_lock(&watch_lock);
+    if (!running) {
+        pthread_mutex_unlock(&watch_lock);
+        return -1;
+    }
+    pthread_mutex_lock(&watch_manager.mutex);
+    
+    if (watch_manager.count >= watch_manager.capacity) {
+        size_t new_capacity = watch_manager.capacity * WATCH_GROWTH_FACTOR;
+        watch_entry_t *new_entries = realloc(watch_manager.entries,
+                                           sizeof(watch_entry_t) * new_capacity);
+        
+        if (!new_entries) {
+            pthread_mutex_unlock(&watch_manager.mutex);
+            pthread_mutex_unlock(&watch_lock);
+            log_event("[ERROR] Failed to expand watch manager capacity");
+            stats.watch_limit_hits++;
+            return -1;
+        }
+        
+        watch_manager.entries = new_entries;
+        watch_manager.capacity = new_capacity;
+        stats.memory_reallocations++;
+        
+        char msg[256];
+        snprintf(msg, sizeof(msg), "[INFO] Watch manager expanded to %zu entries",
+                new_capacity);
+        log_event(msg);
+    }
+    
+    int wd = inotify_add_watch(inotify_fd, path,
+                              IN_CREATE | IN_DELETE | IN_MODIFY |
+                              IN_MOVE | IN_ATTRIB | IN_OPEN | IN_CLOSE |
+                              (access_events ? IN_ACCESS : 0));
+    
+    if (wd == -1) {
+        pthread_mutex_unlock(&watch_manager.mutex);
+        pthread_mutex_unlock(&watch_lock);
+        char error_msg[512];
+        snprintf(error_msg, sizeof(error_msg),
+                "[ERROR] Failed to add watch for %s: %s", path, strerror(errno));
+        log_event(error_msg);
+        return -1;
+    }
+    
+    if ((size_t)wd < watch_manager.wd_index_capacity && watch_manager.wd_index[wd]) {
+        pthread_mutex_unlock(&watch_manager.mutex);
+        pthread_mutex_unlock(&watch_lock);
+        return wd;
+    }
+    if ((size_t)wd >= watch_manager.wd_index_capacity) {
+        size_t capacity = watch_manager.wd_index_capacity ? watch_manager.wd_index_capacity : INITIAL_WATCH_CAPACITY;
+        while (capacity <= (size_t)wd) capacity *= 2;
+        size_t *index = realloc(watch_manager.wd_index, capacity * sizeof(size_t));
+        if (!index) {
+            inotify_rm_watch(inotify_fd, wd);
+            pthread_mutex_unlock(&watch_manager.mutex);
+            pthread_mutex_unlock(&watch_lock);
+            log_event("[ERROR] Failed to expand watch descriptor index");
+            stats.watch_limit_hits++;
+            return -1;
+        }
+        memset(index + watch_manager.wd_index_capacity, 0,
+               (capacity - watch_manager.wd_index_capacity) * sizeof(size_t));
+        watch_manager.wd_index = index;
+        watch_manager.wd_index_capacity = capacity;
+    }
+    
+    if (path_index_put(&watch_index, path, strlen(path), watch_manager.count) != 0) {
+        inotify_rm_watch(inotify_fd, wd);
+        pthread_mutex_unlock(&watch_manager.mutex);
+        pthread_mutex_unlock(&watch_lock);
+        log_event("[ERROR] Failed to record watch path");
+        stats.watch_limit_hits++;
+        return -1;
+    }
+    watch_entry_t *entry = &watch_manager.entries[watch_manager.count];
+    entry->wd = wd;
+    entry->added_time = time(NULL);
+    entry->event_count = 0;
+    entry->reported_count = 0;
+    entry->self_outputs = self_outputs;
+    entry->policy = policy;
+    
+    watch_manager.count++;
+    watch_manager.wd_index[wd] = watch_manager.count;
+    
+    pthread_mutex_unlock(&watch_manager.mutex);
+    pthread_mutex_unlock(&watch_lock);
+    *added = 1;
+    
+    char success_msg[512];
+    snprintf(success_msg, sizeof(success_msg), "[WATCH] Added: %s (wd: %d)", path, wd);
+    log_event(success_msg);
+    
+    return wd;
+}
+
+watch_entry_t *find_watch_by_wd(int wd) {
+    watch_entry_t *entry = NULL;
+    pthread_mutex_lock(&watch_manager.mutex);
+    if (wd >= 0 && (size_t)wd < watch_manager.wd_index_capacity && watch_manager.wd_index[wd]) {
+        entry = &watch_manager.entries[watch_manager.wd_index[wd] - 1];
+    }
+    pthread_mutex_unlock(&watch_manager.mutex);
+    return entry;
+}
+
+int add_watch_recursive_enhanced(const char *path) {
+    struct stat path_stat;
+    if (stat(path, &path_stat) != 0) {
+        char error_msg[512];
+        snprintf(error_msg, sizeof(error_msg), "[ERROR] Cannot stat path: %s", path);
+        log_event(error_msg);
+        return -1;
+    }
+    
+    if (!S_ISDIR(path_stat.st_mode)) {
+        log_event("[ERROR] Path is not a directory");
+        return -1;
+    }
+    
+    return crawl_directory(path, 0, 0);
+}
+
+void handle_event_enhanced(struct inotify_event *event) {
+    watch_entry_t *watch_entry = find_watch_by_wd(event->wd);
+    if (!watch_entry) {
+        log_event("[WARN] Event from unknown watch descriptor");
+        return;
+    }
+    if (watch_entry->self_outputs && self_event(watch_entry->self_outputs, event)) {
+        stats.self_events_suppressed++;
+        return;
+    }
+    
+    size_t dir_len;
+    const char *dir = watch_path(watch_entry - watch_manager.entries, &dir_len);
+    if (!dir) return;
+    
+    event_policy = watch_entry->policy;
+    watch_entry->event_count++;
+    stats.total_events++;
+    
+    if (watch_entry->event_count > stats.max_events_per_path) {
+        stats.max_events_per_path = watch_entry->event_count;
+        memcpy(stats.most_active_path, dir, dir_len + 1);
+    }
+    
+    if (event->len > 0) {
+        if (!policy_accepts(event_policy, event->name)) {
+            return;
+        }
+        
+        size_t path_len = build_event_path(dir, dir_len, event->name, event->len);
+        const char *full_path = event_path;
+        
+        if (disk_usage) {
+            usage_event(event->mask, full_path, path_len);
+        }
+        if (event->mask & IN_CREATE) {
+            policy_emit(event_policy, IN_CREATE | (event->mask & IN_ISDIR), "Created: ", full_path, path_len);
+            
+            if (event->mask & IN_ISDIR && recursive_mode) {
+                crawl_submit(full_path, path_len);
+            }
+        }
+        if (event->mask & IN_DELETE) {
+            policy_emit(event_policy, IN_DELETE | (event->mask & IN_ISDIR), "Deleted: ", full_path, path_len);
+        }
+        if ((event->mask & IN_MODIFY) && (event_policy->mask & IN_MODIFY)) {
+            if (event_policy->hash != POLICY_HASH_ON) {
+                policy_emit(event_policy, IN_MODIFY | (event->mask & IN_ISDIR), "Modified: ", full_path, path_len);
+            } else if (policy_wants(event_policy, IN_MODIFY | (event->mask & IN_ISDIR), full_path, path_len) &&
+                       check_file_changed(full_path)) {
+                policy_emit_wanted(event_policy, IN_MODIFY | (event->mask & IN_ISDIR), "Modified (checksum changed): ", full_path, path_len);
+            }
+        }
+        if (event->mask & IN_MOVED_FROM) {
+            policy_emit(event_policy, IN_MOVED_FROM | (event->mask & IN_ISDIR), "Moved from: ", full_path, path_len);
+        }
+        if (event->mask & IN_MOVED_TO) {
+            policy_emit(event_policy, IN_MOVED_TO | (event->mask & IN_ISDIR), "Moved to: ", full_path, path_len);
+        }
+        if (event->mask & IN_OPEN) {
+            policy_emit(event_policy, IN_OPEN | (event->mask & IN_ISDIR), "Opened: ", full_path, path_len);
+        }
+        if (event->mask & IN_CLOSE) {
+            policy_emit(event_policy, IN_CLOSE | (event->mask & IN_ISDIR), "Closed: ", full_path, path_len);
+        }
+        if (event->mask & IN_ACCESS) {
+            policy_emit(event_policy, IN_ACCESS | (event->mask & IN_ISDIR), "Accessed: ", full_path, path_len);
+        }
+    }
+}
+
+// ===== METRICS MODE =====
+
+// --mode=metrics keeps counts instead of log lines. Each event adds one to
+// its directory's watch entry, to each of its event types and to its file
+// extension, all under watch_lock and in fixed-size tables. Every
+// metrics_interval seconds the stats thread rolls the counts up into one
+// "[METRICS] {...}" log line and the "metrics" object of monitor_stats.json,
+// and starts the next interval from zero. Nothing is logged per event and
+// nothing is allocated on the event path.
+
+static uint32_t metrics_ext_hash(const char *ext, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)ext[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Extensions past the table's capacity, or longer than
+// METRICS_EXT_MAX_LEN, are counted together as "other"
+static void metrics_count_extension(const char *name, size_t name_len) {
+    const char *dot = memrchr(name, '.', name_len);
+    const char *ext = (dot && dot != name) ? dot + 1 : name + name_len;
+    size_t len = name + name_len - ext;
+    if (len > METRICS_EXT_MAX_LEN) {
+        metrics_ext_other++;
+        return;
+    }
+    
+    uint32_t hash = metrics_ext_hash(ext, len);
+    for (uint32_t probe = 0; probe < METRICS_EXT_PROBES; probe++) {
+        metrics_ext_t *slot = &metrics_exts[(hash + probe) & (METRICS_EXT_SLOTS - 1)];
+        if (slot->count == 0) {
+            slot->hash = hash;
+            slot->len = len;
+            memcpy(slot->ext, ext, len);
+            slot->count = 1;
+            return;
+        }
+        if (slot->hash == hash && slot->len == len && memcmp(slot->ext, ext, len) == 0) {
+            slot->count++;
+            return;
+        }
+    }
+    metrics_ext_other++;
+}
+
+void handle_event_metrics(struct inotify_event *event) {
+    if (event->mask & IN_Q_OVERFLOW) {
+        metrics_type_counts[__builtin_ctz(IN_Q_OVERFLOW)]++;
+        return;
+    }
+    watch_entry_t *watch_entry = find_watch_by_wd(event->wd);
+    if (!watch_entry) return;
+    if (watch_entry->self_outputs && self_event(watch_entry->self_outputs, event)) {
+        stats.self_events_suppressed++;
+        return;
+    }
+    watch_entry->event_count++;
+    stats.total_events++;
+    
+    uint32_t bits = event->mask & METRICS_TYPE_MASK;
+    while (bits) {
+        metrics_type_counts[__builtin_ctz(bits)]++;
+        bits &= bits - 1;
+    }
+    
+    if (event->len > 0) {
+        size_t name_len = strnlen(event->name, event->len);
+        metrics_count_extension(event->name, name_len);
+        
+        if ((event->mask & (IN_CREATE | IN_ISDIR)) == (IN_CREATE | IN_ISDIR) && recursive_mode) {
+            size_t dir_len;
+            const char *dir = watch_path(watch_entry - watch_manager.entries, &dir_len);
+            if (dir) {
+                size_t path_len = build_event_path(dir, dir_len, event->name, event->len);
+                crawl_submit(event_path, path_len);
+            }
+        }
+    }
+}
+
+// An entry the crawl worker found in a newly watched directory counts as
+// a create in that directory. Caller holds watch_lock.
+void metrics_count_catch_up(int wd, const char *name) {
+    watch_entry_t *watch_entry = find_watch_by_wd(wd);
+    if (watch_entry) watch_entry->event_count++;
+    stats.total_events++;
+    metrics_type_counts[__builtin_ctz(IN_CREATE)]++;
+    metrics_count_extension(name, strlen(name));
+}
+
+static const char *metrics_type_name(int bit) {
+    switch (1u << bit) {
+        case IN_ACCESS:        return "access";
+        case IN_MODIFY:        return "modify";
+        case IN_ATTRIB:        return "attrib";
+        case IN_CLOSE_WRITE:   return "close_write";
+        case IN_CLOSE_NOWRITE: return "close_nowrite";
+        case IN_OPEN:          return "open";
+        case IN_MOVED_FROM:    return "moved_from";
+        case IN_MOVED_TO:      return "moved_to";
+        case IN_CREATE:        return "create";
+        case IN_DELETE:        return "delete";
+        case IN_DELETE_SELF:   return "delete_self";
+        case IN_MOVE_SELF:     return "move_self";
+        case IN_Q_OVERFLOW:    return "overflow";
+        default:               return "other";
+    }
+}
+
+// Keep the metrics_top largest (count, index) pairs, largest first
+static void metrics_top_insert(uint64_t *counts, uint32_t *indexes, int *len, uint64_t count, uint32_t index) {
+    if (*len == metrics_top && (*len == 0 || counts[*len - 1] >= count)) return;
+    int pos = *len < metrics_top ? (*len)++ : *len - 1;
+    while (pos > 0 && counts[pos - 1] < count) {
+        counts[pos] = counts[pos - 1];
+        indexes[pos] = indexes[pos - 1];
+        pos--;
+    }
+    counts[pos] = count;
+    indexes[pos] = index;
+}
+
+// Close the current interval. Counting resumes from zero; the tables are
+// only read and cleared here, with the event thread held off by watch_lock.
+// Called by the stats thread and once more on shutdown.
+void metrics_rollup() {
+    static uint64_t type_counts[32];
+    static uint64_t dir_counts[METRICS_TOP_MAX];
+    static uint32_t dir_indexes[METRICS_TOP_MAX];
+    static char dir_paths[METRICS_TOP_MAX][MAX_PATH_LEN];
+    static uint64_t ext_counts[METRICS_TOP_MAX];
+    static uint32_t ext_indexes[METRICS_TOP_MAX];
+    static metrics_ext_t exts[METRICS_TOP_MAX];
+    int dir_len = 0, ext_len = 0;
+    uint64_t events = 0, ext_other;
+    size_t active_dirs = 0;
+    
+    pthread_mutex_lock(&metrics_mutex);
+    pthread_mutex_lock(&watch_lock);
+    memcpy(type_counts, metrics_type_counts, sizeof(type_counts));
+    memset(metrics_type_counts, 0, sizeof(metrics_type_counts));
+    
+    for (size_t i = 0; i < watch_manager.count; i++) {
+        watch_entry_t *entry = &watch_manager.entries[i];
+        uint64_t count = entry->event_count - entry->reported_count;
+        entry->reported_count = entry->event_count;
+        if (count == 0) continue;
+        events += count;
+        active_dirs++;
+        metrics_top_insert(dir_counts, dir_indexes, &dir_len, count, i);
+    }
+    for (int i = 0; i < dir_len; i++) {
+        size_t len;
+        const char *path = watch_path(dir_indexes[i], &len);
+        memcpy(dir_paths[i], path ? path : "", path ? len + 1 : 1);
+    }
+    
+    for (uint32_t i = 0; i < METRICS_EXT_SLOTS; i++) {
+        if (metrics_exts[i].count) {
+            metrics_top_insert(ext_counts, ext_indexes, &ext_len, metrics_exts[i].count, i);
+        }
+    }
+    for (int i = 0; i < ext_len; i++) {
+        exts[i] = metrics_exts[ext_indexes[i]];
+    }
+    memset(metrics_exts, 0, sizeof(metrics_exts));
+    ext_other = metrics_ext_other;
+    metrics_ext_other = 0;
+    pthread_mutex_unlock(&watch_lock);
+    
+    json_object *rollup = json_object_new_object();
+    json_object_object_add(rollup, "timestamp", json_object_new_int64(time(NULL)));
+    json_object_object_add(rollup, "interval_sec", json_object_new_int64(metrics_interval));
+    json_object_object_add(rollup, "events", json_object_new_int64(events));
+    json_object_object_add(rollup, "active_directories", json_object_new_int64(active_dirs));
+    
+    json_object *types = json_object_new_object();
+    for (int bit = 0; bit < 32; bit++) {
+        if (type_counts[bit]) {
+            json_object_object_add(types, metrics_type_name(bit), json_object_new_int64(type_counts[bit]));
+        }
+    }
+    json_object_object_add(rollup, "types", types);
+    
+    json_object *dirs = json_object_new_array();
+    for (int i = 0; i < dir_len; i++) {
+        json_object *entry = json_object_new_object();
+        json_object_object_add(entry, "path", json_object_new_string(dir_paths[i]));
+        json_object_object_add(entry, "events", json_object_new_int64(dir_counts[i]));
+        json_object_array_add(dirs, entry);
+    }
+    json_object_object_add(rollup, "directories", dirs);
+    
+    json_object *ext_array = json_object_new_array();
+    for (int i = 0; i < ext_len; i++) {
+        char ext[METRICS_EXT_MAX_LEN + 1];
+        memcpy(ext, exts[i].ext, exts[i].len);
+        ext[exts[i].len] = '\0';
+        json_object *entry = json_object_new_object();
+        json_object_object_add(entry, "ext", json_object_new_string(ext));
+        json_object_object_add(entry, "events", json_object_new_int64(ext_counts[i]));
+        json_object_array_add(ext_array, entry);
+    }
+    json_object_object_add(rollup, "extensions", ext_array);
+    json_object_object_add(rollup, "extensions_other", json_object_new_int64(ext_other));
+    
+    const char *text = json_object_to_json_string_ext(rollup, JSON_C_TO_STRING_PLAIN);
+    log_append(0, NULL, "[METRICS] ", 10, text, strlen(text));
+    
+    if (metrics_last) json_object_put(metrics_last);
+    metrics_last = rollup;
+    pthread_mutex_unlock(&metrics_mutex);
+}
+
+// ===== EVENT SAMPLING =====
+
+// sample=open:100,access:1000 logs one event in N of a type. Every event a
+// policy lets through is counted per type, sampled or not; sampled lines
+// carry their rate ("Opened [1/100]: <path>") and every sample_interval
+// seconds a "[SAMPLE] {...}" line reports the exact count, the number
+// logged and the rate of each type, so downstream tools can scale. A
+// sampled-out event goes to no output at all.
+
+static const char *const event_type_names[EVENT_TYPE_COUNT] = {
+    "create", "delete", "modify", "moved_from", "moved_to", "attrib", "open", "close", "access", "other"
+};
+
+// Parse the sample= entries collected by load_config
+int sample_compile() {
+    char spec[FILTER_MAX_SOURCE];
+    strncpy(spec, sample_spec, sizeof(spec) - 1);
+    spec[sizeof(spec) - 1] = '\0';
+    
+    char *save = NULL;
+    for (char *item = strtok_r(spec, ", \t", &save); item; item = strtok_r(NULL, ", \t", &save)) {
+        char *colon = strchr(item, ':');
+        unsigned long rate = colon ? strtoul(colon + 1, NULL, 10) : 0;
+        if (colon) *colon = '\0';
+        
+        int type = -1;
+        for (int i = 0; i < EVENT_TYPE_OTHER; i++) {
+            if (strcmp(item, event_type_names[i]) == 0) type = i;
+        }
+        if (type < 0 || rate < 1 || rate > UINT32_MAX) {
+            char msg[256];
+            snprintf(msg, sizeof(msg), "[ERROR] Invalid sample entry '%.64s' (expected <event>:<N>)", item);
+            log_event(msg);
+            return -1;
+        }
+        sample_rates[type] = rate;
+        if (rate > 1) sampling_enabled = 1;
+    }
+    
+    if (sampling_enabled) {
+        char msg[256];
+        int len = snprintf(msg, sizeof(msg), "[SAMPLE] Logging 1 in N:");
+        for (int i = 0; i < EVENT_TYPE_OTHER && len < (int)sizeof(msg); i++) {
+            if (sample_rates[i] > 1) {
+                len += snprintf(msg + len, sizeof(msg) - len, " %s=%u", event_type_names[i], sample_rates[i]);
+            }
+        }
+        log_event(msg);
+    }
+    return 0;
+}
+
+// Log the exact and logged counts of the interval that just ended.
+// Called by the stats thread only.
+void sample_report() {
+    static uint64_t last_seen[EVENT_TYPE_COUNT];
+    static uint64_t last_logged[EVENT_TYPE_COUNT];
+    
+    json_object *report = json_object_new_object();
+    json_object_object_add(report, "interval_sec", json_object_new_int64(sample_interval));
+    json_object *types = json_object_new_object();
+    for (int i = 0; i < EVENT_TYPE_COUNT; i++) {
+        uint64_t seen = event_type_seen[i];
+        uint64_t logged = event_type_logged[i];
+        if (seen == last_seen[i]) continue;
+        json_object *entry = json_object_new_object();
+        json_object_object_add(entry, "seen", json_object_new_int64(seen - last_seen[i]));
+        json_object_object_add(entry, "logged", json_object_new_int64(logged - last_logged[i]));
+        json_object_object_add(entry, "rate", json_object_new_int64(sample_rates[i]));
+        json_object_object_add(types, event_type_names[i], entry);
+        last_seen[i] = seen;
+        last_logged[i] = logged;
+    }
+    json_object_object_add(report, "types", types);
+    
+    const char *text = json_object_to_json_string_ext(report, JSON_C_TO_STRING_PLAIN);
+    log_append(0, NULL, "[SAMPLE] ", 9, text, strlen(text));
+    json_object_put(report);
+}
+
+// ===== CRAWL WORKER =====
+
+// New directories are registered off the event thread: handlers queue the
+// path and go back to reading events while the worker adds watches for
+// the whole subtree. Anything that appeared in a directory before its
+// watch existed is reported by a catch-up "Created" event from the walk.
+// The queue is bounded; when it is full the path is dropped and, once the
+// queue drains, the worker rescans the tree for directories still without
+// a watch. Directories moved in with disk_usage=true are measured by the
+// same worker, so a large tree never stalls the event thread.
+
+#define CRAWL_QUEUE_SIZE 256
+
+static char crawl_queue[CRAWL_QUEUE_SIZE][MAX_PATH_LEN];
+static size_t crawl_queue_lens[CRAWL_QUEUE_SIZE];
+static uint64_t crawl_queue_measure[CRAWL_QUEUE_SIZE];  // move time of a usage job, 0 = crawl
+static int crawl_head = 0;
+static int crawl_count = 0;
+static int crawl_rescan_pending = 0;
+static uint64_t crawl_measure_pending = 0;  // earliest usage job lost to a full queue
+static uint64_t crawl_job_ns = 0;           // the running job's seed horizon, 0 = idle
+static int crawl_running = 0;
+static char crawl_root[MAX_PATH_LEN];
+static pthread_t crawl_thread;
+static pthread_mutex_t crawl_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t crawl_cond = PTHREAD_COND_INITIALIZER;
+
+// Report an entry of a newly watched directory as created: counted in
+// metrics mode, otherwise counted per type, sampled and emitted like an
+// event of its policy. Runs under watch_lock, like every event of a read
+// batch, so sequence numbers reach the file tree and the journal in order.
+// Not rate limited: the buckets belong to the event thread.
+static void crawl_catch_up(monitor_policy_t *policy, int wd, int is_dir, const char *name,
+                           const char *path, size_t path_len, const event_time_t *listed) {
+    uint32_t mask = IN_CREATE | (is_dir ? IN_ISDIR : 0);
+    if (mode == MODE_METRICS) {
+        pthread_mutex_lock(&watch_lock);
+        metrics_count_catch_up(wd, name);
+        pthread_mutex_unlock(&watch_lock);
+    } else {
+        if (!(policy->mask & IN_CREATE) || !policy_accepts(policy, name) ||
+            (filter_len && !filter_match(mask, path, path_len))) {
+            return;
+        }
+        pthread_mutex_lock(&watch_lock);
+        policy_emit_sampled(policy, listed, mask, "Created: ", path, path_len);
+        pthread_mutex_unlock(&watch_lock);
+    }
+    __atomic_fetch_add(&stats.crawl_catchup_events, 1, __ATOMIC_RELAXED);
+}
+
+// Watch path and, in recursive mode, every directory below it. With
+// catch_up, entries of a directory whose watch is new are reported as
+// created. A directory that was already watched belongs to an earlier
+// crawl and ends the walk, unless rescan asks to look below it for
+// directories that are still unwatched.
+int crawl_directory(const char *path, int catch_up, int rescan) {
+    monitor_policy_t *policy = policy_lookup(path);
+    if (policy->ignore) {
+        return 0;
+    }
+    
+    // Events for entries of this directory are read after this point
+    event_time_t watching;
+    event_time_now(&watching);
+    int added;
+    int wd = uses_watch_manager() ? add_watch_dynamic(path, policy, &added) :
+                                       add_watch_basic(path, policy, &added);
+    if (wd == -1) {
+        return -1;
+    }
+    if (!added && !rescan) {
+        __atomic_fetch_add(&stats.crawl_duplicates, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    
+    if (!recursive_mode && !disk_usage) {
+        return 0;
+    }
+    
+    DIR *dir = opendir(path);
+    if (!dir) {
+        char error_msg[512];
+        snprintf(error_msg, sizeof(error_msg), "[ERROR] Cannot open directory: %s", path);
+        log_event(error_msg);
+        return -1;
+    }
+    
+    // Catch-up events were "read" when the directory was listed
+    event_time_t listed;
+    event_time_now(&listed);
+    struct dirent *entry;
+    while (running && (entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        
+        char subpath[MAX_PATH_LEN];
+        int subpath_len = snprintf(subpath, sizeof(subpath), "%s/%s", path, entry->d_name);
+        if (subpath_len >= (int)sizeof(subpath)) {
+            continue;
+        }
+        
+        // Symlinks to directories are followed, as stat() always did
+        int is_dir = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+            struct stat sub_stat;
+            is_dir = stat(subpath, &sub_stat) == 0 && S_ISDIR(sub_stat.st_mode);
+        }
+        
+        if (catch_up && added) {
+            crawl_catch_up(policy, wd, is_dir, entry->d_name, subpath, subpath_len, &listed);
+        }
+        if (is_dir) {
+            if (recursive_mode) {
+                crawl_directory(subpath, catch_up, rescan);
+            }
+        } else if (disk_usage && added && policy_accepts(policy, entry->d_name)) {
+            usage_seed(dirfd(dir), entry->d_name, subpath, subpath_len, watching.monotonic_ns);
+        }
+    }
+    
+    closedir(dir);
+    return 0;
+}
+
+static void crawl_push(const char *path, size_t path_len, uint64_t measure_ns) {
+    if (!crawl_running || path_len >= MAX_PATH_LEN) return;
+    
+    pthread_mutex_lock(&crawl_mutex);
+    // A queued job of the same kind for the directory or an ancestor will
+    // reach it
+    for (int i = 0; i < crawl_count; i++) {
+        int slot = (crawl_head + i) % CRAWL_QUEUE_SIZE;
+        size_t len = crawl_queue_lens[slot];
+        if ((crawl_queue_measure[slot] != 0) == (measure_ns != 0) &&
+            len <= path_len && memcmp(crawl_queue[slot], path, len) == 0 &&
+            (len == path_len || path[len] == '/')) {
+            __atomic_fetch_add(&stats.crawl_duplicates, 1, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&crawl_mutex);
+            return;
+        }
+    }
+    
+    if (crawl_count == CRAWL_QUEUE_SIZE) {
+        if (!measure_ns) {
+            crawl_rescan_pending = 1;
+        } else if (!crawl_measure_pending || measure_ns < crawl_measure_pending) {
+            crawl_measure_pending = measure_ns;
+        }
+        stats.crawl_overflows++;
+    } else {
+        int slot = (crawl_head + crawl_count) % CRAWL_QUEUE_SIZE;
+        memcpy(crawl_queue[slot], path, path_len);
+        crawl_queue[slot][path_len] = '\0';
+        crawl_queue_lens[slot] = path_len;
+        crawl_queue_measure[slot] = measure_ns;
+        crawl_count++;
+    }
+    pthread_cond_signal(&crawl_cond);
+    pthread_mutex_unlock(&crawl_mutex);
+}
+
+// Queue a new directory for the worker. Never blocks the event thread.
+void crawl_submit(const char *path, size_t path_len) {
+    crawl_push(path, path_len, 0);
+}
+
+// Queue a directory moved in at moved_ns to have its files measured
+void crawl_submit_measure(const char *path, size_t path_len, uint64_t moved_ns) {
+    crawl_push(path, path_len, moved_ns);
+}
+
+// Oldest watched_ns a running or queued job may still pass to usage_seed,
+// or 0 when there is none. A usage tombstone at least this new must stay.
+uint64_t crawl_seed_horizon() {
+    pthread_mutex_lock(&crawl_mutex);
+    uint64_t horizon = crawl_job_ns;
+    for (int i = 0; i < crawl_count; i++) {
+        uint64_t measure_ns = crawl_queue_measure[(crawl_head + i) % CRAWL_QUEUE_SIZE];
+        if (measure_ns && (!horizon || measure_ns < horizon)) horizon = measure_ns;
+    }
+    if (crawl_measure_pending && (!horizon || crawl_measure_pending < horizon)) {
+        horizon = crawl_measure_pending;
+    }
+    pthread_mutex_unlock(&crawl_mutex);
+    return horizon;
+}
+
+static void* crawl_thread_func(void* arg) {
+    (void)arg;
+    thread_set_role("crawl");
+    char path[MAX_PATH_LEN];
+    
+    pthread_mutex_lock(&crawl_mutex);
+    while (running) {
+        if (crawl_count == 0 && !crawl_rescan_pending && !crawl_measure_pending) {
+            pthread_cond_wait(&crawl_cond, &crawl_mutex);
+            continue;
+        }
+        
+        event_time_t started;
+        event_time_now(&started);
+        if (crawl_count > 0) {
+            memcpy(path, crawl_queue[crawl_head], crawl_queue_lens[crawl_head] + 1);
+            uint64_t measure_ns = crawl_queue_measure[crawl_head];
+            crawl_head = (crawl_head + 1) % CRAWL_QUEUE_SIZE;
+            crawl_count--;
+            crawl_job_ns = measure_ns ? measure_ns : started.monotonic_ns;
+            pthread_mutex_unlock(&crawl_mutex);
+            
+            __atomic_fetch_add(&stats.crawl_jobs, 1, __ATOMIC_RELAXED);
+            if (measure_ns) {
+                usage_scan(path, measure_ns);
+            } else {
+                crawl_directory(path, 1, 0);
+            }
+        } else if (crawl_measure_pending) {
+            uint64_t measure_ns = crawl_measure_pending;
+            crawl_measure_pending = 0;
+            crawl_job_ns = measure_ns;
+            pthread_mutex_unlock(&crawl_mutex);
+            
+            char msg[MAX_PATH_LEN + 64];
+            snprintf(msg, sizeof(msg), "[CRAWL] Queue overflowed; measuring %s for disk usage", crawl_root);
+            log_event(msg);
+            usage_scan(crawl_root, measure_ns);
+        } else {
+            crawl_rescan_pending = 0;
+            crawl_job_ns = started.monotonic_ns;
+            pthread_mutex_unlock(&crawl_mutex);
+            
+            char msg[MAX_PATH_LEN + 64];
+            snprintf(msg, sizeof(msg), "[CRAWL] Queue overflowed; rescanning %s for unwatched directories",
+                     crawl_root);
+            log_event(msg);
+            crawl_directory(crawl_root, 1, 1);
+        }
+        pthread_mutex_lock(&crawl_mutex);
+        crawl_job_ns = 0;
+    }
+    pthread_mutex_unlock(&crawl_mutex);
+    return NULL;
+}
+
+int crawl_start(const char *root) {
+    strncpy(crawl_root, root, MAX_PATH_LEN - 1);
+    if (pthread_create(&crawl_thread, NULL, crawl_thread_func, NULL) != 0) {
+        return -1;
+    }
+    crawl_running = 1;
+    return 0;
+}
+
+// Wake the worker and wait for it; running is already 0, so a walk in
+// progress stops at its next directory
+void crawl_shutdown() {
+    if (!crawl_running) return;
+    
+    pthread_mutex_lock(&crawl_mutex);
+    pthread_cond_broadcast(&crawl_cond);
+    pthread_mutex_unlock(&crawl_mutex);
+    pthread_join(crawl_thread, NULL);
+    crawl_running = 0;
+}
+
+// ===== ADVANCED MODE FUNCTIONS =====
+
+// Hash an open file into the caller's buffer. Uses raw read() so no FILE
+// object (and its heap buffer) is created per event.
+int calculate_fd_hash(int fd, char hex_string[HASH_SIZE]) {
+    static const char hex_digits[] = "0123456789abcdef";
+    
+    SHA256_CTX sha256;
+    SHA256_Init(&sha256);
+    
+    unsigned char buffer[8192];
+    ssize_t bytes;
+    while ((bytes = read(fd, buffer, sizeof(buffer))) != 0) {
+        if (bytes < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        SHA256_Update(&sha256, buffer, bytes);
+    }
+    
+    unsigned char hash[SHA256_DIGEST_LENGTH];
+    SHA256_Final(hash, &sha256);
+    
+    for (int i = 0; i < SHA256_DIGEST_LENGTH; i++) {
+        hex_string[i * 2] = hex_digits[hash[i] >> 4];
+        hex_string[i * 2 + 1] = hex_digits[hash[i] & 0x0f];
+    }
+    hex_string[HASH_SIZE - 1] = '\0';
+    
+    return 0;
+}
+
+// Content state is tracked per (dev, ino), see FILE IDENTITY
+int check_file_changed(const char *filepath) {
+    if (!enable_checksum) return 1;
+    
+    uint64_t cpu_start = cpu_event_thread ? thread_cpu_ns() : 0;
+    pthread_mutex_lock(&hash_mutex);
+    int changed = file_identity_check(filepath, strlen(filepath));
+    pthread_mutex_unlock(&hash_mutex);
+    if (cpu_event_thread) {
+        cpu_stage_ns[CPU_STAGE_HASH] += thread_cpu_ns() - cpu_start;
+    }
+    return changed;
+}
+
+void rotate_log_file() {
+    pthread_mutex_lock(&log_mutex);
+    if (log_fd == -1) {
+        pthread_mutex_unlock(&log_mutex);
+        return;
+    }
+    
+    log_flush_locked();
+    close(log_fd);
+    log_fd = -1;
+    pthread_mutex_unlock(&log_mutex);
+    
+    char old_name[MAX_PATH_LEN];
+    char new_name[MAX_PATH_LEN];
+    
+    // Shift both plain and compressed segments so replay sees them in order
+    pthread_mutex_lock(&segment_mutex);
+    static const char *segment_suffixes[] = { "", ".gz", ".gz.idx" };
+    for (int i = MAX_LOG_FILES - 1; i > 0; i--) {
+        for (int k = 0; k < 3; k++) {
+            snprintf(old_name, sizeof(old_name), "%s.%d%s", LOG_FILE, i - 1, segment_suffixes[k]);
+            snprintf(new_name, sizeof(new_name), "%s.%d%s", LOG_FILE, i, segment_suffixes[k]);
+            
+            if (access(old_name, F_OK) == 0) {
+                if (i == MAX_LOG_FILES - 1) {
+                    unlink(old_name);
+                } else {
+                    rename(old_name, new_name);
+                }
+            }
+        }
+    }
+    
+    snprintf(new_name, sizeof(new_name), "%s.0", LOG_FILE);
+    rename(LOG_FILE, new_name);
+    pthread_mutex_unlock(&segment_mutex);
+    
+    pthread_mutex_lock(&log_mutex);
+    log_fd = open(LOG_FILE, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    log_size = 0;
+    pthread_mutex_unlock(&log_mutex);
+    
+    if (log_fd != -1) {
+        log_event("[INFO] Log file rotated successfully");
+    }
+    
+    if (enable_compression) {
+        compress_old_log(new_name);
+    }
+}
+
+void compress_old_log(const char *filename) {
+    char gz_filename[MAX_PATH_LEN];
+    snprintf(gz_filename, sizeof(gz_filename), "%s.gz", filename);
+    
+    // Block-indexed so queries and replay can start mid-segment
+    if (segment_compress_file(filename, gz_filename) != 0) {
+        unlink(gz_filename);
+        char msg[512];
+        snprintf(msg, sizeof(msg), "[WARN] Failed to compress log file: %s", filename);
+        log_event(msg);
+        return;
+    }
+    unlink(filename);
+    
+    char msg[512];
+    snprintf(msg, sizeof(msg), "[INFO] Compressed log file: %s", gz_filename);
+    log_event(msg);
+}
+
+void handle_event_advanced(struct inotify_event *event, const char *watch_path, size_t watch_path_len) {
+    stats.total_events++;
+    
+    if (event->len > 0) {
+        if (!policy_accepts(event_policy, event->name)) {
+            return;
+        }
+        
+        size_t path_len = build_event_path(watch_path, watch_path_len, event->name, event->len);
+        const char *full_path = event_path;
+        
+        if (disk_usage) {
+            usage_event(event->mask, full_path, path_len);
+        }
+        if (event->mask & IN_CREATE) {
+            policy_emit(event_policy, IN_CREATE | (event->mask & IN_ISDIR), "Created: ", full_path, path_len);
+            
+            if (event->mask & IN_ISDIR && recursive_mode) {
+                crawl_submit(full_path, path_len);
+            }
+        }
+        if (event->mask & IN_DELETE) {
+            policy_emit(event_policy, IN_DELETE | (event->mask & IN_ISDIR), "Deleted: ", full_path, path_len);
+            file_identity_event(event->mask, full_path, path_len);
+        }
+        if ((event->mask & IN_MODIFY) && (event_policy->mask & IN_MODIFY)) {
+            if (event_policy->hash == POLICY_HASH_OFF) {
+                policy_emit(event_policy, IN_MODIFY | (event->mask & IN_ISDIR), "Modified: ", full_path, path_len);
+            } else if (policy_wants(event_policy, IN_MODIFY | (event->mask & IN_ISDIR), full_path, path_len) &&
+                       check_file_changed(full_path)) {
+                policy_emit_wanted(event_policy, IN_MODIFY | (event->mask & IN_ISDIR), "Modified (checksum changed): ", full_path, path_len);
+            }
+        }
+        if (event->mask & IN_MOVED_FROM) {
+            policy_emit(event_policy, IN_MOVED_FROM | (event->mask & IN_ISDIR), "Moved from: ", full_path, path_len);
+            file_identity_event(event->mask, full_path, path_len);
+        }
+        if (event->mask & IN_MOVED_TO) {
+            policy_emit(event_policy, IN_MOVED_TO | (event->mask & IN_ISDIR), "Moved to: ", full_path, path_len);
+            file_identity_event(event->mask, full_path, path_len);
+        }
+        if (event->mask & IN_OPEN) {
+            policy_emit(event_policy, IN_OPEN | (event->mask & IN_ISDIR), "Opened: ", full_path, path_len);
+        }
+        if (event->mask & IN_CLOSE) {
+            policy_emit(event_policy, IN_CLOSE | (event->mask & IN_ISDIR), "Closed: ", full_path, path_len);
+        }
+        if (event->mask & IN_ACCESS) {
+            policy_emit(event_policy, IN_ACCESS | (event->mask & IN_ISDIR), "Accessed: ", full_path, path_len);
+        }
+    }
+}
+
+// ===== COLLECTOR SINK =====
+
+#define COLLECTOR_SEND_FRAMES 16
+
+typedef struct {
+    collector_frame_header_t header;
+    const char *payload;
+} collector_frame_t;
+
+// Connection and spool state below is only touched by the collector thread
+static int collector_fd = -1;
+static long collector_backoff_ms = COLLECTOR_BACKOFF_MIN_MS;
+static struct timespec collector_next_attempt = {0, 0};
+static int collector_connected_once = 0;
+static int collector_spool_fd = -1;
+static off_t collector_spool_len = 0;
+static off_t collector_spool_offset = 0;
+static z_stream collector_zstream;
+static char *collector_zbuf = NULL;
+static size_t collector_zslot = 0;
+static char *collector_drain_buf = NULL;
+static size_t collector_drain_capacity = 0;
+
+int collector_init() {
+    // A datagram must fit the socket send buffer (net.core.wmem_default)
+    if (collector_socket_type == SOCK_DGRAM && collector_batch_bytes > COLLECTOR_MAX_DGRAM_KB * 1024) {
+        char warn_msg[128];
+        snprintf(warn_msg, sizeof(warn_msg),
+                "[WARN] collector_batch_kb=%zu too large for datagrams, using %d",
+                collector_batch_bytes / 1024, COLLECTOR_MAX_DGRAM_KB);
+        log_event(warn_msg);
+        collector_batch_bytes = COLLECTOR_MAX_DGRAM_KB * 1024;
+    }
+    
+    collector_stage_capacity = collector_batch_bytes * COLLECTOR_STAGE_FRAMES;
+    collector_stage = malloc(collector_stage_capacity);
+    collector_outbox = malloc(collector_stage_capacity);
+    
+    // Spooled frames may come from an earlier run with a larger batch size
+    collector_drain_capacity = compressBound(COLLECTOR_MAX_BATCH_KB * 1024);
+    collector_drain_buf = malloc(collector_drain_capacity);
+    
+    if (collector_compress) {
+        memset(&collector_zstream, 0, sizeof(collector_zstream));
+        if (deflateInit(&collector_zstream, Z_DEFAULT_COMPRESSION) != Z_OK) {
+            log_event("[WARN] Collector compression unavailable, sending raw frames");
+            collector_compress = 0;
+        } else {
+            collector_zslot = compressBound(collector_batch_bytes);
+            collector_zbuf = malloc(collector_zslot * COLLECTOR_SEND_FRAMES);
+        }
+    }
+    
+    if (!collector_stage || !collector_outbox || !collector_drain_buf ||
+        (collector_compress && !collector_zbuf)) {
+        log_event("[ERROR] Failed to allocate collector buffers");
+        return -1;
+    }
+    
+    collector_spool_fd = open(collector_spool_path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (collector_spool_fd == -1) {
+        char error_msg[MAX_PATH_LEN + 64];
+        snprintf(error_msg, sizeof(error_msg), "[WARN] Cannot open collector spool %s: %s",
+                collector_spool_path, strerror(errno));
+        log_event(error_msg);
+    } else {
+        struct stat spool_stat;
+        if (fstat(collector_spool_fd, &spool_stat) == 0) {
+            collector_spool_len = spool_stat.st_size;
+        }
+    }
+    
+    collector_enabled = 1;
+    if (pthread_create(&collector_thread, NULL, collector_thread_func, NULL) != 0) {
+        collector_enabled = 0;
+        log_event("[ERROR] Failed to create collector thread");
+        return -1;
+    }
+    
+    char msg[512];
+    snprintf(msg, sizeof(msg),
+            "[COLLECTOR] Shipping log to %s (%s, batch=%zuKB, flush=%dms, compress=%s)",
+            collector_socket_path,
+            collector_socket_type == SOCK_STREAM ? "stream" : "dgram",
+            collector_batch_bytes / 1024, collector_flush_ms,
+            collector_compress ? "yes" : "no");
+    log_event(msg);
+    return 0;
+}
+
+// Stage flushed log bytes for the collector thread. Called with log_mutex
+// held; only copies into the preallocated stage buffer.
+void collector_submit(const char *data, size_t len) {
+    pthread_mutex_lock(&collector_mutex);
+    if (collector_stage_len + len > collector_stage_capacity) {
+        stats.collector_bytes_dropped += len;
+    } else {
+        memcpy(collector_stage + collector_stage_len, data, len);
+        collector_stage_len += len;
+        if (collector_stage_len >= collector_batch_bytes) {
+            pthread_cond_signal(&collector_cond);
+        }
+    }
+    pthread_mutex_unlock(&collector_mutex);
+}
+
+static long collector_ms_until(const struct timespec *when) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (when->tv_sec - now.tv_sec) * 1000 + (when->tv_nsec - now.tv_nsec) / 1000000;
+}
+
+static void collector_schedule_retry() {
+    clock_gettime(CLOCK_MONOTONIC, &collector_next_attempt);
+    collector_next_attempt.tv_sec += collector_backoff_ms / 1000;
+    collector_next_attempt.tv_nsec += (collector_backoff_ms % 1000) * 1000000;
+    if (collector_next_attempt.tv_nsec >= 1000000000) {
+        collector_next_attempt.tv_sec++;
+        collector_next_attempt.tv_nsec -= 1000000000;
+    }
+    collector_backoff_ms *= 2;
+    if (collector_backoff_ms > COLLECTOR_BACKOFF_MAX_MS) {
+        collector_backoff_ms = COLLECTOR_BACKOFF_MAX_MS;
+    }
+}
+
+static void collector_disconnect(const char *reason) {
+    if (collector_fd != -1) {
+        close(collector_fd);
+        collector_fd = -1;
+    }
+    collector_schedule_retry();
+    
+    char msg[MAX_PATH_LEN + 128];
+    snprintf(msg, sizeof(msg), "[COLLECTOR] Connection lost (%s), spooling to %s",
+            reason, collector_spool_path);
+    log_event(msg);
+}
+
+static int collector_connect() {
+    if (collector_ms_until(&collector_next_attempt) > 0) {
+        return -1;
+    }
+    
+    int fd = socket(AF_UNIX, collector_socket_type | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        collector_schedule_retry();
+        return -1;
+    }
+    
+    // Never let a stalled collector block the sink for long
+    struct timeval timeout = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, collector_socket_path, sizeof(addr.sun_path));
+    
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        close(fd);
+        collector_schedule_retry();
+        return -1;
+    }
+    
+    collector_fd = fd;
+    collector_backoff_ms = COLLECTOR_BACKOFF_MIN_MS;
+    if (collector_connected_once) {
+        stats.collector_reconnects++;
+    }
+    collector_connected_once = 1;
+    
+    char msg[512];
+    snprintf(msg, sizeof(msg), "[COLLECTOR] Connected to %s", collector_socket_path);
+    log_event(msg);
+    return 0;
+}
+
+// Send frames over the connected socket: one sendmmsg() for datagram
+// sockets, one writev() for stream sockets. Returns the number of frames
+// consumed: delivered completely, or dropped because the datagram socket
+// can never carry them (EMSGSIZE is not a lost connection).
+static int collector_send_frames(collector_frame_t *frames, int count) {
+    struct iovec iov[COLLECTOR_SEND_FRAMES * 2];
+    for (int i = 0; i < count; i++) {
+        iov[i * 2].iov_base = &frames[i].header;
+        iov[i * 2].iov_len = sizeof(collector_frame_header_t);
+        iov[i * 2 + 1].iov_base = (void *)frames[i].payload;
+        iov[i * 2 + 1].iov_len = frames[i].header.payload_len;
+    }
+    
+    int sent = 0;
+    if (collector_socket_type == SOCK_DGRAM) {
+        struct mmsghdr msgs[COLLECTOR_SEND_FRAMES];
+        memset(msgs, 0, sizeof(msgs[0]) * count);
+        for (int i = 0; i < count; i++) {
+            msgs[i].msg_hdr.msg_iov = &iov[i * 2];
+            msgs[i].msg_hdr.msg_iovlen = 2;
+        }
+        while (sent < count) {
+            int n = sendmmsg(collector_fd, msgs + sent, count - sent, 0);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno != EMSGSIZE) break;
+                // e.g. spooled by an earlier run with a larger batch size
+                stats.collector_frames_oversized++;
+                stats.collector_bytes_dropped += frames[sent].header.raw_len;
+                sent++;
+                continue;
+            }
+            for (int i = sent; i < sent + n; i++) {
+                stats.collector_frames_sent++;
+                stats.collector_bytes_sent += sizeof(collector_frame_header_t) + frames[i].header.payload_len;
+            }
+            sent += n;
+        }
+        return sent;
+    } else {
+        struct iovec *cursor = iov;
+        int iov_left = count * 2;
+        while (iov_left > 0) {
+            ssize_t n = writev(collector_fd, cursor, iov_left);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            while (iov_left > 0 && (size_t)n >= cursor->iov_len) {
+                n -= cursor->iov_len;
+                cursor++;
+                iov_left--;
+            }
+            if (iov_left > 0) {
+                cursor->iov_base = (char *)cursor->iov_base + n;
+                cursor->iov_len -= n;
+            }
+        }
+        // A partially written frame counts as undelivered and is resent
+        // whole on the next connection
+        sent = (count * 2 - iov_left) / 2;
+    }
+    
+    for (int i = 0; i < sent; i++) {
+        stats.collector_frames_sent++;
+        stats.collector_bytes_sent += sizeof(collector_frame_header_t) + frames[i].header.payload_len;
+    }
+    return sent;
+}
+
+static void collector_spool_frames(collector_frame_t *frames, int count) {
+    size_t bytes = 0;
+    for (int i = 0; i < count; i++) {
+        bytes += sizeof(collector_frame_header_t) + frames[i].header.payload_len;
+    }
+    
+    if (collector_spool_fd == -1 ||
+        collector_spool_len + (off_t)bytes > (off_t)COLLECTOR_SPOOL_MAX_MB * 1024 * 1024) {
+        for (int i = 0; i < count; i++) {
+            stats.collector_bytes_dropped += frames[i].header.raw_len;
+        }
+        return;
+    }
+    
+    struct iovec iov[COLLECTOR_SEND_FRAMES * 2];
+    for (int i = 0; i < count; i++) {
+        iov[i * 2].iov_base = &frames[i].header;
+        iov[i * 2].iov_len = sizeof(collector_frame_header_t);
+        iov[i * 2 + 1].iov_base = (void *)frames[i].payload;
+        iov[i * 2 + 1].iov_len = frames[i].header.payload_len;
+    }
+    
+    // Keep only the frames that were written whole; a torn tail would make
+    // the next drain discard everything behind it
+    ssize_t n = writev(collector_spool_fd, iov, count * 2);
+    size_t kept = 0;
+    int whole = 0;
+    while (whole < count && n > 0 &&
+           kept + sizeof(collector_frame_header_t) + frames[whole].header.payload_len <= (size_t)n) {
+        kept += sizeof(collector_frame_header_t) + frames[whole].header.payload_len;
+        whole++;
+    }
+    if (n > 0 && (size_t)n != kept && ftruncate(collector_spool_fd, collector_spool_len + kept) != 0) {
+        log_event("[WARN] Cannot truncate torn collector spool frame");
+    }
+    collector_spool_len += kept;
+    stats.collector_frames_spooled += whole;
+    for (int i = whole; i < count; i++) {
+        stats.collector_bytes_dropped += frames[i].header.raw_len;
+    }
+}
+
+// Replay spooled frames in order. Returns 0 once the spool is empty.
+static int collector_drain_spool() {
+    while (collector_spool_offset < collector_spool_len) {
+        collector_frame_t frame;
+        if (pread(collector_spool_fd, &frame.header, sizeof(frame.header),
+                  collector_spool_offset) != sizeof(frame.header) ||
+            frame.header.magic != COLLECTOR_FRAME_MAGIC ||
+            frame.header.payload_len > collector_drain_capacity ||
+            pread(collector_spool_fd, collector_drain_buf, frame.header.payload_len,
+                  collector_spool_offset + sizeof(frame.header)) != (ssize_t)frame.header.payload_len) {
+            log_event("[WARN] Collector spool is corrupt, discarding remainder");
+            break;
+        }
+        
+        frame.payload = collector_drain_buf;
+        if (collector_send_frames(&frame, 1) != 1) {
+            return -1;
+        }
+        collector_spool_offset += sizeof(frame.header) + frame.header.payload_len;
+    }
+    
+    if (ftruncate(collector_spool_fd, 0) == 0) {
+        collector_spool_len = 0;
+        collector_spool_offset = 0;
+    }
+    return 0;
+}
+
+// Cut staged bytes into frames at line boundaries, compress them if
+// configured, and deliver them (or spool them while the collector is down)
+static void collector_ship(const char *data, size_t len) {
+    if (collector_fd == -1) {
+        collector_connect();
+    }
+    if (collector_fd != -1 && collector_spool_offset < collector_spool_len) {
+        if (collector_drain_spool() != 0) {
+            collector_disconnect(strerror(errno));
+        }
+    }
+    
+    size_t pos = 0;
+    while (pos < len) {
+        collector_frame_t frames[COLLECTOR_SEND_FRAMES];
+        int count = 0;
+        
+        while (pos < len && count < COLLECTOR_SEND_FRAMES) {
+            size_t frame_len = len - pos;
+            if (frame_len > collector_batch_bytes) {
+                frame_len = collector_batch_bytes;
+                const char *newline = memrchr(data + pos, '\n', frame_len);
+                if (newline) {
+                    frame_len = newline - (data + pos) + 1;
+                }
+            }
+            
+            collector_frame_t *frame = &frames[count];
+            frame->header.magic = COLLECTOR_FRAME_MAGIC;
+            frame->header.version = COLLECTOR_FRAME_VERSION;
+            frame->header.flags = 0;
+            frame->header.raw_len = frame_len;
+            frame->header.payload_len = frame_len;
+            frame->payload = data + pos;
+            
+            if (collector_compress) {
+                char *out = collector_zbuf + count * collector_zslot;
+                deflateReset(&collector_zstream);
+                collector_zstream.next_in = (Bytef *)(data + pos);
+                collector_zstream.avail_in = frame_len;
+                collector_zstream.next_out = (Bytef *)out;
+                collector_zstream.avail_out = collector_zslot;
+                if (deflate(&collector_zstream, Z_FINISH) == Z_STREAM_END &&
+                    collector_zstream.total_out < frame_len) {
+                    frame->header.flags = COLLECTOR_FLAG_DEFLATE;
+                    frame->header.payload_len = collector_zstream.total_out;
+                    frame->payload = out;
+                }
+            }
+            
+            pos += frame_len;
+            count++;
+        }
+        
+        int sent = 0;
+        if (collector_fd != -1 && collector_spool_offset >= collector_spool_len) {
+            sent = collector_send_frames(frames, count);
+            if (sent < count) {
+                collector_disconnect(strerror(errno));
+            }
+        }
+        if (sent < count) {
+            collector_spool_frames(frames + sent, count - sent);
+        }
+    }
+}
+
+void* collector_thread_func(void* arg) {
+    (void)arg;
+    thread_set_role("collector");
+    
+    for (;;) {
+        pthread_mutex_lock(&collector_mutex);
+        
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += collector_flush_ms / 1000;
+        deadline.tv_nsec += (collector_flush_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        
+        while (!collector_stopping && collector_stage_len < collector_batch_bytes) {
+            if (pthread_cond_timedwait(&collector_cond, &collector_mutex, &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+        
+        // Swap buffers so producers keep staging while this batch ships
+        char *outbox = collector_stage;
+        collector_stage = collector_outbox;
+        collector_outbox = outbox;
+        size_t len = collector_stage_len;
+        collector_stage_len = 0;
+        int stopping = collector_stopping;
+        
+        pthread_mutex_unlock(&collector_mutex);
+        
+        collector_ship(outbox, len);
+        
+        if (stopping) break;
+    }
+    
+    if (collector_fd != -1) {
+        close(collector_fd);
+        collector_fd = -1;
+    }
+    return NULL;
+}
+
+// Ship whatever is still staged, then stop the collector thread
+void collector_shutdown() {
+    if (!collector_enabled) return;
+    
+    pthread_mutex_lock(&collector_mutex);
+    collector_stopping = 1;
+    pthread_cond_signal(&collector_cond);
+    pthread_mutex_unlock(&collector_mutex);
+    pthread_join(collector_thread, NULL);
+    
+    collector_enabled = 0;
+    if (collector_compress) {
+        deflateEnd(&collector_zstream);
+    }
+    if (collector_spool_fd != -1) {
+        close(collector_spool_fd);
+        collector_spool_fd = -1;
+    }
+    free(collector_stage);
+    free(collector_outbox);
+    free(collector_zbuf);
+    free(collector_drain_buf);
+    collector_stage = collector_outbox = collector_zbuf = collector_drain_buf = NULL;
+}
+
+// ===== REPLICATION SINK =====
+
+#define REPLICA_INFLIGHT_MAX 4096
+
+typedef struct {
+    uint64_t batch_seq;
+    off_t end_offset;
+} replica_inflight_t;
+
+// Persisted in REPLICA_STATE_FILE so replay resumes across restarts
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t next_seq;
+    uint64_t acked_seq;
+    uint64_t acked_offset;
+} replica_state_t;
+
+// Connection and spool state below is only touched by the replica thread
+static int replica_fd = -1;
+static long replica_backoff_ms = COLLECTOR_BACKOFF_MIN_MS;
+static struct timespec replica_next_attempt = {0, 0};
+static int replica_connected_once = 0;
+static int replica_spool_fd = -1;
+static int replica_state_fd = -1;
+static off_t replica_spool_len = 0;
+static off_t replica_send_offset = 0;
+static uint64_t replica_next_seq = 1;
+static uint64_t replica_acked_seq = 0;
+static off_t replica_acked_offset = 0;
+static replica_inflight_t replica_inflight[REPLICA_INFLIGHT_MAX];
+static size_t replica_inflight_head = 0;
+static size_t replica_inflight_count = 0;
+static char replica_ack_buf[sizeof(replica_ack_t)];
+static size_t replica_ack_len = 0;
+static z_stream replica_zstream;
+static char *replica_zbuf = NULL;
+static size_t replica_zcapacity = 0;
+static char *replica_io_buf = NULL;
+
+static void replica_save_state() {
+    if (replica_state_fd == -1) return;
+    
+    replica_state_t state = {
+        .magic = REPLICA_STATE_MAGIC,
+        .version = REPLICA_VERSION,
+        .next_seq = replica_next_seq,
+        .acked_seq = replica_acked_seq,
+        .acked_offset = replica_acked_offset
+    };
+    if (pwrite(replica_state_fd, &state, sizeof(state), 0) != sizeof(state)) {
+        log_event("[WARN] Failed to persist replication state");
+    }
+}
+
+static void replica_load_state() {
+    replica_state_t state;
+    if (pread(replica_state_fd, &state, sizeof(state), 0) != sizeof(state) ||
+        state.magic != REPLICA_STATE_MAGIC || state.version != REPLICA_VERSION) {
+        return;
+    }
+    
+    replica_next_seq = state.next_seq;
+    replica_acked_seq = state.acked_seq;
+    replica_acked_offset = state.acked_offset;
+    if (replica_acked_offset > replica_spool_len) {
+        // Spool was truncated or replaced underneath us
+        replica_acked_offset = replica_spool_len;
+    }
+}
+
+int replica_init() {
+    replica_stage_capacity = replica_batch_bytes * REPLICA_STAGE_BATCHES;
+    replica_stage = malloc(replica_stage_capacity);
+    replica_outbox = malloc(replica_stage_capacity);
+    replica_zcapacity = compressBound(REPLICA_MAX_BATCH_KB * 1024);
+    replica_zbuf = malloc(replica_zcapacity);
+    replica_io_buf = malloc(replica_zcapacity + sizeof(replica_batch_header_t));
+    
+    if (!replica_stage || !replica_outbox || !replica_zbuf || !replica_io_buf) {
+        log_event("[ERROR] Failed to allocate replication buffers");
+        return -1;
+    }
+    
+    memset(&replica_zstream, 0, sizeof(replica_zstream));
+    if (replica_compress && deflateInit(&replica_zstream, Z_DEFAULT_COMPRESSION) != Z_OK) {
+        log_event("[WARN] Replication compression unavailable, sending raw batches");
+        replica_compress = 0;
+    }
+    
+    replica_spool_fd = open(replica_spool_path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (replica_spool_fd == -1) {
+        char error_msg[MAX_PATH_LEN + 64];
+        snprintf(error_msg, sizeof(error_msg), "[ERROR] Cannot open replication spool %s: %s",
+                replica_spool_path, strerror(errno));
+        log_event(error_msg);
+        return -1;
+    }
+    struct stat spool_stat;
+    if (fstat(replica_spool_fd, &spool_stat) == 0) {
+        replica_spool_len = spool_stat.st_size;
+    }
+    
+    char state_path[MAX_PATH_LEN + sizeof(".state")];
+    snprintf(state_path, sizeof(state_path), "%s.state", replica_spool_path);
+    replica_state_fd = open(state_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (replica_state_fd != -1) {
+        replica_load_state();
+    }
+    replica_send_offset = replica_acked_offset;
+    
+    if (!replica_source[0]) {
+        // "<host>/<instance>": unique per working directory, stable across
+        // restarts, and the host part lets the aggregator de-duplicate
+        // monitors with overlapping watches on the same machine
+        char host[48] = "", cwd[MAX_PATH_LEN];
+        gethostname(host, sizeof(host) - 1);
+        uLong cwd_crc = getcwd(cwd, sizeof(cwd)) ?
+                        crc32(0L, (const Bytef *)cwd, strlen(cwd)) : 0;
+        snprintf(replica_source, sizeof(replica_source), "%s/%08lx", host, cwd_crc);
+    }
+    
+    replica_enabled = 1;
+    if (pthread_create(&replica_thread, NULL, replica_thread_func, NULL) != 0) {
+        replica_enabled = 0;
+        log_event("[ERROR] Failed to create replication thread");
+        return -1;
+    }
+    
+    char msg[MAX_PATH_LEN + 256];
+    snprintf(msg, sizeof(msg),
+            "[REPLICA] Replicating events to %s as '%s' (batch=%zuKB, flush=%dms, "
+            "compress=%s, next batch=%llu, unacked spool=%lld bytes)",
+            replica_target, replica_source, replica_batch_bytes / 1024, replica_flush_ms,
+            replica_compress ? "yes" : "no", (unsigned long long)replica_next_seq,
+            (long long)(replica_spool_len - replica_acked_offset));
+    log_event(msg);
+    return 0;
+}
+
+// Append one binary event record to the stage buffer. Called from the
+// event path; copies into preallocated memory only. The record carries the
+// wall-clock time the event was read, which the aggregator orders by.
+void replica_submit(const event_time_t *time, uint32_t mask, const char *path, size_t path_len) {
+    replica_record_t record = {
+        .timestamp_ns = time->realtime_ns,
+        .mask = mask,
+        .path_len = path_len,
+        .reserved = 0
+    };
+    size_t record_len = sizeof(record) + path_len;
+    
+    pthread_mutex_lock(&replica_mutex);
+    if (replica_stage_len + record_len > replica_stage_capacity) {
+        stats.replica_records_dropped++;
+    } else {
+        memcpy(replica_stage + replica_stage_len, &record, sizeof(record));
+        memcpy(replica_stage + replica_stage_len + sizeof(record), path, path_len);
+        replica_stage_len += record_len;
+        if (replica_stage_len >= replica_batch_bytes) {
+            pthread_cond_signal(&replica_cond);
+        }
+    }
+    pthread_mutex_unlock(&replica_mutex);
+}
+
+static void replica_schedule_retry() {
+    clock_gettime(CLOCK_MONOTONIC, &replica_next_attempt);
+    replica_next_attempt.tv_sec += replica_backoff_ms / 1000;
+    replica_next_attempt.tv_nsec += (replica_backoff_ms % 1000) * 1000000;
+    if (replica_next_attempt.tv_nsec >= 1000000000) {
+        replica_next_attempt.tv_sec++;
+        replica_next_attempt.tv_nsec -= 1000000000;
+    }
+    replica_backoff_ms *= 2;
+    if (replica_backoff_ms > COLLECTOR_BACKOFF_MAX_MS) {
+        replica_backoff_ms = COLLECTOR_BACKOFF_MAX_MS;
+    }
+}
+
+static void replica_disconnect(const char *reason) {
+    if (replica_fd != -1) {
+        close(replica_fd);
+        replica_fd = -1;
+    }
+    // Everything not acknowledged is replayed from the spool next time
+    replica_inflight_count = 0;
+    replica_ack_len = 0;
+    replica_send_offset = replica_acked_offset;
+    replica_schedule_retry();
+    
+    char msg[MAX_PATH_LEN + 128];
+    snprintf(msg, sizeof(msg), "[REPLICA] Connection to %s lost (%s)", replica_target, reason);
+    log_event(msg);
+}
+
+// Open a stream socket to "host:port" or "unix:/path" with a bounded
+// connect timeout. Shared with the aggregator's address parsing rules.
+int open_stream_connection(const char *target, int timeout_ms) {
+    int fd = -1;
+    
+    if (strncmp(target, "unix:", 5) == 0) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, target + 5, sizeof(addr.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd != -1 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+    
+    char host[256];
+    const char *colon = strrchr(target, ':');
+    if (!colon || colon == target || (size_t)(colon - target) >= sizeof(host)) {
+        errno = EINVAL;
+        return -1;
+    }
+    memcpy(host, target, colon - target);
+    host[colon - target] = '\0';
+    
+    struct addrinfo hints, *result = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, colon + 1, &hints, &result) != 0) {
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+    
+    for (struct addrinfo *ai = result; ai && fd == -1; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC | SOCK_NONBLOCK, ai->ai_protocol);
+        if (fd == -1) continue;
+        
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == -1) {
+            int connected = 0;
+            if (errno == EINPROGRESS) {
+                struct pollfd pfd = {fd, POLLOUT, 0};
+                int err = 0;
+                socklen_t err_len = sizeof(err);
+                if (poll(&pfd, 1, timeout_ms) == 1 &&
+                    getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &err_len) == 0 && err == 0) {
+                    connected = 1;
+                } else if (err) {
+                    errno = err;
+                }
+            }
+            if (!connected) {
+                close(fd);
+                fd = -1;
+                continue;
+            }
+        }
+        
+        int flags = fcntl(fd, F_GETFL);
+        fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    
+    freeaddrinfo(result);
+    return fd;
+}
+
+// Receive exactly len bytes, waiting at most timeout_ms for each chunk
+int recv_exact(int fd, void *buf, size_t len, int timeout_ms) {
+    char *p = buf;
+    while (len > 0) {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, timeout_ms) != 1) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        ssize_t n = recv(fd, p, len, 0);
+        if (n == 0) {
+            errno = ECONNRESET;
+            return -1;
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int replica_send_all(const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = send(replica_fd, p, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Apply a cumulative acknowledgement from the aggregator
+static void replica_apply_ack(uint64_t batch_seq) {
+    while (replica_inflight_count > 0) {
+        replica_inflight_t *entry = &replica_inflight[replica_inflight_head];
+        if (entry->batch_seq > batch_seq) break;
+        replica_acked_offset = entry->end_offset;
+        replica_inflight_head = (replica_inflight_head + 1) % REPLICA_INFLIGHT_MAX;
+        replica_inflight_count--;
+        stats.replica_batches_acked++;
+    }
+    if (batch_seq > replica_acked_seq) {
+        replica_acked_seq = batch_seq;
+    }
+}
+
+// Read whatever acknowledgements are pending, waiting up to timeout_ms
+static int replica_read_acks(int timeout_ms) {
+    struct pollfd pfd = {replica_fd, POLLIN, 0};
+    while (poll(&pfd, 1, timeout_ms) == 1) {
+        ssize_t n = recv(replica_fd, replica_ack_buf + replica_ack_len,
+                         sizeof(replica_ack_buf) - replica_ack_len, MSG_DONTWAIT);
+        if (n == 0) {
+            errno = ECONNRESET;
+            return -1;
+        }
+        if (n < 0 && errno != EAGAIN && errno != EINTR) {
+            return -1;
+        }
+        if (n > 0) {
+            replica_ack_len += n;
+        }
+        if (replica_ack_len == sizeof(replica_ack_t)) {
+            replica_ack_t ack;
+            memcpy(&ack, replica_ack_buf, sizeof(ack));
+            replica_ack_len = 0;
+            if (ack.magic != REPLICA_ACK_MAGIC) {
+                errno = EPROTO;
+                return -1;
+            }
+            replica_apply_ack(ack.batch_seq);
+        }
+        timeout_ms = 0;
+    }
+    return 0;
+}
+
+// The aggregator holds a batch we have not numbered yet, so our spool or
+// state file was lost and numbering restarted. Accepting that ack would
+// skip every new batch as already delivered; instead renumber the unsent
+// spool above it. Only the header changes, the CRC covers the payload.
+static int replica_renumber_spool(uint64_t aggregator_seq) {
+    // The spool fd is O_APPEND, which makes pwrite() append on Linux
+    int fd = open(replica_spool_path, O_WRONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    
+    uint64_t seq = aggregator_seq;
+    off_t offset = replica_acked_offset;
+    while (offset < replica_spool_len) {
+        replica_batch_header_t header;
+        if (pread(replica_spool_fd, &header, sizeof(header), offset) != sizeof(header) ||
+            header.magic != REPLICA_BATCH_MAGIC) {
+            // replica_send_spooled() discards the corrupt remainder
+            break;
+        }
+        header.batch_seq = ++seq;
+        if (pwrite(fd, &header.batch_seq, sizeof(header.batch_seq),
+                   offset + offsetof(replica_batch_header_t, batch_seq)) != sizeof(header.batch_seq)) {
+            close(fd);
+            return -1;
+        }
+        offset += sizeof(header) + header.payload_len;
+    }
+    close(fd);
+    
+    char msg[MAX_PATH_LEN + 256];
+    snprintf(msg, sizeof(msg),
+            "[ERROR] Aggregator %s already has batch %llu but the next local batch is %llu; "
+            "replication state was lost, renumbered %llu unsent batches from %llu",
+            replica_target, (unsigned long long)aggregator_seq, (unsigned long long)replica_next_seq,
+            (unsigned long long)(seq - aggregator_seq), (unsigned long long)aggregator_seq + 1);
+    log_event(msg);
+    
+    replica_acked_seq = aggregator_seq;
+    replica_next_seq = seq + 1;
+    replica_save_state();
+    return 0;
+}
+
+// Connect, introduce ourselves, and learn the last batch the aggregator
+// already holds so replay can skip it
+static int replica_connect() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec < replica_next_attempt.tv_sec ||
+        (now.tv_sec == replica_next_attempt.tv_sec && now.tv_nsec < replica_next_attempt.tv_nsec)) {
+        return -1;
+    }
+    
+    replica_fd = open_stream_connection(replica_target, 2000);
+    if (replica_fd == -1) {
+        replica_schedule_retry();
+        return -1;
+    }
+    struct timeval timeout = {2, 0};
+    setsockopt(replica_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    
+    replica_hello_t hello;
+    memset(&hello, 0, sizeof(hello));
+    hello.magic = REPLICA_HELLO_MAGIC;
+    hello.version = REPLICA_VERSION;
+    memcpy(hello.source, replica_source, sizeof(hello.source));
+    
+    replica_ack_t ack;
+    if (replica_send_all(&hello, sizeof(hello)) != 0 ||
+        recv_exact(replica_fd, &ack, sizeof(ack), 2000) != 0 ||
+        ack.magic != REPLICA_ACK_MAGIC) {
+        replica_disconnect("handshake failed");
+        return -1;
+    }
+    if (ack.batch_seq >= replica_next_seq) {
+        if (replica_renumber_spool(ack.batch_seq) != 0) {
+            replica_disconnect("cannot renumber spool");
+            return -1;
+        }
+    } else {
+        replica_apply_ack(ack.batch_seq);
+    }
+    
+    replica_backoff_ms = COLLECTOR_BACKOFF_MIN_MS;
+    if (replica_connected_once) {
+        stats.replica_reconnects++;
+    }
+    replica_connected_once = 1;
+    replica_send_offset = replica_acked_offset;
+    
+    char msg[MAX_PATH_LEN + 128];
+    snprintf(msg, sizeof(msg), "[REPLICA] Connected to %s (aggregator has batch %llu)",
+            replica_target, (unsigned long long)replica_acked_seq);
+    log_event(msg);
+    return 0;
+}
+
+// Send spooled batches from replica_send_offset, skipping any the
+// aggregator already acknowledged
+static int replica_send_spooled() {
+    while (replica_send_offset < replica_spool_len &&
+           replica_inflight_count < REPLICA_INFLIGHT_MAX) {
+        replica_batch_header_t header;
+        if (pread(replica_spool_fd, &header, sizeof(header), replica_send_offset) != sizeof(header) ||
+            header.magic != REPLICA_BATCH_MAGIC || header.payload_len > replica_zcapacity) {
+            log_event("[WARN] Replication spool is corrupt, discarding remainder");
+            replica_spool_len = replica_send_offset;
+            if (ftruncate(replica_spool_fd, replica_spool_len) != 0) {
+                return -1;
+            }
+            break;
+        }
+        
+        off_t end_offset = replica_send_offset + sizeof(header) + header.payload_len;
+        if (header.batch_seq <= replica_acked_seq) {
+            if (replica_inflight_count == 0) {
+                replica_acked_offset = end_offset;
+            }
+            replica_send_offset = end_offset;
+            continue;
+        }
+        
+        size_t frame_len = sizeof(header) + header.payload_len;
+        if (pread(replica_spool_fd, replica_io_buf, frame_len, replica_send_offset) != (ssize_t)frame_len ||
+            replica_send_all(replica_io_buf, frame_len) != 0) {
+            return -1;
+        }
+        
+        size_t slot = (replica_inflight_head + replica_inflight_count) % REPLICA_INFLIGHT_MAX;
+        replica_inflight[slot].batch_seq = header.batch_seq;
+        replica_inflight[slot].end_offset = end_offset;
+        replica_inflight_count++;
+        replica_send_offset = end_offset;
+        stats.replica_batches_sent++;
+        
+        if (replica_read_acks(0) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Drop the acknowledged prefix of the spool once it is fully drained
+static void replica_trim_spool() {
+    if (replica_acked_offset > 0 && replica_acked_offset == replica_spool_len &&
+        replica_inflight_count == 0) {
+        if (ftruncate(replica_spool_fd, 0) == 0) {
+            replica_spool_len = 0;
+            replica_acked_offset = 0;
+            replica_send_offset = 0;
+        }
+    }
+}
+
+// Cut staged records into batches of whole records, compress, number, and
+// append each batch to the spool (write-ahead of the network send)
+static void replica_spool_records(const char *data, size_t len) {
+    size_t pos = 0;
+    while (pos < len) {
+        size_t batch_len = 0;
+        uint32_t record_count = 0;
+        while (pos + batch_len < len) {
+            replica_record_t record;
+            memcpy(&record, data + pos + batch_len, sizeof(record));
+            size_t record_len = sizeof(record) + record.path_len;
+            if (batch_len > 0 && batch_len + record_len > replica_batch_bytes) break;
+            batch_len += record_len;
+            record_count++;
+        }
+        
+        replica_batch_header_t header = {
+            .magic = REPLICA_BATCH_MAGIC,
+            .version = REPLICA_VERSION,
+            .flags = 0,
+            .batch_seq = replica_next_seq,
+            .record_count = record_count,
+            .raw_len = batch_len,
+            .payload_len = batch_len,
+            .crc = 0
+        };
+        const char *payload = data + pos;
+        
+        if (replica_compress) {
+            deflateReset(&replica_zstream);
+            replica_zstream.next_in = (Bytef *)payload;
+            replica_zstream.avail_in = batch_len;
+            replica_zstream.next_out = (Bytef *)replica_zbuf;
+            replica_zstream.avail_out = replica_zcapacity;
+            if (deflate(&replica_zstream, Z_FINISH) == Z_STREAM_END &&
+                replica_zstream.total_out < batch_len) {
+                header.flags = REPLICA_FLAG_DEFLATE;
+                header.payload_len = replica_zstream.total_out;
+                payload = replica_zbuf;
+            }
+        }
+        header.crc = crc32(0L, (const Bytef *)payload, header.payload_len);
+        pos += batch_len;
+        
+        if (replica_spool_len + (off_t)(sizeof(header) + header.payload_len) >
+            (off_t)REPLICA_SPOOL_MAX_MB * 1024 * 1024) {
+            stats.replica_records_dropped += record_count;
+            continue;
+        }
+        
+        struct iovec iov[2] = {
+            {&header, sizeof(header)},
+            {(void *)payload, header.payload_len}
+        };
+        ssize_t n = writev(replica_spool_fd, iov, 2);
+        if (n != (ssize_t)(sizeof(header) + header.payload_len)) {
+            stats.replica_records_dropped += record_count;
+            continue;
+        }
+        replica_spool_len += n;
+        replica_next_seq++;
+    }
+}
+
+void* replica_thread_func(void* arg) {
+    (void)arg;
+    thread_set_role("replica");
+    
+    for (;;) {
+        pthread_mutex_lock(&replica_mutex);
+        
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += replica_flush_ms / 1000;
+        deadline.tv_nsec += (replica_flush_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        
+        while (!replica_stopping && replica_stage_len < replica_batch_bytes) {
+            if (pthread_cond_timedwait(&replica_cond, &replica_mutex, &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+        
+        char *outbox = replica_stage;
+        replica_stage = replica_outbox;
+        replica_outbox = outbox;
+        size_t len = replica_stage_len;
+        replica_stage_len = 0;
+        int stopping = replica_stopping;
+        
+        pthread_mutex_unlock(&replica_mutex);
+        
+        uint64_t seq_before = replica_next_seq;
+        uint64_t acked_before = replica_acked_seq;
+        replica_spool_records(outbox, len);
+        
+        if (replica_fd == -1) {
+            replica_connect();
+        }
+        if (replica_fd != -1) {
+            if (replica_read_acks(0) != 0 || replica_send_spooled() != 0) {
+                replica_disconnect(strerror(errno));
+            } else if (stopping && replica_inflight_count > 0) {
+                // Give the aggregator a moment to confirm the final batches
+                replica_read_acks(1000);
+            }
+        }
+        
+        replica_trim_spool();
+        if (replica_next_seq != seq_before || replica_acked_seq != acked_before) {
+            replica_save_state();
+        }
+        
+        if (stopping) break;
+    }
+    
+    replica_save_state();
+    if (replica_fd != -1) {
+        close(replica_fd);
+        replica_fd = -1;
+    }
+    return NULL;
+}
+
+void replica_shutdown() {
+    if (!replica_enabled) return;
+    
+    pthread_mutex_lock(&replica_mutex);
+    replica_stopping = 1;
+    pthread_cond_signal(&replica_cond);
+    pthread_mutex_unlock(&replica_mutex);
+    pthread_join(replica_thread, NULL);
+    
+    replica_enabled = 0;
+    if (replica_compress) {
+        deflateEnd(&replica_zstream);
+    }
+    if (replica_spool_fd != -1) {
+        close(replica_spool_fd);
+        replica_spool_fd = -1;
+    }
+    if (replica_state_fd != -1) {
+        close(replica_state_fd);
+        replica_state_fd = -1;
+    }
+    free(replica_stage);
+    free(replica_outbox);
+    free(replica_zbuf);
+    free(replica_io_buf);
+    replica_stage = replica_outbox = replica_zbuf = replica_io_buf = NULL;
+}
+
+// ===== FILE TREE =====
+
+// With file_tree=true every path seen in an event becomes a node. A node's
+// clock is the sequence number of its last event and max_clock the newest
+// clock in its subtree. Children are kept most-recently-changed first, so
+// a "since" query stops at the first child whose subtree is older and
+// costs O(changed entries x depth) instead of O(tree). Directory usage and
+// enrichment hang their data off the same nodes.
+//
+// Deleted paths stay as tombstones so queries can report them. Once
+// nothing needs a childless node any more (a tombstone older than
+// file_tree_tombstone_sec, a measured file that is gone, a node without a
+// metadata cache entry) the stats thread unlinks it and puts it on a free
+// list. Live nodes keep their index. A query whose clock is older than
+// the newest pruned tombstone is answered with is_fresh_instance.
+typedef struct {
+    uint32_t parent;        // TREE_NONE for a node on the free list
+    uint32_t first_child;
+    uint32_t last_child;
+    uint32_t prev_sibling;
+    uint32_t next_sibling;  // next free node while on the free list
+    uint32_t name_off;
+    uint16_t name_len;
+    uint8_t is_dir;
+    uint8_t exists;
+    uint32_t seen_sec;      // monotonic second of the last recorded event
+    uint64_t clock;
+    uint64_t max_clock;
+} tree_node_t;
+
+// Bytes and files at or below a node (see DIRECTORY USAGE)
+typedef struct {
+    uint64_t bytes;
+    uint64_t files;
+    uint64_t stat_ns;       // read time of the batch that last measured a file
+} tree_usage_t;
+
+#define TREE_NONE UINT32_MAX
+#define TREE_CREATE_QUIET 2 // create a node without a clock, at the end of its parent's list
+#define TREE_PRUNE_MIN 4096 // nodes a prune pass must be able to free to be worth it
+
+static tree_node_t *tree_nodes = NULL;
+static uint32_t tree_node_count = 0;
+static uint32_t tree_node_capacity = 0;
+static tree_usage_t *tree_usage = NULL;     // parallel to tree_nodes with disk_usage=true
+static uint32_t tree_usage_capacity = 0;
+static char *tree_names = NULL;
+static size_t tree_names_len = 0;
+static size_t tree_names_capacity = 0;
+static uint32_t *tree_slots = NULL;         // open-addressed (parent, name) index
+static size_t tree_slot_capacity = 0;
+static uint64_t tree_start_clock = 1;       // first sequence number this tree can see
+static uint32_t tree_free_head = TREE_NONE;
+static uint32_t tree_free_count = 0;
+static uint32_t tree_live_after_prune = 0;
+static uint32_t tree_prune_young = 0;       // tombstones last seen too young to prune
+static uint64_t tree_prune_young_due = 0;   // when all of them will be old enough
+static uint64_t tree_pruned_clock = 0;      // newest clock of a pruned tombstone
+static uint64_t tree_pruned_total = 0;
+static uint64_t tree_prunes = 0;            // generation; node indices may be reused
+static char tree_cached_dir[MAX_PATH_LEN];  // last directory resolved
+static size_t tree_cached_dir_len = (size_t)-1;
+static uint32_t tree_cached_dir_node = TREE_NONE;
+static pthread_mutex_t tree_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t fnv1a(const void *data, size_t len, uint64_t hash) {
+    const unsigned char *p = data;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static uint64_t tree_hash(uint32_t parent, const char *name, size_t len) {
+    return fnv1a(name, len, 0xcbf29ce484222325ULL ^ ((uint64_t)parent * 0x9e3779b97f4a7c15ULL));
+}
+
+static int tree_rehash(size_t capacity) {
+    uint32_t *slots = malloc(capacity * sizeof(uint32_t));
+    if (!slots) return -1;
+    memset(slots, 0xff, capacity * sizeof(uint32_t));
+    
+    for (uint32_t i = 1; i < tree_node_count; i++) {
+        tree_node_t *node = &tree_nodes[i];
+        if (node->parent == TREE_NONE) continue;
+        size_t slot = tree_hash(node->parent, tree_names + node->name_off, node->name_len) & (capacity - 1);
+        while (slots[slot] != TREE_NONE) {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        slots[slot] = i;
+    }
+    free(tree_slots);
+    tree_slots = slots;
+    tree_slot_capacity = capacity;
+    return 0;
+}
+
+int tree_init(uint64_t start_clock) {
+    tree_start_clock = start_clock;
+    tree_node_capacity = 1024;
+    tree_nodes = malloc(tree_node_capacity * sizeof(tree_node_t));
+    tree_names_capacity = 64 * 1024;
+    tree_names = malloc(tree_names_capacity);
+    if (!tree_nodes || !tree_names) return -1;
+    
+    // Node 0 is the root; "/a" and "a" both hang below it
+    memset(&tree_nodes[0], 0, sizeof(tree_node_t));
+    tree_nodes[0].parent = TREE_NONE;
+    tree_nodes[0].first_child = TREE_NONE;
+    tree_nodes[0].last_child = TREE_NONE;
+    tree_nodes[0].prev_sibling = TREE_NONE;
+    tree_nodes[0].next_sibling = TREE_NONE;
+    tree_nodes[0].is_dir = 1;
+    tree_nodes[0].exists = 1;
+    tree_node_count = 1;
+    if (disk_usage) {
+        tree_usage = calloc(tree_node_capacity, sizeof(tree_usage_t));
+        if (!tree_usage) return -1;
+        tree_usage_capacity = tree_node_capacity;
+    }
+    return tree_rehash(4096);
+}
+
+static void tree_unlink_child(tree_node_t *parent, uint32_t idx) {
+    tree_node_t *node = &tree_nodes[idx];
+    if (node->prev_sibling != TREE_NONE) {
+        tree_nodes[node->prev_sibling].next_sibling = node->next_sibling;
+    } else {
+        parent->first_child = node->next_sibling;
+    }
+    if (node->next_sibling != TREE_NONE) {
+        tree_nodes[node->next_sibling].prev_sibling = node->prev_sibling;
+    } else {
+        parent->last_child = node->prev_sibling;
+    }
+}
+
+static void tree_push_child(tree_node_t *parent, uint32_t idx) {
+    tree_node_t *node = &tree_nodes[idx];
+    node->prev_sibling = TREE_NONE;
+    node->next_sibling = parent->first_child;
+    if (parent->first_child != TREE_NONE) {
+        tree_nodes[parent->first_child].prev_sibling = idx;
+    } else {
+        parent->last_child = idx;
+    }
+    parent->first_child = idx;
+}
+
+// Nodes without a clock go last, where the most-recent-first order puts them
+static void tree_append_child(tree_node_t *parent, uint32_t idx) {
+    tree_node_t *node = &tree_nodes[idx];
+    node->next_sibling = TREE_NONE;
+    node->prev_sibling = parent->last_child;
+    if (parent->last_child != TREE_NONE) {
+        tree_nodes[parent->last_child].next_sibling = idx;
+    } else {
+        parent->first_child = idx;
+    }
+    parent->last_child = idx;
+}
+
+// Find (or create) the child of parent called name. A node created for an
+// event goes first; one created with TREE_CREATE_QUIET goes last. Caller
+// holds tree_mutex.
+static uint32_t tree_child(uint32_t parent, const char *name, size_t len, int create) {
+    size_t slot = tree_hash(parent, name, len) & (tree_slot_capacity - 1);
+    while (tree_slots[slot] != TREE_NONE) {
+        tree_node_t *node = &tree_nodes[tree_slots[slot]];
+        if (node->parent == parent && node->name_len == len &&
+            memcmp(tree_names + node->name_off, name, len) == 0) {
+            return tree_slots[slot];
+        }
+        slot = (slot + 1) & (tree_slot_capacity - 1);
+    }
+    if (!create || len > UINT16_MAX) return TREE_NONE;
+    
+    // Indices and name offsets are 32-bit; refuse to wrap them
+    if (tree_names_len + len > UINT32_MAX) return TREE_NONE;
+    if (tree_free_head == TREE_NONE && tree_node_count == tree_node_capacity) {
+        if (tree_node_capacity > (TREE_NONE - 1) / 2) return TREE_NONE;
+        tree_node_t *grown = realloc(tree_nodes, tree_node_capacity * 2 * sizeof(tree_node_t));
+        if (!grown) return TREE_NONE;
+        tree_nodes = grown;
+        tree_node_capacity *= 2;
+    }
+    if (tree_usage && tree_usage_capacity < tree_node_capacity) {
+        tree_usage_t *grown = realloc(tree_usage, tree_node_capacity * sizeof(tree_usage_t));
+        if (!grown) return TREE_NONE;
+        tree_usage = grown;
+        tree_usage_capacity = tree_node_capacity;
+    }
+    if (tree_names_len + len > tree_names_capacity) {
+        size_t capacity = tree_names_capacity * 2 + len;
+        char *grown = realloc(tree_names, capacity);
+        if (!grown) return TREE_NONE;
+        tree_names = grown;
+        tree_names_capacity = capacity;
+    }
+    
+    uint32_t idx;
+    if (tree_free_head != TREE_NONE) {
+        idx = tree_free_head;
+        tree_free_head = tree_nodes[idx].next_sibling;
+        tree_free_count--;
+    } else {
+        idx = tree_node_count++;
+    }
+    tree_node_t *node = &tree_nodes[idx];
+    memset(node, 0, sizeof(*node));
+    node->parent = parent;
+    node->first_child = TREE_NONE;
+    node->last_child = TREE_NONE;
+    node->name_off = tree_names_len;
+    node->name_len = len;
+    node->is_dir = 1;       // until an event says otherwise
+    node->exists = 1;
+    memcpy(tree_names + tree_names_len, name, len);
+    tree_names_len += len;
+    if (create == TREE_CREATE_QUIET) {
+        tree_append_child(&tree_nodes[parent], idx);
+    } else {
+        tree_push_child(&tree_nodes[parent], idx);
+    }
+    if (tree_usage) {
+        memset(&tree_usage[idx], 0, sizeof(tree_usage_t));
+    }
+    
+    tree_slots[slot] = idx;
+    if ((size_t)tree_node_count * 10 > tree_slot_capacity * 7) {
+        tree_rehash(tree_slot_capacity * 2);
+    }
+    return idx;
+}
+
+// Resolve a '/'-separated path to a node. Caller holds tree_mutex.
+static uint32_t tree_lookup(const char *path, size_t len, int create) {
+    uint32_t node = 0;
+    size_t pos = 0;
+    while (pos < len && node != TREE_NONE) {
+        const char *slash = memchr(path + pos, '/', len - pos);
+        size_t end = slash ? (size_t)(slash - path) : len;
+        if (end > pos) {
+            node = tree_child(node, path + pos, end - pos, create);
+        }
+        pos = end + 1;
+    }
+    return node;
+}
+
+// Resolve a file's path to a node. The parent directory of consecutive
+// events is almost always the same, so it is resolved once and cached.
+// Caller holds tree_mutex.
+static uint32_t tree_path_node(const char *path, size_t path_len, int create) {
+    const char *slash = memrchr(path, '/', path_len);
+    size_t dir_len = slash ? (size_t)(slash - path) : 0;
+    const char *name = slash ? slash + 1 : path;
+    size_t name_len = path_len - (name - path);
+    
+    uint32_t dir = tree_cached_dir_node;
+    if (dir_len != tree_cached_dir_len || memcmp(path, tree_cached_dir, dir_len) != 0) {
+        dir = tree_lookup(path, dir_len, create);
+        if (dir == TREE_NONE) return TREE_NONE;
+        memcpy(tree_cached_dir, path, dir_len);
+        tree_cached_dir_len = dir_len;
+        tree_cached_dir_node = dir;
+    }
+    return tree_child(dir, name, name_len, create);
+}
+
+// Record one event, read at time
+void tree_record(uint32_t mask, const char *path, size_t path_len, uint64_t clock, const event_time_t *time) {
+    pthread_mutex_lock(&tree_mutex);
+    if (!tree_nodes) {
+        pthread_mutex_unlock(&tree_mutex);
+        return;
+    }
+    uint32_t idx = tree_path_node(path, path_len, 1);
+    if (idx == TREE_NONE) {
+        pthread_mutex_unlock(&tree_mutex);
+        return;
+    }
+    
+    tree_node_t *node = &tree_nodes[idx];
+    if (clock < node->clock) {
+        // Recorded out of order; the node already reflects a later event
+        pthread_mutex_unlock(&tree_mutex);
+        return;
+    }
+    node->clock = clock;
+    node->seen_sec = (uint32_t)(time->monotonic_ns / 1000000000ULL);
+    node->is_dir = (mask & IN_ISDIR) != 0;
+    if (mask & (IN_DELETE | IN_MOVED_FROM)) {
+        node->exists = 0;
+    } else if (mask & (IN_CREATE | IN_MOVED_TO)) {
+        node->exists = 1;
+    }
+    
+    // Bubble the new clock up and keep every ancestor at the front of its
+    // parent's child list. max_clock never moves backwards, which the
+    // early exit in tree_query_walk relies on.
+    while (idx != 0) {
+        node = &tree_nodes[idx];
+        if (clock > node->max_clock) node->max_clock = clock;
+        tree_node_t *parent = &tree_nodes[node->parent];
+        if (parent->first_child != idx) {
+            tree_unlink_child(parent, idx);
+            tree_push_child(parent, idx);
+        }
+        idx = node->parent;
+    }
+    if (clock > tree_nodes[0].max_clock) tree_nodes[0].max_clock = clock;
+    pthread_mutex_unlock(&tree_mutex);
+}
+
+typedef struct {
+    uint64_t now_ns;
+    uint64_t seed_horizon;  // a usage stamp at least this new must stay
+    uint32_t freed;
+    uint64_t age_ns;
+    uint32_t young;         // prunable but for their age
+    uint64_t young_due;     // when the newest of them is old enough
+    uint64_t freed_clock;
+} tree_prune_t;
+
+// Post-order, so a directory emptied by the pass can go too. inherited is
+// the removal stamp of the nearest measured-empty ancestor. Caller holds
+// tree_mutex.
+static void tree_prune_walk(tree_prune_t *prune, uint32_t dir, uint64_t inherited) {
+    uint32_t idx = tree_nodes[dir].first_child;
+    while (idx != TREE_NONE) {
+        tree_node_t *node = &tree_nodes[idx];
+        uint32_t next = node->next_sibling;
+        uint64_t stamp = inherited;
+        if (tree_usage && (tree_usage[idx].bytes || tree_usage[idx].files)) {
+            stamp = 0;
+        } else if (tree_usage && tree_usage[idx].stat_ns) {
+            stamp = tree_usage[idx].stat_ns;
+        }
+        if (node->first_child != TREE_NONE) {
+            tree_prune_walk(prune, idx, stamp);
+        }
+        if (node->first_child != TREE_NONE || enrich_cached(idx)) {
+            idx = next;
+            continue;
+        }
+        
+        // Live paths keep their node, so do removals that are too recent
+        // (young) or that a running seed still has to see
+        uint64_t newest = 0;
+        if (file_tree_enabled && node->clock) {
+            if (node->exists) {
+                idx = next;
+                continue;
+            }
+            newest = (uint64_t)(node->seen_sec + 1) * 1000000000ULL;
+        }
+        if (tree_usage) {
+            if (!stamp || (prune->seed_horizon && stamp >= prune->seed_horizon)) {
+                idx = next;
+                continue;
+            }
+            if (stamp > newest) newest = stamp;
+        }
+        if (newest > prune->now_ns - prune->age_ns) {
+            prune->young++;
+            if (newest + prune->age_ns > prune->young_due) prune->young_due = newest + prune->age_ns;
+            idx = next;
+            continue;
+        }
+        
+        if (file_tree_enabled && node->max_clock > prune->freed_clock) {
+            prune->freed_clock = node->max_clock;
+        }
+        tree_unlink_child(&tree_nodes[dir], idx);
+        node->parent = TREE_NONE;
+        node->next_sibling = tree_free_head;
+        tree_free_head = idx;
+        tree_free_count++;
+        prune->freed++;
+        idx = next;
+    }
+}
+
+// Copy the names of live nodes to a buffer of their own size
+static void tree_compact_names(size_t live_bytes) {
+    size_t capacity = live_bytes > 64 * 1024 ? live_bytes : 64 * 1024;
+    char *names = malloc(capacity);
+    if (!names) return;
+    size_t len = 0;
+    for (uint32_t i = 1; i < tree_node_count; i++) {
+        tree_node_t *node = &tree_nodes[i];
+        if (node->parent == TREE_NONE) continue;
+        memcpy(names + len, tree_names + node->name_off, node->name_len);
+        node->name_off = len;
+        len += node->name_len;
+    }
+    free(tree_names);
+    tree_names = names;
+    tree_names_len = len;
+    tree_names_capacity = capacity;
+}
+
+// Free the nodes nothing needs any more (stats thread, every second).
+// A pass costs a walk of the whole tree, so it only runs once the tree
+// has grown by a quarter since the last one, or once that growth plus the
+// nodes the last pass found too young add up to as much and those have
+// all aged.
+void tree_maintain() {
+    if (!tree_nodes || (disk_usage && !usage_seeded)) return;
+    event_time_t now;
+    event_time_now(&now);
+    uint64_t seed_horizon = tree_usage ? crawl_seed_horizon() : 0;
+    
+    pthread_mutex_lock(&tree_mutex);
+    uint32_t live = tree_node_count - tree_free_count;
+    uint32_t step = live / 4 > TREE_PRUNE_MIN ? live / 4 : TREE_PRUNE_MIN;
+    uint32_t grown = live > tree_live_after_prune ? live - tree_live_after_prune : 0;
+    if (grown < step &&
+        (grown + tree_prune_young < step || now.monotonic_ns < tree_prune_young_due)) {
+        pthread_mutex_unlock(&tree_mutex);
+        return;
+    }
+    
+    uint64_t age_ns = (uint64_t)file_tree_tombstone_sec * 1000000000ULL;
+    tree_prune_t prune = {0};
+    prune.now_ns = now.monotonic_ns;
+    prune.age_ns = age_ns < now.monotonic_ns ? age_ns : now.monotonic_ns;
+    prune.seed_horizon = seed_horizon;
+    tree_prune_walk(&prune, 0, 0);
+    
+    if (prune.freed) {
+        if (prune.freed_clock > tree_pruned_clock) tree_pruned_clock = prune.freed_clock;
+        tree_pruned_total += prune.freed;
+        tree_prunes++;
+        tree_cached_dir_len = (size_t)-1;
+        size_t live_bytes = 0;
+        for (uint32_t i = 1; i < tree_node_count; i++) {
+            if (tree_nodes[i].parent != TREE_NONE) live_bytes += tree_nodes[i].name_len;
+        }
+        if (tree_names_len > live_bytes * 2) tree_compact_names(live_bytes);
+        tree_rehash(tree_slot_capacity);
+    }
+    tree_live_after_prune = tree_node_count - tree_free_count;
+    tree_prune_young = prune.young;
+    tree_prune_young_due = prune.young_due;
+    pthread_mutex_unlock(&tree_mutex);
+}
+
+typedef struct {
+    uint64_t since;
+    const char *glob;
+    int glob_has_slash;
+    int type;               // 0 = any, 'f' or 'd'
+    json_object *files;
+    size_t visited;
+    char path[MAX_PATH_LEN];
+} tree_query_t;
+
+static void tree_query_walk(tree_query_t *query, uint32_t dir, size_t path_len) {
+    for (uint32_t idx = tree_nodes[dir].first_child; idx != TREE_NONE;
+         idx = tree_nodes[idx].next_sibling) {
+        tree_node_t *node = &tree_nodes[idx];
+        if (node->max_clock <= query->since) break;   // the rest are older
+        query->visited++;
+        
+        size_t len = path_len + (path_len ? 1 : 0) + node->name_len;
+        if (len >= MAX_PATH_LEN) continue;
+        if (path_len) query->path[path_len] = '/';
+        memcpy(query->path + len - node->name_len, tree_names + node->name_off, node->name_len);
+        query->path[len] = '\0';
+        
+        if (node->clock > query->since &&
+            (!query->type || query->type == (node->is_dir ? 'd' : 'f')) &&
+            (!query->glob ||
+             fnmatch(query->glob, query->glob_has_slash ? query->path :
+                     query->path + len - node->name_len,
+                     query->glob_has_slash ? FNM_PATHNAME : 0) == 0)) {
+            json_object *file = json_object_new_object();
+            json_object_object_add(file, "name", json_object_new_string(query->path));
+            json_object_object_add(file, "exists", json_object_new_boolean(node->exists));
+            json_object_object_add(file, "type", json_object_new_string(node->is_dir ? "d" : "f"));
+            json_object_object_add(file, "clock", json_object_new_int64(node->clock));
+            json_object_array_add(query->files, file);
+        }
+        
+        if (node->first_child != TREE_NONE) {
+            tree_query_walk(query, idx, len);
+        }
+    }
+}
+
+// Files under root changed after clock `since`, optionally filtered by a
+// glob (matched against the name, or against the root-relative path when
+// it contains '/') and a type ('f' or 'd')
+json_object *tree_query(uint64_t since, const char *root, const char *glob, const char *type) {
+    static tree_query_t query;      // guarded by tree_mutex
+    json_object *reply = json_object_new_object();
+    if (!file_tree_enabled) {
+        json_object_object_add(reply, "success", json_object_new_boolean(0));
+        json_object_object_add(reply, "error", json_object_new_string("file tree disabled (file_tree=true)"));
+        return reply;
+    }
+    
+    pthread_mutex_lock(&tree_mutex);
+    query.since = since;
+    query.glob = glob && glob[0] ? glob : NULL;
+    query.glob_has_slash = query.glob && strchr(query.glob, '/') != NULL;
+    query.type = type && (type[0] == 'f' || type[0] == 'd') ? type[0] : 0;
+    query.files = json_object_new_array();
+    query.visited = 0;
+    
+    uint32_t root_node = tree_nodes ? tree_lookup(root ? root : "", root ? strlen(root) : 0, 0) : TREE_NONE;
+    if (root_node != TREE_NONE) {
+        tree_query_walk(&query, root_node, 0);
+    }
+    
+    json_object_object_add(reply, "success", json_object_new_boolean(1));
+    json_object_object_add(reply, "clock",
+                          json_object_new_int64(tree_nodes ? tree_nodes[0].max_clock : 0));
+    // Changes before the tree started, or deletes that were pruned since,
+    // are unknown; the caller must rescan
+    json_object_object_add(reply, "is_fresh_instance",
+                          json_object_new_boolean(since + 1 < tree_start_clock || since < tree_pruned_clock));
+    json_object_object_add(reply, "visited", json_object_new_int64(query.visited));
+    json_object_object_add(reply, "files", query.files);
+    pthread_mutex_unlock(&tree_mutex);
+    return reply;
+}
+
+// ===== DIRECTORY USAGE =====
+
+// With disk_usage=true every file tree node also carries the bytes and the
+// number of files below it (tree_usage, parallel to tree_nodes). The crawl
+// that adds a directory's watch measures the files it lists. From then on
+// a file event replaces the file's cached size with a fresh statx()
+// (create, modify, close-write, move-in) or drops it (delete, move-out),
+// and adds the difference to every ancestor, so a du for any subtree is a
+// single lookup. Modifications of one file within a read batch share one
+// statx(). A directory moved in is measured by a walk; one moved away or
+// deleted is subtracted whole.
+
+// "500MB", "2G", "4096" (1024-based)
+int parse_size(const char *text, uint64_t *bytes) {
+    char *end;
+    errno = 0;
+    double value = strtod(text, &end);
+    if (end == text || errno || value < 0) return -1;
+    
+    double scale;
+    if (!*end || strcasecmp(end, "b") == 0) scale = 1;
+    else if (strcasecmp(end, "k") == 0 || strcasecmp(end, "kb") == 0) scale = 1024.0;
+    else if (strcasecmp(end, "m") == 0 || strcasecmp(end, "mb") == 0) scale = 1024.0 * 1024;
+    else if (strcasecmp(end, "g") == 0 || strcasecmp(end, "gb") == 0) scale = 1024.0 * 1024 * 1024;
+    else if (strcasecmp(end, "t") == 0 || strcasecmp(end, "tb") == 0) scale = 1024.0 * 1024 * 1024 * 1024;
+    else return -1;
+    *bytes = (uint64_t)(value * scale);
+    return 0;
+}
+
+// growth_alert=<subtree> <size>
+int growth_alert_add(const char *spec) {
+    const char *space = strrchr(spec, ' ');
+    uint64_t threshold;
+    if (!space || growth_alert_count == GROWTH_ALERT_MAX || parse_size(space + 1, &threshold) != 0) {
+        return -1;
+    }
+    
+    growth_alert_t *alert = &growth_alerts[growth_alert_count];
+    size_t len = space - spec;
+    while (len > 1 && spec[len - 1] == '/') len--;
+    if (len == 0 || len >= sizeof(alert->path)) return -1;
+    memcpy(alert->path, spec, len);
+    alert->path[len] = '\0';
+    alert->threshold = threshold;
+    alert->last_bytes = 0;
+    alert->primed = 0;
+    growth_alert_count++;
+    return 0;
+}
+
+// Add a change to a node and all its ancestors. Caller holds tree_mutex.
+static void usage_add(uint32_t idx, int64_t bytes, int64_t files) {
+    while (idx != TREE_NONE) {
+        tree_usage[idx].bytes += bytes;
+        tree_usage[idx].files += files;
+        idx = tree_nodes[idx].parent;
+    }
+}
+
+// Set a file node's size, or mark it gone (size < 0). Caller holds
+// tree_mutex.
+static void usage_set(uint32_t idx, int64_t size, uint64_t stat_ns) {
+    tree_usage_t *usage = &tree_usage[idx];
+    int64_t bytes = size >= 0 ? size : 0;
+    int64_t files = size >= 0 ? 1 : 0;
+    usage_add(idx, bytes - (int64_t)usage->bytes, files - (int64_t)usage->files);
+    usage->stat_ns = stat_ns;
+    if (size >= 0) tree_nodes[idx].is_dir = 0;
+}
+
+// Record the current size of a file, or that it is gone (size < 0).
+// stat_ns is the read time of the batch that measured it. A gone file
+// keeps its node as a tombstone, so a crawl that listed it earlier does
+// not seed it back.
+static void usage_file_size(const char *path, size_t len, int64_t size, uint64_t stat_ns) {
+    pthread_mutex_lock(&tree_mutex);
+    uint32_t idx = tree_path_node(path, len, TREE_CREATE_QUIET);
+    if (idx != TREE_NONE) {
+        usage_set(idx, size, stat_ns);
+    }
+    pthread_mutex_unlock(&tree_mutex);
+}
+
+// Zero everything below dir. A node whose totals are zero has nothing
+// below it. Caller holds tree_mutex.
+static void usage_clear_walk(uint32_t dir) {
+    for (uint32_t idx = tree_nodes[dir].first_child; idx != TREE_NONE;
+         idx = tree_nodes[idx].next_sibling) {
+        if (!tree_usage[idx].bytes && !tree_usage[idx].files) continue;
+        tree_usage[idx].bytes = 0;
+        tree_usage[idx].files = 0;
+        usage_clear_walk(idx);
+    }
+}
+
+// Zero a directory that was deleted or moved away. Its node is stamped
+// with the batch time so that a seed listed before the removal cannot put
+// its files back (see usage_seed).
+static void usage_remove_dir(const char *path, size_t len) {
+    pthread_mutex_lock(&tree_mutex);
+    uint32_t idx = tree_path_node(path, len, TREE_CREATE_QUIET);
+    if (idx != TREE_NONE) {
+        usage_add(idx, -(int64_t)tree_usage[idx].bytes, -(int64_t)tree_usage[idx].files);
+        usage_clear_walk(idx);
+        tree_usage[idx].stat_ns = event_time.monotonic_ns;
+    }
+    pthread_mutex_unlock(&tree_mutex);
+}
+
+// Measure a directory moved in at moved_ns (crawl worker), following the
+// crawl's rules for policies, name patterns and symlinked directories
+void usage_scan(const char *path, uint64_t moved_ns) {
+    monitor_policy_t *policy = policy_lookup(path);
+    if (policy->ignore) return;
+    DIR *dir = opendir(path);
+    if (!dir) return;
+    
+    struct dirent *entry;
+    while (running && (entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 ||
+            !policy_accepts(policy, entry->d_name)) {
+            continue;
+        }
+        char subpath[MAX_PATH_LEN];
+        int subpath_len = snprintf(subpath, sizeof(subpath), "%s/%s", path, entry->d_name);
+        if (subpath_len >= (int)sizeof(subpath)) continue;
+        
+        int is_dir = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+            struct stat sub_stat;
+            is_dir = stat(subpath, &sub_stat) == 0 && S_ISDIR(sub_stat.st_mode);
+        }
+        if (is_dir) {
+            if (recursive_mode) usage_scan(subpath, moved_ns);
+            continue;
+        }
+        usage_seed(dirfd(dir), entry->d_name, subpath, subpath_len, moved_ns);
+    }
+    closedir(dir);
+}
+
+// Called by the crawl for each file it lists below a new watch, and by
+// usage_scan. The statx runs outside tree_mutex, so an event measured
+// since watched_ns (when the crawl began adding the watch, or the
+// directory moved in), a delete included, is at least as fresh and the
+// seed leaves it alone; so does the removal of a directory above it.
+void usage_seed(int dir_fd, const char *name, const char *path, size_t len, uint64_t watched_ns) {
+    if (!tree_usage) return;
+    struct statx stx;
+    if (statx(dir_fd, name, AT_SYMLINK_NOFOLLOW, STATX_SIZE, &stx) != 0) return;
+    
+    pthread_mutex_lock(&tree_mutex);
+    uint32_t idx = tree_path_node(path, len, TREE_CREATE_QUIET);
+    uint32_t newer = idx;
+    while (newer != TREE_NONE && tree_usage[newer].stat_ns < watched_ns) {
+        newer = tree_nodes[newer].parent;
+    }
+    if (idx != TREE_NONE && newer == TREE_NONE) {
+        usage_set(idx, stx.stx_size, 0);
+    }
+    pthread_mutex_unlock(&tree_mutex);
+}
+
+// Apply one raw inotify event (event thread)
+void usage_event(uint32_t mask, const char *path, size_t len) {
+    if (!tree_usage) return;
+    if (mask & IN_ISDIR) {
+        if (mask & (IN_DELETE | IN_MOVED_FROM)) {
+            usage_remove_dir(path, len);
+        } else if (mask & IN_MOVED_TO) {
+            crawl_submit_measure(path, len, event_time.monotonic_ns);
+        }
+        return;
+    }
+    if (mask & (IN_DELETE | IN_MOVED_FROM)) {
+        usage_file_size(path, len, -1, event_time.monotonic_ns);
+        return;
+    }
+    if (!(mask & (IN_CREATE | IN_MOVED_TO | IN_MODIFY | IN_CLOSE_WRITE))) return;
+    
+    if (!(mask & (IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE))) {
+        pthread_mutex_lock(&tree_mutex);
+        uint32_t idx = tree_path_node(path, len, 0);
+        int measured = idx != TREE_NONE && tree_usage[idx].stat_ns == event_time.monotonic_ns;
+        pthread_mutex_unlock(&tree_mutex);
+        if (measured) return;
+    }
+    struct statx stx;
+    int64_t size = statx(AT_FDCWD, path, AT_SYMLINK_NOFOLLOW, STATX_SIZE, &stx) == 0 ?
+                   (int64_t)stx.stx_size : -1;
+    usage_file_size(path, len, size, event_time.monotonic_ns);
+}
+
+// Bytes and files under root, and the filesystem holding it
+json_object *usage_query(const char *root) {
+    json_object *reply = json_object_new_object();
+    if (!tree_usage) {
+        json_object_object_add(reply, "success", json_object_new_boolean(0));
+        json_object_object_add(reply, "error", json_object_new_string("disk usage disabled"));
+        return reply;
+    }
+    
+    size_t len = strlen(root);
+    while (len > 1 && root[len - 1] == '/') len--;
+    pthread_mutex_lock(&tree_mutex);
+    uint32_t idx = tree_lookup(root, len, 0);
+    uint64_t bytes = idx != TREE_NONE ? tree_usage[idx].bytes : 0;
+    uint64_t files = idx != TREE_NONE ? tree_usage[idx].files : 0;
+    pthread_mutex_unlock(&tree_mutex);
+    
+    json_object_object_add(reply, "success", json_object_new_boolean(1));
+    json_object_object_add(reply, "root", json_object_new_string(root));
+    json_object_object_add(reply, "tracked", json_object_new_boolean(idx != TREE_NONE));
+    json_object_object_add(reply, "bytes", json_object_new_int64(bytes));
+    json_object_object_add(reply, "files", json_object_new_int64(files));
+    
+    struct statvfs fs;
+    if (statvfs(root[0] ? root : ".", &fs) == 0 && fs.f_blocks > 0) {
+        uint64_t used = (uint64_t)(fs.f_blocks - fs.f_bfree) * fs.f_frsize;
+        uint64_t avail = (uint64_t)fs.f_bavail * fs.f_frsize;
+        json_object *filesystem = json_object_new_object();
+        json_object_object_add(filesystem, "size_bytes",
+                               json_object_new_int64((uint64_t)fs.f_blocks * fs.f_frsize));
+        json_object_object_add(filesystem, "used_bytes", json_object_new_int64(used));
+        json_object_object_add(filesystem, "available_bytes", json_object_new_int64(avail));
+        json_object_object_add(filesystem, "used_percent",
+                               json_object_new_int64(used + avail ? (used * 100 + used + avail - 1) / (used + avail) : 0));
+        json_object_object_add(reply, "filesystem", filesystem);
+    }
+    return reply;
+}
+
+// Log subtrees that grew by more than their threshold since the last
+// check (stats thread, every growth_interval seconds)
+void usage_check_growth() {
+    if (!tree_usage) return;
+    for (int i = 0; i < growth_alert_count; i++) {
+        growth_alert_t *alert = &growth_alerts[i];
+        pthread_mutex_lock(&tree_mutex);
+        uint32_t idx = tree_lookup(alert->path, strlen(alert->path), 0);
+        uint64_t bytes = idx != TREE_NONE ? tree_usage[idx].bytes : 0;
+        uint64_t files = idx != TREE_NONE ? tree_usage[idx].files : 0;
+        pthread_mutex_unlock(&tree_mutex);
+        
+        if (alert->primed && bytes > alert->last_bytes + alert->threshold) {
+            json_object *report = json_object_new_object();
+            json_object_object_add(report, "path", json_object_new_string(alert->path));
+            json_object_object_add(report, "grew_bytes", json_object_new_int64(bytes - alert->last_bytes));
+            json_object_object_add(report, "interval_sec", json_object_new_int64(growth_interval));
+            json_object_object_add(report, "threshold_bytes", json_object_new_int64(alert->threshold));
+            json_object_object_add(report, "bytes", json_object_new_int64(bytes));
+            json_object_object_add(report, "files", json_object_new_int64(files));
+            const char *text = json_object_to_json_string_ext(report, JSON_C_TO_STRING_PLAIN);
+            log_append(0, NULL, "[GROWTH] ", 9, text, strlen(text));
+            json_object_put(report);
+        }
+        alert->last_bytes = bytes;
+        alert->primed = 1;
+    }
+}
+
+// ===== EVENT ENRICHMENT =====
+
+// With enrich=true each logged event line carries the file's metadata
+// after a tab, so consumers need not stat() the file themselves:
+//
+//   ... #42 Modified: data/in/a.dat\tsize=4096 mode=0100644 uid=1000 gid=1000 ino=5531 mtime=1792339210.123456789
+//
+// Metadata comes from a fixed-size cache keyed by the file's tree node.
+// An entry measured in the same read batch is reused, so a burst of events
+// on one file costs a single statx(). Opens, reads and read-only closes
+// change nothing and also reuse an entry up to enrich_window_ms old.
+// Entries are placed in a set of ENRICH_PROBES slots and the stalest one
+// is replaced. Deletes and moves-out drop the entry and carry no metadata.
+
+#define ENRICH_PROBES 4
+#define ENRICH_CHANGES (IN_CREATE | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVED_TO)
+
+typedef struct {
+    uint32_t node;          // file tree node, TREE_NONE = free
+    uint32_t mode;
+    uint32_t uid;
+    uint32_t gid;
+    uint64_t stat_ns;       // read time of the window that measured it
+    uint64_t size;
+    uint64_t ino;
+    int64_t mtime_sec;
+    uint32_t mtime_nsec;
+} enrich_entry_t;
+
+static enrich_entry_t *enrich_cache = NULL;     // guarded by tree_mutex
+static uint32_t enrich_slots = 0;               // power of two
+
+int enrich_init() {
+    uint32_t slots = ENRICH_PROBES;
+    while (slots < enrich_cache_entries && slots < (1u << 24)) slots *= 2;
+    enrich_cache = malloc(slots * sizeof(enrich_entry_t));
+    if (!enrich_cache) return -1;
+    for (uint32_t i = 0; i < slots; i++) {
+        enrich_cache[i].node = TREE_NONE;
+    }
+    enrich_slots = slots;
+    return 0;
+}
+
+// The node's entry, or when create is set the slot to reuse for it.
+// Caller holds tree_mutex.
+static enrich_entry_t *enrich_find(uint32_t node, int create) {
+    uint32_t base = (uint32_t)(node * 0x9e3779b97f4a7c15ULL >> 32) & (enrich_slots - 1) & ~(ENRICH_PROBES - 1);
+    enrich_entry_t *victim = NULL;
+    for (uint32_t i = 0; i < ENRICH_PROBES; i++) {
+        enrich_entry_t *entry = &enrich_cache[base + i];
+        if (entry->node == node) return entry;
+        if (!victim || (victim->node != TREE_NONE &&
+                        (entry->node == TREE_NONE || entry->stat_ns < victim->stat_ns))) {
+            victim = entry;
+        }
+    }
+    return create ? victim : NULL;
+}
+
+// Whether the node has an entry, which keeps it from being pruned.
+// Caller holds tree_mutex.
+int enrich_cached(uint32_t node) {
+    return enrich_cache && enrich_find(node, 0) != NULL;
+}
+
+static size_t enrich_format(char *out, const enrich_entry_t *entry) {
+    return snprintf(out, ENRICH_SUFFIX_MAX, "\tsize=%llu mode=0%o uid=%u gid=%u ino=%llu mtime=%lld.%09u",
+                    (unsigned long long)entry->size, entry->mode, entry->uid, entry->gid,
+                    (unsigned long long)entry->ino, (long long)entry->mtime_sec, entry->mtime_nsec);
+}
+
+// Write path plus its metadata suffix to out (MAX_PATH_LEN +
+// ENRICH_SUFFIX_MAX bytes) and return the length; the suffix is left out
+// when the file cannot be measured
+size_t enrich_event(uint32_t mask, const char *path, size_t path_len, const event_time_t *time, char *out) {
+    memcpy(out, path, path_len);
+    enrich_entry_t found;
+    
+    // Only measured events need a node; a gone file only drops its entry.
+    // New nodes go to the back of their parent's child list, as they carry
+    // no clock until the log sink records the event.
+    int gone = (mask & (IN_DELETE | IN_MOVED_FROM)) != 0;
+    pthread_mutex_lock(&tree_mutex);
+    uint32_t node = tree_nodes ? tree_path_node(path, path_len, gone ? 0 : TREE_CREATE_QUIET) : TREE_NONE;
+    uint64_t generation = tree_prunes;
+    enrich_entry_t *entry = node != TREE_NONE ? enrich_find(node, 0) : NULL;
+    if (gone) {
+        if (entry) entry->node = TREE_NONE;
+        pthread_mutex_unlock(&tree_mutex);
+        return path_len;
+    }
+    // A change is only covered by a statx() taken after it was read
+    uint64_t window = (mask & ENRICH_CHANGES) ? 0 : enrich_window_ns;
+    int fresh = entry && time->monotonic_ns >= entry->stat_ns &&
+                time->monotonic_ns - entry->stat_ns <= window;
+    if (fresh) found = *entry;
+    pthread_mutex_unlock(&tree_mutex);
+    
+    if (fresh) {
+        stats.enrich_cache_hits++;
+        return path_len + enrich_format(out + path_len, &found);
+    }
+    if (node == TREE_NONE) return path_len;
+    
+    struct statx stx;
+    stats.enrich_statx_calls++;
+    if (statx(AT_FDCWD, path, AT_SYMLINK_NOFOLLOW, STATX_BASIC_STATS, &stx) != 0) {
+        return path_len;
+    }
+    found.node = node;
+    found.mode = stx.stx_mode;
+    found.uid = stx.stx_uid;
+    found.gid = stx.stx_gid;
+    found.stat_ns = time->monotonic_ns;
+    found.size = stx.stx_size;
+    found.ino = stx.stx_ino;
+    found.mtime_sec = stx.stx_mtime.tv_sec;
+    found.mtime_nsec = stx.stx_mtime.tv_nsec;
+    
+    // A prune in between may have handed the node to another path
+    pthread_mutex_lock(&tree_mutex);
+    if (tree_prunes == generation) *enrich_find(node, 1) = found;
+    pthread_mutex_unlock(&tree_mutex);
+    return path_len + enrich_format(out + path_len, &found);
+}
+
+// Length of the path in an event line's text, without an enrichment suffix
+size_t event_text_path_len(const char *text, size_t len) {
+    const char *tab = memrchr(text, '\t', len);
+    if (tab && len - (tab - text) > 6 && memcmp(tab + 1, "size=", 5) == 0) {
+        return tab - text;
+    }
+    return len;
+}
+
+// ===== CHANGE JOURNAL =====
+
+// Append-only journal of sequenced events keyed by file identity, in the
+// spirit of the NTFS USN journal:
+//   <journal>        header + fixed-size journal_record_t, ordered by seq
+//   <journal>.paths  interned paths ({u32 len, bytes}); a path id is the index
+//   <journal>.files  mmap'd open-addressed table: identity -> last seq
+// "Changed since N" is a binary search in <journal> followed by a forward
+// scan that reports each file once, at its newest record.
+
+#define JOURNAL_MAGIC          0x314a4d46  /* "FMJ1" */
+#define JOURNAL_TABLE_MAGIC    0x544a4d46  /* "FMJT" */
+#define JOURNAL_VERSION        1
+#define JOURNAL_BUFFER_RECORDS 512
+#define JOURNAL_TABLE_INITIAL  65536
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint64_t reserved;
+} journal_header_t;
+
+typedef struct {
+    uint64_t seq;
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t generation;    // birth time in ns; tells reused inode numbers apart
+    uint32_t reason;        // inotify mask of the event
+    uint32_t path_id;
+} journal_record_t;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t capacity;
+    uint32_t count;
+    uint64_t applied_seq;   // every record up to here is reflected below
+} journal_table_header_t;
+
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t generation;
+    uint64_t last_seq;      // 0 = empty slot
+    uint32_t path_id;
+    uint32_t reasons;       // union of reasons seen for this file
+} journal_file_slot_t;
+
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t generation;
+} journal_identity_t;
+
+static int journal_fd = -1;
+static int journal_paths_fd = -1;
+static int journal_table_fd = -1;
+static journal_table_header_t *journal_table = NULL;
+static size_t journal_table_size = 0;
+static journal_record_t journal_buffer[JOURNAL_BUFFER_RECORDS];
+static size_t journal_buffer_count = 0;
+static uint64_t journal_records = 0;        // records on disk
+static uint64_t journal_records_dropped = 0;    // buffer full while writes fail
+static int journal_write_failing = 0;
+static char *journal_path_data = NULL;      // interned paths, back to back
+static size_t journal_path_data_len = 0;
+static size_t journal_path_data_capacity = 0;
+static uint32_t *journal_path_offs = NULL;
+static uint16_t *journal_path_lens = NULL;
+static journal_identity_t *journal_path_ident = NULL;   // last identity per path
+static uint32_t journal_path_count = 0;
+static uint32_t journal_path_capacity = 0;
+static uint32_t *journal_path_slots = NULL;
+static size_t journal_path_slot_capacity = 0;
+static pthread_mutex_t journal_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static journal_file_slot_t *journal_slots() {
+    return (journal_file_slot_t *)(journal_table + 1);
+}
+
+static size_t journal_identity_slot(const journal_table_header_t *table, uint64_t dev,
+                                    uint64_t ino, uint64_t generation) {
+    uint64_t key[3] = {dev, ino, generation};
+    return fnv1a(key, sizeof(key), 0xcbf29ce484222325ULL) & (table->capacity - 1);
+}
+
+static journal_file_slot_t *journal_table_find(journal_table_header_t *table, uint64_t dev,
+                                               uint64_t ino, uint64_t generation, int create) {
+    journal_file_slot_t *slots = (journal_file_slot_t *)(table + 1);
+    size_t slot = journal_identity_slot(table, dev, ino, generation);
+    while (slots[slot].last_seq != 0) {
+        if (slots[slot].dev == dev && slots[slot].ino == ino && slots[slot].generation == generation) {
+            return &slots[slot];
+        }
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+    if (!create) return NULL;
+    
+    slots[slot].dev = dev;
+    slots[slot].ino = ino;
+    slots[slot].generation = generation;
+    table->count++;
+    return &slots[slot];
+}
+
+// Map <journal>.files, creating it with the given capacity if needed
+static journal_table_header_t *journal_table_map(const char *path, uint32_t capacity, int *fd_out,
+                                                 size_t *size_out) {
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) return NULL;
+    
+    journal_table_header_t header;
+    if (pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+        header.magic == JOURNAL_TABLE_MAGIC && header.version == JOURNAL_VERSION &&
+        header.capacity && (header.capacity & (header.capacity - 1)) == 0) {
+        capacity = header.capacity;
+    } else {
+        memset(&header, 0, sizeof(header));
+        header.magic = JOURNAL_TABLE_MAGIC;
+        header.version = JOURNAL_VERSION;
+        header.capacity = capacity;
+        if (ftruncate(fd, 0) != 0 || pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+            close(fd);
+            return NULL;
+        }
+    }
+    
+    size_t size = sizeof(header) + (size_t)capacity * sizeof(journal_file_slot_t);
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, size) == 0) {
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (map == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    *fd_out = fd;
+    *size_out = size;
+    return map;
+}
+
+// Double the identity table into a fresh file and swap it in
+static int journal_table_grow() {
+    char tmp_path[MAX_PATH_LEN + 16];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.files.tmp", journal_path);
+    unlink(tmp_path);
+    
+    int fd;
+    size_t size;
+    journal_table_header_t *grown = journal_table_map(tmp_path, journal_table->capacity * 2, &fd, &size);
+    if (!grown) return -1;
+    
+    journal_file_slot_t *old_slots = journal_slots();
+    for (uint32_t i = 0; i < journal_table->capacity; i++) {
+        if (old_slots[i].last_seq == 0) continue;
+        journal_file_slot_t *slot = journal_table_find(grown, old_slots[i].dev, old_slots[i].ino,
+                                                       old_slots[i].generation, 1);
+        *slot = old_slots[i];
+    }
+    grown->applied_seq = journal_table->applied_seq;
+    
+    char table_path[MAX_PATH_LEN + 16];
+    snprintf(table_path, sizeof(table_path), "%s.files", journal_path);
+    msync(grown, size, MS_SYNC);
+    rename(tmp_path, table_path);
+    munmap(journal_table, journal_table_size);
+    close(journal_table_fd);
+    journal_table = grown;
+    journal_table_size = size;
+    journal_table_fd = fd;
+    return 0;
+}
+
+// Table slot for a record's file. Files that vanished before they could
+// be stat'ed have no identity and are keyed by path id instead.
+static journal_file_slot_t *journal_record_slot(const journal_record_t *record, int create) {
+    if (record->ino == 0) {
+        return journal_table_find(journal_table, 0, 0, record->path_id, create);
+    }
+    return journal_table_find(journal_table, record->dev, record->ino, record->generation, create);
+}
+
+static void journal_table_apply(const journal_record_t *record) {
+    if (record->seq <= journal_table->applied_seq) return;
+    
+    if ((uint64_t)journal_table->count * 10 >= (uint64_t)journal_table->capacity * 7) {
+        journal_table_grow();
+    }
+    journal_file_slot_t *slot = journal_record_slot(record, 1);
+    slot->last_seq = record->seq;
+    slot->path_id = record->path_id;
+    slot->reasons |= record->reason;
+    journal_table->applied_seq = record->seq;
+}
+
+static int journal_path_rehash(size_t capacity) {
+    uint32_t *slots = malloc(capacity * sizeof(uint32_t));
+    if (!slots) return -1;
+    memset(slots, 0xff, capacity * sizeof(uint32_t));
+    for (uint32_t id = 0; id < journal_path_count; id++) {
+        size_t slot = fnv1a(journal_path_data + journal_path_offs[id], journal_path_lens[id],
+                            0xcbf29ce484222325ULL) & (capacity - 1);
+        while (slots[slot] != UINT32_MAX) {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        slots[slot] = id;
+    }
+    free(journal_path_slots);
+    journal_path_slots = slots;
+    journal_path_slot_capacity = capacity;
+    return 0;
+}
+
+// Add a path to the in-memory intern table. Returns its id.
+static uint32_t journal_path_add(const char *path, size_t len) {
+    if (journal_path_count == journal_path_capacity) {
+        uint32_t capacity = journal_path_capacity ? journal_path_capacity * 2 : 1024;
+        uint32_t *offs = realloc(journal_path_offs, capacity * sizeof(uint32_t));
+        if (offs) journal_path_offs = offs;
+        uint16_t *lens = realloc(journal_path_lens, capacity * sizeof(uint16_t));
+        if (lens) journal_path_lens = lens;
+        journal_identity_t *ident = realloc(journal_path_ident, capacity * sizeof(journal_identity_t));
+        if (ident) journal_path_ident = ident;
+        if (!offs || !lens || !ident) return UINT32_MAX;
+        journal_path_capacity = capacity;
+    }
+    if (journal_path_data_len + len > journal_path_data_capacity) {
+        size_t capacity = journal_path_data_capacity * 2 + len + 64 * 1024;
+        char *grown = realloc(journal_path_data, capacity);
+        if (!grown) return UINT32_MAX;
+        journal_path_data = grown;
+        journal_path_data_capacity = capacity;
+    }
+    
+    uint32_t id = journal_path_count++;
+    journal_path_offs[id] = journal_path_data_len;
+    journal_path_lens[id] = len;
+    memset(&journal_path_ident[id], 0, sizeof(journal_identity_t));
+    memcpy(journal_path_data + journal_path_data_len, path, len);
+    journal_path_data_len += len;
+    
+    if ((size_t)journal_path_count * 10 > journal_path_slot_capacity * 7) {
+        journal_path_rehash(journal_path_slot_capacity ? journal_path_slot_capacity * 2 : 4096);
+    } else {
+        size_t slot = fnv1a(path, len, 0xcbf29ce484222325ULL) & (journal_path_slot_capacity - 1);
+        while (journal_path_slots[slot] != UINT32_MAX) {
+            slot = (slot + 1) & (journal_path_slot_capacity - 1);
+        }
+        journal_path_slots[slot] = id;
+    }
+    return id;
+}
+
+// Path id for path, appending it to <journal>.paths the first time
+static uint32_t journal_path_id(const char *path, size_t len) {
+    if (len > UINT16_MAX) len = UINT16_MAX;
+    size_t slot = fnv1a(path, len, 0xcbf29ce484222325ULL) & (journal_path_slot_capacity - 1);
+    while (journal_path_slots[slot] != UINT32_MAX) {
+        uint32_t id = journal_path_slots[slot];
+        if (journal_path_lens[id] == len &&
+            memcmp(journal_path_data + journal_path_offs[id], path, len) == 0) {
+            return id;
+        }
+        slot = (slot + 1) & (journal_path_slot_capacity - 1);
+    }
+    
+    uint32_t id = journal_path_add(path, len);
+    if (id != UINT32_MAX) {
+        uint32_t len32 = len;
+        struct iovec iov[2] = {{&len32, sizeof(len32)}, {(void *)path, len}};
+        if (writev(journal_paths_fd, iov, 2) != (ssize_t)(sizeof(len32) + len)) {
+            log_event("[WARN] Short write to journal path table");
+        }
+    }
+    return id;
+}
+
+static int journal_load_paths() {
+    struct stat st;
+    if (fstat(journal_paths_fd, &st) != 0) return -1;
+    
+    char *data = malloc(st.st_size + 1);
+    if (!data) return -1;
+    ssize_t n = pread(journal_paths_fd, data, st.st_size, 0);
+    size_t pos = 0;
+    while (n > 0 && pos + sizeof(uint32_t) <= (size_t)n) {
+        uint32_t len;
+        memcpy(&len, data + pos, sizeof(len));
+        if (pos + sizeof(len) + len > (size_t)n) break;
+        journal_path_add(data + pos + sizeof(len), len);
+        pos += sizeof(len) + len;
+    }
+    free(data);
+    
+    // Drop a torn final entry so ids stay aligned with the file
+    if (n > 0 && pos < (size_t)n && ftruncate(journal_paths_fd, pos) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// Index of the first record with seq >= since (records are in seq order)
+static uint64_t journal_seek(uint64_t since) {
+    uint64_t lo = 0, hi = journal_records;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        journal_record_t record;
+        off_t offset = sizeof(journal_header_t) + mid * sizeof(journal_record_t);
+        if (pread(journal_fd, &record, sizeof(record), offset) != sizeof(record)) break;
+        if (record.seq < since) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+int journal_init() {
+    char path[MAX_PATH_LEN + 16];
+    journal_fd = open(journal_path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    snprintf(path, sizeof(path), "%s.paths", journal_path);
+    journal_paths_fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    snprintf(path, sizeof(path), "%s.files", journal_path);
+    journal_table = journal_table_map(path, JOURNAL_TABLE_INITIAL, &journal_table_fd, &journal_table_size);
+    
+    if (journal_fd == -1 || journal_paths_fd == -1 || !journal_table ||
+        journal_path_rehash(4096) != 0 || journal_load_paths() != 0) {
+        char msg[MAX_PATH_LEN + 64];
+        snprintf(msg, sizeof(msg), "[ERROR] Cannot open change journal %s: %s",
+                journal_path, strerror(errno));
+        log_event(msg);
+        return -1;
+    }
+    
+    struct stat st;
+    journal_header_t header;
+    fstat(journal_fd, &st);
+    if (st.st_size < (off_t)sizeof(header)) {
+        header.magic = JOURNAL_MAGIC;
+        header.version = JOURNAL_VERSION;
+        header.record_size = sizeof(journal_record_t);
+        header.reserved = 0;
+        if (ftruncate(journal_fd, 0) != 0 || write(journal_fd, &header, sizeof(header)) != sizeof(header)) {
+            return -1;
+        }
+        st.st_size = sizeof(header);
+    } else if (pread(journal_fd, &header, sizeof(header), 0) != sizeof(header) ||
+               header.magic != JOURNAL_MAGIC || header.record_size != sizeof(journal_record_t)) {
+        log_event("[ERROR] Change journal has an unknown format");
+        return -1;
+    }
+    
+    // A torn tail record from a crash is dropped
+    journal_records = (st.st_size - sizeof(header)) / sizeof(journal_record_t);
+    off_t valid = sizeof(header) + journal_records * sizeof(journal_record_t);
+    if (valid != st.st_size && ftruncate(journal_fd, valid) != 0) {
+        return -1;
+    }
+    
+    // Seed the last identity of every path from the table, then bring the
+    // table up to the end of the journal
+    journal_file_slot_t *slots = journal_slots();
+    for (uint32_t i = 0; i < journal_table->capacity; i++) {
+        if (slots[i].last_seq && slots[i].ino && slots[i].path_id < journal_path_count) {
+            journal_path_ident[slots[i].path_id] = (journal_identity_t){slots[i].dev, slots[i].ino,
+                                                                        slots[i].generation};
+        }
+    }
+    uint64_t replayed = 0;
+    journal_record_t record;
+    for (uint64_t i = journal_seek(journal_table->applied_seq + 1); i < journal_records; i++) {
+        off_t offset = sizeof(journal_header_t) + i * sizeof(journal_record_t);
+        if (pread(journal_fd, &record, sizeof(record), offset) != sizeof(record)) break;
+        journal_table_apply(&record);
+        if (record.path_id < journal_path_count) {
+            journal_path_ident[record.path_id] = (journal_identity_t){record.dev, record.ino,
+                                                                      record.generation};
+        }
+        replayed++;
+    }
+    
+    journal_enabled = 1;
+    char msg[MAX_PATH_LEN + 160];
+    snprintf(msg, sizeof(msg),
+            "[JOURNAL] %s: %llu records, %u paths, %u files (%llu replayed into the file table)",
+            journal_path, (unsigned long long)journal_records, journal_path_count,
+            journal_table->count, (unsigned long long)replayed);
+    log_event(msg);
+    return 0;
+}
+
+// Write buffered records, then fold them into the identity table, so the
+// table never runs ahead of the journal
+void journal_flush() {
+    pthread_mutex_lock(&journal_mutex);
+    if (journal_buffer_count > 0) {
+        size_t bytes = journal_buffer_count * sizeof(journal_record_t);
+        ssize_t written = write(journal_fd, journal_buffer, bytes);
+        if (written == (ssize_t)bytes) {
+            journal_records += journal_buffer_count;
+            for (size_t i = 0; i < journal_buffer_count; i++) {
+                journal_table_apply(&journal_buffer[i]);
+            }
+            journal_buffer_count = 0;
+            journal_write_failing = 0;
+        } else {
+            // A partial record would misalign every later one: cut the file
+            // back to whole records and keep the buffer for the next flush
+            off_t valid = sizeof(journal_header_t) + journal_records * sizeof(journal_record_t);
+            int truncated = written <= 0 || ftruncate(journal_fd, valid) == 0;
+            if (!journal_write_failing || !truncated) {
+                char msg[128];
+                snprintf(msg, sizeof(msg), "[WARN] Short write to change journal (%zd of %zu bytes)%s",
+                        written, bytes, truncated ? ", will retry" : ", cannot truncate");
+                log_event(msg);
+            }
+            journal_write_failing = 1;
+        }
+    }
+    pthread_mutex_unlock(&journal_mutex);
+}
+
+// Journal one sequenced event. Deleted and moved-away files can no longer
+// be stat'ed; they keep the identity last seen for their path.
+void journal_record(uint32_t mask, const char *path, size_t path_len, uint64_t seq) {
+    pthread_mutex_lock(&journal_mutex);
+    uint32_t path_id = journal_path_id(path, path_len);
+    if (path_id == UINT32_MAX) {
+        pthread_mutex_unlock(&journal_mutex);
+        return;
+    }
+    
+    if (journal_buffer_count == JOURNAL_BUFFER_RECORDS) {
+        // Still holding records from a failed flush
+        journal_records_dropped++;
+        pthread_mutex_unlock(&journal_mutex);
+        return;
+    }
+    
+    journal_identity_t *ident = &journal_path_ident[path_id];
+    struct statx stx;
+    if (!(mask & (IN_DELETE | IN_MOVED_FROM)) &&
+        statx(AT_FDCWD, path, AT_SYMLINK_NOFOLLOW, STATX_INO | STATX_BTIME, &stx) == 0) {
+        ident->dev = ((uint64_t)stx.stx_dev_major << 32) | stx.stx_dev_minor;
+        ident->ino = stx.stx_ino;
+        ident->generation = (stx.stx_mask & STATX_BTIME) ?
+                            (uint64_t)stx.stx_btime.tv_sec * 1000000000ULL + stx.stx_btime.tv_nsec : 0;
+    }
+    
+    journal_record_t *record = &journal_buffer[journal_buffer_count++];
+    record->seq = seq;
+    record->dev = ident->dev;
+    record->ino = ident->ino;
+    record->generation = ident->generation;
+    record->reason = mask;
+    record->path_id = path_id;
+    int full = journal_buffer_count == JOURNAL_BUFFER_RECORDS;
+    pthread_mutex_unlock(&journal_mutex);
+    
+    if (full) {
+        journal_flush();
+    }
+}
+
+// {"since": N, "limit": M}: files changed at or after N, each reported
+// once at its newest record, in sequence order. next_seq pages onwards.
+json_object *journal_query(uint64_t since, uint64_t limit) {
+    journal_flush();
+    json_object *reply = json_object_new_object();
+    json_object *changes = json_object_new_array();
+    
+    pthread_mutex_lock(&journal_mutex);
+    uint64_t index = journal_seek(since);
+    uint64_t next_seq = since;
+    uint64_t reported = 0;
+    journal_record_t chunk[256];
+    
+    while (index < journal_records && reported < limit) {
+        off_t offset = sizeof(journal_header_t) + index * sizeof(journal_record_t);
+        ssize_t n = pread(journal_fd, chunk, sizeof(chunk), offset);
+        if (n < (ssize_t)sizeof(journal_record_t)) break;
+        
+        size_t count = n / sizeof(journal_record_t);
+        size_t i;
+        for (i = 0; i < count && reported < limit; i++) {
+            journal_record_t *record = &chunk[i];
+            next_seq = record->seq + 1;
+            
+            // Skip records superseded by a newer one for the same file
+            journal_file_slot_t *slot = journal_record_slot(record, 0);
+            if (slot && slot->last_seq > record->seq) continue;
+            
+            json_object *change = json_object_new_object();
+            json_object_object_add(change, "seq", json_object_new_int64(record->seq));
+            json_object_object_add(change, "reason", json_object_new_int64(record->reason));
+            json_object_object_add(change, "dev", json_object_new_int64(record->dev));
+            json_object_object_add(change, "ino", json_object_new_int64(record->ino));
+            json_object_object_add(change, "generation", json_object_new_int64(record->generation));
+            json_object_object_add(change, "path_id", json_object_new_int64(record->path_id));
+            if (record->path_id < journal_path_count) {
+                char path[MAX_PATH_LEN];
+                size_t len = journal_path_lens[record->path_id];
+                if (len >= sizeof(path)) len = sizeof(path) - 1;
+                memcpy(path, journal_path_data + journal_path_offs[record->path_id], len);
+                path[len] = '\0';
+                json_object_object_add(change, "path", json_object_new_string(path));
+            }
+            json_object_array_add(changes, change);
+            reported++;
+        }
+        index += i;
+    }
+    
+    uint64_t oldest_seq = 0;
+    journal_record_t first;
+    if (journal_records > 0 &&
+        pread(journal_fd, &first, sizeof(first), sizeof(journal_header_t)) == sizeof(first)) {
+        oldest_seq = first.seq;
+    }
+    int more = index < journal_records;
+    pthread_mutex_unlock(&journal_mutex);
+    
+    json_object_object_add(reply, "success", json_object_new_boolean(1));
+    json_object_object_add(reply, "oldest_seq", json_object_new_int64(oldest_seq));
+    json_object_object_add(reply, "next_seq", json_object_new_int64(next_seq));
+    json_object_object_add(reply, "more", json_object_new_boolean(more));
+    json_object_object_add(reply, "changes", changes);
+    return reply;
+}
+
+void journal_shutdown() {
+    if (!journal_enabled) return;
+    journal_flush();
+    
+    pthread_mutex_lock(&journal_mutex);
+    journal_enabled = 0;
+    msync(journal_table, journal_table_size, MS_SYNC);
+    munmap(journal_table, journal_table_size);
+    journal_table = NULL;
+    close(journal_table_fd);
+    close(journal_paths_fd);
+    close(journal_fd);
+    journal_fd = journal_paths_fd = journal_table_fd = -1;
+    pthread_mutex_unlock(&journal_mutex);
+}
+
+// ===== FILE IDENTITY =====
+
+// Content state for advanced mode, keyed by (dev, ino) rather than path so
+// hard links share one hash and a renamed file keeps its history. Each
+// identity owns a list of the paths it has been seen under; the paths
+// themselves live in a path index that maps each back to its entry.
+//
+// A cached hash is reused without reading the file when size, mtime and
+// ctime still match and the hash was taken well after the last mtime
+// (the "racy clean" rule: timestamps are coarse, so a write landing in the
+// same tick as the hash would otherwise go unnoticed).
+
+#define IDENTITY_RACY_NS      20000000LL   // 20 ms, above the coarse clock tick
+#define IDENTITY_TABLE_MIN    1024
+#define IDENTITY_SLOT_EMPTY   UINT32_MAX
+#define IDENTITY_SLOT_DELETED (UINT32_MAX - 1)
+
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    int64_t size;
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+    int64_t hashed_ns;      // wall clock when hash was taken, 0 = never
+    uint32_t paths;         // head of this file's path list
+    uint32_t path_count;    // UINT32_MAX marks a free entry
+    char hash[HASH_SIZE];
+} file_identity_t;
+
+typedef struct {
+    uint32_t identity;      // owning identity, UINT32_MAX = free
+    uint32_t next;          // next path of the same identity / free list
+} identity_path_t;
+
+static file_identity_t *identities = NULL;
+static uint32_t identity_count = 0;         // live identities
+static uint32_t identity_used = 0;          // entries handed out, live or free
+static uint32_t identity_capacity = 0;
+static uint32_t identity_free = UINT32_MAX;
+static uint32_t *identity_slots = NULL;     // (dev, ino) -> identity
+static size_t identity_slot_capacity = 0;
+static size_t identity_slot_tombstones = 0;
+static identity_path_t *identity_paths = NULL;
+static uint32_t identity_path_count = 0;
+static uint32_t identity_path_used = 0;
+static uint32_t identity_path_capacity = 0;
+static uint32_t identity_path_free = UINT32_MAX;
+static path_index_t identity_path_index;    // path -> identity_paths index
+
+static uint64_t identity_key_hash(uint64_t dev, uint64_t ino) {
+    uint64_t key[2] = {dev, ino};
+    return fnv1a(key, sizeof(key), 0xcbf29ce484222325ULL);
+}
+
+static int64_t timespec_ns(const struct timespec *ts) {
+    return (int64_t)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+static void identity_slot_insert(uint32_t *slots, size_t capacity, uint64_t hash, uint32_t id) {
+    size_t slot = hash & (capacity - 1);
+    while (slots[slot] != IDENTITY_SLOT_EMPTY && slots[slot] != IDENTITY_SLOT_DELETED) {
+        slot = (slot + 1) & (capacity - 1);
+    }
+    slots[slot] = id;
+}
+
+static size_t identity_table_size(size_t live) {
+    size_t capacity = IDENTITY_TABLE_MIN;
+    while (capacity * 7 < live * 20) capacity *= 2;   // keep load under ~35% after a rebuild
+    return capacity;
+}
+
+// Rebuild the (dev, ino) index from the live entries, dropping tombstones
+// and identities left without paths (files moved out of the tree)
+static int identity_rebuild() {
+    for (uint32_t id = 0; id < identity_used; id++) {
+        file_identity_t *ident = &identities[id];
+        if (ident->path_count == 0) {
+            ident->path_count = UINT32_MAX;
+            ident->paths = identity_free;
+            identity_free = id;
+            identity_count--;
+        }
+    }
+    
+    size_t slot_capacity = identity_table_size(identity_count);
+    uint32_t *slots = malloc(slot_capacity * sizeof(uint32_t));
+    if (!slots) return -1;
+    memset(slots, 0xff, slot_capacity * sizeof(uint32_t));
+    
+    for (uint32_t id = 0; id < identity_used; id++) {
+        if (identities[id].path_count == UINT32_MAX) continue;
+        identity_slot_insert(slots, slot_capacity,
+                             identity_key_hash(identities[id].dev, identities[id].ino), id);
+    }
+    
+    free(identity_slots);
+    identity_slots = slots;
+    identity_slot_capacity = slot_capacity;
+    identity_slot_tombstones = 0;
+    return 0;
+}
+
+// Index slot holding the identity for (dev, ino), or the empty slot where
+// it would go
+static size_t identity_lookup(uint64_t dev, uint64_t ino) {
+    size_t slot = identity_key_hash(dev, ino) & (identity_slot_capacity - 1);
+    while (identity_slots[slot] != IDENTITY_SLOT_EMPTY) {
+        uint32_t id = identity_slots[slot];
+        if (id != IDENTITY_SLOT_DELETED && identities[id].dev == dev && identities[id].ino == ino) {
+            break;
+        }
+        slot = (slot + 1) & (identity_slot_capacity - 1);
+    }
+    return slot;
+}
+
+static int identity_reserve() {
+    if (!identity_slots ||
+        (identity_count + identity_slot_tombstones + 1) * 10 > identity_slot_capacity * 7) {
+        if (identity_rebuild() != 0) return -1;
+    }
+    return 0;
+}
+
+static uint32_t identity_create(uint64_t dev, uint64_t ino, size_t slot) {
+    uint32_t id = identity_free;
+    if (id != UINT32_MAX) {
+        identity_free = identities[id].paths;
+    } else {
+        if (identity_used == identity_capacity) {
+            uint32_t capacity = identity_capacity ? identity_capacity * 2 : 256;
+            file_identity_t *grown = realloc(identities, capacity * sizeof(file_identity_t));
+            if (!grown) return UINT32_MAX;
+            identities = grown;
+            identity_capacity = capacity;
+        }
+        id = identity_used++;
+    }
+    
+    file_identity_t *ident = &identities[id];
+    memset(ident, 0, sizeof(*ident));
+    ident->dev = dev;
+    ident->ino = ino;
+    ident->paths = UINT32_MAX;
+    if (identity_slots[slot] == IDENTITY_SLOT_DELETED) identity_slot_tombstones--;
+    identity_slots[slot] = id;
+    identity_count++;
+    return id;
+}
+
+// Detach path entry p from its identity and drop it from the path index
+static void identity_path_remove(uint32_t p, const char *path, size_t len) {
+    file_identity_t *ident = &identities[identity_paths[p].identity];
+    for (uint32_t *link = &ident->paths; *link != UINT32_MAX; link = &identity_paths[*link].next) {
+        if (*link == p) {
+            *link = identity_paths[p].next;
+            break;
+        }
+    }
+    ident->path_count--;
+    
+    identity_paths[p].identity = UINT32_MAX;
+    identity_paths[p].next = identity_path_free;
+    identity_path_free = p;
+    identity_path_count--;
+    path_index_remove(&identity_path_index, path, len);
+}
+
+// Record that path names identity id, moving it off any identity it named before
+static void identity_link_path(uint32_t id, const char *path, size_t len) {
+    uint32_t p = path_index_get(&identity_path_index, path, len);
+    if (p != PATH_INDEX_NONE) {
+        if (identity_paths[p].identity == id) return;
+        identity_path_remove(p, path, len);
+    }
+    
+    p = identity_path_free;
+    if (p != UINT32_MAX) {
+        identity_path_free = identity_paths[p].next;
+    } else {
+        if (identity_path_used == identity_path_capacity) {
+            uint32_t capacity = identity_path_capacity ? identity_path_capacity * 2 : 256;
+            identity_path_t *grown = realloc(identity_paths, capacity * sizeof(identity_path_t));
+            if (!grown) return;
+            identity_paths = grown;
+            identity_path_capacity = capacity;
+        }
+        p = identity_path_used++;
+    }
+    
+    if (path_index_put(&identity_path_index, path, len, p) != 0) {
+        identity_paths[p].identity = UINT32_MAX;
+        identity_paths[p].next = identity_path_free;
+        identity_path_free = p;
+        return;
+    }
+    identity_path_t *entry = &identity_paths[p];
+    entry->identity = id;
+    entry->next = identities[id].paths;
+    identities[id].paths = p;
+    identities[id].path_count++;
+    identity_path_count++;
+}
+
+// Hash filepath through its identity. Returns 1 when the content differs
+// from the last state recorded for the file (or the file is new to us), 0
+// when it is unchanged. Called with hash_mutex held.
+int file_identity_check(const char *filepath, size_t len) {
+    int fd = open(filepath, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1) return 1;
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || identity_reserve() != 0) {
+        close(fd);
+        return 1;
+    }
+    
+    size_t slot = identity_lookup(st.st_dev, st.st_ino);
+    uint32_t id = identity_slots[slot];
+    if (id == IDENTITY_SLOT_EMPTY || id == IDENTITY_SLOT_DELETED) {
+        id = identity_create(st.st_dev, st.st_ino, slot);
+        if (id == UINT32_MAX) {
+            close(fd);
+            return 1;
+        }
+    }
+    identity_link_path(id, filepath, len);
+    
+    file_identity_t *ident = &identities[id];
+    int64_t mtime_ns = timespec_ns(&st.st_mtim);
+    int64_t ctime_ns = timespec_ns(&st.st_ctim);
+    if (ident->hashed_ns && ident->size == st.st_size && ident->mtime_ns == mtime_ns &&
+        ident->ctime_ns == ctime_ns && ident->hashed_ns - mtime_ns > IDENTITY_RACY_NS) {
+        close(fd);
+        stats.hashes_reused++;
+        return 0;
+    }
+    
+    char new_hash[HASH_SIZE];
+    int rc = calculate_fd_hash(fd, new_hash);
+    close(fd);
+    if (rc != 0) return 1;
+    stats.hashes_computed++;
+    
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    int changed = !ident->hashed_ns || memcmp(ident->hash, new_hash, HASH_SIZE) != 0;
+    memcpy(ident->hash, new_hash, HASH_SIZE);
+    ident->size = st.st_size;
+    ident->mtime_ns = mtime_ns;
+    ident->ctime_ns = ctime_ns;
+    ident->hashed_ns = timespec_ns(&now);
+    return changed;
+}
+
+// A path went away (deleted or renamed out). Deleting the last known path
+// of a file forgets it; a rename keeps the identity until the next rebuild
+// so the matching IN_MOVED_TO can pick it up again.
+static void file_identity_forget(const char *filepath, size_t len, int deleted) {
+    uint32_t p = path_index_get(&identity_path_index, filepath, len);
+    if (p == PATH_INDEX_NONE) return;
+    
+    uint32_t id = identity_paths[p].identity;
+    identity_path_remove(p, filepath, len);
+    if (deleted && identities[id].path_count == 0) {
+        size_t id_slot = identity_lookup(identities[id].dev, identities[id].ino);
+        identity_slots[id_slot] = IDENTITY_SLOT_DELETED;
+        identity_slot_tombstones++;
+        identities[id].path_count = UINT32_MAX;
+        identities[id].paths = identity_free;
+        identity_free = id;
+        identity_count--;
+    }
+}
+
+// A path appeared by rename; attach it to the file's existing identity
+static void file_identity_moved(const char *filepath, size_t len) {
+    struct stat st;
+    if (lstat(filepath, &st) != 0 || !S_ISREG(st.st_mode) || identity_reserve() != 0) return;
+    
+    uint32_t id = identity_slots[identity_lookup(st.st_dev, st.st_ino)];
+    if (id != IDENTITY_SLOT_EMPTY && id != IDENTITY_SLOT_DELETED) {
+        identity_link_path(id, filepath, len);
+    }
+}
+
+void file_identity_event(uint32_t mask, const char *filepath, size_t len) {
+    if (!enable_checksum || (mask & IN_ISDIR)) return;
+    pthread_mutex_lock(&hash_mutex);
+    if (!identity_slots) {
+        pthread_mutex_unlock(&hash_mutex);
+        return;
+    }
+    if (mask & (IN_DELETE | IN_MOVED_FROM)) {
+        file_identity_forget(filepath, len, (mask & IN_DELETE) != 0);
+    } else if (mask & IN_MOVED_TO) {
+        file_identity_moved(filepath, len);
+    }
+    pthread_mutex_unlock(&hash_mutex);
+}
+
+void file_identity_cleanup() {
+    pthread_mutex_lock(&hash_mutex);
+    free(identities);
+    free(identity_slots);
+    free(identity_paths);
+    path_index_free(&identity_path_index);
+    identities = NULL;
+    identity_slots = NULL;
+    identity_paths = NULL;
+    identity_count = identity_used = identity_capacity = 0;
+    identity_path_count = identity_path_used = identity_path_capacity = 0;
+    identity_free = identity_path_free = UINT32_MAX;
+    pthread_mutex_unlock(&hash_mutex);
+}
+
+// ===== SEGMENT FILES =====
+
+// Rotated segments are gzip files written as independently decompressible
+// blocks: every SEGMENT_BLOCK_SIZE bytes of log text (at a line boundary)
+// the deflate stream is full-flushed, so inflation can start at any block.
+// A sidecar "<segment>.idx" lists each block's compressed offset, first
+// timestamp and first sequence number. The file itself stays plain gzip.
+#define SEGMENT_BLOCK_SIZE      (256 * 1024)
+#define SEGMENT_INDEX_MAGIC     0x49534d46  // "FMSI"
+#define SEGMENT_INDEX_VERSION   1
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t block_count;
+    uint32_t block_size;
+    uint64_t file_size;       // size of the gzip file the index describes
+} segment_index_header_t;
+
+typedef struct {
+    uint64_t offset;          // compressed offset of the block's first byte
+    uint64_t raw_offset;      // offset of the block's first line in the text
+    uint64_t first_seq;       // first sequenced line in the block, 0 if none
+    char first_ts[TIMESTAMP_SIZE + 4];  // "YYYY-MM-DD HH:MM:SS" of the first line
+} segment_block_t;
+
+typedef struct {
+    FILE *file;
+    z_stream strm;
+    unsigned char out[64 * 1024];
+    segment_block_t *blocks;
+    uint32_t block_count;
+    uint32_t block_capacity;
+    uint64_t raw_total;
+    size_t block_raw;
+    int need_seq;
+    int failed;
+} segment_writer_t;
+
+typedef struct {
+    gzFile gz;                // whole-file reads (plain or unindexed gzip)
+    FILE *file;               // raw inflation of a block range
+    z_stream strm;
+    uint64_t in_left;         // compressed bytes left in the range
+    int at_end;
+    unsigned char in[64 * 1024];
+    char out[256 * 1024];
+    size_t out_pos;
+    size_t out_len;
+} segment_reader_t;
+
+void segment_index_path(const char *segment_path, char *out, size_t out_size) {
+    snprintf(out, out_size, "%s.idx", segment_path);
+}
+
+static int segment_writer_deflate(segment_writer_t *w, const void *data, size_t len, int flush) {
+    w->strm.next_in = (Bytef *)data;
+    w->strm.avail_in = len;
+    do {
+        w->strm.next_out = w->out;
+        w->strm.avail_out = sizeof(w->out);
+        int ret = deflate(&w->strm, flush);
+        if (ret == Z_STREAM_ERROR) return -1;
+        size_t produced = sizeof(w->out) - w->strm.avail_out;
+        if (produced && fwrite(w->out, 1, produced, w->file) != produced) return -1;
+    } while (w->strm.avail_out == 0 || w->strm.avail_in > 0);
+    return 0;
+}
+
+static int segment_writer_open(segment_writer_t *w, const char *path) {
+    memset(w, 0, sizeof(*w));
+    w->file = fopen(path, "wb");
+    if (!w->file) return -1;
+    // windowBits 15 + 16: zlib writes the gzip header and trailer
+    if (deflateInit2(&w->strm, 9, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        fclose(w->file);
+        return -1;
+    }
+    // Emit the gzip header and an empty flush so block 0 also starts on a
+    // byte boundary that raw inflation can begin at
+    if (segment_writer_deflate(w, NULL, 0, Z_FULL_FLUSH) != 0) {
+        deflateEnd(&w->strm);
+        fclose(w->file);
+        return -1;
+    }
+    w->block_raw = SEGMENT_BLOCK_SIZE;   // the first line opens block 0
+    return 0;
+}
+
+// Append whole lines; blocks are cut only between lines
+static int segment_writer_write(segment_writer_t *w, const char *data, size_t len) {
+    size_t pos = 0;
+    while (pos < len && !w->failed) {
+        if (w->block_raw >= SEGMENT_BLOCK_SIZE) {
+            if (w->block_count > 0 && segment_writer_deflate(w, NULL, 0, Z_FULL_FLUSH) != 0) {
+                w->failed = 1;
+                break;
+            }
+            if (w->block_count == w->block_capacity) {
+                uint32_t cap = w->block_capacity ? w->block_capacity * 2 : 64;
+                segment_block_t *grown = realloc(w->blocks, cap * sizeof(segment_block_t));
+                if (!grown) {
+                    w->failed = 1;
+                    break;
+                }
+                w->blocks = grown;
+                w->block_capacity = cap;
+            }
+            segment_block_t *block = &w->blocks[w->block_count++];
+            memset(block, 0, sizeof(*block));
+            block->offset = w->strm.total_out;
+            block->raw_offset = w->raw_total;
+            if (len - pos > TIMESTAMP_SIZE && data[pos] == '[' && data[pos + TIMESTAMP_SIZE] == ']') {
+                memcpy(block->first_ts, data + pos + 1, TIMESTAMP_SIZE - 1);
+            }
+            w->block_raw = 0;
+            w->need_seq = 1;
+        }
+        
+        // Take the rest of the block, extended to the end of its last line
+        size_t take = len - pos;
+        size_t room = SEGMENT_BLOCK_SIZE - w->block_raw;
+        if (take > room) {
+            const char *nl = memchr(data + pos + room - 1, '\n', len - pos - room + 1);
+            take = nl ? (size_t)(nl - (data + pos)) + 1 : len - pos;
+        }
+        
+        // Blocks may start with unsequenced lines ([INFO], [COMPACT], ...)
+        for (size_t p = pos; w->need_seq && p < pos + take; ) {
+            const char *nl = memchr(data + p, '\n', pos + take - p);
+            size_t line_len = nl ? (size_t)(nl - (data + p)) : pos + take - p;
+            uint64_t seq = parse_line_seq(data + p, line_len);
+            if (seq) {
+                // Describe the block by its first event, not a leading marker
+                segment_block_t *block = &w->blocks[w->block_count - 1];
+                block->first_seq = seq;
+                memcpy(block->first_ts, data + p + 1, TIMESTAMP_SIZE - 1);
+                w->need_seq = 0;
+            }
+            p += line_len + 1;
+        }
+        
+        if (segment_writer_deflate(w, data + pos, take, Z_NO_FLUSH) != 0) {
+            w->failed = 1;
+            break;
+        }
+        pos += take;
+        w->raw_total += take;
+        w->block_raw += take;
+    }
+    return w->failed ? -1 : 0;
+}
+
+// Finish the gzip stream and write the block index next to index_for
+// (the path the segment will finally live under)
+static int segment_writer_close(segment_writer_t *w, const char *index_for) {
+    int ok = !w->failed && segment_writer_deflate(w, NULL, 0, Z_FINISH) == 0;
+    uint64_t file_size = w->strm.total_out;
+    deflateEnd(&w->strm);
+    ok = fclose(w->file) == 0 && ok;
+    
+    if (ok && index_for) {
+        char index_path[MAX_PATH_LEN + 8], tmp_path[MAX_PATH_LEN + 16];
+        segment_index_path(index_for, index_path, sizeof(index_path));
+        snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", index_path);
+        
+        segment_index_header_t header;
+        memset(&header, 0, sizeof(header));
+        header.magic = SEGMENT_INDEX_MAGIC;
+        header.version = SEGMENT_INDEX_VERSION;
+        header.block_count = w->block_count;
+        header.block_size = SEGMENT_BLOCK_SIZE;
+        header.file_size = file_size;
+        
+        FILE *idx = fopen(tmp_path, "wb");
+        if (idx) {
+            int idx_ok = fwrite(&header, sizeof(header), 1, idx) == 1 &&
+                         (w->block_count == 0 ||
+                          fwrite(w->blocks, sizeof(segment_block_t), w->block_count, idx) == w->block_count);
+            idx_ok = fclose(idx) == 0 && idx_ok;
+            if (!idx_ok || rename(tmp_path, index_path) != 0) unlink(tmp_path);
+        }
+    }
+    free(w->blocks);
+    w->blocks = NULL;
+    return ok ? 0 : -1;
+}
+
+// Compress a plain segment into a block-indexed gzip segment
+int segment_compress_file(const char *src_path, const char *gz_path) {
+    FILE *input = fopen(src_path, "rb");
+    if (!input) return -1;
+    
+    segment_writer_t w;
+    char *buffer = malloc(SEGMENT_BLOCK_SIZE);
+    if (!buffer || segment_writer_open(&w, gz_path) != 0) {
+        free(buffer);
+        fclose(input);
+        return -1;
+    }
+    
+    // Hand the writer whole lines; a partial last line is carried over
+    size_t have = 0;
+    int result = 0;
+    for (;;) {
+        size_t n = fread(buffer + have, 1, SEGMENT_BLOCK_SIZE - have, input);
+        have += n;
+        if (have == 0) break;
+        const char *nl = n ? memrchr(buffer, '\n', have) : NULL;
+        size_t complete = n == 0 ? have : nl ? (size_t)(nl - buffer) + 1 : have;
+        if (segment_writer_write(&w, buffer, complete) != 0) {
+            result = -1;
+            break;
+        }
+        memmove(buffer, buffer + complete, have - complete);
+        have -= complete;
+        if (n == 0) break;
+    }
+    
+    fclose(input);
+    free(buffer);
+    if (segment_writer_close(&w, gz_path) != 0) result = -1;
+    return result;
+}
+
+// Block index of a gzip segment, or NULL if it has none or it is stale
+segment_block_t *segment_index_load(const char *segment_path, uint32_t *count) {
+    char index_path[MAX_PATH_LEN + 8];
+    segment_index_path(segment_path, index_path, sizeof(index_path));
+    FILE *idx = fopen(index_path, "rb");
+    if (!idx) return NULL;
+    
+    segment_index_header_t header;
+    struct stat st;
+    segment_block_t *blocks = NULL;
+    if (fread(&header, sizeof(header), 1, idx) == 1 &&
+        header.magic == SEGMENT_INDEX_MAGIC && header.version == SEGMENT_INDEX_VERSION &&
+        header.block_count > 0 && header.block_count < (1u << 24) &&
+        stat(segment_path, &st) == 0 && (uint64_t)st.st_size == header.file_size) {
+        blocks = malloc(header.block_count * sizeof(segment_block_t));
+        if (blocks && fread(blocks, sizeof(segment_block_t), header.block_count, idx) != header.block_count) {
+            free(blocks);
+            blocks = NULL;
+        }
+    }
+    fclose(idx);
+    if (blocks) *count = header.block_count;
+    return blocks;
+}
+
+// Open a segment for reading. With offset >= 0 inflation starts at that
+// block boundary and stops after length compressed bytes (0 = to the end);
+// otherwise the whole file is read through zlib's gz layer.
+int segment_reader_open(segment_reader_t *r, const char *path, int64_t offset, uint64_t length) {
+    memset(r, 0, offsetof(segment_reader_t, in));
+    if (offset < 0) {
+        r->gz = gzopen(path, "rb");
+        if (!r->gz) return -1;
+        gzbuffer(r->gz, 256 * 1024);
+        return 0;
+    }
+    
+    r->file = fopen(path, "rb");
+    if (!r->file) return -1;
+    if (fseeko(r->file, offset, SEEK_SET) != 0 || inflateInit2(&r->strm, -15) != Z_OK) {
+        fclose(r->file);
+        r->file = NULL;
+        return -1;
+    }
+    r->in_left = length ? length : UINT64_MAX;
+    return 0;
+}
+
+// Read up to len decompressed bytes; 0 at the end of the range
+size_t segment_reader_read(segment_reader_t *r, char *buf, size_t len) {
+    if (r->gz) {
+        int n = gzread(r->gz, buf, len);
+        return n > 0 ? (size_t)n : 0;
+    }
+    
+    size_t produced = 0;
+    while (produced < len && !r->at_end) {
+        if (r->strm.avail_in == 0) {
+            size_t want = sizeof(r->in);
+            if (want > r->in_left) want = r->in_left;
+            size_t got = want ? fread(r->in, 1, want, r->file) : 0;
+            if (got == 0) {
+                r->at_end = 1;
+                break;
+            }
+            r->in_left -= got;
+            r->strm.next_in = r->in;
+            r->strm.avail_in = got;
+        }
+        r->strm.next_out = (Bytef *)buf + produced;
+        r->strm.avail_out = len - produced;
+        int ret = inflate(&r->strm, Z_NO_FLUSH);
+        produced = len - r->strm.avail_out;
+        if (ret == Z_STREAM_END || (ret != Z_OK && ret != Z_BUF_ERROR)) {
+            r->at_end = 1;
+        }
+    }
+    return produced;
+}
+
+// fgets() over the reader
+char *segment_reader_gets(segment_reader_t *r, char *line, size_t size) {
+    if (r->gz) return gzgets(r->gz, line, size);
+    
+    size_t len = 0;
+    while (len + 1 < size) {
+        if (r->out_pos == r->out_len) {
+            r->out_len = segment_reader_read(r, r->out, sizeof(r->out));
+            r->out_pos = 0;
+            if (r->out_len == 0) break;
+        }
+        char c = r->out[r->out_pos++];
+        line[len++] = c;
+        if (c == '\n') break;
+    }
+    line[len] = '\0';
+    return len ? line : NULL;
+}
+
+void segment_reader_close(segment_reader_t *r) {
+    if (r->gz) {
+        gzclose(r->gz);
+    } else if (r->file) {
+        inflateEnd(&r->strm);
+        fclose(r->file);
+    }
+    r->gz = NULL;
+    r->file = NULL;
+}
+
+// ===== LOG COMPACTION =====
+
+// Rotated segments older than compact_age_hours are rewritten once:
+// Opened/Closed lines (compact_drop) are dropped, and each run of
+// Modified lines for a path, not interrupted by another event on that
+// path, becomes one summary line at the position and sequence number of
+// its last member. Surviving lines keep their numbers, so the segment
+// stays in sequence order for replay. The result is gzip-compressed.
+
+#define COMPACT_MARKER   "[COMPACT]"
+#define COMPACT_INTERVAL 3600
+
+enum { COMPACT_KEEP, COMPACT_DROP, COMPACT_SUMMARY };
+
+typedef struct {
+    const char *path;
+    size_t path_len;
+    uint32_t count;
+    uint32_t last_line;
+    uint64_t first_seq;
+    int active;
+} compact_run_t;
+
+
+// Split an event line into label and path. Returns 0 for other lines.
+static int compact_parse_event(const char *line, size_t len, const char **label, size_t *label_len,
+                               const char **path, size_t *path_len) {
+    if (!parse_line_seq(line, len)) return 0;
+    const char *p = memchr(line + TIMESTAMP_SIZE + 3, ' ', len - TIMESTAMP_SIZE - 3);
+    if (!p) return 0;
+    p++;
+    const char *colon = memmem(p, len - (p - line), ": ", 2);
+    if (!colon) return 0;
+    
+    *label = p;
+    *label_len = colon + 2 - p;
+    *path = colon + 2;
+    *path_len = event_text_path_len(*path, len - (*path - line));
+    return 1;
+}
+
+static compact_run_t *compact_run_find(compact_run_t *runs, size_t capacity,
+                                       const char *path, size_t path_len) {
+    size_t slot = fnv1a(path, path_len, 0xcbf29ce484222325ULL) & (capacity - 1);
+    while (runs[slot].path) {
+        if (runs[slot].path_len == path_len && memcmp(runs[slot].path, path, path_len) == 0) {
+            return &runs[slot];
+        }
+        slot = (slot + 1) & (capacity - 1);
+    }
+    runs[slot].path = path;
+    runs[slot].path_len = path_len;
+    return &runs[slot];
+}
+
+static void compact_run_close(compact_run_t *run, uint8_t *action, uint32_t *run_of, uint32_t run_index) {
+    if (run->active && run->count > 1) {
+        action[run->last_line] = COMPACT_SUMMARY;
+        run_of[run->last_line] = run_index;
+    }
+    run->active = 0;
+}
+
+// Rewrite one rotated segment in compacted form. Returns 0 when rewritten,
+// 1 when it was already compacted, -1 on error
+static int compact_segment(const char *path) {
+    struct stat before;
+    if (stat(path, &before) != 0) return -1;
+    
+    // Load the whole segment; segments are bounded by MAX_LOG_SIZE_MB
+    gzFile in = gzopen(path, "rb");
+    if (!in) return -1;
+    size_t capacity = 4 * 1024 * 1024, len = 0;
+    char *data = malloc(capacity);
+    int n;
+    while (data && (n = gzread(in, data + len, capacity - len)) > 0) {
+        len += n;
+        if (len == capacity) {
+            char *grown = realloc(data, capacity * 2);
+            if (!grown) {
+                free(data);
+                data = NULL;
+                break;
+            }
+            data = grown;
+            capacity *= 2;
+        }
+    }
+    gzclose(in);
+    if (!data) return -1;
+    if (len >= sizeof(COMPACT_MARKER) + TIMESTAMP_SIZE &&
+        memcmp(data + TIMESTAMP_SIZE + 2, COMPACT_MARKER, sizeof(COMPACT_MARKER) - 1) == 0) {
+        free(data);
+        return 1;   // already compacted
+    }
+    
+    size_t line_count = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (data[i] == '\n') line_count++;
+    }
+    size_t run_capacity = 1024;
+    while (run_capacity < line_count * 2) run_capacity *= 2;
+    
+    uint32_t *line_off = malloc((line_count + 1) * sizeof(uint32_t));
+    uint8_t *action = calloc(line_count + 1, 1);
+    uint32_t *run_of = malloc((line_count + 1) * sizeof(uint32_t));
+    compact_run_t *runs = calloc(run_capacity, sizeof(compact_run_t));
+    char *out = malloc(len + 256);
+    if (!line_off || !action || !run_of || !runs || !out) {
+        free(line_off); free(action); free(run_of); free(runs); free(out); free(data);
+        return -1;
+    }
+    
+    // Pass 1: decide what happens to every line
+    size_t lines = 0, pos = 0;
+    while (pos < len) {
+        const char *line = data + pos;
+        const char *nl = memchr(line, '\n', len - pos);
+        size_t line_len = nl ? (size_t)(nl - line) : len - pos;
+        line_off[lines] = pos;
+        
+        const char *label, *event_path_ptr;
+        size_t label_len, event_path_len;
+        if (compact_parse_event(line, line_len, &label, &label_len, &event_path_ptr, &event_path_len)) {
+            // Sampled lines read "Opened [1/N]: "
+            int is_open = label_len >= 8 && memcmp(label, "Opened", 6) == 0 && (label[6] == ':' || label[6] == ' ');
+            int is_close = label_len >= 8 && memcmp(label, "Closed", 6) == 0 && (label[6] == ':' || label[6] == ' ');
+            if ((is_open && compact_drop_open) || (is_close && compact_drop_close)) {
+                action[lines] = COMPACT_DROP;
+            } else {
+                compact_run_t *run = compact_run_find(runs, run_capacity, event_path_ptr, event_path_len);
+                uint32_t run_index = run - runs;
+                if (label_len >= 8 && memcmp(label, "Modified", 8) == 0) {
+                    if (run->active) {
+                        action[run->last_line] = COMPACT_DROP;
+                        run->count++;
+                    } else {
+                        run->active = 1;
+                        run->count = 1;
+                        run->first_seq = parse_line_seq(line, line_len);
+                    }
+                    run->last_line = lines;
+                } else {
+                    compact_run_close(run, action, run_of, run_index);
+                }
+            }
+        }
+        lines++;
+        pos += line_len + 1;
+    }
+    for (size_t i = 0; i < run_capacity; i++) {
+        compact_run_close(&runs[i], action, run_of, i);
+    }
+    
+    // Pass 2: write the survivors and the summaries
+    size_t out_len = 0, kept = 0;
+    const char *last_stamp = NULL;
+    
+    for (size_t i = 0; i < lines; i++) {
+        const char *line = data + line_off[i];
+        size_t line_len = (i + 1 < lines ? line_off[i + 1] - 1 : len) - line_off[i];
+        if (line_len && line[line_len - 1] == '\n') line_len--;
+        
+        if (action[i] == COMPACT_DROP) continue;
+        kept++;
+        if (line_len > TIMESTAMP_SIZE && line[0] == '[') last_stamp = line + 1;
+        if (action[i] == COMPACT_SUMMARY) {
+            // "[ts] #<last> Modified (xN since #<first>): <path>"
+            compact_run_t *run = &runs[run_of[i]];
+            const char *label = memchr(line + TIMESTAMP_SIZE + 3, ' ', line_len - TIMESTAMP_SIZE - 3) + 1;
+            char summary[64];
+            int summary_len = snprintf(summary, sizeof(summary), "Modified (x%u since #%llu): ",
+                                       run->count, (unsigned long long)run->first_seq);
+            size_t head_len = label - line;
+            if (out_len + head_len + summary_len + run->path_len + 1 > len + 256) {
+                // Summaries are never longer than the lines they replace
+                break;
+            }
+            memcpy(out + out_len, line, head_len);
+            out_len += head_len;
+            memcpy(out + out_len, summary, summary_len);
+            out_len += summary_len;
+            memcpy(out + out_len, run->path, run->path_len);
+            out_len += run->path_len;
+        } else {
+            memcpy(out + out_len, line, line_len);
+            out_len += line_len;
+        }
+        out[out_len++] = '\n';
+    }
+    
+    // The marker carries the time of the last kept line, not of the
+    // compaction, so time-range searches still see the segment's own span
+    char timestamp[TIMESTAMP_SIZE];
+    if (last_stamp) {
+        memcpy(timestamp, last_stamp, TIMESTAMP_SIZE - 1);
+        timestamp[TIMESTAMP_SIZE - 1] = '\0';
+    } else {
+        time_t now = time(NULL);
+        struct tm tm_info;
+        localtime_r(&now, &tm_info);
+        strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &tm_info);
+    }
+    char marker[160];
+    int marker_len = snprintf(marker, sizeof(marker), "[%s] %s Compacted segment: kept %zu of %zu lines\n",
+                              timestamp, COMPACT_MARKER, kept, lines);
+    
+    char tmp_path[MAX_PATH_LEN + 16], final_path[MAX_PATH_LEN + 8];
+    size_t path_len = strlen(path);
+    int is_gz = path_len > 3 && strcmp(path + path_len - 3, ".gz") == 0;
+    snprintf(final_path, sizeof(final_path), "%s%s", path, is_gz ? "" : ".gz");
+    snprintf(tmp_path, sizeof(tmp_path), "%s.compact", final_path);
+    
+    char tmp_index[MAX_PATH_LEN + 24], final_index[MAX_PATH_LEN + 16];
+    segment_index_path(tmp_path, tmp_index, sizeof(tmp_index));
+    segment_index_path(final_path, final_index, sizeof(final_index));
+    
+    int result = -1;
+    segment_writer_t w;
+    if (segment_writer_open(&w, tmp_path) == 0) {
+        int ok = segment_writer_write(&w, marker, marker_len) == 0 &&
+                 segment_writer_write(&w, out, out_len) == 0;
+        ok = segment_writer_close(&w, tmp_path) == 0 && ok;
+        
+        // Rotation may have shifted the segment meanwhile; only replace the
+        // file that was actually read
+        pthread_mutex_lock(&segment_mutex);
+        struct stat after;
+        if (ok && stat(path, &after) == 0 && after.st_ino == before.st_ino &&
+            rename(tmp_path, final_path) == 0) {
+            if (rename(tmp_index, final_index) != 0) unlink(final_index);
+            if (!is_gz) unlink(path);
+            result = 0;
+        } else {
+            unlink(tmp_path);
+            unlink(tmp_index);
+        }
+        pthread_mutex_unlock(&segment_mutex);
+    }
+    
+    if (result == 0) {
+        struct stat compacted;
+        char msg[MAX_PATH_LEN + 160];
+        stat(final_path, &compacted);
+        snprintf(msg, sizeof(msg),
+                "[COMPACT] %s: kept %zu of %zu lines, %lld -> %lld bytes",
+                final_path, kept, lines, (long long)before.st_size, (long long)compacted.st_size);
+        log_event(msg);
+    }
+    
+    free(line_off); free(action); free(run_of); free(runs); free(out); free(data);
+    return result;
+}
+
+// Compact every rotated segment older than max_age_hours
+int compact_pass(long max_age_hours) {
+    time_t cutoff = time(NULL) - max_age_hours * 3600;
+    int compacted = 0;
+    
+    for (int i = 0; i < MAX_LOG_FILES; i++) {
+        for (int gz = 0; gz < 2; gz++) {
+            char path[MAX_PATH_LEN];
+            struct stat st;
+            snprintf(path, sizeof(path), "%s.%d%s", LOG_FILE, i, gz ? ".gz" : "");
+            if (stat(path, &st) != 0 || st.st_mtime > cutoff) continue;
+            if (compact_segment(path) == 0) compacted++;
+        }
+    }
+    return compacted;
+}
+
+void* compact_thread_func(void* arg) {
+    (void)arg;
+    thread_set_role("compact");
+    while (running) {
+        compact_pass(compact_age_hours);
+        for (int waited = 0; waited < COMPACT_INTERVAL && running; waited++) {
+            sleep(1);
+        }
+    }
+    return NULL;
+}
+
+// ===== EVENT SEQUENCE AND IPC SERVER =====
+
+// Sequence number of a sequenced log line ("[timestamp] #<seq> ..."), or 0
+uint64_t parse_line_seq(const char *line, size_t len) {
+    if (len < TIMESTAMP_SIZE + 4 || line[0] != '[' ||
+        line[TIMESTAMP_SIZE] != ']' || line[TIMESTAMP_SIZE + 2] != '#') {
+        return 0;
+    }
+    
+    uint64_t seq = 0;
+    for (size_t i = TIMESTAMP_SIZE + 3; i < len && line[i] >= '0' && line[i] <= '9'; i++) {
+        seq = seq * 10 + (line[i] - '0');
+    }
+    return seq;
+}
+
+// Highest sequence number in the tail of a plain log file
+static uint64_t log_last_seq(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return 0;
+    
+    static char tail[LOG_BUFFER_SIZE];
+    struct stat st;
+    uint64_t last = 0;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        off_t start = st.st_size > LOG_BUFFER_SIZE ? st.st_size - LOG_BUFFER_SIZE : 0;
+        ssize_t n = pread(fd, tail, st.st_size - start, start);
+        const char *p = tail, *end = tail + (n > 0 ? n : 0);
+        
+        // The first line of a partial tail may be cut; skip it
+        if (start > 0) {
+            const char *nl = memchr(p, '\n', end - p);
+            p = nl ? nl + 1 : end;
+        }
+        while (p < end) {
+            const char *nl = memchr(p, '\n', end - p);
+            size_t len = nl ? (size_t)(nl - p) : (size_t)(end - p);
+            uint64_t seq = parse_line_seq(p, len);
+            if (seq > last) last = seq;
+            p += len + 1;
+        }
+    }
+    close(fd);
+    return last;
+}
+
+int seq_init() {
+    uint64_t stored = 0;
+    seq_fd = open(SEQ_STATE_FILE, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (seq_fd != -1) {
+        char text[32];
+        ssize_t n = pread(seq_fd, text, sizeof(text) - 1, 0);
+        if (n > 0) {
+            text[n] = '\0';
+            stored = strtoull(text, NULL, 10);
+        }
+    }
+    
+    // The log itself wins if the state file was lost or is behind
+    uint64_t logged = log_last_seq(LOG_FILE);
+    pthread_mutex_lock(&log_mutex);
+    event_seq = stored > logged ? stored : logged;
+    event_seq_reserved = event_seq;
+    pthread_mutex_unlock(&log_mutex);
+    
+    char msg[128];
+    snprintf(msg, sizeof(msg), "[SEQ] Event sequence resumes after #%llu",
+            (unsigned long long)event_seq);
+    log_event(msg);
+    return seq_fd == -1 ? -1 : 0;
+}
+
+void seq_shutdown() {
+    pthread_mutex_lock(&log_mutex);
+    if (seq_fd != -1) {
+        seq_store(event_seq);
+        close(seq_fd);
+        seq_fd = -1;
+    }
+    pthread_mutex_unlock(&log_mutex);
+}
+
+// Copy one event line to every live subscriber. Caller holds log_mutex.
+void ipc_publish_locked(const char *line, size_t len) {
+    for (int i = 0; i < IPC_MAX_SUBSCRIBERS; i++) {
+        ipc_subscriber_t *sub = &ipc_subscribers[i];
+        if (!sub->active || sub->overrun) continue;
+        
+        if (sub->head - sub->tail + len > IPC_SUBSCRIBER_RING) {
+            sub->overrun = 1;
+            continue;
+        }
+        size_t pos = sub->head % IPC_SUBSCRIBER_RING;
+        size_t first = IPC_SUBSCRIBER_RING - pos < len ? IPC_SUBSCRIBER_RING - pos : len;
+        memcpy(sub->ring + pos, line, first);
+        memcpy(sub->ring, line + first, len - first);
+        sub->head += len;
+    }
+}
+
+static int send_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Log segments, oldest first: monitor.log.N[.gz] ... monitor.log.0[.gz], monitor.log
+static int log_segment_paths(char paths[][MAX_PATH_LEN], int max) {
+    int count = 0;
+    for (int i = MAX_LOG_FILES - 1; i >= 0 && count < max - 1; i--) {
+        for (int gz = 1; gz >= 0; gz--) {
+            snprintf(paths[count], MAX_PATH_LEN, "%s.%d%s", LOG_FILE, i, gz ? ".gz" : "");
+            if (access(paths[count], F_OK) == 0) {
+                count++;
+                break;
+            }
+        }
+    }
+    snprintf(paths[count++], MAX_PATH_LEN, "%s", LOG_FILE);
+    return count;
+}
+
+static uint64_t segment_first_seq(const char *path) {
+    uint32_t block_count = 0;
+    segment_block_t *blocks = segment_index_load(path, &block_count);
+    if (blocks) {
+        uint64_t seq = 0;
+        for (uint32_t b = 0; b < block_count && !seq; b++) {
+            seq = blocks[b].first_seq;
+        }
+        free(blocks);
+        if (seq) return seq;
     }
     
-    if (!recursive_mode) {
-        return 0;
+    gzFile in = gzopen(path, "rb");
+    if (!in) return 0;
+    
+    char line[MAX_PATH_LEN + 128];
+    uint64_t seq = 0;
+    while (!seq && gzgets(in, line, sizeof(line))) {
+        seq = parse_line_seq(line, strlen(line));
     }
+    gzclose(in);
+    return seq;
+}
+
+// Send every logged event with from_seq <= seq < until_seq, reading the
+// rotated (possibly gzip-compressed) segments and the active log. Returns
+// the last sequence number sent, or -1 if the consumer went away.
+static int64_t ipc_replay(int fd, uint64_t from_seq, uint64_t until_seq) {
+    char paths[MAX_LOG_FILES + 1][MAX_PATH_LEN];
+    int count = log_segment_paths(paths, MAX_LOG_FILES + 1);
     
-    DIR *dir = opendir(path);
-    if (!dir) {
-        char error_msg[512];
-        snprintf(error_msg, sizeof(error_msg), "[ERROR] Cannot open directory: %s", path);
-        log_event(error_msg);
+    // Skip whole segments that end before from_seq
+    int start = 0;
+    for (int i = count - 1; i > 0; i--) {
+        uint64_t first = segment_first_seq(paths[i]);
+        if (first && first <= from_seq) {
+            start = i;
+            break;
+        }
+    }
+    
+    char line[MAX_PATH_LEN + 128];
+    char *out = malloc(LOG_BUFFER_SIZE);
+    size_t out_len = 0;
+    uint64_t last_sent = 0;
+    if (!out) return -1;
+    
+    segment_reader_t *in = malloc(sizeof(segment_reader_t));
+    if (!in) {
+        free(out);
         return -1;
     }
     
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            continue;
+    for (int i = start; i < count; i++) {
+        // In the first segment, start at the last block that begins at or
+        // before from_seq instead of inflating the whole file
+        int64_t offset = -1;
+        uint32_t block_count = 0;
+        segment_block_t *blocks = i == start ? segment_index_load(paths[i], &block_count) : NULL;
+        for (uint32_t b = 0; b < block_count; b++) {
+            if (blocks[b].first_seq && blocks[b].first_seq <= from_seq) {
+                offset = blocks[b].offset;
+            } else if (blocks[b].first_seq > from_seq) {
+                break;
+            }
         }
+        free(blocks);
+        if (segment_reader_open(in, paths[i], offset, 0) != 0) continue;
         
-        char subpath[MAX_PATH_LEN];
-        snprintf(subpath, sizeof(subpath), "%s/%s", path, entry->d_name);
+        while (segment_reader_gets(in, line, sizeof(line))) {
+            size_t len = strlen(line);
+            uint64_t seq = parse_line_seq(line, len);
+            if (seq < from_seq || seq <= last_sent) continue;
+            if (seq >= until_seq) break;
+            
+            if (out_len + len > LOG_BUFFER_SIZE) {
+                if (send_all(fd, out, out_len) != 0) {
+                    segment_reader_close(in);
+                    free(in);
+                    free(out);
+                    return -1;
+                }
+                out_len = 0;
+            }
+            memcpy(out + out_len, line, len);
+            out_len += len;
+            last_sent = seq;
+        }
+        segment_reader_close(in);
+    }
+    free(in);
+    
+    int result = out_len > 0 ? send_all(fd, out, out_len) : 0;
+    free(out);
+    return result == 0 ? (int64_t)last_sent : -1;
+}
+
+// Serve {"command":"subscribe","data":{"from_seq":N}}: a JSON header line,
+// then every event line from N onwards, replayed from disk and followed
+// live. A consumer that stores the last sequence number it processed can
+// reconnect with from_seq = last + 1 and neither miss nor repeat events.
+static void ipc_serve_subscribe(int fd, uint64_t from_seq) {
+    int slot = -1;
+    char *ring = malloc(IPC_SUBSCRIBER_RING);
+    char header[256];
+    
+    pthread_mutex_lock(&log_mutex);
+    for (int i = 0; i < IPC_MAX_SUBSCRIBERS && ring; i++) {
+        if (!ipc_subscribers[i].active) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot == -1) {
+        pthread_mutex_unlock(&log_mutex);
+        free(ring);
+        snprintf(header, sizeof(header), "{\"success\":false,\"error\":\"too many subscribers\"}\n");
+        send_all(fd, header, strlen(header));
+        return;
+    }
+    
+    // Everything before live_seq is on disk; everything after goes to the ring
+    if (log_fd != -1 && log_buffer_len > 0) {
+        log_flush_locked();
+    }
+    uint64_t live_seq = event_seq + 1;
+    ipc_subscriber_t *sub = &ipc_subscribers[slot];
+    sub->ring = ring;
+    sub->head = sub->tail = 0;
+    sub->overrun = 0;
+    sub->active = 1;
+    ipc_subscriber_count++;
+    pthread_mutex_unlock(&log_mutex);
+    
+    if (from_seq == 0 || from_seq > live_seq) {
+        from_seq = live_seq;
+    }
+    snprintf(header, sizeof(header),
+            "{\"success\":true,\"from_seq\":%llu,\"live_seq\":%llu}\n",
+            (unsigned long long)from_seq, (unsigned long long)live_seq);
+    
+    int ok = send_all(fd, header, strlen(header)) == 0 &&
+             (from_seq >= live_seq || ipc_replay(fd, from_seq, live_seq) >= 0);
+    
+    char *chunk = ok ? malloc(LOG_BUFFER_SIZE) : NULL;
+    while (chunk && running) {
+        pthread_mutex_lock(&log_mutex);
+        if (sub->head == sub->tail && !sub->overrun) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += 200 * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&ipc_cond, &log_mutex, &deadline);
+        }
+        
+        size_t available = sub->head - sub->tail;
+        size_t len = available < LOG_BUFFER_SIZE ? available : LOG_BUFFER_SIZE;
+        size_t pos = sub->tail % IPC_SUBSCRIBER_RING;
+        size_t first = IPC_SUBSCRIBER_RING - pos < len ? IPC_SUBSCRIBER_RING - pos : len;
+        memcpy(chunk, sub->ring + pos, first);
+        memcpy(chunk + first, sub->ring, len - first);
+        sub->tail += len;
+        int overrun_done = sub->overrun && sub->head == sub->tail;
+        pthread_mutex_unlock(&log_mutex);
         
-        struct stat sub_stat;
-        if (stat(subpath, &sub_stat) == 0 && S_ISDIR(sub_stat.st_mode)) {
-            add_watch_recursive_basic(subpath);
+        if (len > 0 && send_all(fd, chunk, len) != 0) break;
+        if (len == 0) {
+            // Idle wakeup: notice consumers that hung up
+            char probe;
+            if (recv(fd, &probe, 1, MSG_PEEK | MSG_DONTWAIT) == 0) break;
+        }
+        if (overrun_done) {
+            // Too slow to follow live; it resumes from disk on reconnect
+            break;
         }
     }
+    free(chunk);
     
-    closedir(dir);
+    pthread_mutex_lock(&log_mutex);
+    sub->active = 0;
+    sub->ring = NULL;
+    ipc_subscriber_count--;
+    pthread_mutex_unlock(&log_mutex);
+    free(ring);
+}
+
+typedef struct {
+    json_object *paths;
+    size_t limit;
+    int truncated;
+} ipc_path_list_t;
+
+static int ipc_collect_path(const char *path, size_t len, uint32_t value, void *arg) {
+    (void)len;
+    (void)value;
+    ipc_path_list_t *list = arg;
+    if (json_object_array_length(list->paths) >= list->limit) {
+        list->truncated = 1;
+        return 1;
+    }
+    json_object_array_add(list->paths, json_object_new_string(path));
     return 0;
 }
 
-void handle_event_basic(struct inotify_event *event, const char *watch_path) {
-    stats.total_events++;
+// {"root": "src", "limit": N}: watched directories and content-tracked
+// files at or below root, straight from the path indexes
+static json_object *ipc_list_paths(const char *root, size_t limit) {
+    size_t root_len = strlen(root);
+    while (root_len > 1 && root[root_len - 1] == '/') root_len--;
+    json_object *reply = json_object_new_object();
+    ipc_path_list_t watched = { json_object_new_array(), limit, 0 };
+    ipc_path_list_t tracked = { json_object_new_array(), limit, 0 };
     
-    if (event->len > 0) {
-        char full_path[MAX_PATH_LEN];
-        snprintf(full_path, sizeof(full_path), "%s/%s", watch_path, event->name);
+    pthread_mutex_lock(&watch_lock);
+    path_index_each(&watch_index, root, root_len, ipc_collect_path, &watched);
+    pthread_mutex_unlock(&watch_lock);
+    pthread_mutex_lock(&hash_mutex);
+    path_index_each(&identity_path_index, root, root_len, ipc_collect_path, &tracked);
+    pthread_mutex_unlock(&hash_mutex);
+    
+    json_object_object_add(reply, "success", json_object_new_boolean(1));
+    json_object_object_add(reply, "watched", watched.paths);
+    json_object_object_add(reply, "tracked", tracked.paths);
+    json_object_object_add(reply, "truncated", json_object_new_boolean(watched.truncated || tracked.truncated));
+    return reply;
+}
+
+static void ipc_serve_status(int fd) {
+    pthread_mutex_lock(&log_mutex);
+    uint64_t last_seq = event_seq;
+    int subscribers = ipc_subscriber_count;
+    pthread_mutex_unlock(&log_mutex);
+    
+    json_object *reply = json_object_new_object();
+    json_object_object_add(reply, "success", json_object_new_boolean(1));
+    json_object_object_add(reply, "mode", json_object_new_string(mode_name()));
+    json_object_object_add(reply, "pid", json_object_new_int64(getpid()));
+    json_object_object_add(reply, "total_events", json_object_new_int64(stats.total_events));
+    json_object_object_add(reply, "last_seq", json_object_new_int64(last_seq));
+    json_object_object_add(reply, "subscribers", json_object_new_int64(subscribers));
+    json_object_object_add(reply, "uptime_seconds",
+                          json_object_new_int64(time(NULL) - stats.start_time));
+    
+    const char *text = json_object_to_json_string_ext(reply, JSON_C_TO_STRING_PLAIN);
+    send_all(fd, text, strlen(text));
+    send_all(fd, "\n", 1);
+    json_object_put(reply);
+}
+
+// One request per connection: {"command": "...", "data": {...}}, the
+// format fmon.py's MonitorIPC sends
+static void* ipc_conn_thread(void* arg) {
+    int fd = (int)(intptr_t)arg;
+    thread_set_role("ipc-conn");
+    char request[IPC_REQUEST_MAX];
+    size_t len = 0;
+    json_object *message = NULL;
+    
+    while (!message && len < sizeof(request) - 1) {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, 2000) != 1) break;
+        ssize_t n = recv(fd, request + len, sizeof(request) - 1 - len, 0);
+        if (n <= 0) break;
+        len += n;
+        request[len] = '\0';
+        message = json_tokener_parse(request);
+    }
+    
+    json_object *command_obj = NULL, *data = NULL, *value = NULL;
+    const char *command = "";
+    if (message && json_object_object_get_ex(message, "command", &command_obj)) {
+        command = json_object_get_string(command_obj);
+    }
+    if (message) {
+        json_object_object_get_ex(message, "data", &data);
+    }
+    
+    if (strcmp(command, "subscribe") == 0) {
+        uint64_t from_seq = 0;
+        if (data && json_object_object_get_ex(data, "from_seq", &value)) {
+            from_seq = json_object_get_int64(value);
+        }
+        json_object_put(message);
+        message = NULL;
+        ipc_serve_subscribe(fd, from_seq);
+    } else if (strcmp(command, "query") == 0) {
+        // {"since": N, "root": "src", "glob": "*.c", "type": "f"}
+        uint64_t since = 0;
+        const char *root = NULL, *glob = NULL, *type = NULL;
+        if (data && json_object_object_get_ex(data, "since", &value)) since = json_object_get_int64(value);
+        if (data && json_object_object_get_ex(data, "root", &value)) root = json_object_get_string(value);
+        if (data && json_object_object_get_ex(data, "glob", &value)) glob = json_object_get_string(value);
+        if (data && json_object_object_get_ex(data, "type", &value)) type = json_object_get_string(value);
         
-        if (!should_monitor_file(event->name)) {
-            return;
+        json_object *reply = tree_query(since, root, glob, type);
+        const char *text = json_object_to_json_string_ext(reply, JSON_C_TO_STRING_PLAIN);
+        send_all(fd, text, strlen(text));
+        send_all(fd, "\n", 1);
+        json_object_put(reply);
+    } else if (strcmp(command, "journal") == 0) {
+        // {"since": N, "limit": M}
+        uint64_t since = 0, limit = 10000;
+        if (data && json_object_object_get_ex(data, "since", &value)) since = json_object_get_int64(value);
+        if (data && json_object_object_get_ex(data, "limit", &value)) limit = json_object_get_int64(value);
+        
+        json_object *reply;
+        if (journal_enabled) {
+            reply = journal_query(since, limit);
+        } else {
+            reply = json_object_new_object();
+            json_object_object_add(reply, "success", json_object_new_boolean(0));
+            json_object_object_add(reply, "error", json_object_new_string("journal disabled"));
         }
+        const char *text = json_object_to_json_string_ext(reply, JSON_C_TO_STRING_PLAIN);
+        send_all(fd, text, strlen(text));
+        send_all(fd, "\n", 1);
+        json_object_put(reply);
+    } else if (strcmp(command, "paths") == 0) {
+        // {"root": "src", "limit": N}
+        const char *root = "";
+        uint64_t limit = 10000;
+        if (data && json_object_object_get_ex(data, "root", &value)) root = json_object_get_string(value);
+        if (data && json_object_object_get_ex(data, "limit", &value)) limit = json_object_get_int64(value);
         
-        char log_msg[MAX_PATH_LEN + 100];
+        json_object *reply = ipc_list_paths(root ? root : "", limit);
+        const char *text = json_object_to_json_string_ext(reply, JSON_C_TO_STRING_PLAIN);
+        send_all(fd, text, strlen(text));
+        send_all(fd, "\n", 1);
+        json_object_put(reply);
+    } else if (strcmp(command, "du") == 0) {
+        // {"root": "src"}
+        const char *root = "";
+        if (data && json_object_object_get_ex(data, "root", &value)) root = json_object_get_string(value);
         
-        if (event->mask & IN_CREATE) {
-            snprintf(log_msg, sizeof(log_msg), "Created: %s", full_path);
-            log_event(log_msg);
-            
-            if (event->mask & IN_ISDIR && recursive_mode) {
-                add_watch_recursive_basic(full_path);
-            }
+        json_object *reply = usage_query(root ? root : "");
+        const char *text = json_object_to_json_string_ext(reply, JSON_C_TO_STRING_PLAIN);
+        send_all(fd, text, strlen(text));
+        send_all(fd, "\n", 1);
+        json_object_put(reply);
+    } else if (strcmp(command, "status") == 0) {
+        ipc_serve_status(fd);
+    } else {
+        const char *reply = "{\"success\":false,\"error\":\"unknown command\"}\n";
+        send_all(fd, reply, strlen(reply));
+    }
+    
+    if (message) {
+        json_object_put(message);
+    }
+    close(fd);
+    return NULL;
+}
+
+void* ipc_thread_func(void* arg) {
+    (void)arg;
+    thread_set_role("ipc");
+    while (running) {
+        struct pollfd pfd = {ipc_socket, POLLIN, 0};
+        if (poll(&pfd, 1, 200) != 1) continue;
+        
+        int fd = accept4(ipc_socket, NULL, NULL, SOCK_CLOEXEC);
+        if (fd == -1) continue;
+        
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, ipc_conn_thread, (void *)(intptr_t)fd) != 0) {
+            close(fd);
+            continue;
         }
-        if (event->mask & IN_DELETE) {
-            snprintf(log_msg, sizeof(log_msg), "Deleted: %s", full_path);
-            log_event(log_msg);
+        pthread_detach(thread);
+    }
+    return NULL;
+}
+
+int ipc_init() {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, ipc_socket_path, sizeof(addr.sun_path));
+    
+    // A live monitor already answers on this path: leave it alone
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe != -1 && connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        close(probe);
+        char msg[256];
+        snprintf(msg, sizeof(msg), "[WARN] IPC socket %s belongs to another monitor; IPC disabled",
+                ipc_socket_path);
+        log_event(msg);
+        return -1;
+    }
+    if (probe != -1) close(probe);
+    
+    unlink(ipc_socket_path);
+    ipc_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (ipc_socket == -1 ||
+        bind(ipc_socket, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(ipc_socket, 16) == -1) {
+        char msg[256];
+        snprintf(msg, sizeof(msg), "[WARN] Cannot open IPC socket %s: %s",
+                ipc_socket_path, strerror(errno));
+        log_event(msg);
+        if (ipc_socket != -1) close(ipc_socket);
+        ipc_socket = -1;
+        return -1;
+    }
+    
+    if (pthread_create(&ipc_thread, NULL, ipc_thread_func, NULL) != 0) {
+        close(ipc_socket);
+        unlink(ipc_socket_path);
+        ipc_socket = -1;
+        return -1;
+    }
+    pthread_detach(ipc_thread);
+    return 0;
+}
+
+// ===== LOG QUERY =====
+
+#define QUERY_CHUNK_SIZE    (8 * 1024 * 1024)
+#define QUERY_GZ_BUFFER     (1024 * 1024)
+#define QUERY_MAX_THREADS   32
+#define QUERY_MAX_TYPES     8
+
+// One unit of work: a line-aligned byte range of a plain segment, a run
+// of blocks of an indexed gzip segment (compressed offset and length, 0 =
+// to the end), or a whole unindexed gzip segment (offset -1)
+typedef struct {
+    char path[MAX_PATH_LEN];
+    int compressed;
+    off_t offset;
+    off_t length;
+    char *out;
+    size_t out_len;
+    size_t out_cap;
+    size_t matches;
+    size_t scanned;
+    int done;
+} query_unit_t;
+
+static int query_requested = 0;
+static char query_pattern[256];             // lowercased needle, may be empty
+static size_t query_pattern_len = 0;
+static char query_since[TIMESTAMP_SIZE];    // timestamp prefixes, "" = open
+static char query_until[TIMESTAMP_SIZE];
+static time_t query_since_time = 0;
+static char query_types[QUERY_MAX_TYPES][32];
+static int query_type_count = 0;
+static long query_limit = 0;
+static int query_threads = 0;
+
+static query_unit_t *query_units = NULL;
+static int query_unit_count = 0;
+static int query_next_unit = 0;
+static int query_printed_unit = 0;
+static volatile int query_stop = 0;
+static pthread_mutex_t query_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t query_cond = PTHREAD_COND_INITIALIZER;
+
+static inline unsigned char query_fold(unsigned char c) {
+    return (c >= 'A' && c <= 'Z') ? (c | 0x20) : c;
+}
+
+static int query_match_at(const unsigned char *h, const char *needle, size_t n) {
+    for (size_t k = 0; k < n; k++) {
+        if (query_fold(h[k]) != (unsigned char)needle[k]) return 0;
+    }
+    return 1;
+}
+
+// ASCII case-insensitive search for a lowercased needle. With SSE2 the
+// folded first and last needle bytes are compared 16 positions at a time
+// and only candidate positions are verified.
+static const char *query_find(const char *hay, size_t len, const char *needle, size_t n) {
+    if (len < n) return NULL;
+    const unsigned char *h = (const unsigned char *)hay;
+    size_t i = 0;
+#ifdef __SSE2__
+    unsigned char first = needle[0];
+    unsigned char last = needle[n - 1];
+    const __m128i v_first = _mm_set1_epi8((char)first);
+    const __m128i v_last = _mm_set1_epi8((char)last);
+    // OR-ing 0x20 folds case only where the needle byte is a letter
+    const __m128i f_first = _mm_set1_epi8((first >= 'a' && first <= 'z') ? 0x20 : 0);
+    const __m128i f_last = _mm_set1_epi8((last >= 'a' && last <= 'z') ? 0x20 : 0);
+    for (; i + n - 1 + 16 <= len; i += 16) {
+        __m128i a = _mm_or_si128(_mm_loadu_si128((const __m128i *)(h + i)), f_first);
+        __m128i b = _mm_or_si128(_mm_loadu_si128((const __m128i *)(h + i + n - 1)), f_last);
+        unsigned mask = (unsigned)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(a, v_first), _mm_cmpeq_epi8(b, v_last)));
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            if (query_match_at(h + i + bit, needle, n)) return hay + i + bit;
+            mask &= mask - 1;
         }
-        if (event->mask & IN_MODIFY) {
-            snprintf(log_msg, sizeof(log_msg), "Modified: %s", full_path);
-            log_event(log_msg);
+    }
+#endif
+    for (; i + n <= len; i++) {
+        if (query_match_at(h + i, needle, n)) return hay + i;
+    }
+    return NULL;
+}
+
+// Time range and event type filters for one line (without its newline)
+static int query_line_ok(const char *line, size_t len) {
+    if (query_since[0] || query_until[0]) {
+        if (len <= TIMESTAMP_SIZE || line[0] != '[' || line[TIMESTAMP_SIZE] != ']') return 0;
+        if (query_since[0] && memcmp(line + 1, query_since, strlen(query_since)) < 0) return 0;
+        if (query_until[0] && memcmp(line + 1, query_until, strlen(query_until)) > 0) return 0;
+    }
+    if (query_type_count > 0) {
+        if (len <= TIMESTAMP_SIZE + 2 || line[TIMESTAMP_SIZE] != ']') return 0;
+        size_t pos = TIMESTAMP_SIZE + 2;
+        if (line[pos] == '#') {
+            while (pos < len && line[pos] != ' ') pos++;
+            pos++;
         }
-        if (event->mask & IN_MOVED_FROM) {
-            snprintf(log_msg, sizeof(log_msg), "Moved from: %s", full_path);
-            log_event(log_msg);
+        for (int t = 0; t < query_type_count; t++) {
+            size_t tlen = strlen(query_types[t]);
+            if (pos + tlen <= len && strncasecmp(line + pos, query_types[t], tlen) == 0) return 1;
         }
-        if (event->mask & IN_MOVED_TO) {
-            snprintf(log_msg, sizeof(log_msg), "Moved to: %s", full_path);
-            log_event(log_msg);
+        return 0;
+    }
+    return 1;
+}
+
+static void query_emit(query_unit_t *u, const char *line, size_t len) {
+    if (u->out_len + len + 1 > u->out_cap) {
+        size_t cap = u->out_cap ? u->out_cap * 2 : 64 * 1024;
+        while (cap < u->out_len + len + 1) cap *= 2;
+        char *grown = realloc(u->out, cap);
+        if (!grown) return;
+        u->out = grown;
+        u->out_cap = cap;
+    }
+    memcpy(u->out + u->out_len, line, len);
+    u->out[u->out_len + len] = '\n';
+    u->out_len += len + 1;
+    u->matches++;
+}
+
+// Scan complete lines in data[0..len); returns 1 once the unit has enough
+// matches to satisfy the limit on its own
+static int query_scan(query_unit_t *u, const char *data, size_t len) {
+    size_t pos = 0;
+    u->scanned += len;
+    while (pos < len) {
+        const char *line = data + pos;
+        if (query_pattern_len) {
+            const char *hit = query_find(data + pos, len - pos, query_pattern, query_pattern_len);
+            if (!hit) break;
+            const char *nl = memrchr(data + pos, '\n', hit - (data + pos));
+            line = nl ? nl + 1 : data + pos;
         }
-        if (event->mask & IN_OPEN) {
-            snprintf(log_msg, sizeof(log_msg), "Opened: %s", full_path);
-            log_event(log_msg);
+        const char *end = memchr(line, '\n', data + len - line);
+        size_t line_len = end ? (size_t)(end - line) : (size_t)(data + len - line);
+        if (query_line_ok(line, line_len)) {
+            query_emit(u, line, line_len);
+            if (query_limit > 0 && u->matches >= (size_t)query_limit) return 1;
         }
-        if (event->mask & IN_CLOSE) {
-            snprintf(log_msg, sizeof(log_msg), "Closed: %s", full_path);
-            log_event(log_msg);
+        pos = (line - data) + line_len + 1;
+    }
+    return 0;
+}
+
+static void query_run_unit(query_unit_t *u) {
+    if (!u->compressed) {
+        int fd = open(u->path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size <= u->offset) {
+            close(fd);
+            return;
+        }
+        size_t size = st.st_size;
+        char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) return;
+        madvise(map, size, MADV_SEQUENTIAL);
+        
+        // A unit owns the lines that start inside its range
+        size_t start = u->offset;
+        size_t end = u->offset + u->length;
+        if (end > size) end = size;
+        if (start > 0 && map[start - 1] != '\n') {
+            const char *nl = memchr(map + start, '\n', end - start);
+            start = nl ? (size_t)(nl - map) + 1 : end;
+        }
+        if (end < size && map[end - 1] != '\n') {
+            const char *nl = memchr(map + end, '\n', size - end);
+            end = nl ? (size_t)(nl - map) + 1 : size;
+        }
+        if (start < end) query_scan(u, map + start, end - start);
+        munmap(map, size);
+        return;
+    }
+    
+    segment_reader_t *in = malloc(sizeof(segment_reader_t));
+    char *buf = malloc(QUERY_GZ_BUFFER);
+    if (!in || !buf || segment_reader_open(in, u->path, u->offset, u->length) != 0) {
+        free(in);
+        free(buf);
+        return;
+    }
+    size_t have = 0;
+    while (!query_stop) {
+        size_t n = segment_reader_read(in, buf + have, QUERY_GZ_BUFFER - have);
+        if (n == 0) {
+            if (have) query_scan(u, buf, have);
+            break;
         }
+        have += n;
+        const char *nl = memrchr(buf, '\n', have);
+        size_t complete = nl ? (size_t)(nl - buf) + 1 : have;
+        if (!nl && have < QUERY_GZ_BUFFER) continue;
+        if (query_scan(u, buf, complete)) break;
+        memmove(buf, buf + complete, have - complete);
+        have -= complete;
     }
+    free(buf);
+    segment_reader_close(in);
+    free(in);
 }
 
-// ===== ENHANCED MODE FUNCTIONS =====
+static void* query_worker(void* arg) {
+    (void)arg;
+    thread_set_role("query");
+    for (;;) {
+        pthread_mutex_lock(&query_mutex);
+        // Stay a bounded distance ahead of the printer so matches are not
+        // buffered for the whole history at once
+        while (!query_stop && query_next_unit < query_unit_count &&
+               query_next_unit >= query_printed_unit + query_threads * 2) {
+            pthread_cond_wait(&query_cond, &query_mutex);
+        }
+        if (query_stop || query_next_unit >= query_unit_count) {
+            pthread_mutex_unlock(&query_mutex);
+            return NULL;
+        }
+        query_unit_t *u = &query_units[query_next_unit++];
+        pthread_mutex_unlock(&query_mutex);
+        
+        query_run_unit(u);
+        
+        pthread_mutex_lock(&query_mutex);
+        u->done = 1;
+        pthread_cond_broadcast(&query_cond);
+        pthread_mutex_unlock(&query_mutex);
+    }
+}
 
-int init_watch_manager() {
-    watch_manager.capacity = INITIAL_WATCH_CAPACITY;
-    watch_manager.count = 0;
-    watch_manager.entries = malloc(sizeof(watch_entry_t) * watch_manager.capacity);
-    
-    if (!watch_manager.entries) {
-        log_event("[ERROR] Failed to allocate watch manager memory");
-        return -1;
+// "2026-01-31", "2026-01-31 12:00" or a relative "90s", "30m", "24h", "7d"
+static int query_parse_time(const char *arg, char *out, size_t out_size, time_t *when) {
+    char *end;
+    long amount = strtol(arg, &end, 10);
+    if (end != arg && end[0] && !end[1] && strchr("smhd", end[0])) {
+        long unit = end[0] == 's' ? 1 : end[0] == 'm' ? 60 : end[0] == 'h' ? 3600 : 86400;
+        time_t t = time(NULL) - amount * unit;
+        struct tm tm_info;
+        localtime_r(&t, &tm_info);
+        strftime(out, out_size, "%Y-%m-%d %H:%M:%S", &tm_info);
+        if (when) *when = t;
+        return 0;
     }
     
-    if (pthread_mutex_init(&watch_manager.mutex, NULL) != 0) {
-        log_event("[ERROR] Failed to initialize watch manager mutex");
-        free(watch_manager.entries);
-        return -1;
+    size_t len = strlen(arg);
+    if (len < 4 || len >= out_size || arg[0] < '0' || arg[0] > '9') return -1;
+    memcpy(out, arg, len + 1);
+    if (when) {
+        char full[TIMESTAMP_SIZE] = "0000-01-01 00:00:00";
+        memcpy(full, arg, len);
+        struct tm tm_info;
+        memset(&tm_info, 0, sizeof(tm_info));
+        if (!strptime(full, "%Y-%m-%d %H:%M:%S", &tm_info)) return -1;
+        tm_info.tm_isdst = -1;
+        *when = mktime(&tm_info);
     }
-    
-    log_event("[INFO] Watch manager initialized");
     return 0;
 }
 
-void cleanup_watch_manager() {
-    if (watch_manager.entries) {
-        pthread_mutex_lock(&watch_manager.mutex);
-        free(watch_manager.entries);
-        watch_manager.entries = NULL;
-        watch_manager.count = 0;
-        watch_manager.capacity = 0;
-        pthread_mutex_unlock(&watch_manager.mutex);
-        pthread_mutex_destroy(&watch_manager.mutex);
+static int query_add_unit(const char *path, int compressed, off_t offset, off_t length) {
+    query_unit_t *grown = realloc(query_units, (query_unit_count + 1) * sizeof(query_unit_t));
+    if (!grown) return -1;
+    query_units = grown;
+    query_unit_t *u = &query_units[query_unit_count++];
+    memset(u, 0, sizeof(*u));
+    snprintf(u->path, sizeof(u->path), "%s", path);
+    u->compressed = compressed;
+    u->offset = offset;
+    u->length = length;
+    return 0;
+}
+
+// Split an indexed gzip segment into units of about QUERY_CHUNK_SIZE of
+// text, leaving out blocks that lie wholly outside --since/--until
+static int query_plan_blocks(const char *path, const segment_block_t *blocks, uint32_t count) {
+    uint32_t first = 0, last = count;   // [first, last)
+    if (query_since[0]) {
+        // Block b holds nothing at or after since if block b+1 starts before it
+        while (first + 1 < count && blocks[first + 1].first_ts[0] &&
+               strncmp(blocks[first + 1].first_ts, query_since, strlen(query_since)) < 0) {
+            first++;
+        }
     }
+    if (query_until[0]) {
+        while (last > first + 1 && blocks[last - 1].first_ts[0] &&
+               strncmp(blocks[last - 1].first_ts, query_until, strlen(query_until)) > 0) {
+            last--;
+        }
+    }
+    
+    uint32_t b = first;
+    while (b < last) {
+        uint32_t end = b + 1;
+        while (end < last && blocks[end].raw_offset - blocks[b].raw_offset < QUERY_CHUNK_SIZE) {
+            end++;
+        }
+        off_t length = end < count ? (off_t)(blocks[end].offset - blocks[b].offset) : 0;
+        if (query_add_unit(path, 1, blocks[b].offset, length) != 0) return -1;
+        b = end;
+    }
+    return 0;
 }
 
-int add_watch_dynamic(const char *path) {
-    pthread_mutex_lock(&watch_manager.mutex);
+// monitor --query[=TEXT]: search the active log and every rotated segment
+// in parallel and stream matching lines, oldest first, to stdout
+int run_query() {
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
     
-    if (watch_manager.count >= watch_manager.capacity) {
-        size_t new_capacity = watch_manager.capacity * WATCH_GROWTH_FACTOR;
-        watch_entry_t *new_entries = realloc(watch_manager.entries,
-                                           sizeof(watch_entry_t) * new_capacity);
+    char paths[MAX_LOG_FILES + 1][MAX_PATH_LEN];
+    int count = log_segment_paths(paths, MAX_LOG_FILES + 1);
+    int segments = 0;
+    for (int i = 0; i < count; i++) {
+        struct stat st;
+        if (stat(paths[i], &st) != 0) continue;
+        // A segment last written before the range starts holds nothing newer
+        if (query_since_time && st.st_mtime < query_since_time) continue;
+        segments++;
         
-        if (!new_entries) {
-            pthread_mutex_unlock(&watch_manager.mutex);
-            log_event("[ERROR] Failed to expand watch manager capacity");
-            stats.watch_limit_hits++;
-            return -1;
+        size_t len = strlen(paths[i]);
+        int res = 0;
+        if (len > 3 && strcmp(paths[i] + len - 3, ".gz") == 0) {
+            uint32_t block_count = 0;
+            segment_block_t *blocks = segment_index_load(paths[i], &block_count);
+            res = blocks ? query_plan_blocks(paths[i], blocks, block_count)
+                         : query_add_unit(paths[i], 1, -1, 0);
+            free(blocks);
+        } else {
+            for (off_t off = 0; off < st.st_size && res == 0; off += QUERY_CHUNK_SIZE) {
+                res = query_add_unit(paths[i], 0, off, QUERY_CHUNK_SIZE);
+            }
+        }
+        if (res != 0) {
+            fprintf(stderr, "[ERROR] Out of memory planning the query\n");
+            return 1;
+        }
+    }
+    
+    if (query_threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        query_threads = cpus > 0 ? (int)cpus : 1;
+    }
+    if (query_threads > QUERY_MAX_THREADS) query_threads = QUERY_MAX_THREADS;
+    if (query_threads > query_unit_count) query_threads = query_unit_count;
+    
+    pthread_t workers[QUERY_MAX_THREADS];
+    int started_workers = 0;
+    for (int i = 0; i < query_threads; i++) {
+        if (pthread_create(&workers[i], NULL, query_worker, NULL) != 0) break;
+        started_workers++;
+    }
+    if (started_workers == 0 && query_unit_count > 0) {
+        fprintf(stderr, "[ERROR] Cannot start query threads\n");
+        return 1;
+    }
+    
+    // Print finished units in order while later ones are still being scanned
+    size_t printed = 0;
+    size_t scanned = 0;
+    for (int i = 0; i < query_unit_count; i++) {
+        query_unit_t *u = &query_units[i];
+        pthread_mutex_lock(&query_mutex);
+        while (!u->done) {
+            pthread_cond_wait(&query_cond, &query_mutex);
         }
+        pthread_mutex_unlock(&query_mutex);
         
-        watch_manager.entries = new_entries;
-        watch_manager.capacity = new_capacity;
-        stats.memory_reallocations++;
+        size_t len = u->out_len;
+        if (query_limit > 0 && printed + u->matches > (size_t)query_limit) {
+            // Cut the unit's output after the line that reaches the limit
+            size_t keep = query_limit - printed;
+            const char *p = u->out;
+            for (size_t n = 0; n < keep; n++) {
+                p = memchr(p, '\n', u->out + u->out_len - p) + 1;
+            }
+            len = p - u->out;
+            u->matches = keep;
+        }
+        fwrite(u->out, 1, len, stdout);
+        printed += u->matches;
+        scanned += u->scanned;
+        free(u->out);
+        u->out = NULL;
         
-        char msg[256];
-        snprintf(msg, sizeof(msg), "[INFO] Watch manager expanded to %zu entries",
-                new_capacity);
-        log_event(msg);
+        pthread_mutex_lock(&query_mutex);
+        query_printed_unit = i + 1;
+        if (query_limit > 0 && printed >= (size_t)query_limit) {
+            query_stop = 1;
+        }
+        pthread_cond_broadcast(&query_cond);
+        pthread_mutex_unlock(&query_mutex);
+        if (query_stop) break;
+    }
+    fflush(stdout);
+    
+    for (int i = 0; i < started_workers; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    for (int i = 0; i < query_unit_count; i++) {
+        free(query_units[i].out);
+    }
+    free(query_units);
+    
+    struct timespec finished;
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    double elapsed = (finished.tv_sec - started.tv_sec) +
+                     (finished.tv_nsec - started.tv_nsec) / 1e9;
+    fprintf(stderr, "[QUERY] %zu matches in %d segment(s), %.1f MB scanned in %.3fs (%d threads)\n",
+            printed, segments, scanned / (1024.0 * 1024.0), elapsed, started_workers);
+    return 0;
+}
+
+// ===== AGGREGATOR MODE =====
+
+// One decoded batch; records point into its data and the block is freed
+// when the last of them has been written
+typedef struct {
+    size_t remaining;
+    char data[];
+} aggregate_block_t;
+
+typedef struct {
+    uint64_t timestamp_ns;
+    uint64_t batch_seq;
+    uint32_t mask;
+    uint16_t path_len;
+    uint16_t source;
+    const char *path;
+    aggregate_block_t *block;
+} aggregate_record_t;
+
+typedef struct {
+    char name[64];
+    uint64_t host_hash;
+    uint64_t accepted_seq;      // last batch taken into the merge buffer
+    uint64_t written_seq;       // last batch fully written to the output
+    uint32_t pending[AGGREGATE_PENDING_BATCHES];   // unwritten records per batch
+    int connected;
+} aggregate_source_t;
+
+typedef struct {
+    uint64_t key;
+    uint64_t timestamp_ns;
+    uint16_t source;
+} aggregate_dedup_entry_t;
+
+typedef struct {
+    int fd;
+} aggregate_conn_t;
+
+static char aggregate_listen[AGGREGATE_MAX_LISTENERS][256];
+static int aggregate_listen_count = 0;
+static char aggregate_output_path[MAX_PATH_LEN] = AGGREGATE_LOG_FILE;
+static long aggregate_reorder_ms = 2000;
+static long aggregate_dedup_ms = 1000;
+
+static aggregate_source_t aggregate_sources[AGGREGATE_MAX_SOURCES];
+static int aggregate_source_count = 0;
+static aggregate_record_t *aggregate_heap = NULL;
+static size_t aggregate_heap_len = 0;
+static size_t aggregate_heap_capacity = 0;
+static uint64_t aggregate_last_written_ns = 0;
+static int aggregate_sources_dirty = 0;
+static aggregate_dedup_entry_t aggregate_dedup[AGGREGATE_DEDUP_SLOTS];
+static pthread_mutex_t aggregate_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int aggregate_heap_less(const aggregate_record_t *a, const aggregate_record_t *b) {
+    if (a->timestamp_ns != b->timestamp_ns) return a->timestamp_ns < b->timestamp_ns;
+    if (a->source != b->source) return a->source < b->source;
+    return a->batch_seq < b->batch_seq;
+}
+
+// Caller holds aggregate_mutex
+static int aggregate_heap_push(const aggregate_record_t *record) {
+    if (aggregate_heap_len == aggregate_heap_capacity) {
+        size_t new_capacity = aggregate_heap_capacity ? aggregate_heap_capacity * 2 : 4096;
+        aggregate_record_t *grown = realloc(aggregate_heap, new_capacity * sizeof(*grown));
+        if (!grown) return -1;
+        aggregate_heap = grown;
+        aggregate_heap_capacity = new_capacity;
     }
     
-    int wd = inotify_add_watch(inotify_fd, path,
-                              IN_CREATE | IN_DELETE | IN_MODIFY |
-                              IN_MOVE | IN_ATTRIB | IN_OPEN | IN_CLOSE);
+    size_t i = aggregate_heap_len++;
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!aggregate_heap_less(record, &aggregate_heap[parent])) break;
+        aggregate_heap[i] = aggregate_heap[parent];
+        i = parent;
+    }
+    aggregate_heap[i] = *record;
+    return 0;
+}
+
+// Caller holds aggregate_mutex
+static aggregate_record_t aggregate_heap_pop() {
+    aggregate_record_t top = aggregate_heap[0];
+    aggregate_record_t last = aggregate_heap[--aggregate_heap_len];
     
-    if (wd == -1) {
-        pthread_mutex_unlock(&watch_manager.mutex);
-        char error_msg[512];
-        snprintf(error_msg, sizeof(error_msg),
-                "[ERROR] Failed to add watch for %s: %s", path, strerror(errno));
-        log_event(error_msg);
-        return -1;
+    size_t i = 0;
+    for (;;) {
+        size_t child = i * 2 + 1;
+        if (child >= aggregate_heap_len) break;
+        if (child + 1 < aggregate_heap_len &&
+            aggregate_heap_less(&aggregate_heap[child + 1], &aggregate_heap[child])) {
+            child++;
+        }
+        if (!aggregate_heap_less(&aggregate_heap[child], &last)) break;
+        aggregate_heap[i] = aggregate_heap[child];
+        i = child;
+    }
+    if (aggregate_heap_len > 0) {
+        aggregate_heap[i] = last;
+    }
+    return top;
+}
+
+// Find or register a source by name. Caller holds aggregate_mutex.
+static int aggregate_source_index(const char *name) {
+    for (int i = 0; i < aggregate_source_count; i++) {
+        if (strcmp(aggregate_sources[i].name, name) == 0) return i;
     }
+    if (aggregate_source_count >= AGGREGATE_MAX_SOURCES) return -1;
     
-    watch_entry_t *entry = &watch_manager.entries[watch_manager.count];
-    entry->wd = wd;
-    strncpy(entry->path, path, MAX_PATH_LEN - 1);
-    entry->path[MAX_PATH_LEN - 1] = '\0';
-    entry->added_time = time(NULL);
-    entry->event_count = 0;
+    aggregate_source_t *source = &aggregate_sources[aggregate_source_count];
+    memset(source, 0, sizeof(*source));
+    strncpy(source->name, name, sizeof(source->name) - 1);
+    // Sources named "<host>/<instance>" share a host scope for de-duplication
+    const char *slash = strchr(source->name, '/');
+    size_t host_len = slash ? (size_t)(slash - source->name) : strlen(source->name);
+    source->host_hash = fnv1a(source->name, host_len, 0xcbf29ce484222325ULL);
+    return aggregate_source_count++;
+}
+
+static void aggregate_load_sources() {
+    char sources_path[MAX_PATH_LEN + 16];
+    snprintf(sources_path, sizeof(sources_path), "%s.sources", aggregate_output_path);
+    FILE *file = fopen(sources_path, "r");
+    if (!file) return;
     
-    watch_manager.count++;
+    char name[64];
+    unsigned long long seq;
+    while (fscanf(file, "%63s %llu", name, &seq) == 2) {
+        int idx = aggregate_source_index(name);
+        if (idx >= 0) {
+            aggregate_sources[idx].accepted_seq = seq;
+            aggregate_sources[idx].written_seq = seq;
+        }
+    }
+    fclose(file);
+}
+
+// Persist the written position of every source so a restarted aggregator
+// tells reconnecting monitors where to resume
+static void aggregate_save_sources() {
+    char sources_path[MAX_PATH_LEN + 16], tmp_path[MAX_PATH_LEN + 24];
+    snprintf(sources_path, sizeof(sources_path), "%s.sources", aggregate_output_path);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", sources_path);
     
-    pthread_mutex_unlock(&watch_manager.mutex);
+    FILE *file = fopen(tmp_path, "w");
+    if (!file) return;
+    pthread_mutex_lock(&aggregate_mutex);
+    for (int i = 0; i < aggregate_source_count; i++) {
+        fprintf(file, "%s %llu\n", aggregate_sources[i].name,
+                (unsigned long long)aggregate_sources[i].written_seq);
+    }
+    aggregate_sources_dirty = 0;
+    pthread_mutex_unlock(&aggregate_mutex);
+    fclose(file);
+    rename(tmp_path, sources_path);
+}
+
+// Returns 1 if another source on the same host already reported this
+// event within the de-duplication window. Caller holds aggregate_mutex.
+static int aggregate_is_duplicate(const aggregate_record_t *record) {
+    uint64_t key = fnv1a(record->path, record->path_len,
+                         aggregate_sources[record->source].host_hash ^ record->mask);
+    aggregate_dedup_entry_t *entry = &aggregate_dedup[key & (AGGREGATE_DEDUP_SLOTS - 1)];
+    uint64_t window = (uint64_t)aggregate_dedup_ms * 1000000ULL;
     
-    char success_msg[512];
-    snprintf(success_msg, sizeof(success_msg), "[WATCH] Added: %s (wd: %d)", path, wd);
-    log_event(success_msg);
+    if (entry->key == key && entry->source != record->source) {
+        uint64_t delta = record->timestamp_ns > entry->timestamp_ns ?
+                         record->timestamp_ns - entry->timestamp_ns :
+                         entry->timestamp_ns - record->timestamp_ns;
+        if (delta <= window) {
+            return 1;
+        }
+    }
+    entry->key = key;
+    entry->timestamp_ns = record->timestamp_ns;
+    entry->source = record->source;
+    return 0;
+}
+
+// Mark one record of a batch as written and advance the source's
+// acknowledgeable position. Caller holds aggregate_mutex.
+static void aggregate_record_done(const aggregate_record_t *record) {
+    aggregate_source_t *source = &aggregate_sources[record->source];
+    source->pending[record->batch_seq % AGGREGATE_PENDING_BATCHES]--;
+    while (source->written_seq < source->accepted_seq &&
+           source->pending[(source->written_seq + 1) % AGGREGATE_PENDING_BATCHES] == 0) {
+        source->written_seq++;
+        aggregate_sources_dirty = 1;
+    }
     
-    return wd;
+    if (--record->block->remaining == 0) {
+        free(record->block);
+    }
 }
 
-watch_entry_t *find_watch_by_wd(int wd) {
-    pthread_mutex_lock(&watch_manager.mutex);
+static void aggregate_write_record(FILE *output, const aggregate_record_t *record) {
+    static time_t cached_second = (time_t)-1;
+    static char timestamp[TIMESTAMP_SIZE];
     
-    for (size_t i = 0; i < watch_manager.count; i++) {
-        if (watch_manager.entries[i].wd == wd) {
-            pthread_mutex_unlock(&watch_manager.mutex);
-            return &watch_manager.entries[i];
-        }
+    time_t second = record->timestamp_ns / 1000000000ULL;
+    if (second != cached_second) {
+        struct tm tm_info;
+        localtime_r(&second, &tm_info);
+        strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &tm_info);
+        cached_second = second;
     }
     
-    pthread_mutex_unlock(&watch_manager.mutex);
-    return NULL;
+    fprintf(output, "[%s.%03u] [%s] %s%.*s\n", timestamp,
+            (unsigned)(record->timestamp_ns / 1000000ULL % 1000),
+            aggregate_sources[record->source].name, event_label(record->mask),
+            (int)record->path_len, record->path);
 }
 
-int add_watch_recursive_enhanced(const char *path) {
-    struct stat path_stat;
-    if (stat(path, &path_stat) != 0) {
-        char error_msg[512];
-        snprintf(error_msg, sizeof(error_msg), "[ERROR] Cannot stat path: %s", path);
-        log_event(error_msg);
-        return -1;
+// Write out every record older than the reorder window (everything when
+// draining on shutdown)
+static void aggregate_merge_once(FILE *output, int drain) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    uint64_t now_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+    uint64_t horizon = now_ns - (uint64_t)aggregate_reorder_ms * 1000000ULL;
+    
+    pthread_mutex_lock(&aggregate_mutex);
+    while (aggregate_heap_len > 0 &&
+           (drain || aggregate_heap[0].timestamp_ns <= horizon)) {
+        aggregate_record_t record = aggregate_heap_pop();
+        
+        if (aggregate_is_duplicate(&record)) {
+            stats.aggregate_duplicates++;
+        } else {
+            if (record.timestamp_ns < aggregate_last_written_ns) {
+                // Arrived after its reorder window closed
+                stats.aggregate_late_records++;
+            } else {
+                aggregate_last_written_ns = record.timestamp_ns;
+            }
+            aggregate_write_record(output, &record);
+            stats.aggregate_records_written++;
+        }
+        aggregate_record_done(&record);
     }
+    int dirty = aggregate_sources_dirty;
+    pthread_mutex_unlock(&aggregate_mutex);
     
-    if (!S_ISDIR(path_stat.st_mode)) {
-        log_event("[ERROR] Path is not a directory");
+    fflush(output);
+    if (dirty) {
+        aggregate_save_sources();
+    }
+}
+
+// Decode one received batch into the merge buffer. Decompression and
+// parsing run in the connection's own thread, outside the merge lock.
+static int aggregate_ingest(int source_idx, const replica_batch_header_t *header,
+                            const char *payload, z_stream *zstream) {
+    if (crc32(0L, (const Bytef *)payload, header->payload_len) != header->crc) {
         return -1;
     }
     
-    if (add_watch_dynamic(path) == -1) {
+    aggregate_block_t *block = malloc(sizeof(aggregate_block_t) + header->raw_len);
+    aggregate_record_t *records = malloc(sizeof(aggregate_record_t) * (header->record_count + 1));
+    if (!block || !records) {
+        free(block);
+        free(records);
         return -1;
     }
     
-    if (!recursive_mode) {
-        return 0;
+    if (header->flags & REPLICA_FLAG_DEFLATE) {
+        inflateReset(zstream);
+        zstream->next_in = (Bytef *)payload;
+        zstream->avail_in = header->payload_len;
+        zstream->next_out = (Bytef *)block->data;
+        zstream->avail_out = header->raw_len;
+        if (inflate(zstream, Z_FINISH) != Z_STREAM_END || zstream->total_out != header->raw_len) {
+            free(block);
+            free(records);
+            return -1;
+        }
+    } else {
+        memcpy(block->data, payload, header->raw_len);
     }
     
-    DIR *dir = opendir(path);
-    if (!dir) {
-        char error_msg[512];
-        snprintf(error_msg, sizeof(error_msg), "[ERROR] Cannot open directory: %s", path);
-        log_event(error_msg);
-        return -1;
+    size_t count = 0, pos = 0;
+    while (pos + sizeof(replica_record_t) <= header->raw_len && count < header->record_count) {
+        replica_record_t wire;
+        memcpy(&wire, block->data + pos, sizeof(wire));
+        if (pos + sizeof(wire) + wire.path_len > header->raw_len) break;
+        
+        aggregate_record_t *record = &records[count++];
+        record->timestamp_ns = wire.timestamp_ns;
+        record->batch_seq = header->batch_seq;
+        record->mask = wire.mask;
+        record->path_len = wire.path_len;
+        record->source = source_idx;
+        record->path = block->data + pos + sizeof(wire);
+        record->block = block;
+        pos += sizeof(wire) + wire.path_len;
     }
+    block->remaining = count;
     
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            continue;
+    pthread_mutex_lock(&aggregate_mutex);
+    aggregate_source_t *source = &aggregate_sources[source_idx];
+    source->accepted_seq = header->batch_seq;
+    source->pending[header->batch_seq % AGGREGATE_PENDING_BATCHES] = count;
+    size_t dropped = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (aggregate_heap_push(&records[i]) != 0) {
+            // No room in the merge heap: drop the record rather than leave
+            // the batch pending forever, which would stall acknowledgements
+            source->pending[header->batch_seq % AGGREGATE_PENDING_BATCHES]--;
+            block->remaining--;
+            dropped++;
         }
-        
-        char subpath[MAX_PATH_LEN];
-        snprintf(subpath, sizeof(subpath), "%s/%s", path, entry->d_name);
-        
-        struct stat sub_stat;
-        if (stat(subpath, &sub_stat) == 0 && S_ISDIR(sub_stat.st_mode)) {
-            add_watch_recursive_enhanced(subpath);
+    }
+    stats.aggregate_records_dropped += dropped;
+    if (block->remaining == 0) {
+        free(block);
+        while (source->written_seq < source->accepted_seq &&
+               source->pending[(source->written_seq + 1) % AGGREGATE_PENDING_BATCHES] == 0) {
+            source->written_seq++;
         }
+        aggregate_sources_dirty = 1;
     }
+    stats.aggregate_batches_received++;
+    pthread_mutex_unlock(&aggregate_mutex);
     
-    closedir(dir);
+    free(records);
+    if (dropped) {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "[WARN] Merge buffer full, dropped %zu records of batch %llu",
+                dropped, (unsigned long long)header->batch_seq);
+        log_event(msg);
+    }
     return 0;
 }
 
-void handle_event_enhanced(struct inotify_event *event) {
-    watch_entry_t *watch_entry = find_watch_by_wd(event->wd);
-    if (!watch_entry) {
-        log_event("[WARN] Event from unknown watch descriptor");
-        return;
+static void* aggregate_conn_thread(void* arg) {
+    aggregate_conn_t *conn = arg;
+    thread_set_role("agg-conn");
+    int fd = conn->fd;
+    free(conn);
+    
+    replica_hello_t hello;
+    if (recv_exact(fd, &hello, sizeof(hello), 5000) != 0 ||
+        hello.magic != REPLICA_HELLO_MAGIC || hello.version != REPLICA_VERSION) {
+        close(fd);
+        return NULL;
     }
+    hello.source[sizeof(hello.source) - 1] = '\0';
     
-    watch_entry->event_count++;
-    stats.total_events++;
+    pthread_mutex_lock(&aggregate_mutex);
+    int source_idx = aggregate_source_index(hello.source);
+    uint64_t resume_seq = source_idx >= 0 ? aggregate_sources[source_idx].written_seq : 0;
+    // One live stream per source: a second one would race the first on
+    // accepted_seq and the pending counts
+    int duplicate = source_idx >= 0 && aggregate_sources[source_idx].connected;
+    if (source_idx >= 0 && !duplicate) {
+        aggregate_sources[source_idx].connected = 1;
+    }
+    pthread_mutex_unlock(&aggregate_mutex);
     
-    if (watch_entry->event_count > stats.max_events_per_path) {
-        stats.max_events_per_path = watch_entry->event_count;
-        strncpy(stats.most_active_path, watch_entry->path, MAX_PATH_LEN - 1);
+    char msg[256];
+    if (source_idx < 0 || duplicate) {
+        snprintf(msg, sizeof(msg), "[AGGREGATE] Rejected source '%s': %s", hello.source,
+                duplicate ? "already connected" : "too many sources");
+        log_event(msg);
+        close(fd);
+        return NULL;
     }
+    snprintf(msg, sizeof(msg), "[AGGREGATE] Source connected: %s (resuming after batch %llu)",
+            hello.source, (unsigned long long)resume_seq);
+    log_event(msg);
     
-    if (event->len > 0) {
-        char full_path[MAX_PATH_LEN];
-        snprintf(full_path, sizeof(full_path), "%s/%s", watch_entry->path, event->name);
-        
-        if (!should_monitor_file(event->name)) {
-            return;
-        }
-        
-        char log_msg[MAX_PATH_LEN + 100];
-        
-        if (event->mask & IN_CREATE) {
-            snprintf(log_msg, sizeof(log_msg), "Created: %s", full_path);
-            log_event(log_msg);
+    replica_ack_t ack = {REPLICA_ACK_MAGIC, 0, resume_seq};
+    uint64_t acked = resume_seq;
+    z_stream zstream;
+    memset(&zstream, 0, sizeof(zstream));
+    inflateInit(&zstream);
+    size_t payload_capacity = compressBound(REPLICA_MAX_BATCH_KB * 1024);
+    char *payload = malloc(payload_capacity);
+    
+    if (payload && send(fd, &ack, sizeof(ack), MSG_NOSIGNAL) == sizeof(ack)) {
+        while (running) {
+            struct pollfd pfd = {fd, POLLIN, 0};
+            int ready = poll(&pfd, 1, 100);
             
-            if (event->mask & IN_ISDIR && recursive_mode) {
-                add_watch_recursive_enhanced(full_path);
+            if (ready == 1) {
+                replica_batch_header_t header;
+                if (recv_exact(fd, &header, sizeof(header), 5000) != 0 ||
+                    header.magic != REPLICA_BATCH_MAGIC || header.payload_len > payload_capacity ||
+                    header.raw_len > REPLICA_MAX_BATCH_KB * 1024 ||
+                    recv_exact(fd, payload, header.payload_len, 5000) != 0) {
+                    break;
+                }
+                
+                pthread_mutex_lock(&aggregate_mutex);
+                int already_have = header.batch_seq <= aggregate_sources[source_idx].accepted_seq ||
+                                   header.batch_seq > aggregate_sources[source_idx].written_seq +
+                                                      AGGREGATE_PENDING_BATCHES;
+                pthread_mutex_unlock(&aggregate_mutex);
+                
+                if (!already_have && aggregate_ingest(source_idx, &header, payload, &zstream) != 0) {
+                    snprintf(msg, sizeof(msg), "[AGGREGATE] Corrupt batch %llu from %s",
+                            (unsigned long long)header.batch_seq, hello.source);
+                    log_event(msg);
+                    break;
+                }
+            } else if (ready < 0 && errno != EINTR) {
+                break;
+            }
+            
+            // Acknowledge only what has reached the output file
+            pthread_mutex_lock(&aggregate_mutex);
+            uint64_t written = aggregate_sources[source_idx].written_seq;
+            pthread_mutex_unlock(&aggregate_mutex);
+            if (written > acked) {
+                ack.batch_seq = written;
+                if (send(fd, &ack, sizeof(ack), MSG_NOSIGNAL) != sizeof(ack)) break;
+                acked = written;
             }
-        }
-        if (event->mask & IN_DELETE) {
-            snprintf(log_msg, sizeof(log_msg), "Deleted: %s", full_path);
-            log_event(log_msg);
-        }
-        if (event->mask & IN_MODIFY) {
-            snprintf(log_msg, sizeof(log_msg), "Modified: %s", full_path);
-            log_event(log_msg);
-        }
-        if (event->mask & IN_MOVED_FROM) {
-            snprintf(log_msg, sizeof(log_msg), "Moved from: %s", full_path);
-            log_event(log_msg);
-        }
-        if (event->mask & IN_MOVED_TO) {
-            snprintf(log_msg, sizeof(log_msg), "Moved to: %s", full_path);
-            log_event(log_msg);
-        }
-        if (event->mask & IN_OPEN) {
-            snprintf(log_msg, sizeof(log_msg), "Opened: %s", full_path);
-            log_event(log_msg);
-        }
-        if (event->mask & IN_CLOSE) {
-            snprintf(log_msg, sizeof(log_msg), "Closed: %s", full_path);
-            log_event(log_msg);
         }
     }
+    
+    inflateEnd(&zstream);
+    free(payload);
+    close(fd);
+    
+    pthread_mutex_lock(&aggregate_mutex);
+    aggregate_sources[source_idx].connected = 0;
+    pthread_mutex_unlock(&aggregate_mutex);
+    
+    snprintf(msg, sizeof(msg), "[AGGREGATE] Source disconnected: %s", hello.source);
+    log_event(msg);
+    return NULL;
 }
 
-// ===== ADVANCED MODE FUNCTIONS =====
+static void* aggregate_merge_thread(void* arg) {
+    FILE *output = arg;
+    thread_set_role("agg-merge");
+    while (running) {
+        usleep(AGGREGATE_MERGE_INTERVAL_MS * 1000);
+        aggregate_merge_once(output, 0);
+    }
+    return NULL;
+}
 
-char* calculate_file_hash(const char *filepath) {
-    FILE *file = fopen(filepath, "rb");
-    if (!file) return NULL;
-    
-    SHA256_CTX sha256;
-    SHA256_Init(&sha256);
-    
-    unsigned char buffer[8192];
-    int bytes;
-    while ((bytes = fread(buffer, 1, sizeof(buffer), file)) > 0) {
-        SHA256_Update(&sha256, buffer, bytes);
+// Bind "host:port" (TCP) or "unix:/path"
+static int aggregate_open_listener(const char *spec) {
+    int fd;
+    if (strncmp(spec, "unix:", 5) == 0) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, spec + 5, sizeof(addr.sun_path) - 1);
+        unlink(addr.sun_path);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd == -1 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+            if (fd != -1) close(fd);
+            return -1;
+        }
+    } else {
+        char host[256];
+        const char *colon = strrchr(spec, ':');
+        if (!colon || (size_t)(colon - spec) >= sizeof(host)) return -1;
+        memcpy(host, spec, colon - spec);
+        host[colon - spec] = '\0';
+        
+        struct addrinfo hints, *result = NULL;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        if (getaddrinfo(host[0] ? host : NULL, colon + 1, &hints, &result) != 0) return -1;
+        
+        fd = socket(result->ai_family, result->ai_socktype | SOCK_CLOEXEC, result->ai_protocol);
+        int one = 1;
+        if (fd != -1) {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        }
+        if (fd == -1 || bind(fd, result->ai_addr, result->ai_addrlen) == -1) {
+            if (fd != -1) close(fd);
+            freeaddrinfo(result);
+            return -1;
+        }
+        freeaddrinfo(result);
     }
-    fclose(file);
     
-    unsigned char hash[SHA256_DIGEST_LENGTH];
-    SHA256_Final(hash, &sha256);
-    
-    char *hex_string = malloc(HASH_SIZE);
-    for (int i = 0; i < SHA256_DIGEST_LENGTH; i++) {
-        sprintf(hex_string + (i * 2), "%02x", hash[i]);
+    if (listen(fd, 64) == -1) {
+        close(fd);
+        return -1;
     }
-    hex_string[HASH_SIZE - 1] = '\0';
-    
-    return hex_string;
+    return fd;
 }
 
-int check_file_changed(const char *filepath) {
-    if (!enable_checksum) return 1;
+// --mode=aggregate: accept replication streams from many monitors, merge
+// them by timestamp, drop duplicates from overlapping watches, and write
+// one combined log
+int run_aggregator() {
+    struct pollfd listeners[AGGREGATE_MAX_LISTENERS];
     
-    pthread_mutex_lock(&hash_mutex);
+    for (int i = 0; i < aggregate_listen_count; i++) {
+        listeners[i].fd = aggregate_open_listener(aggregate_listen[i]);
+        listeners[i].events = POLLIN;
+        if (listeners[i].fd == -1) {
+            char error_msg[MAX_PATH_LEN + 64];
+            snprintf(error_msg, sizeof(error_msg), "[ERROR] Cannot listen on %s: %s",
+                    aggregate_listen[i], strerror(errno));
+            log_event(error_msg);
+            fprintf(stderr, "%s\n", error_msg);
+            return 1;
+        }
+    }
     
-    char *new_hash = calculate_file_hash(filepath);
-    if (!new_hash) {
-        pthread_mutex_unlock(&hash_mutex);
+    FILE *output = fopen(aggregate_output_path, "a");
+    if (!output) {
+        fprintf(stderr, "[ERROR] Cannot open aggregate output: %s\n", aggregate_output_path);
+        return 1;
+    }
+    aggregate_load_sources();
+    
+    pthread_t merge_thread;
+    if (pthread_create(&merge_thread, NULL, aggregate_merge_thread, output) != 0) {
+        fclose(output);
         return 1;
     }
     
-    for (int i = 0; i < hash_count; i++) {
-        if (strcmp(file_hashes[i].filepath, filepath) == 0) {
-            int changed = (strcmp(file_hashes[i].hash, new_hash) != 0);
-            if (changed) {
-                strncpy(file_hashes[i].hash, new_hash, HASH_SIZE - 1);
-                file_hashes[i].last_modified = time(NULL);
+    char msg[MAX_PATH_LEN + 128];
+    for (int i = 0; i < aggregate_listen_count; i++) {
+        snprintf(msg, sizeof(msg), "[AGGREGATE] Listening on %s", aggregate_listen[i]);
+        log_event(msg);
+    }
+    snprintf(msg, sizeof(msg), "[AGGREGATE] Writing %s (reorder window %ldms, dedup window %ldms)",
+            aggregate_output_path, aggregate_reorder_ms, aggregate_dedup_ms);
+    log_event(msg);
+    
+    while (running) {
+        if (poll(listeners, aggregate_listen_count, 200) <= 0) continue;
+        
+        for (int i = 0; i < aggregate_listen_count; i++) {
+            if (!(listeners[i].revents & POLLIN)) continue;
+            
+            int fd = accept4(listeners[i].fd, NULL, NULL, SOCK_CLOEXEC);
+            if (fd == -1) continue;
+            
+            aggregate_conn_t *conn = malloc(sizeof(aggregate_conn_t));
+            pthread_t thread;
+            if (!conn) {
+                close(fd);
+                continue;
             }
-            free(new_hash);
-            pthread_mutex_unlock(&hash_mutex);
-            return changed;
+            conn->fd = fd;
+            if (pthread_create(&thread, NULL, aggregate_conn_thread, conn) != 0) {
+                free(conn);
+                close(fd);
+                continue;
+            }
+            pthread_detach(thread);
         }
     }
     
-    if (hash_count >= hash_capacity) {
-        hash_capacity = (hash_capacity == 0) ? 100 : hash_capacity * 2;
-        file_hashes = realloc(file_hashes, sizeof(file_hash_info_t) * hash_capacity);
+    pthread_join(merge_thread, NULL);
+    
+    // Give connection threads a moment to finish the batch they are reading
+    for (int waited = 0; waited < 20; waited++) {
+        int connected = 0;
+        pthread_mutex_lock(&aggregate_mutex);
+        for (int i = 0; i < aggregate_source_count; i++) {
+            connected += aggregate_sources[i].connected;
+        }
+        pthread_mutex_unlock(&aggregate_mutex);
+        if (connected == 0) break;
+        usleep(50000);
     }
+    aggregate_merge_once(output, 1);
+    fclose(output);
     
-    if (file_hashes) {
-        strncpy(file_hashes[hash_count].filepath, filepath, MAX_PATH_LEN - 1);
-        strncpy(file_hashes[hash_count].hash, new_hash, HASH_SIZE - 1);
-        file_hashes[hash_count].last_modified = time(NULL);
-        
-        struct stat st;
-        if (stat(filepath, &st) == 0) {
-            file_hashes[hash_count].file_size = st.st_size;
+    for (int i = 0; i < aggregate_listen_count; i++) {
+        close(listeners[i].fd);
+        if (strncmp(aggregate_listen[i], "unix:", 5) == 0) {
+            unlink(aggregate_listen[i] + 5);
         }
-        
-        hash_count++;
-        free(new_hash);
     }
     
-    pthread_mutex_unlock(&hash_mutex);
-    return 1;
+    snprintf(msg, sizeof(msg),
+            "[AGGREGATE] Stopped: %lu batches, %lu records written, %lu duplicates, %lu late, %lu dropped",
+            stats.aggregate_batches_received, stats.aggregate_records_written,
+            stats.aggregate_duplicates, stats.aggregate_late_records, stats.aggregate_records_dropped);
+    log_event(msg);
+    return 0;
 }
 
-void rotate_log_file() {
-    if (!log_file) return;
+// ===== STATS HISTORY =====
+
+// Fixed-size time-series ring of stats samples (default: one every 10 s
+// for 7 days). The file is a header followed by slot_count samples;
+// readers mmap it read-only. A slot is filled before write_index is
+// advanced, so every slot except the oldest (the next to be overwritten)
+// is stable while write_index does not change.
+#define STATS_HISTORY_MAGIC     0x53544d46  // "FMTS"
+#define STATS_HISTORY_VERSION   1
+#define LATENCY_BUCKETS         256
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t slot_size;       // sizeof(stats_sample_t)
+    uint32_t interval_sec;
+    uint32_t slot_count;
+    uint64_t write_index;     // samples written so far; newest = (write_index - 1) % slot_count
+    int64_t created;
+    uint8_t reserved[32];
+} stats_history_header_t;
+
+typedef struct {
+    int64_t timestamp;        // end of the interval (unix seconds)
+    uint64_t total_events;
+    uint64_t bytes_logged;
+    uint32_t events;          // during the interval
+    uint32_t batches;         // inotify read() batches during the interval
+    float events_per_sec;
+    float bytes_per_sec;
+    uint32_t latency_p50_ns;  // per-batch processing time, ~12% resolution
+    uint32_t latency_p90_ns;
+    uint32_t latency_p99_ns;
+    uint32_t latency_max_ns;
+    uint32_t rss_kb;
+    float cpu_percent;        // during the interval
+    uint32_t active_watches;
+    uint32_t reserved;
+} stats_sample_t;
+
+// Cumulative batch latency histogram: log2 buckets split into 4 linear
+// sub-buckets. Written only by the event thread; the sampler diffs
+// successive copies, so nothing is ever reset under the writer.
+static uint64_t latency_hist[LATENCY_BUCKETS];
+static stats_history_header_t *stats_history = NULL;
+static size_t stats_history_size = 0;
+
+static inline int latency_bucket(uint64_t ns) {
+    if (ns < 4) return (int)ns;
+    int e = 63 - __builtin_clzll(ns);
+    return (e - 1) * 4 + (int)((ns >> (e - 2)) & 3);
+}
+
+// Largest value that falls into bucket b
+static uint64_t latency_bucket_max(int b) {
+    if (b < 4) return b;
+    int e = b / 4 + 1;
+    return ((uint64_t)(4 + b % 4 + 1) << (e - 2)) - 1;
+}
+
+static inline void stats_record_batch(uint64_t ns) {
+    int b = latency_bucket(ns);
+    __atomic_store_n(&latency_hist[b], latency_hist[b] + 1, __ATOMIC_RELAXED);
+}
+
+unsigned long read_rss_kb() {
+    unsigned long rss = 0;
+    FILE *status = fopen("/proc/self/status", "r");
+    if (status) {
+        char line[256];
+        while (fgets(line, sizeof(line), status)) {
+            if (strncmp(line, "VmRSS:", 6) == 0) {
+                sscanf(line, "VmRSS: %lu kB", &rss);
+                break;
+            }
+        }
+        fclose(status);
+    }
+    return rss;
+}
+
+int stats_history_init() {
+    if (stats_history_interval < 1) stats_history_interval = 1;
+    if (stats_history_days < 1) stats_history_days = 1;
+    // The ring needs at least two slots; an interval past half the window
+    // would leave none and stats_history_sample() would divide by zero
+    int64_t max_interval = (int64_t)stats_history_days * 86400 / 2;
+    if (stats_history_interval > max_interval) {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "[WARN] stats_history_interval=%d exceeds half of stats_history_days, using %lld",
+                stats_history_interval, (long long)max_interval);
+        log_event(msg);
+        stats_history_interval = (int)max_interval;
+    }
+    uint32_t slot_count = (uint32_t)((int64_t)stats_history_days * 86400 / stats_history_interval);
+    size_t size = sizeof(stats_history_header_t) + (size_t)slot_count * sizeof(stats_sample_t);
     
-    fclose(log_file);
+    int fd = open(stats_history_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) return -1;
     
-    char old_name[MAX_PATH_LEN];
-    char new_name[MAX_PATH_LEN];
+    // Keep the history across restarts unless its geometry changed or the
+    // file was cut short (touching a page past EOF raises SIGBUS)
+    stats_history_header_t header;
+    struct stat st;
+    int reuse = fstat(fd, &st) == 0 && st.st_size >= (off_t)size &&
+                pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+                header.magic == STATS_HISTORY_MAGIC && header.version == STATS_HISTORY_VERSION &&
+                header.slot_size == sizeof(stats_sample_t) &&
+                header.interval_sec == (uint32_t)stats_history_interval &&
+                header.slot_count == slot_count;
+    if (!reuse && (ftruncate(fd, 0) != 0 || ftruncate(fd, size) != 0)) {
+        close(fd);
+        return -1;
+    }
     
-    for (int i = MAX_LOG_FILES - 1; i > 0; i--) {
-        snprintf(old_name, sizeof(old_name), "%s.%d", LOG_FILE, i - 1);
-        snprintf(new_name, sizeof(new_name), "%s.%d", LOG_FILE, i);
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+    stats_history = map;
+    stats_history_size = size;
+    
+    if (!reuse) {
+        stats_history->slot_size = sizeof(stats_sample_t);
+        stats_history->interval_sec = stats_history_interval;
+        stats_history->slot_count = slot_count;
+        stats_history->write_index = 0;
+        stats_history->created = time(NULL);
+        stats_history->version = STATS_HISTORY_VERSION;
+        __atomic_store_n(&stats_history->magic, STATS_HISTORY_MAGIC, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+// Append one sample covering the time since the previous call
+void stats_history_sample() {
+    static uint64_t prev_hist[LATENCY_BUCKETS];
+    static uint64_t prev_events, prev_bytes;
+    static struct timespec prev_wall;
+    static double prev_cpu;
+    static int primed = 0;
+    
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    struct rusage usage;
+    double cpu = 0;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        cpu = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+              (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+    }
+    uint64_t events = stats.total_events;
+    uint64_t bytes = stats.bytes_logged;
+    uint64_t hist[LATENCY_BUCKETS];
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+        hist[b] = __atomic_load_n(&latency_hist[b], __ATOMIC_RELAXED);
+    }
+    
+    if (primed && stats_history) {
+        double elapsed = (now.tv_sec - prev_wall.tv_sec) + (now.tv_nsec - prev_wall.tv_nsec) / 1e9;
+        if (elapsed <= 0) elapsed = 1;
         
-        if (access(old_name, F_OK) == 0) {
-            if (i == MAX_LOG_FILES - 1) {
-                unlink(old_name);
-            } else {
-                rename(old_name, new_name);
-            }
+        stats_sample_t *slot = (stats_sample_t *)(stats_history + 1) +
+                               stats_history->write_index % stats_history->slot_count;
+        memset(slot, 0, sizeof(*slot));
+        slot->timestamp = time(NULL);
+        slot->total_events = events;
+        slot->bytes_logged = bytes;
+        slot->events = events - prev_events;
+        slot->events_per_sec = (events - prev_events) / elapsed;
+        slot->bytes_per_sec = (bytes - prev_bytes) / elapsed;
+        slot->cpu_percent = (cpu - prev_cpu) / elapsed * 100.0;
+        slot->rss_kb = read_rss_kb();
+        slot->active_watches = uses_watch_manager() ? watch_manager.count : (uint32_t)watch_count;
+        
+        uint64_t batches = 0;
+        for (int b = 0; b < LATENCY_BUCKETS; b++) {
+            batches += hist[b] - prev_hist[b];
+        }
+        slot->batches = batches;
+        // Quantile q is the bucket holding the ceil(q * batches)-th batch
+        uint64_t rank50 = (batches * 50 + 99) / 100;
+        uint64_t rank90 = (batches * 90 + 99) / 100;
+        uint64_t rank99 = (batches * 99 + 99) / 100;
+        uint64_t seen = 0;
+        for (int b = 0; b < LATENCY_BUCKETS && batches; b++) {
+            uint64_t n = hist[b] - prev_hist[b];
+            if (!n) continue;
+            uint64_t bound = latency_bucket_max(b);
+            uint32_t value = bound > UINT32_MAX ? UINT32_MAX : (uint32_t)bound;
+            if (seen < rank50 && seen + n >= rank50) slot->latency_p50_ns = value;
+            if (seen < rank90 && seen + n >= rank90) slot->latency_p90_ns = value;
+            if (seen < rank99 && seen + n >= rank99) slot->latency_p99_ns = value;
+            seen += n;
+            slot->latency_max_ns = value;
         }
+        
+        __atomic_store_n(&stats_history->write_index, stats_history->write_index + 1, __ATOMIC_RELEASE);
     }
     
-    snprintf(new_name, sizeof(new_name), "%s.0", LOG_FILE);
-    rename(LOG_FILE, new_name);
+    memcpy(prev_hist, hist, sizeof(hist));
+    prev_events = events;
+    prev_bytes = bytes;
+    prev_wall = now;
+    prev_cpu = cpu;
+    primed = 1;
+}
+
+// ===== STATS PAGE =====
+
+// Live stats in one shared-memory page (default /dev/shm/file_monitor.stats)
+// guarded by a seqlock: the writer makes seq odd, updates the fields and
+// makes it even again. A reader copies the page and retries if seq was odd
+// or changed meanwhile, so status reads take no syscalls and no locks.
+#define STATS_PAGE_MAGIC        0x50534d46  // "FMSP"
+#define STATS_PAGE_VERSION      1
+#define STATS_PAGE_SIZE         4096
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;            // sizeof(stats_page_t)
+    uint32_t seq;             // seqlock: odd while an update is in progress
+    int32_t pid;
+    uint32_t running;         // 0 once the monitor has shut down
+    char mode[12];
+    int64_t start_time;
+    int64_t updated;
+    uint64_t total_events;
+    uint64_t last_seq;
+    uint64_t bytes_logged;
+    uint64_t memory_usage_kb;
+    double cpu_usage_percent;
+    double events_per_second;
+    uint64_t active_watches;
+    uint64_t watch_capacity;
+    uint64_t watch_limit_hits;
+    uint64_t memory_reallocations;
+    uint64_t max_events_per_path;
+    uint64_t subscribers;
+    uint64_t journal_records;
+    uint64_t collector_frames_sent;
+    uint64_t replica_batches_acked;
+    uint64_t aggregate_records_written;
+    char most_active_path[256];
+} stats_page_t;
+
+static stats_page_t *stats_page = NULL;
+static pthread_mutex_t stats_page_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+int stats_page_init() {
+    int fd = open(stats_page_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) return -1;
     
-    if (enable_compression) {
-        compress_old_log(new_name);
+    // Leave a page that another live monitor is publishing alone
+    stats_page_t current;
+    if (pread(fd, &current, sizeof(current), 0) == (ssize_t)sizeof(current) &&
+        current.magic == STATS_PAGE_MAGIC && current.running && current.pid != getpid() &&
+        current.pid > 0 && kill(current.pid, 0) == 0) {
+        close(fd);
+        return -1;
     }
     
-    log_file = fopen(LOG_FILE, "a");
-    if (log_file) {
-        log_event("[INFO] Log file rotated successfully");
+    if (ftruncate(fd, STATS_PAGE_SIZE) != 0) {
+        close(fd);
+        return -1;
     }
+    void *map = mmap(NULL, STATS_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+    
+    stats_page = map;
+    memset(stats_page, 0, sizeof(*stats_page));
+    stats_page->version = STATS_PAGE_VERSION;
+    stats_page->size = sizeof(stats_page_t);
+    stats_page->pid = getpid();
+    stats_page->start_time = stats.start_time;
+    __atomic_store_n(&stats_page->magic, STATS_PAGE_MAGIC, __ATOMIC_RELEASE);
+    return 0;
 }
 
-void compress_old_log(const char *filename) {
-    char gz_filename[MAX_PATH_LEN];
-    snprintf(gz_filename, sizeof(gz_filename), "%s.gz", filename);
+void stats_page_publish(int running_now) {
+    if (!stats_page) return;
     
-    FILE *input = fopen(filename, "rb");
-    if (!input) return;
+    pthread_mutex_lock(&stats_page_mutex);
+    uint32_t seq = stats_page->seq;
+    __atomic_store_n(&stats_page->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
     
-    gzFile output = gzopen(gz_filename, "wb9");
-    if (!output) {
-        fclose(input);
-        return;
+    stats_page->running = running_now;
+    strncpy(stats_page->mode, mode_name(), sizeof(stats_page->mode) - 1);
+    stats_page->updated = time(NULL);
+    stats_page->total_events = stats.total_events;
+    stats_page->last_seq = event_seq;
+    stats_page->bytes_logged = stats.bytes_logged;
+    stats_page->memory_usage_kb = stats.memory_usage_kb;
+    stats_page->cpu_usage_percent = stats.cpu_usage_percent;
+    stats_page->events_per_second = stats.events_per_second;
+    stats_page->active_watches = uses_watch_manager() ? watch_manager.count : (uint64_t)watch_count;
+    stats_page->watch_capacity = uses_watch_manager() ? watch_manager.capacity : sizeof(watch_descriptors) / sizeof(watch_descriptors[0]);
+    stats_page->watch_limit_hits = stats.watch_limit_hits;
+    stats_page->memory_reallocations = stats.memory_reallocations;
+    stats_page->max_events_per_path = stats.max_events_per_path;
+    stats_page->subscribers = ipc_subscriber_count;
+    stats_page->journal_records = journal_records;
+    stats_page->collector_frames_sent = stats.collector_frames_sent;
+    stats_page->replica_batches_acked = stats.replica_batches_acked;
+    stats_page->aggregate_records_written = stats.aggregate_records_written;
+    // Paths longer than the page field keep their tail behind "...";
+    // the deepest components are the informative part
+    const char *active = stats.most_active_path;
+    size_t active_len = strnlen(active, sizeof(stats.most_active_path));
+    size_t active_max = sizeof(stats_page->most_active_path) - 1;
+    if (active_len > active_max) {
+        memcpy(stats_page->most_active_path, "...", 3);
+        memcpy(stats_page->most_active_path + 3, active + active_len - (active_max - 3), active_max - 3);
+        stats_page->most_active_path[active_max] = '\0';
+    } else {
+        memcpy(stats_page->most_active_path, active, active_len + 1);
     }
     
-    char buffer[8192];
-    size_t bytes;
-    while ((bytes = fread(buffer, 1, sizeof(buffer), input)) > 0) {
-        gzwrite(output, buffer, bytes);
-    }
+    __atomic_store_n(&stats_page->seq, seq + 2, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&stats_page_mutex);
+}
+
+// ===== THREAD ACCOUNTING =====
+
+// Every long-lived thread names itself "fmon-<role>" and the stats thread
+// reads /proc/self/task/*/stat once a second, so the CPU time of each
+// thread is reported under its role (the main thread is the reader). The
+// event thread's own time is split further into stages with
+// CLOCK_THREAD_CPUTIME_ID: read (the read() after a batch), dispatch
+// (handlers, filter, log staging), hash (content checks) and write (log
+// and journal flushes). That clock is a system call, so only one batch in
+// CPU_STAGE_SAMPLE is split and the stages are reported per event of the
+// sampled batches.
+
+void thread_set_role(const char *role) {
+    char name[16];
+    snprintf(name, sizeof(name), "fmon-%s", role);
+    pthread_setname_np(pthread_self(), name);
+}
+
+uint64_t thread_cpu_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// CPU time of one task from /proc/self/task/<tid>/stat; copies its name
+static int cpu_read_task(pid_t tid, char comm[16], uint64_t *ticks) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/task/%d/stat", (int)tid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+    char buf[512];
+    ssize_t len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0) return -1;
+    buf[len] = '\0';
     
-    fclose(input);
-    gzclose(output);
-    unlink(filename);
+    // "tid (comm) state ppid ... utime stime ...": comm may contain spaces
+    // and parentheses, so it ends at the last ')'
+    char *open_paren = strchr(buf, '(');
+    char *close_paren = strrchr(buf, ')');
+    if (!open_paren || !close_paren || close_paren < open_paren) return -1;
+    size_t comm_len = close_paren - open_paren - 1;
+    if (comm_len > 15) comm_len = 15;
+    memcpy(comm, open_paren + 1, comm_len);
+    comm[comm_len] = '\0';
     
-    char msg[512];
-    snprintf(msg, sizeof(msg), "[INFO] Compressed log file: %s", gz_filename);
-    log_event(msg);
+    unsigned long long utime, stime;
+    if (sscanf(close_paren + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+               &utime, &stime) != 2) {
+        return -1;
+    }
+    *ticks = utime + stime;
+    return 0;
 }
 
-void handle_event_advanced(struct inotify_event *event, const char *watch_path) {
-    stats.total_events++;
+// Called once a second by the stats thread
+void cpu_sample() {
+    DIR *dir = opendir("/proc/self/task");
+    if (!dir) return;
     
-    if (event->len > 0) {
-        char full_path[MAX_PATH_LEN];
-        snprintf(full_path, sizeof(full_path), "%s/%s", watch_path, event->name);
-        
-        if (!should_monitor_file(event->name)) {
-            return;
-        }
-        
-        char log_msg[MAX_PATH_LEN + 100];
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t now_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+    long ticks_per_second = sysconf(_SC_CLK_TCK);
+    if (ticks_per_second <= 0) ticks_per_second = 100;
+    pid_t pid = getpid();
+    
+    pthread_mutex_lock(&cpu_mutex);
+    for (int i = 0; i < cpu_thread_count; i++) {
+        cpu_threads[i].seen = 0;
+    }
+    
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] < '0' || entry->d_name[0] > '9') continue;
+        pid_t tid = (pid_t)atoi(entry->d_name);
+        char comm[16];
+        uint64_t ticks;
+        if (cpu_read_task(tid, comm, &ticks) != 0) continue;
         
-        if (event->mask & IN_CREATE) {
-            snprintf(log_msg, sizeof(log_msg), "Created: %s", full_path);
-            log_event(log_msg);
-            
-            if (event->mask & IN_ISDIR && recursive_mode) {
-                add_watch_recursive_basic(full_path);
-            }
-        }
-        if (event->mask & IN_DELETE) {
-            snprintf(log_msg, sizeof(log_msg), "Deleted: %s", full_path);
-            log_event(log_msg);
-        }
-        if (event->mask & IN_MODIFY) {
-            if (check_file_changed(full_path)) {
-                snprintf(log_msg, sizeof(log_msg), "Modified (checksum changed): %s", full_path);
-                log_event(log_msg);
+        cpu_thread_t *thread = NULL;
+        for (int i = 0; i < cpu_thread_count; i++) {
+            if (cpu_threads[i].tid == tid) {
+                thread = &cpu_threads[i];
+                break;
             }
         }
-        if (event->mask & IN_MOVED_FROM) {
-            snprintf(log_msg, sizeof(log_msg), "Moved from: %s", full_path);
-            log_event(log_msg);
-        }
-        if (event->mask & IN_MOVED_TO) {
-            snprintf(log_msg, sizeof(log_msg), "Moved to: %s", full_path);
-            log_event(log_msg);
-        }
-        if (event->mask & IN_OPEN) {
-            snprintf(log_msg, sizeof(log_msg), "Opened: %s", full_path);
-            log_event(log_msg);
+        uint64_t cpu_ns = ticks * (1000000000ULL / ticks_per_second);
+        if (!thread) {
+            if (cpu_thread_count == CPU_THREAD_MAX) continue;
+            thread = &cpu_threads[cpu_thread_count++];
+            thread->tid = tid;
+            thread->last_cpu_ns = cpu_ns;
         }
-        if (event->mask & IN_CLOSE) {
-            snprintf(log_msg, sizeof(log_msg), "Closed: %s", full_path);
-            log_event(log_msg);
+        // The name is re-read each time: threads name themselves after start
+        if (tid == pid) {
+            strcpy(thread->role, mode == MODE_AGGREGATE ? "listen" : "reader");
+        } else if (strncmp(comm, "fmon-", 5) == 0) {
+            strcpy(thread->role, comm + 5);
+        } else {
+            strcpy(thread->role, "other");
         }
+        thread->cpu_ns = cpu_ns;
+        thread->seen = 1;
     }
+    closedir(dir);
+    
+    uint64_t elapsed = cpu_sampled_ns ? now_ns - cpu_sampled_ns : 0;
+    int kept = 0;
+    for (int i = 0; i < cpu_thread_count; i++) {
+        cpu_thread_t *thread = &cpu_threads[i];
+        if (!thread->seen) continue;
+        thread->cpu_percent = elapsed ? (double)(thread->cpu_ns - thread->last_cpu_ns) * 100.0 / elapsed : 0.0;
+        thread->last_cpu_ns = thread->cpu_ns;
+        cpu_threads[kept++] = *thread;
+    }
+    cpu_thread_count = kept;
+    cpu_sampled_ns = now_ns;
+    pthread_mutex_unlock(&cpu_mutex);
 }
 
 // ===== STATISTICS FUNCTIONS =====
 
 void update_stats() {
     stats.last_update = time(NULL);
-    
-    FILE *status = fopen("/proc/self/status", "r");
-    if (status) {
-        char line[256];
-        while (fgets(line, sizeof(line), status)) {
-            if (strncmp(line, "VmRSS:", 6) == 0) {
-                sscanf(line, "VmRSS: %lu kB", &stats.memory_usage_kb);
-                break;
-            }
-        }
-        fclose(status);
-    }
+    stats.memory_usage_kb = read_rss_kb();
     
     struct rusage usage;
     if (getrusage(RUSAGE_SELF, &usage) == 0) {
@@ -875,6 +9558,14 @@ void update_stats() {
             stats.events_per_second = stats.total_events / elapsed_time;
         }
     }
+    
+    // Used share of the space available to us, rounded up as df does
+    struct statvfs fs;
+    if (monitor_root[0] && statvfs(monitor_root, &fs) == 0 && fs.f_blocks > 0) {
+        uint64_t used = fs.f_blocks - fs.f_bfree;
+        uint64_t total = used + fs.f_bavail;
+        stats.disk_usage_percent = total ? (long)((used * 100 + total - 1) / total) : 0;
+    }
 }
 
 void save_stats() {
@@ -882,12 +9573,11 @@ void save_stats() {
     
     json_object *stats_json = json_object_new_object();
     json_object_object_add(stats_json, "mode",
-                          json_object_new_string(mode == MODE_BASIC ? "basic" :
-                                                mode == MODE_ADVANCED ? "advanced" : "enhanced"));
+                          json_object_new_string(mode_name()));
     json_object_object_add(stats_json, "total_events",
                           json_object_new_int64(stats.total_events));
     
-    if (mode == MODE_ENHANCED) {
+    if (uses_watch_manager()) {
         json_object_object_add(stats_json, "active_watches",
                               json_object_new_int64(watch_manager.count));
         json_object_object_add(stats_json, "watch_capacity",
@@ -900,6 +9590,12 @@ void save_stats() {
         json_object_object_add(stats_json, "active_watches",
                               json_object_new_int64(watch_count));
     }
+    pthread_mutex_lock(&watch_lock);
+    json_object_object_add(stats_json, "watch_path_bytes",
+                          json_object_new_int64(path_index_memory(&watch_index)));
+    json_object_object_add(stats_json, "watch_path_key_bytes",
+                          json_object_new_int64(watch_index.key_bytes));
+    pthread_mutex_unlock(&watch_lock);
     
     json_object_object_add(stats_json, "memory_usage_kb",
                           json_object_new_int64(stats.memory_usage_kb));
@@ -907,6 +9603,183 @@ void save_stats() {
                           json_object_new_double(stats.cpu_usage_percent));
     json_object_object_add(stats_json, "uptime_seconds",
                           json_object_new_int64(time(NULL) - stats.start_time));
+    json_object_object_add(stats_json, "self_events_suppressed",
+                          json_object_new_int64(stats.self_events_suppressed));
+    json_object_object_add(stats_json, "disk_usage_percent",
+                          json_object_new_int64(stats.disk_usage_percent));
+    if (tree_nodes) {
+        pthread_mutex_lock(&tree_mutex);
+        json_object_object_add(stats_json, "file_tree_nodes",
+                              json_object_new_int64(tree_node_count - tree_free_count));
+        json_object_object_add(stats_json, "file_tree_pruned", json_object_new_int64(tree_pruned_total));
+        pthread_mutex_unlock(&tree_mutex);
+    }
+    if (tree_usage) {
+        pthread_mutex_lock(&tree_mutex);
+        json_object_object_add(stats_json, "tracked_bytes", json_object_new_int64(tree_usage[0].bytes));
+        json_object_object_add(stats_json, "tracked_files", json_object_new_int64(tree_usage[0].files));
+        pthread_mutex_unlock(&tree_mutex);
+    }
+    
+    if (collector_enabled) {
+        json_object_object_add(stats_json, "collector_frames_sent",
+                              json_object_new_int64(stats.collector_frames_sent));
+        json_object_object_add(stats_json, "collector_bytes_sent",
+                              json_object_new_int64(stats.collector_bytes_sent));
+        json_object_object_add(stats_json, "collector_reconnects",
+                              json_object_new_int64(stats.collector_reconnects));
+        json_object_object_add(stats_json, "collector_frames_spooled",
+                              json_object_new_int64(stats.collector_frames_spooled));
+        json_object_object_add(stats_json, "collector_bytes_dropped",
+                              json_object_new_int64(stats.collector_bytes_dropped));
+        json_object_object_add(stats_json, "collector_frames_oversized",
+                              json_object_new_int64(stats.collector_frames_oversized));
+    }
+    
+    if (policy_count > 0) {
+        json_object *policy_array = json_object_new_array();
+        for (int i = 0; i < policy_count; i++) {
+            json_object *entry = json_object_new_object();
+            json_object_object_add(entry, "prefix", json_object_new_string(policies[i].prefix));
+            json_object_object_add(entry, "events", json_object_new_int64(policies[i].events));
+            json_object_object_add(entry, "rate_dropped", json_object_new_int64(policies[i].dropped));
+            json_object_array_add(policy_array, entry);
+        }
+        json_object_object_add(stats_json, "policies", policy_array);
+    }
+    
+    pthread_mutex_lock(&cpu_mutex);
+    json_object *thread_array = json_object_new_array();
+    for (int i = 0; i < cpu_thread_count; i++) {
+        json_object *entry = json_object_new_object();
+        json_object_object_add(entry, "role", json_object_new_string(cpu_threads[i].role));
+        json_object_object_add(entry, "tid", json_object_new_int64(cpu_threads[i].tid));
+        json_object_object_add(entry, "cpu_ms", json_object_new_int64(cpu_threads[i].cpu_ns / 1000000));
+        json_object_object_add(entry, "cpu_percent", json_object_new_double(cpu_threads[i].cpu_percent));
+        json_object_array_add(thread_array, entry);
+    }
+    pthread_mutex_unlock(&cpu_mutex);
+    json_object_object_add(stats_json, "threads", thread_array);
+    
+    if (mode != MODE_AGGREGATE) {
+        json_object *stage_array = json_object_new_array();
+        uint64_t stage_events = cpu_stage_events;
+        for (int i = 0; i < CPU_STAGE_COUNT; i++) {
+            json_object *entry = json_object_new_object();
+            json_object_object_add(entry, "stage", json_object_new_string(cpu_stage_names[i]));
+            json_object_object_add(entry, "cpu_ns_per_event",
+                                  json_object_new_int64(stage_events ? cpu_stage_ns[i] / stage_events : 0));
+            json_object_array_add(stage_array, entry);
+        }
+        json_object_object_add(stats_json, "stages", stage_array);
+        json_object_object_add(stats_json, "stage_sampled_events", json_object_new_int64(stage_events));
+    }
+    
+    json_object *type_counts = json_object_new_object();
+    for (int i = 0; i < EVENT_TYPE_COUNT; i++) {
+        if (!event_type_seen[i]) continue;
+        json_object *entry = json_object_new_object();
+        json_object_object_add(entry, "seen", json_object_new_int64(event_type_seen[i]));
+        json_object_object_add(entry, "logged", json_object_new_int64(event_type_logged[i]));
+        json_object_object_add(entry, "sample_rate", json_object_new_int64(sample_rates[i]));
+        json_object_object_add(type_counts, event_type_names[i], entry);
+    }
+    json_object_object_add(stats_json, "event_types", type_counts);
+    
+    pthread_mutex_lock(&metrics_mutex);
+    if (metrics_last) {
+        json_object_object_add(stats_json, "metrics", json_object_get(metrics_last));
+    }
+    pthread_mutex_unlock(&metrics_mutex);
+    
+    if (event_times_enabled) {
+        pthread_mutex_lock(&log_mutex);
+        json_object_object_add(stats_json, "event_latency_avg_ns",
+                              json_object_new_int64(stats.event_latency_samples ?
+                                                    stats.event_latency_total_ns / stats.event_latency_samples : 0));
+        json_object_object_add(stats_json, "event_latency_max_ns",
+                              json_object_new_int64(stats.event_latency_max_ns));
+        pthread_mutex_unlock(&log_mutex);
+    }
+    
+    if (enrich_enabled) {
+        json_object_object_add(stats_json, "enrich_statx_calls",
+                              json_object_new_int64(stats.enrich_statx_calls));
+        json_object_object_add(stats_json, "enrich_cache_hits",
+                              json_object_new_int64(stats.enrich_cache_hits));
+        json_object_object_add(stats_json, "enrich_cache_entries",
+                              json_object_new_int64(enrich_slots));
+    }
+    
+    if (filter_len) {
+        json_object_object_add(stats_json, "filter_rejected",
+                              json_object_new_int64(stats.filter_rejected));
+        json_object_object_add(stats_json, "filter_stat_calls",
+                              json_object_new_int64(stats.filter_stat_calls));
+    }
+    
+    if (recursive_mode) {
+        json_object_object_add(stats_json, "crawl_jobs",
+                              json_object_new_int64(stats.crawl_jobs));
+        json_object_object_add(stats_json, "crawl_duplicates",
+                              json_object_new_int64(stats.crawl_duplicates));
+        json_object_object_add(stats_json, "crawl_overflows",
+                              json_object_new_int64(stats.crawl_overflows));
+        json_object_object_add(stats_json, "crawl_catchup_events",
+                              json_object_new_int64(stats.crawl_catchup_events));
+    }
+    
+    if (mode == MODE_ADVANCED && enable_checksum) {
+        pthread_mutex_lock(&hash_mutex);
+        json_object_object_add(stats_json, "file_identities",
+                              json_object_new_int64(identity_count));
+        json_object_object_add(stats_json, "identity_paths",
+                              json_object_new_int64(identity_path_count));
+        json_object_object_add(stats_json, "identity_path_bytes",
+                              json_object_new_int64(path_index_memory(&identity_path_index)));
+        json_object_object_add(stats_json, "identity_path_key_bytes",
+                              json_object_new_int64(identity_path_index.key_bytes));
+        pthread_mutex_unlock(&hash_mutex);
+        json_object_object_add(stats_json, "hashes_computed",
+                              json_object_new_int64(stats.hashes_computed));
+        json_object_object_add(stats_json, "hashes_reused",
+                              json_object_new_int64(stats.hashes_reused));
+    }
+    
+    if (replica_enabled) {
+        json_object_object_add(stats_json, "replica_batches_sent",
+                              json_object_new_int64(stats.replica_batches_sent));
+        json_object_object_add(stats_json, "replica_batches_acked",
+                              json_object_new_int64(stats.replica_batches_acked));
+        json_object_object_add(stats_json, "replica_reconnects",
+                              json_object_new_int64(stats.replica_reconnects));
+        json_object_object_add(stats_json, "replica_records_dropped",
+                              json_object_new_int64(stats.replica_records_dropped));
+    }
+    
+    if (journal_enabled) {
+        json_object_object_add(stats_json, "journal_records",
+                              json_object_new_int64(journal_records));
+        json_object_object_add(stats_json, "journal_files",
+                              json_object_new_int64(journal_table->count));
+        json_object_object_add(stats_json, "journal_records_dropped",
+                              json_object_new_int64(journal_records_dropped));
+    }
+    
+    if (mode == MODE_AGGREGATE) {
+        json_object_object_add(stats_json, "aggregate_sources",
+                              json_object_new_int64(aggregate_source_count));
+        json_object_object_add(stats_json, "aggregate_batches_received",
+                              json_object_new_int64(stats.aggregate_batches_received));
+        json_object_object_add(stats_json, "aggregate_records_written",
+                              json_object_new_int64(stats.aggregate_records_written));
+        json_object_object_add(stats_json, "aggregate_duplicates",
+                              json_object_new_int64(stats.aggregate_duplicates));
+        json_object_object_add(stats_json, "aggregate_late_records",
+                              json_object_new_int64(stats.aggregate_late_records));
+        json_object_object_add(stats_json, "aggregate_records_dropped",
+                              json_object_new_int64(stats.aggregate_records_dropped));
+    }
     
     if (json_object_to_file(STATS_FILE, stats_json) != 0) {
         log_event("[ERROR] Failed to save statistics");
@@ -916,28 +9789,362 @@ void save_stats() {
 }
 
 void* stats_thread_func(void* arg) {
+    (void)arg;
+    thread_set_role("stats");
+    int ticks = 0;
+    update_stats();
+    cpu_sample();
+    stats_page_publish(1);
+    stats_history_sample();
     while (running) {
-        sleep(30);
-        if (running) {
+        sleep(1);
+        ticks++;
+        if (!running) break;
+        update_stats();
+        cpu_sample();
+        stats_page_publish(1);
+        if (stats_history && ticks % stats_history_interval == 0) {
+            stats_history_sample();
+        }
+        if (disk_usage && usage_seeded && growth_alert_count && ticks % growth_interval == 0) {
+            usage_check_growth();
+        }
+        tree_maintain();
+        if (sampling_enabled && ticks % sample_interval == 0) {
+            sample_report();
+        }
+        if (mode == MODE_METRICS && ticks % metrics_interval == 0) {
+            metrics_rollup();
+            save_stats();
+        } else if (ticks % 30 == 0) {
             save_stats();
         }
     }
     return NULL;
 }
 
+// ===== EVENT DISPATCH =====
+
+// Events on the monitor's own output files (log and its rotated segments,
+// stats, journal, spools, ...) would be logged again and feed back into
+// the log. Each output is registered by the (dev, ino) of the directory it
+// lives in plus its name, since inotify names the file but not its inode.
+// A watch on such a directory carries a bitmask of the outputs inside it,
+// so events elsewhere cost a single test.
+
+#define SELF_OUTPUT_MAX 16
+
+typedef struct {
+    dev_t dir_dev;
+    ino_t dir_ino;
+    char name[NAME_MAX + 1];
+    size_t name_len;
+    int prefix;             // also covers "<name>.<suffix>" (segments, tmp files)
+} self_output_t;
+
+static self_output_t self_outputs[SELF_OUTPUT_MAX];
+static int self_output_count = 0;
+
+static void self_output_add(const char *path, int prefix) {
+    if (!path[0] || self_output_count == SELF_OUTPUT_MAX) return;
+    
+    const char *slash = strrchr(path, '/');
+    const char *name = slash ? slash + 1 : path;
+    char dir[MAX_PATH_LEN];
+    if (!slash) {
+        strcpy(dir, ".");
+    } else if (slash == path) {
+        strcpy(dir, "/");
+    } else {
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+    }
+    
+    struct stat st;
+    if (!name[0] || strlen(name) > NAME_MAX || stat(dir, &st) != 0) return;
+    
+    self_output_t *output = &self_outputs[self_output_count++];
+    output->dir_dev = st.st_dev;
+    output->dir_ino = st.st_ino;
+    strcpy(output->name, name);
+    output->name_len = strlen(name);
+    output->prefix = prefix;
+}
+
+// Register every file this run writes. Called once paths are configured
+// and before the first watch is added.
+void self_outputs_init() {
+    self_output_add(LOG_FILE, 1);
+    self_output_add(STATS_FILE, 0);
+    self_output_add(SEQ_STATE_FILE, 0);
+    self_output_add(ipc_socket_path, 0);
+    if (stats_history_enabled) self_output_add(stats_history_path, 0);
+    if (stats_page_enabled) self_output_add(stats_page_path, 0);
+    if (journal_requested) self_output_add(journal_path, 1);
+    if (collector_socket_path[0]) self_output_add(collector_spool_path, 0);
+    if (replica_target[0]) self_output_add(replica_spool_path, 1);
+}
+
+// Bitmask of registered outputs that live directly in dir_path
+uint32_t self_output_mask(const char *dir_path) {
+    if (self_output_count == 0) return 0;
+    
+    struct stat st;
+    if (stat(dir_path, &st) != 0) return 0;
+    
+    uint32_t mask = 0;
+    for (int i = 0; i < self_output_count; i++) {
+        if (self_outputs[i].dir_dev == st.st_dev && self_outputs[i].dir_ino == st.st_ino) {
+            mask |= 1u << i;
+        }
+    }
+    return mask;
+}
+
+// Whether event names one of the outputs in the watch's mask
+int self_event(uint32_t outputs, const struct inotify_event *event) {
+    if (event->len == 0) return 0;
+    
+    size_t len = strnlen(event->name, event->len);
+    while (outputs) {
+        const self_output_t *output = &self_outputs[__builtin_ctz(outputs)];
+        outputs &= outputs - 1;
+        if (len >= output->name_len && memcmp(event->name, output->name, output->name_len) == 0 &&
+            (len == output->name_len || (output->prefix && event->name[output->name_len] == '.'))) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void log_begin_batch() {
+    pthread_mutex_lock(&log_mutex);
+    log_batching = 1;
+    pthread_mutex_unlock(&log_mutex);
+}
+
+static void log_end_batch() {
+    pthread_mutex_lock(&log_mutex);
+    log_batching = 0;
+    pthread_mutex_unlock(&log_mutex);
+    log_flush();
+}
+
+// Handle every event in one inotify read() buffer; log lines produced by
+// the batch are written out together at the end
+void process_events(char *buffer, int length) {
+    struct timespec batch_start, batch_end;
+    int sampled = cpu_batch_count++ % CPU_STAGE_SAMPLE == 0;
+    uint64_t cpu_start = 0;
+    uint64_t cpu_hashed = cpu_stage_ns[CPU_STAGE_HASH];
+    if (sampled || cpu_batch_end_ns) {
+        cpu_start = thread_cpu_ns();
+        if (cpu_batch_end_ns) {
+            cpu_stage_ns[CPU_STAGE_READ] += cpu_start - cpu_batch_end_ns;
+            cpu_batch_end_ns = 0;
+        }
+    }
+    cpu_event_thread = sampled;
+    event_time_now(&event_time);
+    batch_start.tv_sec = event_time.monotonic_ns / 1000000000ULL;
+    batch_start.tv_nsec = event_time.monotonic_ns % 1000000000ULL;
+    log_begin_batch();
+    pthread_mutex_lock(&watch_lock);
+    
+    int offset = 0;
+    while (offset < length) {
+        struct inotify_event *event = (struct inotify_event *)(buffer + offset);
+        
+        if (mode == MODE_METRICS) {
+            handle_event_metrics(event);
+        } else if (mode == MODE_ENHANCED) {
+            handle_event_enhanced(event);
+        } else if (mode == MODE_ADVANCED) {
+            // Find watch path for advanced mode
+            const char *path = NULL;
+            size_t path_len = 0;
+            for (int i = 0; i < watch_count; i++) {
+                if (watch_descriptors[i] == event->wd) {
+                    path = watch_path(i, &path_len);
+                    event_policy = watch_policies[i];
+                    if (watch_self_outputs[i] && self_event(watch_self_outputs[i], event)) {
+                        stats.self_events_suppressed++;
+                        path = NULL;
+                    }
+                    break;
+                }
+            }
+            if (path) {
+                handle_event_advanced(event, path, path_len);
+            }
+        } else {
+            // Basic mode
+            const char *path = NULL;
+            size_t path_len = 0;
+            for (int i = 0; i < watch_count; i++) {
+                if (watch_descriptors[i] == event->wd) {
+                    path = watch_path(i, &path_len);
+                    event_policy = watch_policies[i];
+                    if (watch_self_outputs[i] && self_event(watch_self_outputs[i], event)) {
+                        stats.self_events_suppressed++;
+                        path = NULL;
+                    }
+                    break;
+                }
+            }
+            if (path) {
+                handle_event_basic(event, path, path_len);
+            }
+        }
+        
+        offset += EVENT_SIZE + event->len;
+        cpu_stage_events += sampled;
+    }
+    
+    pthread_mutex_unlock(&watch_lock);
+    uint64_t cpu_dispatched = sampled ? thread_cpu_ns() : 0;
+    log_end_batch();
+    if (journal_enabled) {
+        journal_flush();
+    }
+    if (sampled) {
+        cpu_batch_end_ns = thread_cpu_ns();
+        cpu_stage_ns[CPU_STAGE_DISPATCH] += cpu_dispatched - cpu_start -
+                                            (cpu_stage_ns[CPU_STAGE_HASH] - cpu_hashed);
+        cpu_stage_ns[CPU_STAGE_WRITE] += cpu_batch_end_ns - cpu_dispatched;
+        cpu_event_thread = 0;
+    }
+    
+    clock_gettime(CLOCK_MONOTONIC, &batch_end);
+    stats_record_batch((batch_end.tv_sec - batch_start.tv_sec) * 1000000000ULL +
+                       batch_end.tv_nsec - batch_start.tv_nsec);
+}
+
+// ===== BENCHMARK =====
+
+// Feed synthetic events for the root watch through process_events().
+// After warm-up the steady-state path must not touch the heap; builds with
+// -DALLOC_CHECK (make test-alloc) fail if it does.
+int run_benchmark(unsigned long iterations) {
+    static const uint32_t masks[] = {
+        IN_CREATE, IN_MODIFY, IN_OPEN, IN_CLOSE_WRITE,
+        IN_MOVED_FROM, IN_MOVED_TO, IN_DELETE, IN_ATTRIB
+    };
+    static char buffer[BENCH_EVENT_NAMES * (EVENT_SIZE + 32)];
+    
+    int wd = uses_watch_manager() ? watch_manager.entries[0].wd : watch_descriptors[0];
+    int length = 0;
+    for (int i = 0; i < BENCH_EVENT_NAMES; i++) {
+        struct inotify_event *event = (struct inotify_event *)(buffer + length);
+        memset(event, 0, EVENT_SIZE + 32);
+        event->wd = wd;
+        event->mask = masks[i % (sizeof(masks) / sizeof(masks[0]))];
+        event->len = 32;
+        snprintf(event->name, 32, "bench_%02d.txt", i);
+        length += EVENT_SIZE + 32;
+    }
+    
+    for (unsigned long n = 0; n < BENCH_WARMUP_EVENTS; n += BENCH_EVENT_NAMES) {
+        process_events(buffer, length);
+    }
+    
+    // The filter is also timed on its own, over the same names and masks
+    static char paths[BENCH_EVENT_NAMES][MAX_PATH_LEN];
+    static size_t path_lens[BENCH_EVENT_NAMES];
+    size_t dir_len;
+    const char *dir = watch_path(0, &dir_len);
+    for (int i = 0; i < BENCH_EVENT_NAMES; i++) {
+        path_lens[i] = snprintf(paths[i], MAX_PATH_LEN, "%s/bench_%02d.txt", dir, i);
+    }
+    unsigned long matched = 0;
+    unsigned long stat_calls = 0;
+    
+    struct timespec start, end, filter_end;
+    unsigned long processed = 0;
+    uint64_t stage_start[CPU_STAGE_COUNT];
+    memcpy(stage_start, cpu_stage_ns, sizeof(stage_start));
+    uint64_t stage_events = cpu_stage_events;
+    
+    ALLOC_TRACKING_BEGIN();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (processed < iterations) {
+        process_events(buffer, length);
+        processed += BENCH_EVENT_NAMES;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (filter_len) {
+        stat_calls = stats.filter_stat_calls;
+        for (unsigned long n = 0; n < iterations; n++) {
+            int i = n % BENCH_EVENT_NAMES;
+            matched += filter_match(masks[i % (sizeof(masks) / sizeof(masks[0]))],
+                                    paths[i], path_lens[i]);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &filter_end);
+    ALLOC_TRACKING_END();
+    
+    double elapsed_ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    printf("[BENCH] mode=%s events=%lu total=%.3fs per_event=%.1fns\n",
+           mode_name(),
+           processed, elapsed_ns / 1e9, elapsed_ns / processed);
+    // Stages are timed for sampled batches only; a short run may have none
+    uint64_t sampled_events = cpu_stage_events - stage_events;
+    printf("[BENCH] cpu per event:");
+    if (sampled_events == 0) {
+        printf(" no sampled batches");
+    }
+    for (int i = 0; i < CPU_STAGE_COUNT && sampled_events; i++) {
+        printf(" %s=%.1fns", cpu_stage_names[i],
+               (double)(cpu_stage_ns[i] - stage_start[i]) / sampled_events);
+    }
+    printf("\n");
+    if (filter_len) {
+        double filter_ns = (filter_end.tv_sec - end.tv_sec) * 1e9 + (filter_end.tv_nsec - end.tv_nsec);
+        printf("[BENCH] filter insns=%u events=%lu matched=%lu stat_calls=%lu per_event=%.1fns\n",
+               filter_len, iterations, matched, stats.filter_stat_calls - stat_calls,
+               filter_ns / iterations);
+    }
+    
+#ifdef ALLOC_CHECK
+    printf("[BENCH] heap calls during steady state: malloc=%lu free=%lu\n",
+           alloc_calls, free_calls);
+    if (alloc_calls > 0 || free_calls > 0) {
+        fprintf(stderr, "[FAIL] Event hot path allocated memory after warm-up\n");
+        return 1;
+    }
+#endif
+    return 0;
+}
+
 // ===== MAIN PROGRAM =====
 
 void print_usage(const char *program_name) {
     printf("Unified File Monitor v2.0\n");
-    printf("Usage: %s [OPTIONS] <directory_path>\n\n", program_name);
+    printf("Usage: %s [OPTIONS] <directory_path>\n", program_name);
+    printf("       %s --mode=aggregate --listen=ADDR [--listen=ADDR ...] [OPTIONS]\n\n", program_name);
     printf("Options:\n");
-    printf("  --mode=MODE          Monitor mode: basic, advanced, or enhanced (default: basic)\n");
+    printf("  --mode=MODE          Monitor mode: basic, advanced, enhanced, metrics, or aggregate (default: basic)\n");
     printf("  -h, --help           Show this help message\n");
     printf("  --version            Show version information\n");
+    printf("  --bench=N            Process N synthetic events and report per-event cost\n");
+    printf("  --filter=EXPR        Report only matching events (replaces filter= in the config)\n");
+    printf("  --compact[=HOURS]    Compact rotated logs older than HOURS (default: all), then exit\n");
+    printf("  --query[=TEXT]       Search all log segments (case-insensitive) and print matches\n");
+    printf("    --since=TIME       Only lines at or after TIME (2026-01-31 [12:00], or 30m/24h/7d ago)\n");
+    printf("    --until=TIME       Only lines at or before TIME\n");
+    printf("    --type=LIST        Only these event types (created,modified,deleted,moved,...)\n");
+    printf("    --limit=N          Stop after N matches\n");
+    printf("    --threads=N        Worker threads (default: one per CPU)\n");
+    printf("\nAggregate options:\n");
+    printf("  --listen=ADDR        Accept monitors on host:port or unix:/path (repeatable)\n");
+    printf("  --output=PATH        Combined log file (default: %s)\n", AGGREGATE_LOG_FILE);
+    printf("  --reorder-ms=MS      Timestamp reorder window (default: 2000)\n");
+    printf("  --dedup-ms=MS        Window for dropping duplicate events (default: 1000)\n");
     printf("\nModes:\n");
     printf("  basic     - Simple file monitoring\n");
     printf("  advanced  - Monitoring with checksums and log compression\n");
     printf("  enhanced  - Monitoring with dynamic scaling (no watch limits)\n");
+    printf("  aggregate - Merge replicated streams from many monitors into one log\n");
+    printf("  metrics   - Count events per directory, type and extension without logging each one\n");
     printf("\nSignals:\n");
     printf("  SIGUSR1      - Show real-time statistics\n");
     printf("  SIGINT/TERM  - Graceful shutdown\n");
@@ -947,6 +10154,8 @@ int main(int argc, char **argv) {
     setlocale(LC_ALL, "en_US.UTF-8");
     
     char *watch_path = NULL;
+    unsigned long bench_iterations = 0;
+    long compact_once_hours = -1;
     
     // Parse arguments
     for (int i = 1; i < argc; i++) {
@@ -964,17 +10173,90 @@ int main(int argc, char **argv) {
                 mode = MODE_ADVANCED;
             } else if (strcmp(mode_str, "enhanced") == 0) {
                 mode = MODE_ENHANCED;
+            } else if (strcmp(mode_str, "metrics") == 0) {
+                mode = MODE_METRICS;
+            } else if (strcmp(mode_str, "aggregate") == 0) {
+                mode = MODE_AGGREGATE;
             } else {
                 fprintf(stderr, "Error: Invalid mode '%s'\n", mode_str);
                 print_usage(argv[0]);
                 exit(1);
             }
+        } else if (strncmp(argv[i], "--bench=", 8) == 0) {
+            bench_iterations = strtoul(argv[i] + 8, NULL, 10);
+            bench_mode = bench_iterations > 0;
+        } else if (strncmp(argv[i], "--filter=", 9) == 0) {
+            filter_cli = argv[i] + 9;
+        } else if (strcmp(argv[i], "--compact") == 0) {
+            compact_once_hours = 0;
+        } else if (strncmp(argv[i], "--compact=", 10) == 0) {
+            compact_once_hours = atol(argv[i] + 10);
+            if (compact_once_hours < 0) compact_once_hours = 0;
+        } else if (strcmp(argv[i], "--query") == 0 || strncmp(argv[i], "--query=", 8) == 0) {
+            query_requested = 1;
+            const char *text = argv[i][7] == '=' ? argv[i] + 8 : "";
+            size_t len = strlen(text);
+            if (len >= sizeof(query_pattern)) len = sizeof(query_pattern) - 1;
+            for (size_t k = 0; k < len; k++) {
+                query_pattern[k] = query_fold((unsigned char)text[k]);
+            }
+            query_pattern[len] = '\0';
+            query_pattern_len = len;
+        } else if (strncmp(argv[i], "--since=", 8) == 0) {
+            if (query_parse_time(argv[i] + 8, query_since, sizeof(query_since), &query_since_time) != 0) {
+                fprintf(stderr, "Error: Invalid time '%s'\n", argv[i] + 8);
+                exit(1);
+            }
+        } else if (strncmp(argv[i], "--until=", 8) == 0) {
+            if (query_parse_time(argv[i] + 8, query_until, sizeof(query_until), NULL) != 0) {
+                fprintf(stderr, "Error: Invalid time '%s'\n", argv[i] + 8);
+                exit(1);
+            }
+        } else if (strncmp(argv[i], "--type=", 7) == 0) {
+            char types[256];
+            strncpy(types, argv[i] + 7, sizeof(types) - 1);
+            types[sizeof(types) - 1] = '\0';
+            char *saveptr;
+            for (char *t = strtok_r(types, ",", &saveptr); t && query_type_count < QUERY_MAX_TYPES;
+                 t = strtok_r(NULL, ",", &saveptr)) {
+                strncpy(query_types[query_type_count++], t, sizeof(query_types[0]) - 1);
+            }
+        } else if (strncmp(argv[i], "--limit=", 8) == 0) {
+            query_limit = atol(argv[i] + 8);
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            query_threads = atoi(argv[i] + 10);
+        } else if (strncmp(argv[i], "--listen=", 9) == 0) {
+            if (aggregate_listen_count >= AGGREGATE_MAX_LISTENERS) {
+                fprintf(stderr, "Error: Too many --listen addresses\n");
+                exit(1);
+            }
+            strncpy(aggregate_listen[aggregate_listen_count++], argv[i] + 9,
+                    sizeof(aggregate_listen[0]) - 1);
+        } else if (strncmp(argv[i], "--output=", 9) == 0) {
+            strncpy(aggregate_output_path, argv[i] + 9, MAX_PATH_LEN - 1);
+        } else if (strncmp(argv[i], "--reorder-ms=", 13) == 0) {
+            aggregate_reorder_ms = strtol(argv[i] + 13, NULL, 10);
+            if (aggregate_reorder_ms < 0) aggregate_reorder_ms = 0;
+        } else if (strncmp(argv[i], "--dedup-ms=", 11) == 0) {
+            aggregate_dedup_ms = strtol(argv[i] + 11, NULL, 10);
+            if (aggregate_dedup_ms < 0) aggregate_dedup_ms = 0;
         } else if (argv[i][0] != '-') {
             watch_path = argv[i];
         }
     }
     
-    if (!watch_path) {
+    // Queries only read the log segments; nothing is started or written
+    if (query_requested) {
+        exit(run_query());
+    }
+    
+    if (mode == MODE_AGGREGATE && (aggregate_listen_count == 0 || bench_mode)) {
+        fprintf(stderr, "Error: Aggregate mode needs at least one --listen address\n");
+        print_usage(argv[0]);
+        exit(1);
+    }
+    
+    if (!watch_path && mode != MODE_AGGREGATE && compact_once_hours < 0) {
         fprintf(stderr, "Error: No directory path specified\n");
         print_usage(argv[0]);
         exit(1);
@@ -984,21 +10266,31 @@ int main(int argc, char **argv) {
     stats.start_time = time(NULL);
     strcpy(stats.most_active_path, "none");
     
-    // Signal handlers
-    signal(SIGINT, signal_handler);
-    signal(SIGTERM, signal_handler);
-    signal(SIGUSR1, signal_handler);
+    // Signal handlers (no SA_RESTART, so a blocked read() returns EINTR)
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = signal_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
     
-    // Open log file
-    log_file = fopen(LOG_FILE, "a");
-    if (!log_file) {
-        fprintf(stderr, "[ERROR] Cannot open log file: %s\n", LOG_FILE);
+    // Open log file (benchmarks discard their output)
+    const char *log_path = bench_mode ? "/dev/null" : LOG_FILE;
+    log_fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (log_fd == -1) {
+        fprintf(stderr, "[ERROR] Cannot open log file: %s\n", log_path);
         exit(1);
     }
+    struct stat log_stat;
+    if (fstat(log_fd, &log_stat) == 0) {
+        log_size = log_stat.st_size;
+    }
     
     char start_msg[512];
     snprintf(start_msg, sizeof(start_msg), "[START] File Monitor starting in %s mode...",
-            mode == MODE_BASIC ? "basic" : mode == MODE_ADVANCED ? "advanced" : "enhanced");
+            mode_name());
     log_event(start_msg);
     
     // Load configuration
@@ -1006,9 +10298,87 @@ int main(int argc, char **argv) {
         log_event("[ERROR] Failed to load configuration");
         cleanup_and_exit(1);
     }
+    if (filter_compile() != 0 || sample_compile() != 0) {
+        cleanup_and_exit(1);
+    }
+    
+    // Offline compaction: one pass over the rotated segments, then exit
+    if (compact_once_hours >= 0) {
+        int compacted = compact_pass(compact_once_hours);
+        printf("[COMPACT] %d segment(s) compacted\n", compacted);
+        // Not a monitor run: leave the stats files of a live monitor alone
+        log_flush();
+        close(log_fd);
+        exit(0);
+    }
+    
+    // Time-series history of stats samples for dashboards
+    if (stats_history_enabled && !bench_mode && stats_history_init() != 0) {
+        log_event("[WARN] Cannot open stats history file; history disabled");
+    }
+    if (stats_page_enabled && !bench_mode && stats_page_init() != 0) {
+        log_event("[WARN] Cannot publish the shared-memory stats page (in use or unavailable)");
+    }
+    
+    // The aggregator has no watches; it only serves replication streams
+    if (mode == MODE_AGGREGATE) {
+        if (pthread_create(&stats_thread, NULL, stats_thread_func, NULL) != 0) {
+            log_event("[WARN] Failed to create statistics thread");
+        }
+        int result = run_aggregator();
+        save_stats();
+        cleanup_and_exit(result);
+    }
+    
+    // Persistent event sequence numbers and the IPC socket for consumers
+    if (!bench_mode) {
+        if (seq_init() != 0) {
+            log_event("[WARN] Cannot open sequence state file; numbering restarts from the log");
+        }
+        ipc_init();
+    }
+    if ((file_tree_enabled || disk_usage || enrich_enabled) && tree_init(event_seq + 1) != 0) {
+        log_event("[WARN] Failed to allocate the file tree; since-queries disabled");
+        file_tree_enabled = 0;
+    }
+    if (enrich_enabled && enrich_init() != 0) {
+        log_event("[WARN] Failed to allocate the metadata cache; events are not enriched");
+        enrich_enabled = 0;
+    }
+    if (journal_requested && !bench_mode) {
+        if (journal_init() != 0) {
+            cleanup_and_exit(1);
+        }
+    }
+    if (compact_age_hours > 0 && !bench_mode) {
+        if (pthread_create(&compact_thread, NULL, compact_thread_func, NULL) == 0) {
+            pthread_detach(compact_thread);
+        } else {
+            log_event("[WARN] Failed to create log compaction thread");
+        }
+    }
+    
+    // Optional log shipping to a local collector socket
+    if (collector_socket_path[0] && !bench_mode) {
+        if (collector_init() != 0) {
+            cleanup_and_exit(1);
+        }
+    }
+    
+    // Optional event replication to a remote aggregator
+    if (replica_target[0] && !bench_mode) {
+        if (replica_init() != 0) {
+            cleanup_and_exit(1);
+        }
+    }
+    
+    // Events on our own output files are dropped before they are handled
+    if (!bench_mode) {
+        self_outputs_init();
+    }
     
     // Initialize mode-specific structures
-    if (mode == MODE_ENHANCED) {
+    if (uses_watch_manager()) {
         if (init_watch_manager() != 0) {
             log_event("[ERROR] Failed to initialize watch manager");
             cleanup_and_exit(1);
@@ -1022,14 +10392,16 @@ int main(int argc, char **argv) {
         cleanup_and_exit(1);
     }
     
+    strncpy(monitor_root, watch_path, sizeof(monitor_root) - 1);
+    
     // Start statistics thread
-    if (pthread_create(&stats_thread, NULL, stats_thread_func, NULL) != 0) {
+    if (!bench_mode && pthread_create(&stats_thread, NULL, stats_thread_func, NULL) != 0) {
         log_event("[WARN] Failed to create statistics thread");
     }
     
     // Add initial watches
     int result;
-    if (mode == MODE_ENHANCED) {
+    if (uses_watch_manager()) {
         result = add_watch_recursive_enhanced(watch_path);
     } else {
         result = add_watch_recursive_basic(watch_path);
@@ -1038,11 +10410,21 @@ int main(int argc, char **argv) {
     if (result == -1) {
         cleanup_and_exit(1);
     }
+    usage_seeded = 1;
+    
+    // Directories created or moved in from now on are handled by the worker
+    if ((recursive_mode || disk_usage) && !bench_mode && crawl_start(watch_path) != 0) {
+        log_event("[WARN] Failed to create crawl thread; new directories will not be watched");
+    }
+    
+    if (bench_mode) {
+        cleanup_and_exit(run_benchmark(bench_iterations));
+    }
     
     snprintf(start_msg, sizeof(start_msg),
             "[START] Monitoring started: %s (mode: %s, recursive: %s)",
             watch_path,
-            mode == MODE_BASIC ? "basic" : mode == MODE_ADVANCED ? "advanced" : "enhanced",
+            mode_name(),
             recursive_mode ? "yes" : "no");
     log_event(start_msg);
     
@@ -1061,40 +10443,7 @@ int main(int argc, char **argv) {
         
         if (length == 0) continue;
         
-        int offset = 0;
-        while (offset < length) {
-            struct inotify_event *event = (struct inotify_event *)(buffer + offset);
-            
-            if (mode == MODE_ENHANCED) {
-                handle_event_enhanced(event);
-            } else if (mode == MODE_ADVANCED) {
-                // Find watch path for advanced mode
-                const char *path = NULL;
-                for (int i = 0; i < watch_count; i++) {
-                    if (watch_descriptors[i] == event->wd) {
-                        path = watch_paths[i];
-                        break;
-                    }
-                }
-                if (path) {
-                    handle_event_advanced(event, path);
-                }
-            } else {
-                // Basic mode
-                const char *path = NULL;
-                for (int i = 0; i < watch_count; i++) {
-                    if (watch_descriptors[i] == event->wd) {
-                        path = watch_paths[i];
-                        break;
-                    }
-                }
-                if (path) {
-                    handle_event_basic(event, path);
-                }
-            }
-            
-            offset += EVENT_SIZE + event->len;
-        }
+        process_events(buffer, length);
     }
     
     cleanup_and_exit(0);
@@ -0,0 +1,217 @@
+#!/usr/bin/env python3
+"""
+Readers for the monitor's binary stats files.
+The files are memory-mapped read-only, so reading them costs the monitor nothing.
+"""
+
+import json
+import mmap
+import os
+import struct
+import time
+
+STATS_HISTORY_FILE = "monitor_stats.ring"
+STATS_PAGE_FILE = "/dev/shm/file_monitor.stats"
+STATS_JSON_FILE = "monitor_stats.json"
+
+# monitor.c: stats_history_header_t / stats_sample_t (little-endian)
+STATS_HISTORY_MAGIC = 0x53544d46  # "FMTS"
+_HISTORY_HEADER = struct.Struct('<IHHIIQq32x')
+_HISTORY_SAMPLE = struct.Struct('<qQQIIffIIIIIfII')
+SAMPLE_FIELDS = (
+    'timestamp', 'total_events', 'bytes_logged', 'events', 'batches',
+    'events_per_sec', 'bytes_per_sec', 'latency_p50_ns', 'latency_p90_ns',
+    'latency_p99_ns', 'latency_max_ns', 'rss_kb', 'cpu_percent',
+    'active_watches', 'reserved'
+)
+
+# monitor.c: stats_page_t
+STATS_PAGE_MAGIC = 0x50534d46  # "FMSP"
+STATS_PAGE_STALE_SECONDS = 5
+_PAGE = struct.Struct('<IHHIiI12sqqQQQQddQQQQQQQQQQ256s')
+PAGE_FIELDS = (
+    'magic', 'version', 'size', 'seq', 'pid', 'running', 'mode',
+    'start_time', 'updated', 'total_events', 'last_seq', 'bytes_logged',
+    'memory_usage_kb', 'cpu_usage_percent', 'events_per_second',
+    'active_watches', 'watch_capacity', 'watch_limit_hits',
+    'memory_reallocations', 'max_events_per_path', 'subscribers',
+    'journal_records', 'collector_frames_sent', 'replica_batches_acked',
+    'aggregate_records_written', 'most_active_path'
+)
+
+SPARK_CHARS = "▁▂▃▄▅▆▇█"
+
+
+class StatsPage:
+    """공유 메모리 통계 페이지 읽기 (seqlock, 시스템 콜 없음)"""
+    
+    def __init__(self, path: str = STATS_PAGE_FILE):
+        self.path = path
+        with open(path, 'rb') as f:
+            self._map = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        if len(self._map) < _PAGE.size or struct.unpack_from('<I', self._map, 0)[0] != STATS_PAGE_MAGIC:
+            self.close()
+            raise ValueError(f"{path}: not a stats page")
+    
+    def snapshot(self, retries: int = 1000) -> dict:
+        """일관된 스냅샷 (쓰는 중이면 다시 읽기)"""
+        for _ in range(retries):
+            before = struct.unpack_from('<I', self._map, 8)[0]
+            if before & 1:
+                continue
+            data = self._map[:_PAGE.size]
+            if struct.unpack_from('<I', self._map, 8)[0] == before:
+                values = dict(zip(PAGE_FIELDS, _PAGE.unpack(data)))
+                values['mode'] = values['mode'].split(b'\0', 1)[0].decode(errors='replace')
+                values['most_active_path'] = values['most_active_path'].split(b'\0', 1)[0].decode(errors='replace') or 'none'
+                values['uptime_seconds'] = max(0, values['updated'] - values['start_time'])
+                return values
+        return None
+    
+    def close(self):
+        if getattr(self, '_map', None) is not None:
+            self._map.close()
+            self._map = None
+    
+    def __enter__(self):
+        return self
+    
+    def __exit__(self, *exc):
+        self.close()
+
+
+_open_pages = {}
+
+
+def read_stats_page(path: str = STATS_PAGE_FILE):
+    """실행 중인 monitor의 스냅샷, 없거나 종료된 경우 None
+    
+    매핑은 재사용되므로 반복 호출(대시보드 갱신)은 시스템 콜 없이 끝난다.
+    """
+    page = _open_pages.get(path)
+    values = page.snapshot() if page else None
+    if not values or not values['running']:
+        # 새로 시작한 monitor가 파일을 다시 만들었을 수 있으므로 다시 연결
+        if page:
+            page.close()
+            _open_pages.pop(path, None)
+        try:
+            page = StatsPage(path)
+        except (OSError, ValueError):
+            return None
+        _open_pages[path] = page
+        values = page.snapshot()
+    if not values or not values['running']:
+        return None
+    # 매초 갱신되므로 오래된 페이지는 비정상 종료된 monitor의 것
+    if time.time() - values['updated'] > STATS_PAGE_STALE_SECONDS:
+        return None
+    return values
+
+
+def load_monitor_stats(page_path: str = STATS_PAGE_FILE, json_path: str = STATS_JSON_FILE):
+    """통계 페이지 우선, 없으면 monitor_stats.json (이전 버전 호환)"""
+    values = read_stats_page(page_path)
+    if values is not None:
+        return values
+    if os.path.exists(json_path):
+        try:
+            with open(json_path, 'r') as f:
+                return json.load(f)
+        except (OSError, ValueError):
+            return None
+    return None
+
+
+class StatsHistory:
+    """monitor_stats.ring 시계열 읽기 (mmap)"""
+    
+    def __init__(self, path: str = STATS_HISTORY_FILE):
+        self.path = path
+        self._file = open(path, 'rb')
+        try:
+            self._map = mmap.mmap(self._file.fileno(), 0, access=mmap.ACCESS_READ)
+        except ValueError:
+            self._file.close()
+            raise
+        magic, version, slot_size, interval, slot_count, _, created = \
+            _HISTORY_HEADER.unpack_from(self._map, 0)
+        if magic != STATS_HISTORY_MAGIC or slot_size != _HISTORY_SAMPLE.size:
+            self.close()
+            raise ValueError(f"{path}: not a stats history file")
+        self.interval = interval
+        self.slot_count = slot_count
+        self.created = created
+    
+    def _write_index(self) -> int:
+        return struct.unpack_from('<Q', self._map, 16)[0]
+    
+    def samples(self, seconds: int = None) -> list:
+        """최근 샘플 목록 (오래된 것부터), seconds 지정 시 해당 구간만"""
+        count = self.slot_count if seconds is None else max(1, seconds // self.interval)
+        before = self._write_index()
+        count = min(count, before, self.slot_count - 1)
+        
+        raw = []
+        for i in range(before - count, before):
+            offset = _HISTORY_HEADER.size + (i % self.slot_count) * _HISTORY_SAMPLE.size
+            raw.append(_HISTORY_SAMPLE.unpack_from(self._map, offset))
+        
+        # 읽는 동안 덮어써졌을 수 있는 가장 오래된 슬롯 제외
+        advanced = self._write_index() - before
+        if advanced and len(raw) + advanced >= self.slot_count:
+            raw = raw[advanced:]
+        return [dict(zip(SAMPLE_FIELDS, values)) for values in raw]
+    
+    def latest(self) -> dict:
+        recent = self.samples(self.interval)
+        return recent[-1] if recent else None
+    
+    def close(self):
+        if getattr(self, '_map', None) is not None:
+            self._map.close()
+            self._map = None
+        self._file.close()
+    
+    def __enter__(self):
+        return self
+    
+    def __exit__(self, *exc):
+        self.close()
+
+
+def open_history(path: str = STATS_HISTORY_FILE):
+    """history 파일이 없거나 손상된 경우 None"""
+    if not os.path.exists(path):
+        return None
+    try:
+        return StatsHistory(path)
+    except (OSError, ValueError):
+        return None
+
+
+def sparkline(values: list, width: int = 60) -> str:
+    """값 목록을 width 칸의 막대 문자열로 변환 (칸마다 평균)"""
+    if not values:
+        return ""
+    if len(values) > width:
+        step = len(values) / width
+        values = [
+            sum(values[int(i * step):max(int(i * step) + 1, int((i + 1) * step))]) /
+            max(1, int((i + 1) * step) - int(i * step))
+            for i in range(width)
+        ]
+    top = max(values)
+    if top <= 0:
+        return SPARK_CHARS[0] * len(values)
+    return "".join(SPARK_CHARS[min(len(SPARK_CHARS) - 1, int(v / top * (len(SPARK_CHARS) - 1) + 0.5))]
+                   for v in values)
+
+
+def format_age(timestamp: int) -> str:
+    seconds = int(time.time() - timestamp)
+    if seconds < 120:
+        return f"{seconds}s ago"
+    if seconds < 7200:
+        return f"{seconds // 60}m ago"
+    return f"{seconds // 3600}h ago"
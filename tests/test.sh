@@ -57,6 +57,35 @@ print_section() {
     echo ""
 }
 
+# 빌드된 모니터 바이너리와 임시 작업 디렉터리 준비 (호출한 함수의 지역 변수에 설정)
+setup_monitor_test() {
+    root_dir="$(cd "$(dirname "${BASH_SOURCE[0]}")/.." && pwd)"
+    monitor_bin="$root_dir/build/monitor"
+    if [ ! -x "$monitor_bin" ]; then
+        print_fail "Monitor binary not built: $monitor_bin"
+        return 1
+    fi
+    work_dir="$(mktemp -d)"
+}
+
+# IPC 소켓에 명령 하나를 보내고 응답 JSON을 한 줄로 출력
+# (fmon.py의 MonitorIPC.send_command와 같이 연결이 닫힐 때까지 읽음)
+ipc_request() {
+    python3 - "$1" "$2" "$3" <<'PYEOF'
+import json, socket, sys
+s = socket.socket(socket.AF_UNIX)
+s.connect(sys.argv[1])
+s.sendall(json.dumps({"command": sys.argv[2], "data": json.loads(sys.argv[3])}).encode())
+chunks = []
+while True:
+    chunk = s.recv(65536)
+    if not chunk:
+        break
+    chunks.append(chunk)
+print(json.dumps(json.loads(b"".join(chunks))))
+PYEOF
+}
+
 # 테스트 정리 함수
 cleanup() {
     print_info "Cleaning up test environment..."
@@ -110,6 +139,75 @@ main() {
     print_section "10. PERFORMANCE TEST"
     test_performance
     
+    print_section "11. EVENT REPLICATION"
+    test_replication
+    
+    print_section "12. EVENT AGGREGATION"
+    test_aggregation
+    
+    print_section "13. EVENT SEQUENCE AND REPLAY"
+    test_event_sequence
+    
+    print_section "14. SINCE-CLOCK QUERIES"
+    test_since_query
+    
+    print_section "15. CHANGE JOURNAL"
+    test_change_journal
+    
+    print_section "16. LOG COMPACTION"
+    test_log_compaction
+    
+    print_section "17. LOG QUERY"
+    test_log_query
+    
+    print_section "18. SEEKABLE SEGMENTS"
+    test_seekable_segments
+    
+    print_section "19. STATS HISTORY"
+    test_stats_history
+    
+    print_section "20. STATS PAGE"
+    test_stats_page
+    
+    print_section "21. FILE IDENTITY"
+    test_file_identity
+    
+    print_section "22. SELF-EVENT SUPPRESSION"
+    test_self_events
+    
+    print_section "23. CRAWL WORKER"
+    test_crawl_worker
+    
+    print_section "24. SUBTREE POLICIES"
+    test_subtree_policies
+    
+    print_section "25. EVENT FILTER"
+    test_event_filter
+    
+    print_section "26. PATH INDEX"
+    test_path_index
+    
+    print_section "27. EVENT TIMES"
+    test_event_times
+    
+    print_section "28. THREAD CPU"
+    test_thread_cpu
+    
+    print_section "29. METRICS MODE"
+    test_metrics_mode
+    
+    print_section "30. SAMPLED LOGGING"
+    test_sampled_logging
+    
+    print_section "31. DIRECTORY USAGE"
+    test_directory_usage
+    
+    print_section "32. EVENT ENRICHMENT"
+    test_event_enrichment
+    
+    print_section "33. LOG SHIPPING"
+    test_log_shipping
+    
     # 최종 결과 출력
     print_final_results
 }
@@ -481,6 +579,1647 @@ test_performance() {
     fi
 }
 
+# 11. 이벤트 복제 테스트 (loopback 수신기)
+test_replication() {
+    print_test "Testing event replication over loopback"
+    
+    local root_dir monitor_bin work_dir
+    setup_monitor_test || return
+    local port=$((40000 + RANDOM % 20000))
+    mkdir -p "$work_dir/watched"
+    printf 'replicate_to=127.0.0.1:%s\nreplicate_flush_ms=100\n' "$port" > "$work_dir/monitor.conf"
+    
+    # 최소 수신기: hello 응답, 배치 CRC/압축 해제 확인, 경로 기록 후 ack
+    # (집계기처럼 이미 받은 번호 이하의 배치는 버림)
+    cat > "$work_dir/listener.py" <<'PYEOF'
+import os, socket, struct, sys, zlib
+port, out, state = int(sys.argv[1]), sys.argv[2], sys.argv[3]
+last = int(open(state).read()) if os.path.exists(state) else 0
+srv = socket.socket()
+srv.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+srv.bind(("127.0.0.1", port)); srv.listen(1); srv.settimeout(10)
+conn, _ = srv.accept(); f = conn.makefile("rb")
+def rd(n):
+    b = f.read(n)
+    if len(b) < n: raise EOFError
+    return b
+rd(72)
+conn.sendall(struct.pack("<IIQ", 0x41524d46, 0, last))
+try:
+    with open(out, "a") as o:
+        while True:
+            magic, ver, flags, seq, count, raw, plen, crc = struct.unpack("<IHHQIIII", rd(32))
+            payload = rd(plen)
+            if magic != 0x42524d46 or zlib.crc32(payload) != crc: sys.exit(1)
+            if flags & 1: payload = zlib.decompress(payload)
+            pos = len(payload) if seq <= last else 0
+            last = max(last, seq)
+            while pos < len(payload):
+                ts, mask, n, _ = struct.unpack("<QIHH", payload[pos:pos + 16])
+                o.write(payload[pos + 16:pos + 16 + n].decode() + "\n"); pos += 16 + n
+            o.flush(); open(state, "w").write(str(last))
+            conn.sendall(struct.pack("<IIQ", 0x41524d46, 0, last))
+except EOFError:
+    pass
+PYEOF
+    
+    (
+        cd "$work_dir" || exit 1
+        timeout 2 python3 listener.py "$port" received.txt last_seq.txt &
+        sleep 0.3
+        "$monitor_bin" watched >/dev/null 2>&1 &
+        local monitor_pid=$!
+        sleep 0.5
+        touch watched/first.txt
+        sleep 1.8
+        # 수신기가 내려간 동안의 이벤트는 스풀에 남았다가 재연결 후 재전송
+        touch watched/second.txt
+        sleep 0.5
+        timeout 3 python3 listener.py "$port" received.txt last_seq.txt &
+        sleep 2
+        kill "$monitor_pid" 2>/dev/null
+        wait 2>/dev/null
+    )
+    
+    if grep -q "watched/first.txt" "$work_dir/received.txt" 2>/dev/null; then
+        print_pass "Events replicated to loopback listener"
+    else
+        print_fail "Events were not replicated"
+    fi
+    
+    print_test "Spooled events replayed after reconnect"
+    if grep -q "watched/second.txt" "$work_dir/received.txt" 2>/dev/null; then
+        print_pass "Spooled events replayed after reconnect"
+    else
+        print_fail "Spooled events were not replayed after reconnect"
+    fi
+    
+    # 스풀과 상태 파일을 잃으면 번호가 1부터 다시 시작하므로, 수신기가 이미 가진
+    # 번호 위로 다시 매겨야 새 이벤트가 버려지지 않음
+    (
+        cd "$work_dir" || exit 1
+        rm -f monitor_replica.spool monitor_replica.spool.state
+        echo 5000 > last_seq.txt
+        timeout 3 python3 listener.py "$port" received.txt last_seq.txt &
+        sleep 0.3
+        "$monitor_bin" watched >/dev/null 2>&1 &
+        local monitor_pid=$!
+        sleep 0.5
+        touch watched/third.txt
+        sleep 1.5
+        kill "$monitor_pid" 2>/dev/null
+        wait 2>/dev/null
+    )
+    
+    print_test "Lost replication state renumbers batches above the aggregator"
+    if grep -q "watched/third.txt" "$work_dir/received.txt" 2>/dev/null &&
+       [ "$(cat "$work_dir/last_seq.txt" 2>/dev/null)" -gt 5000 ] 2>/dev/null &&
+       grep -q "replication state was lost" "$work_dir/monitor.log" 2>/dev/null; then
+        print_pass "Lost replication state renumbers batches above the aggregator"
+    else
+        print_fail "After state loss: last_seq=$(cat "$work_dir/last_seq.txt" 2>/dev/null), third.txt $(grep -c third.txt "$work_dir/received.txt" 2>/dev/null)"
+    fi
+    
+    rm -rf "$work_dir"
+}
+
+# 12. 집계 모드 테스트 (겹치는 감시 범위를 가진 모니터 두 개)
+test_aggregation() {
+    print_test "Testing aggregate mode with two local monitors"
+    
+    local root_dir monitor_bin work_dir
+    setup_monitor_test || return
+    mkdir -p "$work_dir/agg" "$work_dir/outer" "$work_dir/inner" "$work_dir/data/sub" \
+        "$work_dir/twin1" "$work_dir/twin2" "$work_dir/other"
+    for instance in outer inner; do
+        printf 'replicate_to=unix:%s/agg.sock\nreplicate_flush_ms=100\n' "$work_dir" \
+            > "$work_dir/$instance/monitor.conf"
+    done
+    # 같은 source 이름을 쓰는 두 모니터 (두 번째 연결은 거부되어야 함)
+    for instance in twin1 twin2; do
+        printf 'replicate_to=unix:%s/agg.sock\nreplicate_flush_ms=100\nreplicate_source=twin/1\n' "$work_dir" \
+            > "$work_dir/$instance/monitor.conf"
+    done
+    
+    (
+        cd "$work_dir/agg" || exit 1
+        "$monitor_bin" --mode=aggregate --listen="unix:$work_dir/agg.sock" \
+            --reorder-ms=300 >/dev/null 2>&1 &
+        local aggregator_pid=$!
+        sleep 0.5
+        # outer는 data 전체, inner는 data/sub만 감시 (sub 이벤트는 양쪽에서 보고됨)
+        (cd "$work_dir/outer" && exec "$monitor_bin" "$work_dir/data" >/dev/null 2>&1) &
+        local outer_pid=$!
+        (cd "$work_dir/inner" && exec "$monitor_bin" "$work_dir/data/sub" >/dev/null 2>&1) &
+        local inner_pid=$!
+        (cd "$work_dir/twin1" && exec "$monitor_bin" "$work_dir/other" >/dev/null 2>&1) &
+        local twin1_pid=$!
+        sleep 0.3
+        (cd "$work_dir/twin2" && exec "$monitor_bin" "$work_dir/other" >/dev/null 2>&1) &
+        local twin2_pid=$!
+        sleep 0.8
+        touch "$work_dir/data/top.txt" "$work_dir/data/sub/shared.txt"
+        sleep 1.5
+        kill "$outer_pid" "$inner_pid" "$twin1_pid" "$twin2_pid" 2>/dev/null
+        sleep 0.5
+        kill "$aggregator_pid" 2>/dev/null
+        wait 2>/dev/null
+    )
+    
+    local output="$work_dir/agg/aggregate.log"
+    if grep -q "Created: $work_dir/data/top.txt" "$output" 2>/dev/null &&
+       grep -q "Created: $work_dir/data/sub/shared.txt" "$output" 2>/dev/null; then
+        print_pass "Streams from both monitors merged into one log"
+    else
+        print_fail "Aggregated log is missing events"
+    fi
+    
+    print_test "Overlapping coverage de-duplicated"
+    if [ "$(grep -c "Created: $work_dir/data/sub/shared.txt" "$output" 2>/dev/null)" = "1" ]; then
+        print_pass "Overlapping coverage de-duplicated"
+    else
+        print_fail "Duplicate events from overlapping watches"
+    fi
+    
+    print_test "Per-source positions persisted"
+    if [ "$(wc -l < "$work_dir/agg/aggregate.log.sources" 2>/dev/null)" = "3" ]; then
+        print_pass "Per-source positions persisted"
+    else
+        print_fail "Source positions were not persisted"
+    fi
+    
+    print_test "Second live connection for the same source rejected"
+    if grep -q "Rejected source 'twin/1': already connected" "$work_dir/agg/monitor.log" 2>/dev/null &&
+       [ "$(grep -c "Source connected: twin/1" "$work_dir/agg/monitor.log")" = "1" ]; then
+        print_pass "Second live connection for the same source rejected"
+    else
+        print_fail "Duplicate source connections: $(grep -c "twin/1" "$work_dir/agg/monitor.log" 2>/dev/null)"
+    fi
+    
+    rm -rf "$work_dir"
+}
+
+# 13. 이벤트 시퀀스 번호와 구독 재생 테스트
+test_event_sequence() {
+    print_test "Testing sequence numbers and subscribe-from-sequence replay"
+    
+    local root_dir monitor_bin work_dir
+    setup_monitor_test || return
+    mkdir -p "$work_dir/watched"
+    printf 'ipc_socket=%s/ipc.sock\n' "$work_dir" > "$work_dir/monitor.conf"
+    
+    # from_seq 부터 받은 시퀀스 번호가 빈틈 없이 이어지는지 확인
+    cat > "$work_dir/subscribe.py" <<'PYEOF'
+import json, socket, sys
+s = socket.socket(socket.AF_UNIX); s.connect(sys.argv[1])
+s.sendall(json.dumps({"command": "subscribe", "data": {"from_seq": int(sys.argv[2])}}).encode())
+s.settimeout(0.5); data = b""
+try:
+    while True:
+        chunk = s.recv(65536)
+        if not chunk: break
+        data += chunk
+except socket.timeout:
+    pass
+seqs = [int(l.split()[2][1:]) for l in data.decode().splitlines()[1:]]
+ok = seqs and seqs == list(range(int(sys.argv[2]), int(sys.argv[2]) + len(seqs)))
+print(seqs[-1] if ok else "gap")
+PYEOF
+    
+    local first_last second_last
+    (
+        cd "$work_dir" || exit 1
+        "$monitor_bin" watched >/dev/null 2>&1 &
+        local pid=$!
+        sleep 0.5
+        touch watched/a.txt watched/b.txt
+        sleep 0.3
+        python3 subscribe.py "$work_dir/ipc.sock" 1 > first.txt
+        kill "$pid"; wait "$pid" 2>/dev/null
+        
+        "$monitor_bin" watched >/dev/null 2>&1 &
+        pid=$!
+        sleep 0.5
+        touch watched/c.txt
+        sleep 0.3
+        python3 subscribe.py "$work_dir/ipc.sock" 3 > second.txt
+        kill "$pid"; wait "$pid" 2>/dev/null
+    )
+    first_last="$(cat "$work_dir/first.txt" 2>/dev/null)"
+    second_last="$(cat "$work_dir/second.txt" 2>/dev/null)"
+    
+    if [[ "$first_last" =~ ^[0-9]+$ ]]; then
+        print_pass "Replay from sequence 1 is gap-free (last #$first_last)"
+    else
+        print_fail "Replay from sequence 1 failed: $first_last"
+    fi
+    
+    print_test "Sequence numbers continue across restart"
+    if [[ "$second_last" =~ ^[0-9]+$ ]] && [ "$second_last" -gt "${first_last:-0}" ] 2>/dev/null; then
+        print_pass "Sequence numbers continue across restart"
+    else
+        print_fail "Sequence numbers did not continue across restart"
+    fi
+    
+    rm -rf "$work_dir"
+}
+
+# 14. since-clock 질의 테스트
+test_since_query() {
+    print_test "Testing since-clock queries over the in-memory file tree"
+    
+    local root_dir monitor_bin work_dir
+    setup_monitor_test || return
+    mkdir -p "$work_dir/watched/src" "$work_dir/watched/docs"
+    printf 'ipc_socket=%s/ipc.sock\nfile_tree=true\nfile_tree_tombstone_sec=1\n' "$work_dir" > "$work_dir/monitor.conf"
+    
+    local first second pruned
+    (
+        cd "$work_dir" || exit 1
+        "$monitor_bin" watched >/dev/null 2>&1 &
+        local pid=$!
+        sleep 0.5
+        touch watched/src/a.c watched/src/b.h watched/docs/x.c
+        sleep 0.3
+        ipc_request "$work_dir/ipc.sock" query \
+            '{"since": 0, "root": "watched/src", "glob": "*.c", "type": "f"}' > first.json
+        local clock
+        clock="$(python3 -c 'import json, sys; print(json.load(open(sys.argv[1]))["clock"])' first.json)"
+        touch watched/src/c.c
+        sleep 0.3
+        ipc_request "$work_dir/ipc.sock" query \
+            "{\"since\": $clock, \"root\": \"watched\", \"glob\": \"*.c\"}" > second.json
+        
+        # 임시 파일 5000개를 만들고 지운 뒤 묘비가 정리되는지 확인
+        mkdir watched/tmp
+        (cd watched/tmp && seq 1 5000 | xargs touch && seq 1 5000 | xargs rm -f)
+        sleep 3.5
+        ipc_request "$work_dir/ipc.sock" query '{"since": 0, "root": "watched/tmp"}' > pruned.json
+        kill "$pid"; wait "$pid" 2>/dev/null
+    )
+    # 변경된 이름 목록만 비교 (묘비 정리 후에는 목록과 is_fresh_instance)
+    first="$(python3 -c 'import json, sys; print(",".join(sorted(f["name"] for f in json.load(open(sys.argv[1]))["files"])))' \
+        "$work_dir/first.json" 2>/dev/null)"
+    second="$(python3 -c 'import json, sys; print(",".join(sorted(f["name"] for f in json.load(open(sys.argv[1]))["files"])))' \
+        "$work_dir/second.json" 2>/dev/null)"
+    pruned="$(python3 -c 'import json, sys; r = json.load(open(sys.argv[1])); print(len(r["files"]), r["is_fresh_instance"])' \
+        "$work_dir/pruned.json" 2>/dev/null)"
+    
+    if [ "$first" = "a.c" ]; then
+        print_pass "Glob and type predicates applied under root"
+    else
+        print_fail "Unexpected query result: '$first'"
+    fi
+    
+    print_test "Only files changed since the clock are returned"
+    if [ "$second" = "src/c.c" ]; then
+        print_pass "Only files changed since the clock are returned"
+    else
+        print_fail "Unexpected since-clock result: '$second'"
+    fi
+    
+    print_test "Pruned tombstones turn older clocks into a fresh instance"
+    local pruned_count
+    pruned_count="$(python3 -c 'import json,sys; print(json.load(open(sys.argv[1])).get("file_tree_pruned", 0))' \
+        "$work_dir/monitor_stats.json" 2>/dev/null)"
+    if [ "$pruned" = "0 True" ] && [ "${pruned_count:-0}" -ge 5000 ]; then
+        print_pass "Pruned tombstones turn older clocks into a fresh instance"
+    else
+        print_fail "Tombstones not pruned: '$pruned', pruned=$pruned_count"
+    fi
+    
+    rm -rf "$work_dir"
+}
+
+# 15. 변경 저널 테스트 (재시작 후에도 since 질의 유지)
+test_change_journal() {
+    print_test "Testing the persistent change journal"
+    
+    local root_dir monitor_bin work_dir
+    setup_monitor_test || return
+    mkdir -p "$work_dir/watched"
+    printf 'ipc_socket=%s/ipc.sock\njournal=true\n' "$work_dir" > "$work_dir/monitor.conf"
+    
+    (
+        cd "$work_dir" || exit 1
+        "$monitor_bin" watched >/dev/null 2>&1 &
+        local pid=$!
+        sleep 0.5
+        echo one > watched/a.txt
+        echo two > watched/b.txt
+        sleep 0.3
+        mv watched/b.txt watched/c.txt
+        sleep 0.3
+        kill "$pid"; wait "$pid" 2>/dev/null
+        
+        "$monitor_bin" watched >/dev/null 2>&1 &
+        pid=$!
+        sleep 0.5
+        ipc_request "$work_dir/ipc.sock" journal '{"since": 0}' > changes.json
+        kill "$pid"; wait "$pid" 2>/dev/null
+    )
+    # "이름:inode" 목록만 비교
+    local changes
+    changes="$(python3 -c 'import json, sys; print(" ".join(c["path"].split("/")[-1] + ":" + str(c["ino"]) for c in json.load(open(sys.argv[1]))["changes"]))' \
+        "$work_dir/changes.json" 2>/dev/null)"
+    
+    if [[ "$changes" =~ a\.txt:[1-9] ]] && [[ "$changes" =~ c\.txt:[1-9] ]]; then
+        print_pass "Journal answers since-queries after restart with file ids"
+    else
+        print_fail "Unexpected journal result: '$changes'"
+    fi
+    
+    print_test "Renamed file reported once under its new path"
+    if [[ "$changes" != *b.txt* ]]; then
+        print_pass "Renamed file reported once under its new path"
+    else
+        print_fail "Superseded record for renamed file reported: '$changes'"
+    fi
+    
+    rm -rf "$work_dir"
+}
+
+# 16. 로그 압축 테스트
+test_log_compaction() {
+    print_test "Testing offline compaction of rotated segments"
+    
+    local root_dir monitor_bin work_dir
+    setup_monitor_test || return
+    cat > "$work_dir/monitor.log.1" <<'LOGEOF'
+[2026-01-01 00:00:01] #10 Opened: /w/a
+[2026-01-01 00:00:01] #11 Modified: /w/a
+[2026-01-01 00:00:01] #12 Modified: /w/a
+[2026-01-01 00:00:01] #13 Closed: /w/a
+[2026-01-01 00:00:02] #14 Created: /w/b
+[2026-01-01 00:00:02] #15 Modified: /w/a
+LOGEOF
+    (
+        cd "$work_dir" || exit 1
+        "$monitor_bin" --compact >/dev/null 2>&1
+        "$monitor_bin" --compact > second.txt 2>&1
+    )
+    
+    if [ -f "$work_dir/monitor.log.1.gz" ] && [ ! -f "$work_dir/monitor.log.1" ]; then
+        print_pass "Segment replaced by a compacted .gz"
+    else
+        print_fail "Compacted segment not written"
+        rm -rf "$work_dir"
+        return
+    fi
+    
+    local content
+    content="$(zcat "$work_dir/monitor.log.1.gz")"
+    print_test "Modify runs summarized, open/close dropped, sequence numbers kept"
+    if [[ "$content" == *"#15 Modified (x3 since #11): /w/a"* ]] && \
+       [[ "$content" == *"#14 Created: /w/b"* ]] && \
+       [[ "$content" != *Opened* ]] && [[ "$content" != *Closed* ]]; then
+        print_pass "Modify runs summarized, open/close dropped, sequence numbers kept"
+    else
+        print_fail "Unexpected compacted content: '$content'"
+    fi
+    
+    print_test "Already compacted segments are skipped"
+    if grep -q "0 segment" "$work_dir/second.txt"; then
+        print_pass "Already compacted segments are skipped"
+    else
+        print_fail "Segment compacted twice: '$(cat "$work_dir/second.txt")'"
+    fi
+    
+    print_test "Compaction marker stamped with the segment's last event time"
+    if [[ "$content" == "[2026-01-01 00:00:02] [COMPACT] "* ]]; then
+        print_pass "Compaction marker stamped with the segment's last event time"
+    else
+        print_fail "Unexpected marker: '$(head -1 <<< "$content")'"
+    fi
+    
+    rm -rf "$work_dir"
+}
+
+# 17. 로그 검색 테스트
+test_log_query() {
+    print_test "Testing the parallel log query engine"
+    
+    local root_dir monitor_bin work_dir
+    setup_monitor_test || return
+    printf '%s\n' \
+        "[2026-01-01 10:00:00] #1 Created: /w/Report.TXT" \
+        "[2026-01-01 10:00:01] #2 Modified: /w/other.txt" | gzip > "$work_dir/monitor.log.1.gz"
+    printf '%s\n' \
+        "[2026-01-02 10:00:00] #3 Modified: /w/report.txt" \
+        "[2026-01-02 10:00:01] #4 Deleted: /w/report.txt" > "$work_dir/monitor.log.0"
+    printf '%s\n' \
+        "[2026-01-03 10:00:00] #5 Modified: /w/REPORT.txt" > "$work_dir/monitor.log"
+    
+    local all typed ranged limited
+    all="$(cd "$work_dir" && "$monitor_bin" --query=report.txt 2>/dev/null | grep -o '#[0-9]*' | tr '\n' ' ')"
+    typed="$(cd "$work_dir" && "$monitor_bin" --query=report --type=modified 2>/dev/null | grep -o '#[0-9]*' | tr '\n' ' ')"
+    ranged="$(cd "$work_dir" && "$monitor_bin" --query --since=2026-01-02 --until="2026-01-02 10:00:00" 2>/dev/null | grep -o '#[0-9]*' | tr '\n' ' ')"
+    limited="$(cd "$work_dir" && "$monitor_bin" --query=report --limit=2 --threads=2 2>/dev/null | wc -l)"
+    
+    if [ "$all" = "#1 #3 #4 #5 " ]; then
+        print_pass "Case-insensitive matches from .gz and plain segments, oldest first"
+    else
+        print_fail "Unexpected query result: '$all'"
+    fi
+    
+    print_test "Event type and time range filters applied"
+    if [ "$typed" = "#3 #5 " ] && [ "$ranged" = "#3 " ]; then
+        print_pass "Event type and time range filters applied"
+    else
+        print_fail "Filters not applied: type='$typed' range='$ranged'"
+    fi
+    
+    print_test "Result limit honoured"
+    if [ "$limited" -eq 2 ]; then
+        print_pass "Result limit honoured"
+    else
+        print_fail "Expected 2 lines with --limit=2, got $limited"
+    fi
+    
+    rm -rf "$work_dir"
+}
+
+# 18. 블록 단위 압축 세그먼트 테스트
+test_seekable_segments() {
+    print_test "Testing block-indexed compressed segments"
+    
+    local root_dir monitor_bin work_dir
+    setup_monitor_test || return
+    # 하루치 이벤트 (약 5MB), 압축 전에 원본 보관
+    awk 'BEGIN { for (i = 1; i <= 86400; i++)
+        printf "[2026-02-01 %02d:%02d:%02d] #%d Created: /w/file%d\n", i/3600%24, i/60%60, i%60, i, i }' \
+        > "$work_dir/monitor.log.1"
+    cp "$work_dir/monitor.log.1" "$work_dir/original.txt"
+    printf 'compact_drop=\n' > "$work_dir/monitor.conf"
+    (cd "$work_dir" && "$monitor_bin" --compact >/dev/null 2>&1)
+    
+    if [ -f "$work_dir/monitor.log.1.gz.idx" ] && \
+       [ "$(stat -c %s "$work_dir/monitor.log.1.gz.idx")" -gt 200 ] && \
+       zcat "$work_dir/monitor.log.1.gz" | tail -n +2 | cmp -s - "$work_dir/original.txt"; then
+        print_pass "Segment is plain gzip with a multi-block index"
+    else
+        print_fail "Block-indexed segment not written correctly"
+        rm -rf "$work_dir"
+        return
+    fi
+    
+    local full ranged lines
+    full="$(cd "$work_dir" && "$monitor_bin" --query 2>&1 >/dev/null | grep -o '[0-9.]* MB scanned')"
+    ranged="$(cd "$work_dir" && "$monitor_bin" --query --since="2026-02-01 23:00" 2>&1 >/dev/null | grep -o '[0-9.]* MB scanned')"
+    lines="$(cd "$work_dir" && "$monitor_bin" --query --since="2026-02-01 23:00" --until=2026-02-01 2>/dev/null | wc -l)"
+    
+    print_test "Time-range query decompresses only the blocks it needs"
+    if [ "$lines" -eq 3600 ] && [ "${ranged%% *}" != "${full%% *}" ]; then
+        print_pass "Time-range query decompresses only the blocks it needs ($ranged vs $full)"
+    else
+        print_fail "Range query: $lines lines, $ranged vs $full"
+    fi
+    
+    rm -rf "$work_dir"
+}
+
+# 19. 통계 시계열 테스트
+test_stats_history() {
+    print_test "Testing the mmap-able stats history ring"
+    
+    local root_dir monitor_bin work_dir
+    setup_monitor_test || return
+    mkdir -p "$work_dir/watched"
+    printf 'ipc_socket=%s/ipc.sock\nstats_history_interval=1\nstats_history_days=1\n' "$work_dir" > "$work_dir/monitor.conf"
+    
+    (
+        cd "$work_dir" || exit 1
+        "$monitor_bin" watched >/dev/null 2>&1 &
+        local pid=$!
+        sleep 0.5
+        for i in $(seq 1 50); do echo data > "watched/file$i.txt"; done
+        sleep 2.5
+        kill "$pid"; wait "$pid" 2>/dev/null
+    )
+    
+    local summary
+    summary="$(cd "$work_dir" && PYTHONPATH="$root_dir/src" python3 -c '
+from monitor_stats import open_history
+history = open_history()
+samples = history.samples()
+print(history.slot_count, len(samples), max(s["events"] for s in samples),
+      max(s["batches"] for s in samples) > 0 and max(s["latency_p99_ns"] for s in samples) > 0,
+      all(s["rss_kb"] > 0 for s in samples))
+' 2>&1)"
+    
+    local slots count events latency rss
+    read -r slots count events latency rss <<< "$summary"
+    if [ "$slots" = "86400" ] && [ "${count:-0}" -ge 2 ] 2>/dev/null; then
+        print_pass "Ring sized for the configured window, $count samples recorded"
+    else
+        print_fail "Unexpected history file: '$summary'"
+    fi
+    
+    print_test "Samples carry event counts, batch latency and RSS"
+    if [ "${events:-0}" -ge 50 ] 2>/dev/null && [ "$latency" = "True" ] && [ "$rss" = "True" ]; then
+        print_pass "Samples carry event counts, batch latency and RSS"
+    else
+        print_fail "Sample contents incomplete: '$summary'"
+    fi
+    
+    # 헤더는 맞지만 잘린 파일은 재사용하지 않고(SIGBUS), 창보다 긴 간격은 슬롯 2개로 줄임
+    local history_size alive_truncated alive_interval
+    history_size="$(stat -c %s "$work_dir/monitor_stats.ring" 2>/dev/null)"
+    (
+        cd "$work_dir" || exit 1
+        truncate -s 4096 monitor_stats.ring
+        # 다음 샘플이 잘린 끝 너머의 슬롯에 쓰이도록 write_index를 옮김
+        python3 -c "
+import struct
+with open('monitor_stats.ring', 'r+b') as f:
+    f.seek(16); f.write(struct.pack('<Q', 1000))
+"
+        "$monitor_bin" watched >/dev/null 2>&1 &
+        local pid=$!
+        sleep 1.5
+        kill -0 "$pid" 2>/dev/null && echo yes > alive_truncated.txt
+        kill "$pid"; wait "$pid" 2>/dev/null
+        
+        printf 'ipc_socket=%s/ipc.sock\nstats_history_interval=200000\nstats_history_days=1\n' "$work_dir" > monitor.conf
+        "$monitor_bin" watched >/dev/null 2>&1 &
+        pid=$!
+        sleep 1.5
+        kill -0 "$pid" 2>/dev/null && echo yes > alive_interval.txt
+        kill "$pid"; wait "$pid" 2>/dev/null
+    )
+    alive_truncated="$(cat "$work_dir/alive_truncated.txt" 2>/dev/null)"
+    alive_interval="$(cat "$work_dir/alive_interval.txt" 2>/dev/null)"
+    slots="$(cd "$work_dir" && PYTHONPATH="$root_dir/src" python3 -c 'from monitor_stats import open_history; print(open_history().slot_count)' 2>&1)"
+    
+    print_test "Truncated ring and oversized interval are recreated safely"
+    if [ "$alive_truncated" = "yes" ] && [ "$alive_interval" = "yes" ] && [ "$slots" = "2" ] &&
+       [ "${history_size:-0}" -gt 4096 ] &&
+       grep -q "\[WARN\] stats_history_interval=200000 exceeds half of stats_history_days, using 43200" "$work_dir/monitor.log" 2>/dev/null; then
+        print_pass "Truncated ring and oversized interval are recreated safely"
+    else
+        print_fail "truncated run alive=$alive_truncated, long interval alive=$alive_interval, slots=$slots"
+    fi
+    
+    rm -rf "$work_dir"
+}
+
+# 20. 공유 메모리 통계 페이지 테스트
+test_stats_page() {
+    print_test "Testing the shared-memory stats page"
+    
+    local root_dir monitor_bin work_dir
+    setup_monitor_test || return
+    mkdir -p "$work_dir/watched" "$work_dir/other"
+    printf 'ipc_socket=%s/ipc.sock\nstats_page_path=%s/stats.page\nstats_history=false\n' \
+        "$work_dir" "$work_dir" > "$work_dir/monitor.conf"
+    
+    local reader="from monitor_stats import read_stats_page
+page = read_stats_page('$work_dir/stats.page')
+print('none' if page is None else '%s %d %d' % (page['mode'], page['total_events'], page['pid']))"
+    
+    local live second stopped pid
+    (
+        cd "$work_dir" || exit 1
+        "$monitor_bin" --mode=enhanced watched >/dev/null 2>&1 &
+        pid=$!
+        sleep 0.5
+        for i in $(seq 1 20); do echo data > "watched/file$i.txt"; done
+        sleep 1.5
+        PYTHONPATH="$root_dir/src" python3 -c "$reader" > live.txt 2>&1
+        echo "$pid" > pid.txt
+        
+        # 두 번째 monitor는 살아 있는 페이지를 덮어쓰지 않음
+        "$monitor_bin" other >/dev/null 2>&1 &
+        local other=$!
+        sleep 1.5
+        PYTHONPATH="$root_dir/src" python3 -c "$reader" > second.txt 2>&1
+        kill "$other"; wait "$other" 2>/dev/null
+        
+        kill "$pid"; wait "$pid" 2>/dev/null
+        PYTHONPATH="$root_dir/src" python3 -c "$reader" > stopped.txt 2>&1
+    )
+    live="$(cat "$work_dir/live.txt" 2>/dev/null)"
+    second="$(cat "$work_dir/second.txt" 2>/dev/null)"
+    stopped="$(cat "$work_dir/stopped.txt" 2>/dev/null)"
+    pid="$(cat "$work_dir/pid.txt" 2>/dev/null)"
+    
+    local mode events page_pid
+    read -r mode events page_pid <<< "$live"
+    if [ "$mode" = "enhanced" ] && [ "${events:-0}" -ge 20 ] 2>/dev/null && [ "$page_pid" = "$pid" ]; then
+        print_pass "Reader gets a consistent live snapshot ($live)"
+    else
+        print_fail "Unexpected stats page: '$live' (pid $pid)"
+    fi
+    
+    print_test "A second monitor leaves the live page alone"
+    if [ "${second##* }" = "$pid" ]; then
+        print_pass "A second monitor leaves the live page alone"
+    else
+        print_fail "Stats page taken over: '$second'"
+    fi
+    
+    print_test "Page marked stopped on shutdown"
+    if [ "$stopped" = "none" ]; then
+        print_pass "Page marked stopped on shutdown"
+    else
+        print_fail "Stopped monitor still reported: '$stopped'"
+    fi
+    
+    rm -rf "$work_dir"
+}
+
+# 21. 파일 식별자(dev, ino) 테이블 테스트
+test_file_identity() {
+    print_test "Testing hard-link and rename aware file identity"
+    
+    local root_dir monitor_bin work_dir
+    setup_monitor_test || return
+    mkdir -p "$work_dir/watched"
+    printf 'ipc_socket=%s/ipc.sock\nstats_page=false\nstats_history=false\n' \
+        "$work_dir" > "$work_dir/monitor.conf"
+    
+    (
+        cd "$work_dir" || exit 1
+        "$monitor_bin" --mode=advanced watched >/dev/null 2>&1 &
+        local pid=$!
+        sleep 0.5
+        printf 'v1' > watched/a
+        sleep 0.3
+        ln watched/a watched/b
+        sleep 0.3
+        # 같은 내용을 다시 씀: 하드 링크와 이름 변경 후에도 변경 없음으로 판단해야 함
+        dd if=watched/a of=watched/b conv=notrunc status=none
+        sleep 0.3
+        mv watched/a watched/c
+        sleep 0.3
+        dd if=watched/c of=watched/c conv=notrunc status=none
+        sleep 0.3
+        printf 'v2' >> watched/c
+        sleep 0.5
+        kill "$pid"; wait "$pid" 2>/dev/null
+    )
+    
+    local log="$work_dir/monitor.log"
+    if grep -q "Modified (checksum changed): watched/a" "$log" 2>/dev/null; then
+        print_pass "First write is reported"
+    else
+        print_fail "Initial modification of watched/a missing"
+    fi
+    
+    print_test "Hard link shares the content state of its sibling"
+    if ! grep -q "Modified (checksum changed): watched/b" "$log" 2>/dev/null; then
+        print_pass "Hard link shares the content state of its sibling"
+    else
+        print_fail "Unchanged hard link reported as modified"
+    fi
+    
+    local c_changes
+    c_changes="$(grep -c "Modified (checksum changed): watched/c" "$log" 2>/dev/null)"
+    print_test "Renamed file keeps its hash history"
+    if [ "$c_changes" = "1" ]; then
+        print_pass "Renamed file keeps its hash history"
+    else
+        print_fail "Expected one change for watched/c, got ${c_changes:-0}"
+    fi
+    
+    local counts
+    counts="$(python3 -c "import json; s = json.load(open('$work_dir/monitor_stats.json')); print(s['file_identities'], s['identity_paths'])" 2>/dev/null)"
+    print_test "One identity tracked under both current paths"
+    if [ "$counts" = "1 2" ]; then
+        print_pass "One identity tracked under both current paths"
+    else
+        print_fail "Unexpected identity counts: '$counts'"
+    fi
+    
+    rm -rf "$work_dir"
+}
+
+# 22. 자체 출력 파일 이벤트 억제 테스트
+test_self_events() {
+    print_info "Testing suppression of the monitor's own output files"
+    
+    local root_dir monitor_bin work_dir
+    setup_monitor_test || return
+    printf 'ipc_socket=%s/ipc.sock\nstats_page=false\nstats_history=false\n' \
+        "$work_dir" > "$work_dir/monitor.conf"
+    
+    local m
+    for m in basic enhanced; do
+        (
+            cd "$work_dir" || exit 1
+            rm -f monitor.log monitor_stats.json
+            # 로그가 있는 디렉터리 자체를 감시 (fmon start . 과 동일)
+            "$monitor_bin" --mode=$m . >/dev/null 2>&1 &
+            local pid=$!
+            sleep 0.5
+            echo data > user.txt
+            sleep 1.5
+            kill "$pid"; wait "$pid" 2>/dev/null
+        )
+        
+        local log="$work_dir/monitor.log"
+        local own user suppressed
+        own="$(grep -cE '#[0-9]+ .*monitor(\.log|_stats\.json|\.seq)' "$log" 2>/dev/null)"
+        user="$(grep -c '#[0-9]* .*user\.txt' "$log" 2>/dev/null)"
+        suppressed="$(python3 -c "import json; print(json.load(open('$work_dir/monitor_stats.json'))['self_events_suppressed'])" 2>/dev/null)"
+        
+        print_test "$m: own output events dropped"
+        if [ "${own:-1}" = "0" ] && [ "${user:-0}" -ge 1 ] && [ "${suppressed:-0}" -gt 0 ] 2>/dev/null; then
+            print_pass "$m: own output events dropped ($suppressed suppressed), user events kept"
+        else
+            print_fail "$m: own=$own user=$user suppressed=$suppressed"
+        fi
+        rm -f "$work_dir/user.txt"
+    done
+    
+    rm -rf "$work_dir"
+}
+
+# 23. 새 디렉터리 크롤 워커 테스트
+test_crawl_worker() {
+    print_info "Testing off-thread registration of new directory trees"
+    
+    local root_dir monitor_bin work_dir
+    setup_monitor_test || return
+    printf 'ipc_socket=%s/ipc.sock\nstats_page=false\nstats_history=false\n' \
+        "$work_dir" > "$work_dir/monitor.conf"
+    
+    local m
+    for m in basic enhanced; do
+        rm -rf "$work_dir/watched" "$work_dir/monitor.log" "$work_dir/monitor_stats.json"
+        mkdir -p "$work_dir/watched"
+        (
+            cd "$work_dir" || exit 1
+            "$monitor_bin" --mode=$m watched >/dev/null 2>&1 &
+            local pid=$!
+            sleep 0.5
+            # 감시가 붙기 전에 만들어진 중첩 트리와 파일
+            mkdir -p watched/tree/a/b/c && echo early > watched/tree/a/b/c/early.txt
+            for i in $(seq 1 40); do mkdir -p "watched/many/d$i/sub"; done
+            sleep 1.5
+            echo late > watched/tree/a/b/c/late.txt
+            echo late > watched/many/d40/sub/late.txt
+            sleep 0.5
+            kill "$pid"; wait "$pid" 2>/dev/null
+        )
+        
+        local log="$work_dir/monitor.log"
+        print_test "$m: catch-up scan reports files made before the watch existed"
+        if grep -q "Created: watched/tree/a/b/c/early.txt" "$log" 2>/dev/null; then
+            print_pass "$m: catch-up scan reports files made before the watch existed"
+        else
+            print_fail "$m: early.txt in the new tree was missed"
+        fi
+        
+        print_test "$m: every nested new directory is watched"
+        if grep -q "watched/tree/a/b/c/late.txt" "$log" 2>/dev/null &&
+           grep -q "watched/many/d40/sub/late.txt" "$log" 2>/dev/null; then
+            print_pass "$m: every nested new directory is watched"
+        else
+            print_fail "$m: events in crawled directories are missing"
+        fi
+        
+        local crawl
+        crawl="$(python3 -c "import json; s = json.load(open('$work_dir/monitor_stats.json')); print(s['crawl_jobs'], s['crawl_duplicates'])" 2>/dev/null)"
+        print_test "$m: crawl counters reported"
+        if [ -n "$crawl" ] && [ "${crawl%% *}" -ge 1 ] 2>/dev/null; then
+            print_pass "$m: crawl counters reported (jobs duplicates: $crawl)"
+        else
+            print_fail "$m: crawl counters missing: '$crawl'"
+        fi
+    done
+    
+    rm -rf "$work_dir"
+}
+
+# 24. 하위 트리별 정책 테스트
+test_subtree_policies() {
+    print_test "Testing per-subtree policies"
+    
+    local root_dir monitor_bin work_dir
+    setup_monitor_test || return
+    mkdir -p "$work_dir/watched/config" "$work_dir/watched/cache" "$work_dir/watched/tmp" "$work_dir/watched/burst"
+    cat > "$work_dir/monitor.conf" << EOF
+ipc_socket=$work_dir/ipc.sock
+stats_page=false
+stats_history=false
+policy=watched/config hash=on
+policy=watched/cache mask=create,delete
+policy=watched/tmp ignore
+policy=$work_dir/watched/burst mask=create rate=5
+EOF
+    
+    (
+        cd "$work_dir" || exit 1
+        "$monitor_bin" --mode=basic watched >/dev/null 2>&1 &
+        local pid=$!
+        sleep 0.5
+        printf 'v1' > watched/config/app.conf
+        sleep 0.3
+        # 같은 내용 재기록은 해시 정책에서 변경으로 보지 않음
+        dd if=watched/config/app.conf of=watched/config/app.conf conv=notrunc status=none
+        echo x > watched/cache/c.bin
+        rm watched/cache/c.bin
+        echo x > watched/tmp/scratch.txt
+        for i in $(seq 1 50); do : > "watched/burst/f$i"; done
+        sleep 1
+        kill "$pid"; wait "$pid" 2>/dev/null
+    )
+    
+    local log="$work_dir/monitor.log"
+    local changed plain
+    changed="$(grep -c "Modified (checksum changed): watched/config/app.conf" "$log" 2>/dev/null)"
+    plain="$(grep -c "Modified: watched/config/app.conf" "$log" 2>/dev/null)"
+    if [ "$changed" = "1" ] && [ "$plain" = "0" ]; then
+        print_pass "Hashed subtree reports only real content changes"
+    else
+        print_fail "config: changed=$changed plain=$plain"
+    fi
+    
+    print_test "Mask limits a subtree to creates and deletes"
+    if grep -q "Created: watched/cache/c.bin" "$log" && grep -q "Deleted: watched/cache/c.bin" "$log" &&
+       ! grep -qE "(Opened|Modified|Closed): watched/cache/" "$log"; then
+        print_pass "Mask limits a subtree to creates and deletes"
+    else
+        print_fail "cache subtree mask not applied"
+    fi
+    
+    print_test "Ignored subtree is not watched at all"
+    if ! grep -q "watched/tmp" "$log"; then
+        print_pass "Ignored subtree is not watched at all"
+    else
+        print_fail "Ignored subtree shows up in the log"
+    fi
+    
+    local burst dropped
+    burst="$(grep -c "Created: watched/burst/" "$log" 2>/dev/null)"
+    dropped="$(python3 -c "import json; print([p['rate_dropped'] for p in json.load(open('$work_dir/monitor_stats.json'))['policies'] if p['prefix'].endswith('/burst')][0])" 2>/dev/null)"
+    print_test "Rate limit caps a noisy subtree"
+    if [ "${burst:-0}" -ge 1 ] && [ "${burst:-0}" -le 15 ] && [ "${dropped:-0}" -gt 0 ] 2>/dev/null; then
+        print_pass "Rate limit caps a noisy subtree ($burst logged, $dropped dropped)"
+    else
+        print_fail "burst: logged=$burst dropped=$dropped"
+    fi
+    
+    # 모르는 mask 이름, 넘치는 확장자 목록, 너무 많은 정책은 조용히 버리지 않고 설정 오류로 처리
+    local bad status rejected=0
+    for bad in "mask=creat" "ext=$(seq -s, 1 17)" "many"; do
+        rm -rf "$work_dir/bad"; mkdir -p "$work_dir/bad"
+        if [ "$bad" = "many" ]; then
+            for i in $(seq 1 33); do echo "policy=p$i mask=create"; done > "$work_dir/bad/monitor.conf"
+        else
+            echo "policy=watched $bad" > "$work_dir/bad/monitor.conf"
+        fi
+        status="$(cd "$work_dir/bad" && timeout 5 "$monitor_bin" --mode=basic . >/dev/null 2>&1; echo $?)"
+        if [ "$status" != "0" ] && [ "$status" != "124" ] && grep -q "\[ERROR\]" "$work_dir/bad/monitor.log" 2>/dev/null; then
+            rejected=$((rejected + 1))
+        fi
+    done
+    print_test "Invalid policy lines fail the configuration"
+    if [ "$rejected" = "3" ]; then
+        print_pass "Invalid policy lines fail the configuration"
+    else
+        print_fail "Only $rejected of 3 invalid policy configs rejected"
+    fi
+    
+    rm -rf "$work_dir"
+}
+
+# 25. 이벤트 필터 식 테스트
+test_event_filter() {
+    print_test "Testing filter expressions"
+    
+    local root_dir monitor_bin work_dir
+    setup_monitor_test || return
+    mkdir -p "$work_dir/watched/tmp"
+    cat > "$work_dir/monitor.conf" << EOF
+ipc_socket=$work_dir/ipc.sock
+stats_page=false
+stats_history=false
+filter=size > 1MB and ext in {log, dat} and event is modify and path not under tmp/
+filter=event is delete and name matches "*.bak"
+EOF
+    
+    (
+        cd "$work_dir" || exit 1
+        "$monitor_bin" --mode=basic watched >/dev/null 2>&1 &
+        local pid=$!
+        sleep 0.5
+        head -c 2097152 /dev/zero > watched/big.log
+        head -c 100 /dev/zero > watched/small.log
+        head -c 2097152 /dev/zero > watched/big.txt
+        head -c 2097152 /dev/zero > watched/tmp/big.dat
+        echo x > watched/old.bak
+        rm watched/old.bak watched/small.log
+        sleep 0.5
+        kill "$pid"; wait "$pid" 2>/dev/null
+    )
+    
+    local log="$work_dir/monitor.log"
+    if grep -q "Modified: watched/big.log" "$log" && ! grep -q "watched/small.log" "$log" &&
+       ! grep -q "watched/big.txt" "$log" && ! grep -q "watched/tmp/big.dat" "$log"; then
+        print_pass "Size, extension, event and path conditions combine"
+    else
+        print_fail "Filter let the wrong modifications through"
+    fi
+    
+    print_test "Several filter lines are alternatives"
+    if grep -q "Deleted: watched/old.bak" "$log" && ! grep -q "Created: watched/old.bak" "$log"; then
+        print_pass "Several filter lines are alternatives"
+    else
+        print_fail "Second filter line not applied"
+    fi
+    
+    print_test "Filter compiled at config load"
+    if grep -q "Filter compiled to" "$log"; then
+        print_pass "Filter compiled at config load"
+    else
+        print_fail "No filter compilation message"
+    fi
+    
+    # hash=on 정책에서도 필터에 걸러진 파일은 해시하지 않음
+    mkdir -p "$work_dir/hashed/watched/config"
+    printf 'ipc_socket=%s/hashed/ipc.sock\nstats_page=false\nstats_history=false\npolicy=watched/config hash=on\nfilter=ext in {conf}\n' \
+        "$work_dir" > "$work_dir/hashed/monitor.conf"
+    (
+        cd "$work_dir/hashed" || exit 1
+        "$monitor_bin" --mode=advanced watched >/dev/null 2>&1 &
+        local pid=$!
+        sleep 0.5
+        for i in 1 2 3 4 5; do echo "$i" >> watched/config/skip.txt; done
+        echo a > watched/config/app.conf
+        sleep 0.5
+        kill "$pid"; wait "$pid" 2>/dev/null
+    )
+    local hashed
+    hashed="$(python3 -c "import json; print(json.load(open('$work_dir/hashed/monitor_stats.json'))['hashes_computed'])" 2>/dev/null)"
+    print_test "Filtered out modifications are not hashed"
+    if [ "$hashed" = "1" ] && grep -q "Modified (checksum changed): watched/config/app.conf" "$work_dir/hashed/monitor.log"; then
+        print_pass "Filtered out modifications are not hashed"
+    else
+        print_fail "hashes_computed=$hashed"
+    fi
+    
+    # 합쳐서 FILTER_MAX_SOURCE를 넘는 filter= 줄은 잘리지 않고 시작 시 거부
+    mkdir -p "$work_dir/long"
+    {
+        for i in $(seq 1 40); do echo "filter=name matches \"very-long-file-name-pattern-$i-*\""; done
+    } > "$work_dir/long/monitor.conf"
+    local status
+    status="$(cd "$work_dir/long" && timeout 5 "$monitor_bin" --mode=basic "$work_dir/watched" >/dev/null 2>&1; echo $?)"
+    print_test "Filter lines beyond the source limit are rejected"
+    if [ "$status" != "0" ] && [ "$status" != "124" ] &&
+       grep -q "\[ERROR\] Filter expressions exceed" "$work_dir/long/monitor.log" 2>/dev/null; then
+        print_pass "Filter lines beyond the source limit are rejected"
+    else
+        print_fail "Over-long filter accepted (exit $status)"
+    fi
+    
+    # 잘못된 식은 시작 시 거부
+    local err
+    err="$(cd "$work_dir" && "$monitor_bin" --mode=basic --filter='size > ten' watched 2>&1 >/dev/null)"
+    print_test "Invalid expression is rejected with its position"
+    if echo "$err" | grep -q "Invalid filter (expected a number"; then
+        print_pass "Invalid expression is rejected with its position"
+    else
+        print_fail "Invalid expression accepted: $err"
+    fi
+    
+    # stat() 이전에 저렴한 조건으로 단락 평가
+    local bench_dir="$work_dir/bench"
+    mkdir -p "$bench_dir"
+    local bench
+    bench="$("$monitor_bin" --mode=basic --bench=80000 --filter='size > 1MB and event is create' "$bench_dir" 2>/dev/null | grep "\[BENCH\] filter")"
+    print_test "Cheap checks run before stat()"
+    if echo "$bench" | grep -q "stat_calls=10000 " && echo "$bench" | grep -q "per_event="; then
+        print_pass "Cheap checks run before stat() ($(echo "$bench" | grep -o 'per_event=[0-9.]*ns'))"
+    else
+        print_fail "Unexpected filter benchmark: $bench"
+    fi
+    
+    rm -rf "$work_dir"
+}
+
+# 26. 경로 인덱스 테스트
+test_path_index() {
+    print_test "Testing radix-trie path index"
+    
+    local root_dir monitor_bin work_dir
+    setup_monitor_test || return
+    mkdir -p "$work_dir/watched/src/core" "$work_dir/watched/src/corelib" "$work_dir/watched/docs" "$work_dir/watched/skip"
+    cat > "$work_dir/monitor.conf" << EOF
+ipc_socket=$work_dir/ipc.sock
+stats_page=false
+stats_history=false
+policy=watched/skip ignore
+EOF
+    
+    # 응답을 "watched 경로들|truncated" 형태로 줄임
+    local listing='import json, sys; r = json.load(sys.stdin); print(",".join(sorted(r["watched"])) + "|" + str(r["truncated"]).lower())'
+    (
+        cd "$work_dir" || exit 1
+        "$monitor_bin" --mode=basic watched >/dev/null 2>&1 &
+        local pid=$!
+        sleep 0.5
+        mkdir watched/src/core/new
+        sleep 0.3
+        ipc_request "$work_dir/ipc.sock" paths '{"root": "watched/src/core"}' | python3 -c "$listing" > core.txt
+        ipc_request "$work_dir/ipc.sock" paths '{"root": "watched", "limit": 2}' | python3 -c "$listing" > limited.txt
+        kill "$pid"; wait "$pid" 2>/dev/null
+    )
+    
+    # watched/src/core 접두사는 경로 구성 요소 단위로만 일치해야 함
+    if [ "$(cat "$work_dir/core.txt" 2>/dev/null)" = "watched/src/core,watched/src/core/new|false" ]; then
+        print_pass "Prefix listing stops at component boundaries"
+    else
+        print_fail "paths under watched/src/core: $(cat "$work_dir/core.txt" 2>/dev/null)"
+    fi
+    
+    print_test "Listing honours the limit and reports truncation"
+    if grep -q "|true" "$work_dir/limited.txt" 2>/dev/null &&
+       [ "$(cut -d'|' -f1 "$work_dir/limited.txt" | tr ',' '\n' | grep -c .)" = "2" ]; then
+        print_pass "Listing honours the limit and reports truncation"
+    else
+        print_fail "limited listing: $(cat "$work_dir/limited.txt" 2>/dev/null)"
+    fi
+    
+    print_test "Policy prefixes resolve through the shared index"
+    if ! grep -q "watched/skip" "$work_dir/monitor.log"; then
+        print_pass "Policy prefixes resolve through the shared index"
+    else
+        print_fail "Ignored subtree was watched"
+    fi
+    
+    local sizes
+    sizes="$(python3 -c "import json; s = json.load(open('$work_dir/monitor_stats.json')); print(s['watch_path_bytes'], s['watch_path_key_bytes'])" 2>/dev/null)"
+    print_test "Path index size is reported"
+    if [ -n "$sizes" ] && [ "${sizes#* }" -gt 0 ] 2>/dev/null; then
+        print_pass "Path index size is reported ($sizes)"
+    else
+        print_fail "watch_path_bytes missing from stats"
+    fi
+    
+    rm -rf "$work_dir"
+}
+
+# 27. 이벤트 시각 기록 테스트
+test_event_times() {
+    print_test "Testing nanosecond event read times"
+    
+    local root_dir monitor_bin work_dir
+    setup_monitor_test || return
+    mkdir -p "$work_dir/watched"
+    printf 'event_times=true\nstats_page=false\nstats_history=false\n' > "$work_dir/monitor.conf"
+    
+    local before after
+    (
+        cd "$work_dir" || exit 1
+        "$monitor_bin" --mode=basic watched >/dev/null 2>&1 &
+        local pid=$!
+        sleep 0.5
+        date +%s > before.txt
+        touch watched/a.txt
+        sleep 0.3
+        date +%s > after.txt
+        kill "$pid"; wait "$pid" 2>/dev/null
+    )
+    before="$(cat "$work_dir/before.txt")"
+    after="$(cat "$work_dir/after.txt")"
+    
+    local line
+    line="$(grep "Created: watched/a.txt" "$work_dir/monitor.log" | head -1)"
+    if [[ "$line" =~ \]\ \#([0-9]+)@([0-9]+)\.([0-9]{9})\+([0-9]+)\ Created: ]]; then
+        local second="${BASH_REMATCH[2]}"
+        print_pass "Event line carries sequence, read time and latency"
+        print_test "Read time is wall-clock time of the read"
+        if [ "$second" -ge "$before" ] && [ "$second" -le "$after" ]; then
+            print_pass "Read time is wall-clock time of the read"
+        else
+            print_fail "Read time $second outside [$before, $after]"
+        fi
+    else
+        print_fail "Unexpected event line: $line"
+    fi
+    
+    local latency
+    latency="$(python3 -c "import json; s = json.load(open('$work_dir/monitor_stats.json')); print(s['event_latency_avg_ns'], s['event_latency_max_ns'])" 2>/dev/null)"
+    print_test "Read-to-log latency reported"
+    if [ -n "$latency" ]; then
+        print_pass "Read-to-log latency reported ($latency)"
+    else
+        print_fail "event_latency_* missing from stats"
+    fi
+    
+    rm -rf "$work_dir"
+}
+
+# 28. 스레드별 CPU 계측 테스트
+test_thread_cpu() {
+    print_test "Testing per-thread and per-stage CPU accounting"
+    
+    local root_dir monitor_bin work_dir
+    setup_monitor_test || return
+    mkdir -p "$work_dir/watched"
+    printf 'ipc_socket=%s/ipc.sock\nstats_page=false\nstats_history=false\n' "$work_dir" > "$work_dir/monitor.conf"
+    
+    (
+        cd "$work_dir" || exit 1
+        "$monitor_bin" --mode=advanced watched >/dev/null 2>&1 &
+        local pid=$!
+        sleep 0.5
+        ls "/proc/$pid/task" | while read -r tid; do cat "/proc/$pid/task/$tid/comm"; done | sort > names.txt
+        for i in $(seq 1 200); do echo "$i" > "watched/f$((i % 10)).txt"; done
+        sleep 1.5
+        kill "$pid"; wait "$pid" 2>/dev/null
+    )
+    
+    if grep -q "^fmon-crawl$" "$work_dir/names.txt" && grep -q "^fmon-stats$" "$work_dir/names.txt" &&
+       grep -q "^fmon-ipc$" "$work_dir/names.txt"; then
+        print_pass "Threads are named after their role"
+    else
+        print_fail "Thread names: $(tr '\n' ' ' < "$work_dir/names.txt")"
+    fi
+    
+    # 역할 목록과 단계별 이벤트당 CPU 시간을 한 줄로 출력
+    local summary
+    summary="$(python3 -c "
+import json
+s = json.load(open('$work_dir/monitor_stats.json'))
+roles = sorted(set(t['role'] for t in s['threads']))
+stages = {t['stage']: t['cpu_ns_per_event'] for t in s['stages']}
+print(','.join(roles), stages['dispatch'] > 0, stages['hash'] > 0, sorted(stages), s['stage_sampled_events'] > 0)
+" 2>/dev/null)"
+    print_test "CPU time reported per thread role"
+    if [[ "$summary" == *reader* ]] && [[ "$summary" == *crawl* ]] && [[ "$summary" == *stats* ]]; then
+        print_pass "CPU time reported per thread role"
+    else
+        print_fail "threads: $summary"
+    fi
+    
+    print_test "Event thread CPU split into read, dispatch, hash and write"
+    if [[ "$summary" == *"True True ['dispatch', 'hash', 'read', 'write'] True" ]]; then
+        print_pass "Event thread CPU split into read, dispatch, hash and write"
+    else
+        print_fail "stages: $summary"
+    fi
+    
+    rm -rf "$work_dir"
+}
+
+# 29. 집계 전용 메트릭 모드 테스트
+test_metrics_mode() {
+    print_test "Testing counting-only metrics mode"
+    
+    local root_dir monitor_bin work_dir
+    setup_monitor_test || return
+    mkdir -p "$work_dir/watched/logs" "$work_dir/watched/src" "$work_dir/prep/bulk/sub"
+    touch "$work_dir"/prep/bulk/g{1..300}.dat "$work_dir"/prep/bulk/sub/f{1..300}.dat
+    printf 'metrics_interval=1\nmetrics_top=8\nstats_page=false\nstats_history=false\n' > "$work_dir/monitor.conf"
+    
+    (
+        cd "$work_dir" || exit 1
+        "$monitor_bin" --mode=metrics watched >/dev/null 2>&1 &
+        local pid=$!
+        sleep 0.5
+        # 감시가 붙기 전에 복사된 파일은 크롤 워커가 따라잡아 집계
+        cp -r prep/bulk watched/
+        for i in $(seq 1 30); do echo "$i" >> watched/logs/app.log; done
+        touch watched/src/a.c watched/src/b.c watched/src/README
+        mkdir watched/new
+        sleep 0.3
+        touch watched/new/late.txt
+        sleep 1.5
+        kill "$pid"; wait "$pid" 2>/dev/null
+    )
+    
+    local log="$work_dir/monitor.log"
+    if ! grep -qE "(Created|Modified|Opened|Closed): " "$log" && grep -q "^\[.*\] \[METRICS\] {" "$log"; then
+        print_pass "Only periodic rollups are logged"
+    else
+        print_fail "Per-event lines or missing rollups in the log"
+    fi
+    
+    # 모든 롤업을 합산해 "디렉터리별,확장자별,유형별" 값을 출력
+    local totals
+    totals="$(python3 -c "
+import json, collections
+dirs, exts, types = collections.Counter(), collections.Counter(), collections.Counter()
+for line in open('$log'):
+    if '[METRICS] ' not in line: continue
+    r = json.loads(line.split('[METRICS] ', 1)[1])
+    for d in r['directories']: dirs[d['path']] += d['events']
+    for e in r['extensions']: exts[e['ext']] += e['events']
+    types.update(r['types'])
+print(dirs['watched/logs'] >= 30, dirs['watched/new'] >= 1, exts['log'] >= 30, exts['c'] >= 2, exts[''] >= 1,
+      types['modify'] >= 30, types['create'] >= 4)
+print(exts['dat'] >= 600 and types['create'] >= 606)
+" 2>/dev/null)"
+    print_test "Counts per directory, extension and event type (new directories included)"
+    if [ "$(head -1 <<< "$totals")" = "True True True True True True True" ]; then
+        print_pass "Counts per directory, extension and event type (new directories included)"
+    else
+        print_fail "Rollup totals: $totals"
+    fi
+    
+    local catchup
+    catchup="$(python3 -c "import json; print(json.load(open('$work_dir/monitor_stats.json'))['crawl_catchup_events'])" 2>/dev/null)"
+    print_test "Files of a copied-in tree are all counted, catch-up included"
+    if [ "$(tail -1 <<< "$totals")" = "True" ] && ! grep -q "\.dat" "$log"; then
+        print_pass "Files of a copied-in tree are all counted, catch-up included ($catchup caught up)"
+    else
+        print_fail "Copied tree in metrics mode: $(tail -1 <<< "$totals") / $(grep -c "\.dat" "$log") logged"
+    fi
+    
+    print_test "Latest rollup is in monitor_stats.json"
+    if python3 -c "import json; m = json.load(open('$work_dir/monitor_stats.json'))['metrics']; assert m['interval_sec'] == 1 and len(m['directories']) <= 8" 2>/dev/null; then
+        print_pass "Latest rollup is in monitor_stats.json"
+    else
+        print_fail "metrics missing from monitor_stats.json"
+    fi
+    
+    rm -rf "$work_dir"
+}
+
+# 30. 샘플링 로그 테스트
+test_sampled_logging() {
+    print_test "Testing sampled logging of open and access events"
+    
+    local root_dir monitor_bin work_dir
+    setup_monitor_test || return
+    mkdir -p "$work_dir/watched"
+    echo "data" > "$work_dir/watched/hot.txt"
+    printf 'access_events=true\nsample=open:10,access:25\nsample_interval=1\nstats_page=false\nstats_history=false\n' > "$work_dir/monitor.conf"
+    
+    (
+        cd "$work_dir" || exit 1
+        "$monitor_bin" --mode=enhanced watched >/dev/null 2>&1 &
+        local pid=$!
+        sleep 0.5
+        for i in $(seq 1 100); do cat watched/hot.txt > /dev/null; done
+        echo "more" >> watched/hot.txt
+        sleep 2
+        kill "$pid"; wait "$pid" 2>/dev/null
+    )
+    
+    local log="$work_dir/monitor.log"
+    local opened sampled_opened accessed
+    opened=$(grep -c "Opened: " "$log")
+    sampled_opened=$(grep -c "Opened \[1/10\]: " "$log")
+    accessed=$(grep -c "Accessed \[1/25\]: " "$log")
+    if [ "$opened" -eq 0 ] && [ "$sampled_opened" -ge 9 ] && [ "$sampled_opened" -le 11 ] && [ "$accessed" -ge 3 ]; then
+        print_pass "Sampled lines carry their rate ($sampled_opened opens, $accessed accesses logged)"
+    else
+        print_fail "Unexpected sampled output: opened=$opened sampled=$sampled_opened accessed=$accessed"
+    fi
+    
+    print_test "Unsampled event types are logged in full"
+    if grep -q "Modified: .*hot.txt" "$log" && [ "$(grep -c "Closed: " "$log")" -ge 100 ]; then
+        print_pass "Unsampled event types are logged in full"
+    else
+        print_fail "Unsampled events missing from the log"
+    fi
+    
+    # [SAMPLE] 보고의 합계와 통계 파일의 누적 값이 실제 이벤트 수와 일치하는지 확인
+    local totals
+    totals="$(python3 -c "
+import json
+seen = logged = 0
+for line in open('$log'):
+    if '[SAMPLE] {' not in line: continue
+    t = json.loads(line.split('[SAMPLE] ', 1)[1])['types'].get('open')
+    if t: seen += t['seen']; logged += t['logged']; assert t['rate'] == 10
+s = json.load(open('$work_dir/monitor_stats.json'))['event_types']
+print(seen >= 100, logged == $sampled_opened, s['open']['seen'] == seen, s['open']['sample_rate'] == 10, s['close']['seen'] == s['close']['logged'])
+" 2>/dev/null)"
+    print_test "Exact counts are reported per interval and in monitor_stats.json"
+    if [ "$totals" = "True True True True True" ]; then
+        print_pass "Exact counts are reported per interval and in monitor_stats.json"
+    else
+        print_fail "Sample reports: $totals"
+    fi
+    
+    # 크롤 워커가 따라잡은 생성 이벤트도 같은 유형별 집계에 포함
+    mkdir -p "$work_dir/copy/watched" "$work_dir/copy/prep/bulk"
+    touch "$work_dir"/copy/prep/bulk/f{1..300}.dat
+    printf 'sample=open:10\nstats_page=false\nstats_history=false\n' > "$work_dir/copy/monitor.conf"
+    (
+        cd "$work_dir/copy" || exit 1
+        "$monitor_bin" --mode=enhanced watched >/dev/null 2>&1 &
+        local pid=$!
+        sleep 0.5
+        cp -r prep/bulk watched/
+        sleep 1
+        kill "$pid"; wait "$pid" 2>/dev/null
+    )
+    local created counted
+    created=$(grep -c "Created: " "$work_dir/copy/monitor.log")
+    counted="$(python3 -c "
+import json
+s = json.load(open('$work_dir/copy/monitor_stats.json'))
+print(s['event_types']['create']['seen'], s['event_types']['create']['logged'], s['crawl_catchup_events'])
+" 2>/dev/null)"
+    print_test "Crawl catch-up creates are counted per type"
+    if [ "$created" -ge 301 ] && [ "${counted% *}" = "$created $created" ]; then
+        print_pass "Crawl catch-up creates are counted per type (seen logged caught-up: $counted)"
+    else
+        print_fail "Created lines $created, counted: '$counted'"
+    fi
+    
+    rm -rf "$work_dir"
+}
+
+# 31. 디렉터리 사용량 트리 테스트
+test_directory_usage() {
+    print_test "Testing incrementally maintained directory sizes"
+    
+    local root_dir monitor_bin work_dir
+    setup_monitor_test || return
+    mkdir -p "$work_dir/watched/a" "$work_dir/watched/b/c" "$work_dir/outside"
+    head -c 1000 /dev/zero > "$work_dir/watched/a/one"
+    head -c 3000 /dev/zero > "$work_dir/watched/a/two"
+    head -c 500 /dev/zero > "$work_dir/watched/b/c/three"
+    head -c 700 /dev/zero > "$work_dir/outside/four"
+    mkdir -p "$work_dir/prep"
+    for i in $(seq 1 300); do head -c 100 /dev/zero > "$work_dir/prep/f$i"; done
+    cat > "$work_dir/monitor.conf" << EOF
+ipc_socket=$work_dir/ipc.sock
+stats_page=false
+stats_history=false
+disk_usage=true
+growth_alert=watched/a 10KB
+growth_interval=1
+EOF
+    
+    # du 응답과 실제 파일 시스템을 비교해 "응답 bytes,files = 실제 bytes,files" 형태로 줄임
+    cat > "$work_dir/du_compare.py" <<'PYEOF'
+import json, os, sys
+reply = json.load(sys.stdin)
+size = count = 0
+for d, _, names in os.walk(sys.argv[1]):
+    for n in names:
+        size += os.lstat(os.path.join(d, n)).st_size; count += 1
+print(f"{reply['bytes']},{reply['files']} = {size},{count} {reply['filesystem']['used_percent'] > 0}")
+PYEOF
+    
+    (
+        cd "$work_dir" || exit 1
+        "$monitor_bin" --mode=enhanced watched >/dev/null 2>&1 &
+        local pid=$!
+        sleep 0.5
+        ipc_request "$work_dir/ipc.sock" du '{"root": "watched"}' | python3 du_compare.py watched > initial.txt
+        sleep 1.2
+        head -c 2000 /dev/zero >> watched/a/one
+        head -c 20000 /dev/zero > watched/a/big
+        rm watched/b/c/three
+        mv outside watched/moved_in
+        mv watched/b "$work_dir/moved_out"
+        mkdir watched/new
+        head -c 300 /dev/zero > watched/new/five
+        # 크롤 워커가 목록을 읽는 동안 지우고 늘린 파일도 정확히 반영
+        cp -r prep watched/copied
+        rm watched/copied/f{1..150}
+        for i in $(seq 151 200); do echo more >> "watched/copied/f$i"; done
+        # 들어오자마자 다시 나간 디렉터리는 크롤 워커가 늦게 재더라도 남지 않음
+        cp -r prep bounce
+        mv bounce watched/bounce
+        mv watched/bounce bounced
+        sleep 1.5
+        ipc_request "$work_dir/ipc.sock" du '{"root": "watched"}' | python3 du_compare.py watched > after.txt
+        ipc_request "$work_dir/ipc.sock" du '{"root": "watched/a"}' | python3 du_compare.py watched/a > subtree.txt
+        kill "$pid"; wait "$pid" 2>/dev/null
+    )
+    
+    if [ "$(cat "$work_dir/initial.txt" 2>/dev/null)" = "4500,3 = 4500,3 True" ]; then
+        print_pass "Initial crawl measures every watched file"
+    else
+        print_fail "Initial du: $(cat "$work_dir/initial.txt" 2>/dev/null)"
+    fi
+    
+    local after subtree
+    after="$(cat "$work_dir/after.txt" 2>/dev/null)"
+    subtree="$(cat "$work_dir/subtree.txt" 2>/dev/null)"
+    print_test "Writes, deletes and moves in and out keep subtree totals exact"
+    if [ "$(echo "$after" | awk -F' = ' '{split($2, real, " "); print ($1 == real[1])}')" = "1" ] &&
+       [ "$subtree" = "26000,3 = 26000,3 True" ]; then
+        print_pass "Writes, deletes and moves in and out keep subtree totals exact ($after)"
+    else
+        print_fail "du after changes: $after / watched/a: $subtree"
+    fi
+    
+    # watched/a만 임계값(10KB)을 넘게 증가했으므로 경보는 한 번만 기록되어야 함
+    local growth
+    growth="$(python3 -c "
+import json
+alerts = [json.loads(l.split('[GROWTH] ', 1)[1]) for l in open('$work_dir/monitor.log') if '[GROWTH] {' in l]
+print([(a['path'], a['grew_bytes'], a['files']) for a in alerts])
+" 2>/dev/null)"
+    print_test "Growth alert fires for the subtree that grew"
+    if [ "$growth" = "[('watched/a', 22000, 3)]" ]; then
+        print_pass "Growth alert fires for the subtree that grew"
+    else
+        print_fail "Growth alerts: $growth"
+    fi
+    
+    print_test "disk_usage_percent and tracked totals in monitor_stats.json"
+    if python3 -c "import json; s = json.load(open('$work_dir/monitor_stats.json')); assert 0 < s['disk_usage_percent'] <= 100 and s['tracked_files'] == 155" 2>/dev/null; then
+        print_pass "disk_usage_percent and tracked totals in monitor_stats.json"
+    else
+        print_fail "disk usage stats missing"
+    fi
+    
+    rm -rf "$work_dir"
+}
+
+# 32. 메타데이터 첨부 테스트
+test_event_enrichment() {
+    print_test "Testing statx enrichment of event lines"
+    
+    local root_dir monitor_bin work_dir
+    setup_monitor_test || return
+    mkdir -p "$work_dir/watched"
+    printf 'enrich=true\nenrich_cache=64\nenrich_window_ms=2000\nstats_page=false\nstats_history=false\n' > "$work_dir/monitor.conf"
+    
+    (
+        cd "$work_dir" || exit 1
+        "$monitor_bin" --mode=enhanced watched >/dev/null 2>&1 &
+        local pid=$!
+        sleep 0.5
+        head -c 1234 /dev/zero > watched/a.dat
+        sleep 0.2
+        python3 -c "import os, json; s = os.stat('watched/a.dat'); print(json.dumps([s.st_mode, s.st_ino, s.st_uid, s.st_gid, s.st_mtime_ns]))" > a.stat
+        # 두 파일에 번갈아 쓰면 inotify가 이벤트를 합치지 않음
+        python3 -c "
+b, c = open('watched/b.log', 'w'), open('watched/c.log', 'w')
+for i in range(200):
+    b.write('x'); b.flush(); c.write('y'); c.flush()
+"
+        sleep 0.3
+        rm watched/a.dat
+        sleep 0.5
+        kill "$pid"; wait "$pid" 2>/dev/null
+    )
+    
+    # a.dat의 마지막 Closed 줄에 실제 statx 값이 붙어 있는지 확인
+    local checked
+    checked="$(python3 -c "
+import json
+mode, ino, uid, gid, mtime_ns = json.load(open('$work_dir/a.stat'))
+for line in open('$work_dir/monitor.log'):
+    if 'Closed: watched/a.dat\t' in line:
+        meta = dict(kv.split('=') for kv in line.rstrip('\n').split('\t')[1].split(' '))
+        sec, ns = meta['mtime'].split('.')
+print(meta['size'] == '1234', int(meta['mode'], 8) == mode, int(meta['ino']) == ino,
+      int(meta['uid']) == uid, int(meta['gid']) == gid, int(sec) * 10**9 + int(ns) == mtime_ns)
+" 2>/dev/null)"
+    if [ "$checked" = "True True True True True True" ]; then
+        print_pass "Size, mode, owner, inode and mtime follow the path"
+    else
+        print_fail "Metadata of watched/a.dat: $checked"
+    fi
+    
+    print_test "Deleted files carry no metadata"
+    if grep -q "Deleted: watched/a.dat$" "$work_dir/monitor.log"; then
+        print_pass "Deleted files carry no metadata"
+    else
+        print_fail "Delete line: $(grep "Deleted: watched/a.dat" "$work_dir/monitor.log")"
+    fi
+    
+    # 같은 배치(또는 창) 안의 이벤트는 statx 한 번을 공유해야 함
+    local enriched coalesced
+    enriched=$(grep -c "	size=" "$work_dir/monitor.log")
+    coalesced="$(python3 -c "
+import json
+s = json.load(open('$work_dir/monitor_stats.json'))
+print(s['enrich_statx_calls'] * 2 < $enriched and s['enrich_statx_calls'] + s['enrich_cache_hits'] >= $enriched and s['enrich_cache_entries'] == 64)
+" 2>/dev/null)"
+    print_test "One statx per file per read batch"
+    if [ "$coalesced" = "True" ]; then
+        print_pass "One statx per file per read batch ($enriched enriched lines)"
+    else
+        print_fail "Coalescing: $(grep -o '"enrich[a-z_]*":[0-9]*' "$work_dir/monitor_stats.json" | tr '\n' ' ') lines=$enriched"
+    fi
+    
+    rm -rf "$work_dir"
+}
+
+# 33. 수집기 소켓으로 로그 전송 테스트 (스풀과 재연결 백오프)
+test_log_shipping() {
+    print_test "Testing log shipping to a collector socket"
+    
+    local root_dir monitor_bin work_dir
+    setup_monitor_test || return
+    mkdir -p "$work_dir/watched"
+    printf 'collector_socket=%s/collector.sock\ncollector_type=dgram\ncollector_batch_kb=256\ncollector_flush_ms=100\ncollector_compress=true\nipc_socket=%s/ipc.sock\nstats_page=false\nstats_history=false\n' \
+        "$work_dir" "$work_dir" > "$work_dir/monitor.conf"
+    # 이전 실행이 남긴, 데이터그램으로 보낼 수 없는 250KB 프레임
+    python3 -c "
+import struct
+raw = b'x' * 250000
+open('$work_dir/monitor_collector.spool', 'wb').write(struct.pack('<IHHII', 0x424d4346, 1, 0, len(raw), len(raw)) + raw)
+"
+    # 프레임 헤더를 검사하고 압축을 풀어 받은 줄을 기록하는 수집기
+    cat > "$work_dir/collector.py" <<'PYEOF'
+import os, socket, struct, sys, zlib
+path, out, stop = sys.argv[1:4]
+sock = socket.socket(socket.AF_UNIX, socket.SOCK_DGRAM)
+sock.bind(path)
+sock.settimeout(0.2)
+frames = deflated = bad = 0
+with open(out, 'w') as f:
+    while not os.path.exists(stop):
+        try:
+            data = sock.recv(1 << 20)
+        except socket.timeout:
+            continue
+        magic, version, flags, raw_len, payload_len = struct.unpack('<IHHII', data[:16])
+        payload = data[16:]
+        if magic != 0x424d4346 or version != 1 or len(payload) != payload_len:
+            bad += 1
+            continue
+        if flags & 1:
+            payload = zlib.decompress(payload)
+            deflated += 1
+        if len(payload) != raw_len:
+            bad += 1
+            continue
+        frames += 1
+        f.write(payload.decode())
+        f.flush()
+print(frames, deflated, bad, file=open(out + '.frames', 'w'))
+PYEOF
+    
+    (
+        cd "$work_dir" || exit 1
+        "$monitor_bin" --mode=basic watched >/dev/null 2>&1 &
+        local pid=$!
+        sleep 0.5
+        # 수집기가 없는 동안의 이벤트는 스풀로
+        for i in 1 2 3; do echo down > "watched/down$i.txt"; done
+        sleep 1
+        stat -c %s monitor_collector.spool > spooled.txt 2>/dev/null
+        python3 collector.py collector.sock received.txt stop &
+        local collector=$!
+        # 백오프가 끝나면 재연결해서 스풀부터 보냄
+        sleep 4
+        for i in 1 2 3; do echo up > "watched/up$i.txt"; done
+        sleep 1
+        kill "$pid"; wait "$pid" 2>/dev/null
+        touch stop; wait "$collector"
+    )
+    
+    if [ "$(cat "$work_dir/spooled.txt" 2>/dev/null)" -gt 0 ] 2>/dev/null; then
+        print_pass "Frames spooled while the collector was down"
+    else
+        print_fail "Spool stayed empty: '$(cat "$work_dir/spooled.txt" 2>/dev/null)'"
+    fi
+    
+    local received="$work_dir/received.txt"
+    print_test "Spooled frames delivered first after reconnect"
+    if grep -q "Created: watched/down1.txt" "$received" 2>/dev/null &&
+       grep -q "Created: watched/up3.txt" "$received" 2>/dev/null &&
+       [ "$(grep -n "down3.txt" "$received" | head -1 | cut -d: -f1)" -lt "$(grep -n "up1.txt" "$received" | head -1 | cut -d: -f1)" ] &&
+       [ ! -s "$work_dir/monitor_collector.spool" ]; then
+        print_pass "Spooled frames delivered first after reconnect"
+    else
+        print_fail "Collector received: '$(grep -o 'watched/[a-z0-9]*\.txt' "$received" 2>/dev/null | tr '\n' ' ')'"
+    fi
+    
+    local frames
+    frames="$(cat "$received.frames" 2>/dev/null)"
+    print_test "Frames carry a valid header and deflated payload"
+    if [ -n "$frames" ] && [ "${frames%% *}" -ge 1 ] && [ "$(echo "$frames" | cut -d' ' -f2)" -ge 1 ] &&
+       [ "${frames##* }" = "0" ]; then
+        print_pass "Frames carry a valid header and deflated payload (frames deflated bad: $frames)"
+    else
+        print_fail "Frame check: '$frames'"
+    fi
+    
+    # 너무 큰 프레임은 연결 끊김으로 보지 않고 버린 뒤 다음 프레임을 계속 보냄
+    print_test "Oversized datagram frames dropped instead of blocking the spool"
+    if grep -q "\[WARN\] collector_batch_kb=256 too large for datagrams, using 64" "$work_dir/monitor.log" 2>/dev/null &&
+       python3 -c "import json; s = json.load(open('$work_dir/monitor_stats.json')); assert s['collector_frames_oversized'] == 1" 2>/dev/null &&
+       ! grep -q "xxxx" "$received" 2>/dev/null; then
+        print_pass "Oversized datagram frames dropped instead of blocking the spool"
+    else
+        print_fail "Oversized frame: $(grep -o '"collector_frames_oversized": *[0-9]*' "$work_dir/monitor_stats.json" 2>/dev/null)"
+    fi
+    
+    # 소켓 주소에 들어가지 않는 경로는 잘라 쓰지 않고 거부
+    mkdir -p "$work_dir/long"
+    printf 'collector_socket=%s/%0200d.sock\n' "$work_dir" 0 > "$work_dir/long/monitor.conf"
+    local status
+    status="$(cd "$work_dir/long" && timeout 5 "$monitor_bin" --mode=basic . >/dev/null 2>&1; echo $?)"
+    print_test "Over-long collector socket path rejected"
+    if [ "$status" != "0" ] && [ "$status" != "124" ] &&
+       grep -q "\[ERROR\] collector_socket value too long" "$work_dir/long/monitor.log" 2>/dev/null; then
+        print_pass "Over-long collector socket path rejected"
+    else
+        print_fail "Long collector_socket accepted (exit $status)"
+    fi
+    
+    rm -rf "$work_dir"
+}
+
 # 최종 결과 출력
 print_final_results() {
     echo ""